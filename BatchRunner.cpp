@@ -0,0 +1,312 @@
+#include "BatchRunner.h"
+#include "Logger.h"
+#include "utils/WorkStealingPool.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <mutex>
+#include <sys/stat.h>
+
+namespace
+{
+
+/**
+ * Counting semaphore of bytes. A request larger than the whole budget is granted once nothing else is held.
+ */
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(const size_t capacity) : capacity_(capacity), used_(0) {}
+
+    void acquire(const size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [this, bytes]() { return used_ == 0 || used_ + bytes <= capacity_; });
+        used_ += bytes;
+    }
+
+    void release(const size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_ -= bytes;
+        }
+        released_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    size_t used_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+};
+
+bool isDirectory(const std::string& path)
+{
+    struct stat pathStat = {};
+    return stat(path.c_str(), &pathStat) == 0 && S_ISDIR(pathStat.st_mode);
+}
+
+size_t fileSize(const std::string& path)
+{
+    struct stat pathStat = {};
+    return stat(path.c_str(), &pathStat) == 0 ? static_cast<size_t>(pathStat.st_size) : 0;
+}
+
+std::string baseName(const std::string& path)
+{
+    const auto separator = path.find_last_of('/');
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+/**
+ * @return Absolute path without symbolic links, of the directory and the name if the file does not exist yet.
+ */
+std::string resolvedPath(const std::string& path)
+{
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved))
+    {
+        return resolved;
+    }
+
+    const auto separator = path.find_last_of('/');
+    const auto directory = separator == std::string::npos ? std::string(".") : path.substr(0, separator);
+    if (!realpath(directory.empty() ? "/" : directory.c_str(), resolved))
+    {
+        return path;
+    }
+    const std::string directoryPath(resolved);
+    return directoryPath + (directoryPath.back() == '/' ? "" : "/") + baseName(path);
+}
+
+bool hasTsExtension(const std::string& name)
+{
+    return name.size() > 3 && name.compare(name.size() - 3, 3, ".ts") == 0;
+}
+
+} // namespace
+
+BatchRunner::BatchRunner(const BatchOptions& options) : options_(options) {}
+
+std::string BatchRunner::outputPath(const std::string& input) const
+{
+    return options_.outputDirectory + "/" + baseName(input);
+}
+
+bool BatchRunner::addJobs(const ChannelConfig& channelTemplate)
+{
+    std::vector<std::pair<std::string, std::string>> files;
+
+    if (isDirectory(options_.input))
+    {
+        auto directory = opendir(options_.input.c_str());
+        if (!directory)
+        {
+            Logger::error("Unable to open batch directory %s: %s", options_.input.c_str(), strerror(errno));
+            return false;
+        }
+
+        while (auto entry = readdir(directory))
+        {
+            const std::string name(entry->d_name);
+            const auto path = options_.input + "/" + name;
+            if (hasTsExtension(name) && !isDirectory(path))
+            {
+                files.emplace_back(path, outputPath(path));
+            }
+        }
+        closedir(directory);
+        std::sort(files.begin(), files.end());
+    }
+    else
+    {
+        std::ifstream manifest(options_.input);
+        if (!manifest)
+        {
+            Logger::error("Unable to open batch manifest %s", options_.input.c_str());
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(manifest, line))
+        {
+            const auto first = line.find_first_not_of(" \t");
+            if (first == std::string::npos || line[first] == '#')
+            {
+                continue;
+            }
+
+            const auto inputEnd = line.find_first_of(" \t\r", first);
+            const auto input = line.substr(first, inputEnd - first);
+            const auto outputStart =
+                inputEnd == std::string::npos ? inputEnd : line.find_first_not_of(" \t\r", inputEnd);
+            if (outputStart == std::string::npos)
+            {
+                files.emplace_back(input, outputPath(input));
+                continue;
+            }
+
+            auto output = line.substr(outputStart, line.find_first_of(" \t\r", outputStart) - outputStart);
+            files.emplace_back(input, output[0] == '/' ? output : options_.outputDirectory + "/" + output);
+        }
+    }
+
+    if (files.empty())
+    {
+        Logger::error("Batch input %s lists no files", options_.input.c_str());
+        return false;
+    }
+
+    if (mkdir(options_.outputDirectory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        Logger::error("Unable to create output directory %s: %s", options_.outputDirectory.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (const auto& file : files)
+    {
+        auto config = channelTemplate;
+        config.name = baseName(file.first);
+        config.inputFile = file.first;
+        config.outputFile = file.second;
+        if (!addJob(config))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BatchRunner::addJob(const ChannelConfig& config)
+{
+    Job job;
+    job.config = config;
+    job.inputSize = fileSize(config.inputFile);
+    job.inputPath = resolvedPath(config.inputFile);
+    job.outputPath = config.outputFile.empty() ? std::string() : resolvedPath(config.outputFile);
+
+    // Jobs run concurrently: an output must not be read or written by any other job, nor be its own input. Jobs
+    // without an output file have an empty outputPath, which no input matches.
+    const auto conflicts = [&job](const Job& other) {
+        return (!job.outputPath.empty() &&
+                   (job.outputPath == other.inputPath || job.outputPath == other.outputPath)) ||
+            job.inputPath == other.outputPath;
+    };
+    if (job.outputPath == job.inputPath || std::any_of(jobs_.begin(), jobs_.end(), conflicts))
+    {
+        Logger::error("Output file %s of %s is the input or output of another file",
+            config.outputFile.c_str(),
+            config.inputFile.c_str());
+        return false;
+    }
+    jobs_.push_back(std::move(job));
+    return true;
+}
+
+bool BatchRunner::run()
+{
+    const auto start = std::chrono::steady_clock::now();
+    MemoryBudget memoryBudget(options_.memoryBudget);
+
+    {
+        utils::WorkStealingPool pool(options_.threads);
+        Logger::log("Batch of %zu files on %zu threads, memory budget %zu MB",
+            jobs_.size(),
+            pool.size(),
+            options_.memoryBudget / (1024 * 1024));
+
+        // Largest files first, so that a long file does not start last and hold up the end of the batch.
+        std::vector<Job*> order;
+        for (auto& job : jobs_)
+        {
+            order.push_back(&job);
+        }
+        std::stable_sort(order.begin(), order.end(), [](const Job* left, const Job* right) {
+            return left->inputSize > right->inputSize;
+        });
+
+        for (auto job : order)
+        {
+            pool.submit([job, &memoryBudget]() {
+                // Output is buffered up to the input size, the mapping stays within its window.
+                const auto residentBytes = std::min(job->inputSize * 2, OfflineInserter::maxResidentBytes);
+                memoryBudget.acquire(residentBytes);
+                job->succeeded = OfflineInserter(job->config).run(job->stats);
+                memoryBudget.release(residentBytes);
+            });
+        }
+        pool.wait();
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t bytesIn = 0;
+    uint32_t cues = 0;
+    size_t failed = 0;
+    for (const auto& job : jobs_)
+    {
+        bytesIn += job.stats.bytesIn;
+        cues += job.stats.cues;
+        failed += job.succeeded ? 0 : 1;
+    }
+
+    Logger::log("Batch done: %zu files, %zu failed, %u cues, %.1f MB in %.3f s, %.1f MB/s aggregate",
+        jobs_.size(),
+        failed,
+        cues,
+        static_cast<double>(bytesIn) / 1e6,
+        seconds,
+        seconds > 0.0 ? static_cast<double>(bytesIn) / 1e6 / seconds : 0.0);
+
+    if (!options_.reportFile.empty())
+    {
+        writeReport(seconds);
+    }
+    return failed == 0;
+}
+
+void BatchRunner::writeReport(const double seconds) const
+{
+    auto report = fopen(options_.reportFile.c_str(), "w");
+    if (!report)
+    {
+        Logger::error("Unable to open batch report %s: %s", options_.reportFile.c_str(), strerror(errno));
+        return;
+    }
+
+    fprintf(report, "input,output,status,bytes_in,bytes_out,cues,seconds,mb_per_second\n");
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint32_t cues = 0;
+    for (const auto& job : jobs_)
+    {
+        fprintf(report,
+            "%s,%s,%s,%llu,%llu,%u,%.3f,%.1f\n",
+            job.config.inputFile.c_str(),
+            job.config.outputFile.c_str(),
+            job.succeeded ? "ok" : "failed",
+            static_cast<unsigned long long>(job.stats.bytesIn),
+            static_cast<unsigned long long>(job.stats.bytesOut),
+            job.stats.cues,
+            job.stats.seconds,
+            job.stats.seconds > 0.0 ? static_cast<double>(job.stats.bytesIn) / 1e6 / job.stats.seconds : 0.0);
+        bytesIn += job.stats.bytesIn;
+        bytesOut += job.stats.bytesOut;
+        cues += job.stats.cues;
+    }
+
+    fprintf(report,
+        "total,,,%llu,%llu,%u,%.3f,%.1f\n",
+        static_cast<unsigned long long>(bytesIn),
+        static_cast<unsigned long long>(bytesOut),
+        cues,
+        seconds,
+        seconds > 0.0 ? static_cast<double>(bytesIn) / 1e6 / seconds : 0.0);
+    fclose(report);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "OfflineInserter.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct BatchOptions
+{
+    // Directory of .ts files, or a manifest with one "<input> [<output>]" per line.
+    std::string input;
+    std::string outputDirectory;
+    // Optional CSV file with one line per input file.
+    std::string reportFile;
+    // 0 for one worker per hardware thread.
+    size_t threads = 0;
+    // Memory the running jobs may keep resident together, a job larger than the budget runs alone.
+    size_t memoryBudget = 512 * 1024 * 1024;
+};
+
+/**
+ * Runs offline insertion jobs concurrently on a work-stealing pool, each job an OfflineInserter with its own splice
+ * factory, and reports per-file and aggregate throughput.
+ */
+class BatchRunner
+{
+public:
+    explicit BatchRunner(const BatchOptions& options);
+
+    /**
+     * Adds one job per file of options.input, with the cue and splice settings of channelTemplate.
+     * @return False if the directory or manifest could not be read or lists no files.
+     */
+    bool addJobs(const ChannelConfig& channelTemplate);
+
+    /**
+     * @return False if the output of config is its input or the input or output of a job already added.
+     */
+    bool addJob(const ChannelConfig& config);
+
+    /**
+     * @return False if any job failed.
+     */
+    bool run();
+
+private:
+    struct Job
+    {
+        ChannelConfig config;
+        size_t inputSize = 0;
+        // Resolved paths, to find jobs that share a file.
+        std::string inputPath;
+        std::string outputPath;
+        OfflineStats stats;
+        bool succeeded = false;
+    };
+
+    BatchOptions options_;
+    std::vector<Job> jobs_;
+
+    std::string outputPath(const std::string& input) const;
+    void writeReport(const double seconds) const;
+};
@@ -0,0 +1,257 @@
+#include "BufferPool.h"
+#include "Logger.h"
+#include "utils/TsPacket.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <sys/mman.h>
+#include <vector>
+
+namespace
+{
+
+const size_t hugePageSize = 2 * 1024 * 1024;
+
+/**
+ * Memory of the buffers of one pool. The pool and every wrapped GstMemory hold a reference, so memory that outlives
+ * the pool downstream keeps the slab mapped.
+ */
+struct Slab
+{
+    struct Slot
+    {
+        Slab* slab;
+        uint32_t index;
+    };
+
+    uint8_t* memory = nullptr;
+    size_t mappedSize = 0;
+    size_t bufferSize = 0;
+    std::vector<Slot> slots;
+    std::mutex mutex;
+    std::vector<uint32_t> freeSlots;
+    std::atomic<uint32_t> references{1};
+    std::atomic<uint32_t> usedBuffers{0};
+};
+
+void releaseSlab(Slab* slab)
+{
+    if (slab->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        munmap(slab->memory, slab->mappedSize);
+        delete slab;
+    }
+}
+
+Slab* createSlab(const std::string& channel, const size_t bufferSize, const uint32_t count, const bool hugePages)
+{
+    const auto size = bufferSize * count;
+    void* memory = MAP_FAILED;
+    size_t mappedSize = size;
+    if (hugePages)
+    {
+        mappedSize = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+        memory = mmap(nullptr,
+            mappedSize,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+            -1,
+            0);
+        if (memory == MAP_FAILED)
+        {
+            Logger::warning("[%s] No huge pages for the %zu kB input buffer pool (%s), using transparent huge pages",
+                channel.c_str(),
+                mappedSize / 1024,
+                strerror(errno));
+        }
+    }
+    if (memory == MAP_FAILED)
+    {
+        mappedSize = size;
+        memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        if (hugePages)
+        {
+            madvise(memory, mappedSize, MADV_HUGEPAGE);
+        }
+        // Fault the pages in now rather than on the packet path.
+        memset(memory, 0, mappedSize);
+    }
+
+    auto slab = new Slab();
+    slab->memory = static_cast<uint8_t*>(memory);
+    slab->mappedSize = mappedSize;
+    slab->bufferSize = bufferSize;
+    slab->slots.reserve(count);
+    slab->freeSlots.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        slab->slots.push_back({slab, i});
+        slab->freeSlots.push_back(count - 1 - i);
+    }
+    return slab;
+}
+
+/**
+ * GstBufferPool whose buffers wrap the slots of a Slab.
+ */
+struct SlabBufferPool
+{
+    GstBufferPool parent;
+    Slab* slab;
+};
+
+struct SlabBufferPoolClass
+{
+    GstBufferPoolClass parentClass;
+};
+
+G_DEFINE_TYPE(SlabBufferPool, slab_buffer_pool, GST_TYPE_BUFFER_POOL)
+
+void freeSlot(gpointer data)
+{
+    auto slot = static_cast<Slab::Slot*>(data);
+    auto slab = slot->slab;
+    {
+        std::lock_guard<std::mutex> lock(slab->mutex);
+        slab->freeSlots.push_back(slot->index);
+    }
+    releaseSlab(slab);
+}
+
+GstFlowReturn allocSlabBuffer(GstBufferPool* pool, GstBuffer** buffer, GstBufferPoolAcquireParams* /*params*/)
+{
+    auto slab = reinterpret_cast<SlabBufferPool*>(pool)->slab;
+    uint32_t index = 0;
+    {
+        std::lock_guard<std::mutex> lock(slab->mutex);
+        if (slab->freeSlots.empty())
+        {
+            return GST_FLOW_EOS;
+        }
+        index = slab->freeSlots.back();
+        slab->freeSlots.pop_back();
+    }
+
+    slab->references.fetch_add(1, std::memory_order_relaxed);
+    *buffer = gst_buffer_new();
+    gst_buffer_append_memory(*buffer,
+        gst_memory_new_wrapped(static_cast<GstMemoryFlags>(0),
+            slab->memory + index * slab->bufferSize,
+            slab->bufferSize,
+            0,
+            slab->bufferSize,
+            &slab->slots[index],
+            freeSlot));
+    return GST_FLOW_OK;
+}
+
+void releaseSlabBuffer(GstBufferPool* pool, GstBuffer* buffer)
+{
+    reinterpret_cast<SlabBufferPool*>(pool)->slab->usedBuffers.fetch_sub(1, std::memory_order_relaxed);
+    GST_BUFFER_POOL_CLASS(slab_buffer_pool_parent_class)->release_buffer(pool, buffer);
+}
+
+void finalizeSlabBufferPool(GObject* object)
+{
+    auto pool = reinterpret_cast<SlabBufferPool*>(object);
+    if (pool->slab)
+    {
+        releaseSlab(pool->slab);
+    }
+    G_OBJECT_CLASS(slab_buffer_pool_parent_class)->finalize(object);
+}
+
+void slab_buffer_pool_class_init(SlabBufferPoolClass* poolClass)
+{
+    G_OBJECT_CLASS(poolClass)->finalize = finalizeSlabBufferPool;
+    GST_BUFFER_POOL_CLASS(poolClass)->alloc_buffer = allocSlabBuffer;
+    GST_BUFFER_POOL_CLASS(poolClass)->release_buffer = releaseSlabBuffer;
+}
+
+void slab_buffer_pool_init(SlabBufferPool* pool)
+{
+    pool->slab = nullptr;
+}
+
+} // namespace
+
+BufferPool::BufferPool(const std::string& channel,
+    const std::string& name,
+    const size_t bufferSize,
+    const uint32_t count,
+    const bool hugePages)
+    : channel_(channel),
+      name_(name),
+      bufferSize_((bufferSize + utils::ts::packetSize - 1) / utils::ts::packetSize * utils::ts::packetSize),
+      pool_(nullptr),
+      exhausted_(metrics::registry().counter("scte35_buffer_pool_exhausted_total",
+          "Buffers requested while every buffer of the pool was in use",
+          {{"channel", channel}, {"pool", name}}))
+{
+    auto slab = createSlab(channel_, bufferSize_, count, hugePages);
+    if (!slab)
+    {
+        Logger::error("[%s] Unable to map the %s buffer pool: %s", channel_.c_str(), name_.c_str(), strerror(errno));
+        return;
+    }
+
+    auto pool = static_cast<SlabBufferPool*>(g_object_new(slab_buffer_pool_get_type(), nullptr));
+    gst_object_ref_sink(pool);
+    pool->slab = slab;
+
+    // min and max at the slot count: every buffer is created on activation and no more are allocated later.
+    auto config = gst_buffer_pool_get_config(GST_BUFFER_POOL(pool));
+    gst_buffer_pool_config_set_params(config, nullptr, static_cast<guint>(bufferSize_), count, count);
+    if (!gst_buffer_pool_set_config(GST_BUFFER_POOL(pool), config) ||
+        !gst_buffer_pool_set_active(GST_BUFFER_POOL(pool), TRUE))
+    {
+        Logger::error("[%s] Unable to start the %s buffer pool", channel_.c_str(), name_.c_str());
+        gst_object_unref(pool);
+        return;
+    }
+    pool_ = GST_BUFFER_POOL(pool);
+
+    metrics::registry().gauge("scte35_buffer_pool_used_buffers",
+        "Buffers of the pool held by the pipeline",
+        {{"channel", channel_}, {"pool", name_}},
+        this,
+        [slab]() { return static_cast<double>(slab->usedBuffers.load(std::memory_order_relaxed)); });
+
+    Logger::log("[%s] %s buffer pool: %u buffers of %zu bytes, %zu kB%s",
+        channel_.c_str(),
+        name_.c_str(),
+        count,
+        bufferSize_,
+        slab->mappedSize / 1024,
+        hugePages ? ", huge pages" : "");
+}
+
+BufferPool::~BufferPool()
+{
+    metrics::registry().removeGauges(this);
+    if (pool_)
+    {
+        gst_buffer_pool_set_active(pool_, FALSE);
+        gst_object_unref(pool_);
+    }
+}
+
+GstBuffer* BufferPool::acquire()
+{
+    GstBufferPoolAcquireParams params = {};
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    GstBuffer* buffer = nullptr;
+    if (!pool_ || gst_buffer_pool_acquire_buffer(pool_, &buffer, &params) != GST_FLOW_OK)
+    {
+        exhausted_.increment();
+        return nullptr;
+    }
+
+    reinterpret_cast<SlabBufferPool*>(pool_)->slab->usedBuffers.fetch_add(1, std::memory_order_relaxed);
+    return buffer;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Metrics.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <gst/gst.h>
+#include <string>
+#include <utility>
+
+/**
+ * Fixed set of GstBuffers over one preallocated slab, optionally backed by huge pages. All buffers are created when
+ * the pool starts and return to it when downstream drops them, so acquiring one never allocates. A buffer whose
+ * memory is still shared downstream, e.g. by a sub-buffer of tsparse, is recreated over the same slot once that
+ * memory is freed.
+ *
+ * Buffer sizes are whole TS packets. The number of buffers bounds the memory the input can hold in the pipeline:
+ * when all are in use acquire fails instead of waiting, the caller drops the input and the exhaustion is counted.
+ */
+class BufferPool
+{
+public:
+    // Buffers of the remuxing mode's input: seven 1316 byte datagrams or one jumbo datagram. At low rates a receive
+    // batch is often a single datagram, and each batch takes at least one buffer.
+    static constexpr size_t inputBufferSize = 49 * utils::ts::packetSize;
+
+    /**
+     * @param name Name of the pool in the metrics and log messages.
+     * @param bufferSize Rounded up to whole TS packets.
+     * @param hugePages Back the slab with huge pages, transparent huge pages if none are reserved.
+     */
+    BufferPool(const std::string& channel,
+        const std::string& name,
+        const size_t bufferSize,
+        const uint32_t count,
+        const bool hugePages);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    [[nodiscard]] bool isOpen() const { return pool_ != nullptr; }
+
+    [[nodiscard]] size_t bufferSize() const { return bufferSize_; }
+
+    /**
+     * Never blocks or allocates, callable from any thread.
+     * @return A buffer of bufferSize bytes, nullptr if every buffer is in use.
+     */
+    GstBuffer* acquire();
+
+    /**
+     * Copies datagrams into buffers of the pool, filling each buffer before the next and cutting the last to its
+     * fill, so datagrams may span two buffers. Once no buffer is left the remaining datagrams are dropped.
+     * @param datagram Called with the index of a datagram, returns its data and size as a std::pair.
+     * @param push Takes each filled buffer, returns false to stop.
+     * @param droppedBytes Incremented by the bytes dropped.
+     * @return False if push returned false.
+     */
+    template<typename Datagram, typename Push>
+    bool pack(const size_t count, Datagram datagram, Push push, uint64_t& droppedBytes);
+
+private:
+    std::string channel_;
+    std::string name_;
+    size_t bufferSize_;
+    GstBufferPool* pool_;
+    metrics::Counter& exhausted_;
+};
+
+template<typename Datagram, typename Push>
+bool BufferPool::pack(const size_t count, Datagram datagram, Push push, uint64_t& droppedBytes)
+{
+    GstBuffer* buffer = nullptr;
+    GstMapInfo mapInfo = {};
+    size_t filled = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto [data, size] = datagram(i);
+        while (size != 0)
+        {
+            if (!buffer)
+            {
+                buffer = acquire();
+                if (buffer && !gst_buffer_map(buffer, &mapInfo, GST_MAP_WRITE))
+                {
+                    gst_buffer_unref(buffer);
+                    buffer = nullptr;
+                }
+                if (!buffer)
+                {
+                    droppedBytes += size;
+                    for (++i; i < count; ++i)
+                    {
+                        droppedBytes += datagram(i).second;
+                    }
+                    return true;
+                }
+                filled = 0;
+            }
+
+            const auto copySize = std::min(size, mapInfo.size - filled);
+            memcpy(mapInfo.data + filled, data, copySize);
+            filled += copySize;
+            data += copySize;
+            size -= copySize;
+
+            if (filled == mapInfo.size)
+            {
+                gst_buffer_unmap(buffer, &mapInfo);
+                auto filledBuffer = buffer;
+                buffer = nullptr;
+                if (!push(filledBuffer))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (!buffer)
+    {
+        return true;
+    }
+    gst_buffer_unmap(buffer, &mapInfo);
+    gst_buffer_set_size(buffer, static_cast<gssize>(filled));
+    return push(buffer);
+}
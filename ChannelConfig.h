@@ -0,0 +1,144 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Pacing of the UDP output. Datagrams leave at the times the PCRs give their packets instead of in bursts as the
+ * mux releases them, or at a constant bitrate stuffed with null packets.
+ */
+struct PacingOptions
+{
+    bool enabled = false;
+    // Constant output bitrate in bit/s, 0 paces by PCR without stuffing.
+    uint64_t cbrBitrate = 0;
+    // Time packets are held to absorb the bursts of the mux, it must exceed the PCR interval.
+    std::chrono::milliseconds delay = std::chrono::milliseconds(100);
+};
+
+/**
+ * Socket settings of the batched UDP backend.
+ */
+struct UdpOptions
+{
+    int32_t socketBufferSize = 212992;
+    uint32_t batchSize = 32;
+    uint32_t busyPollUs = 0;
+    // Receive from the shared packet ring of this interface instead of a socket per input.
+    std::string packetRingInterface;
+    // Preallocated buffers the remuxing mode receives into, 0 allocates a buffer per datagram. See BufferPool.
+    uint32_t inputPoolBuffers = 0;
+    bool inputPoolHugePages = false;
+    PacingOptions pacing;
+};
+
+/**
+ * Buffering of the remuxing pipeline. The defaults buffer 1 s before the demuxer and 1 s after the mux with
+ * unbounded queues, lowLatency bounds every queue and starts forwarding immediately.
+ */
+struct LatencyOptions
+{
+    // min-threshold-time of UDP_QUEUE and TS_MUX_QUEUE.
+    std::chrono::milliseconds bufferTime = std::chrono::milliseconds(1000);
+    // max-size-time of every queue, 0 for unbounded.
+    std::chrono::milliseconds queueMaxTime = std::chrono::milliseconds(0);
+    // Full queues drop their oldest buffers instead of blocking upstream.
+    bool leakyQueues = false;
+    // Negative values keep the element defaults, 700 ms for tsdemux.
+    std::chrono::milliseconds demuxLatency = std::chrono::milliseconds(-1);
+    std::chrono::milliseconds muxLatency = std::chrono::milliseconds(-1);
+    // Sinks hold buffers until their running time plus the pipeline latency.
+    bool syncOutput = true;
+
+    static LatencyOptions lowLatency()
+    {
+        LatencyOptions options;
+        options.bufferTime = std::chrono::milliseconds(0);
+        options.queueMaxTime = std::chrono::milliseconds(200);
+        options.leakyQueues = true;
+        options.demuxLatency = std::chrono::milliseconds(40);
+        options.muxLatency = std::chrono::milliseconds(0);
+        options.syncOutput = false;
+        return options;
+    }
+};
+
+/**
+ * HLS output: TS segments and a rolling playlist in a local directory, cut at IDRs and at every splice point.
+ */
+struct HlsOptions
+{
+    // Empty for no HLS output.
+    std::string directory;
+    std::chrono::milliseconds segmentDuration = std::chrono::milliseconds(6000);
+    // Segments in the playlist, older segments are deleted.
+    uint32_t listSize = 6;
+};
+
+/**
+ * Tracing of the remuxing pipeline's elements. See ElementTracer.
+ */
+struct TraceOptions
+{
+    // Chrome trace written when the channel stops, empty for no tracing.
+    std::string file;
+    // Traces 1 in sampleInterval buffers.
+    uint32_t sampleInterval = 16;
+};
+
+/**
+ * Settings of one inserter channel, filled from the command line or from one line of a channel list file.
+ */
+struct ChannelConfig
+{
+    std::string name;
+    std::pair<std::string, uint32_t> inputAddress;
+    // Redundant copy of the input, merged per TS packet with inputAddress after redundancyDelay.
+    std::pair<std::string, uint32_t> secondaryInputAddress;
+    std::chrono::milliseconds redundancyDelay = std::chrono::milliseconds(50);
+    std::pair<std::string, uint32_t> outputAddress;
+    std::string outputFile;
+    // Further outputs of the same mux.
+    std::vector<std::pair<std::string, uint32_t>> extraOutputAddresses;
+    std::vector<std::string> extraOutputFiles;
+    // Bytes each output of a fan-out may queue before it drops output.
+    size_t outputQueueSize = 4 * 1024 * 1024;
+    HlsOptions hls;
+    // Offline mode: the input is read from this file instead of inputAddress.
+    std::string inputFile;
+    // Cues in the --cue format, <offset s>[:out|in|signal][:<duration s>] from the first video PTS.
+    std::vector<std::string> cues;
+    std::string cueScheduleFile;
+    // Memory-mapped file with the id sequences, pending cues and cached PAT/PMT that survive a restart.
+    std::string stateFile;
+    std::chrono::seconds spliceInterval = std::chrono::seconds(0);
+    std::chrono::seconds spliceDuration = std::chrono::seconds(0);
+    bool immediate = false;
+    bool autoReturn = false;
+    // Keeps the SCTE-35 cues of the input and interleaves the local cues with them.
+    bool mergeUpstreamCues = false;
+    bool passthrough = false;
+    bool batchedUdp = false;
+    // Verify mode: the input is only parsed and its SCTE-35 cues reported, optionally to a CSV file.
+    bool monitor = false;
+    std::string monitorReport;
+    UdpOptions udpOptions;
+    LatencyOptions latencyOptions;
+    TraceOptions trace;
+    std::vector<uint32_t> cores;
+
+    size_t outputCount() const
+    {
+        return (outputAddress.first.empty() ? 0 : 1) + (outputFile.empty() ? 0 : 1) + extraOutputAddresses.size() +
+            extraOutputFiles.size() + (hls.directory.empty() ? 0 : 1);
+    }
+
+    /**
+     * @return True if the outputs are fed through an OutputFanOut, the HLS output is only written by one.
+     */
+    bool usesFanOut() const { return outputCount() > 1 || !hls.directory.empty(); }
+};
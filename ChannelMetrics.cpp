@@ -0,0 +1,39 @@
+#include "ChannelMetrics.h"
+
+namespace
+{
+
+const std::vector<double> jitterBuckets =
+    {0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1};
+
+}
+
+ChannelMetrics::ChannelMetrics(const std::string& channel)
+    : packetsIn(metrics::registry().counter("scte35_input_packets_total",
+          "TS packets received",
+          {{"channel", channel}})),
+      bytesIn(metrics::registry().counter("scte35_input_bytes_total", "Bytes received", {{"channel", channel}})),
+      packetsOut(metrics::registry().counter("scte35_output_packets_total",
+          "TS packets sent",
+          {{"channel", channel}})),
+      bytesOut(metrics::registry().counter("scte35_output_bytes_total", "Bytes sent", {{"channel", channel}})),
+      udpDrops(metrics::registry().counter("scte35_udp_input_drops_total",
+          "Datagrams dropped by the kernel because the input socket buffer was full",
+          {{"channel", channel}})),
+      pcrJitter(metrics::registry().histogram("scte35_output_pcr_jitter_seconds",
+          "Absolute difference between the send time and the PCR difference of consecutive output PCRs",
+          {{"channel", channel}},
+          jitterBuckets)),
+      latency(metrics::registry().histogram("scte35_pipeline_latency_seconds",
+          "Time from input to output of the packets",
+          {{"channel", channel}},
+          metrics::latencyBuckets())),
+      timeToFirstPacket(metrics::registry().histogram("scte35_time_to_first_packet_seconds",
+          "Time from the start of the channel until its first output packet",
+          {{"channel", channel}},
+          metrics::latencyBuckets())),
+      upstreamSections(metrics::registry().counter("scte35_upstream_sections_total",
+          "SCTE-35 sections of the input merged into the output",
+          {{"channel", channel}}))
+{
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Metrics.h"
+#include <string>
+
+/**
+ * Packet path metrics of one channel, registered under its name.
+ */
+struct ChannelMetrics
+{
+    explicit ChannelMetrics(const std::string& channel);
+
+    metrics::Counter& packetsIn;
+    metrics::Counter& bytesIn;
+    metrics::Counter& packetsOut;
+    metrics::Counter& bytesOut;
+    metrics::Counter& udpDrops;
+    metrics::Histogram& pcrJitter;
+    metrics::Histogram& latency;
+    metrics::Histogram& timeToFirstPacket;
+    metrics::Counter& upstreamSections;
+};
@@ -0,0 +1,227 @@
+#include "ChannelState.h"
+#include "Logger.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace
+{
+
+// "SC35", a file of an older layout version starts cold.
+const uint32_t stateMagic = 0x53433335;
+const uint32_t stateVersion = 1;
+
+} // namespace
+
+static_assert(std::is_trivially_copyable<ChannelState::Cue>::value, "Cues are copied into the mapped file");
+
+struct ChannelState::Layout
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint32_t nextEventId;
+    uint16_t nextUid;
+    uint64_t scheduleHash;
+    uint64_t lastPts;
+    uint32_t patSize;
+    uint32_t pmtSize;
+    std::array<uint8_t, maxSectionSize> pat;
+    std::array<uint8_t, maxSectionSize> pmt;
+    std::array<uint8_t, maxCues> usedCues;
+    std::array<Cue, maxCues> cues;
+};
+
+ChannelState::ChannelState(const std::string& channel, const std::string& fileName)
+    : channel_(channel),
+      file_(-1),
+      layout_(nullptr),
+      warm_(false),
+      nextFreeSlot_(0)
+{
+    file_ = open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat fileStat = {};
+    if (file_ < 0 || fstat(file_, &fileStat) != 0)
+    {
+        Logger::error("[%s] Unable to open state file %s: %s", channel_.c_str(), fileName.c_str(), strerror(errno));
+        return;
+    }
+
+    const auto size = sizeof(Layout);
+    if (static_cast<size_t>(fileStat.st_size) != size && ftruncate(file_, static_cast<off_t>(size)) != 0)
+    {
+        Logger::error("[%s] Unable to resize state file %s: %s", channel_.c_str(), fileName.c_str(), strerror(errno));
+        return;
+    }
+
+    auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file_, 0);
+    if (mapping == MAP_FAILED)
+    {
+        Logger::error("[%s] Unable to map state file %s: %s", channel_.c_str(), fileName.c_str(), strerror(errno));
+        return;
+    }
+    layout_ = static_cast<Layout*>(mapping);
+
+    warm_ = static_cast<size_t>(fileStat.st_size) == size && layout_->magic == stateMagic &&
+        layout_->version == stateVersion && layout_->size == size;
+    if (!warm_)
+    {
+        memset(static_cast<void*>(layout_), 0, size);
+        layout_->magic = stateMagic;
+        layout_->version = stateVersion;
+        layout_->size = size;
+        Logger::log("[%s] New state file %s", channel_.c_str(), fileName.c_str());
+        return;
+    }
+
+    Logger::log("[%s] Restored state from %s: next event id %u, next unique program id %u, %zu pending cues",
+        channel_.c_str(),
+        fileName.c_str(),
+        layout_->nextEventId,
+        layout_->nextUid,
+        static_cast<size_t>(std::count(layout_->usedCues.begin(), layout_->usedCues.end(), 1)));
+}
+
+ChannelState::~ChannelState()
+{
+    if (layout_)
+    {
+        msync(layout_, sizeof(Layout), MS_SYNC);
+        munmap(layout_, sizeof(Layout));
+    }
+    if (file_ >= 0)
+    {
+        close(file_);
+    }
+}
+
+uint32_t ChannelState::nextEventId() const
+{
+    return layout_ ? layout_->nextEventId : 0;
+}
+
+uint16_t ChannelState::nextUid() const
+{
+    return layout_ ? layout_->nextUid : 0;
+}
+
+void ChannelState::storeIds(const uint32_t nextEventId, const uint16_t nextUid)
+{
+    if (layout_)
+    {
+        layout_->nextEventId = nextEventId;
+        layout_->nextUid = nextUid;
+    }
+}
+
+uint64_t ChannelState::scheduleHash() const
+{
+    return layout_ ? layout_->scheduleHash : 0;
+}
+
+void ChannelState::storeScheduleHash(const uint64_t hash)
+{
+    if (layout_)
+    {
+        layout_->scheduleHash = hash;
+    }
+}
+
+uint64_t ChannelState::lastPts() const
+{
+    return layout_ ? layout_->lastPts : 0;
+}
+
+void ChannelState::storePts(const uint64_t pts)
+{
+    if (layout_)
+    {
+        layout_->lastPts = pts;
+    }
+}
+
+std::vector<ChannelState::Cue> ChannelState::cues() const
+{
+    std::vector<Cue> result;
+    for (size_t slot = 0; layout_ && slot < maxCues; ++slot)
+    {
+        if (layout_->usedCues[slot] == 1)
+        {
+            result.push_back(layout_->cues[slot]);
+        }
+    }
+    return result;
+}
+
+size_t ChannelState::storeCue(const Cue& cue)
+{
+    if (!layout_)
+    {
+        return maxCues;
+    }
+
+    for (size_t i = 0; i < maxCues; ++i)
+    {
+        const auto slot = (nextFreeSlot_ + i) % maxCues;
+        if (layout_->usedCues[slot] == 0)
+        {
+            // The slot is only marked once the cue is complete, a crash in between leaves it free.
+            layout_->cues[slot] = cue;
+            layout_->usedCues[slot] = 1;
+            nextFreeSlot_ = (slot + 1) % maxCues;
+            return slot;
+        }
+    }
+    return maxCues;
+}
+
+void ChannelState::clearCue(const size_t slot)
+{
+    if (layout_ && slot < maxCues)
+    {
+        layout_->usedCues[slot] = 0;
+    }
+}
+
+void ChannelState::clearCues()
+{
+    if (layout_)
+    {
+        layout_->usedCues.fill(0);
+        layout_->scheduleHash = 0;
+    }
+}
+
+bool ChannelState::tables(std::vector<uint8_t>& pat, std::vector<uint8_t>& pmt) const
+{
+    if (!layout_ || layout_->patSize == 0 || layout_->pmtSize == 0 || layout_->patSize > maxSectionSize ||
+        layout_->pmtSize > maxSectionSize)
+    {
+        return false;
+    }
+
+    pat.assign(layout_->pat.begin(), layout_->pat.begin() + layout_->patSize);
+    pmt.assign(layout_->pmt.begin(), layout_->pmt.begin() + layout_->pmtSize);
+    return true;
+}
+
+void ChannelState::storeTables(const std::vector<uint8_t>& pat, const std::vector<uint8_t>& pmt)
+{
+    if (!layout_ || pat.size() > maxSectionSize || pmt.size() > maxSectionSize)
+    {
+        return;
+    }
+
+    layout_->patSize = 0;
+    layout_->pmtSize = 0;
+    std::copy(pat.begin(), pat.end(), layout_->pat.begin());
+    std::copy(pmt.begin(), pmt.end(), layout_->pmt.begin());
+    layout_->patSize = static_cast<uint32_t>(pat.size());
+    layout_->pmtSize = static_cast<uint32_t>(pmt.size());
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "SpliceInfoSection.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Channel state that survives a restart, kept in a memory-mapped file: the event id and unique program id
+ * sequences, the pending cues of the scheduler and the PAT and PMT of the input. Updates are plain stores into the
+ * mapping that the kernel writes back, so neither the packet path nor the main loop waits for the file.
+ *
+ * Ids are stored from the main loop, cues and tables from the packet thread, each part from one thread only.
+ */
+class ChannelState
+{
+public:
+    static const size_t maxCues = 4096;
+    static const size_t maxSectionSize = 1024;
+
+    /**
+     * One pending cue of the scheduler with 33-bit PTS values.
+     */
+    struct Cue
+    {
+        static const uint8_t immediate = 0x01;
+        static const uint8_t interval = 0x02;
+        static const uint8_t hasSplicePts = 0x04;
+        static const uint8_t hasEventId = 0x08;
+        static const uint8_t hasSegmentation = 0x10;
+        static const uint8_t streamPts = 0x20;
+
+        uint8_t flags;
+        uint8_t command;
+        uint8_t type;
+        uint32_t eventId;
+        uint32_t duration;
+        uint64_t splicePts;
+        uint64_t firePts;
+        SegmentationDescriptor segmentation;
+    };
+
+    /**
+     * Maps fileName, creating it if needed. A missing, truncated or foreign file starts an empty state.
+     */
+    ChannelState(const std::string& channel, const std::string& fileName);
+    ~ChannelState();
+
+    ChannelState(const ChannelState&) = delete;
+    ChannelState& operator=(const ChannelState&) = delete;
+
+    bool isOpen() const { return layout_ != nullptr; }
+
+    /**
+     * @return True if the file held the state of a previous run.
+     */
+    bool isWarm() const { return warm_; }
+
+    uint32_t nextEventId() const;
+    uint16_t nextUid() const;
+    void storeIds(const uint32_t nextEventId, const uint16_t nextUid);
+
+    /**
+     * @return Hash of the cue configuration whose cues are stored, 0 until a schedule was stored.
+     */
+    uint64_t scheduleHash() const;
+    void storeScheduleHash(const uint64_t hash);
+
+    /**
+     * @return Latest stored 33-bit video PTS, the position the stored cues are relative to.
+     */
+    uint64_t lastPts() const;
+    void storePts(const uint64_t pts);
+
+    std::vector<Cue> cues() const;
+
+    /**
+     * @return Slot of the stored cue, maxCues if all slots are used.
+     */
+    size_t storeCue(const Cue& cue);
+    void clearCue(const size_t slot);
+    void clearCues();
+
+    /**
+     * @return False until a PAT and a PMT were stored.
+     */
+    bool tables(std::vector<uint8_t>& pat, std::vector<uint8_t>& pmt) const;
+    void storeTables(const std::vector<uint8_t>& pat, const std::vector<uint8_t>& pmt);
+
+private:
+    struct Layout;
+
+    std::string channel_;
+    int32_t file_;
+    Layout* layout_;
+    bool warm_;
+    size_t nextFreeSlot_;
+};
@@ -0,0 +1,431 @@
+#include "ControlServer.h"
+#include "ChannelMetrics.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "utils/Json.h"
+#include <arpa/inet.h>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+
+const std::chrono::milliseconds pollTimeout(100);
+const std::chrono::seconds connectionTimeout(1);
+const size_t maxRequestSize = 8192;
+const int32_t listenBacklog = 16;
+const char* channelsPrefix = "/channels/";
+
+const char* statusText(const uint32_t status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 202:
+        return "Accepted";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Error";
+    }
+}
+
+void writeAll(const int32_t connection, const std::string& data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        const auto result = send(connection, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            return;
+        }
+        written += static_cast<size_t>(result);
+    }
+}
+
+} // namespace
+
+ControlServer::ControlServer() : running_(false) {}
+
+ControlServer::~ControlServer()
+{
+    stop();
+
+    for (const auto listenSocket : listenSockets_)
+    {
+        close(listenSocket);
+    }
+
+    if (!unixSocketPath_.empty())
+    {
+        unlink(unixSocketPath_.c_str());
+    }
+}
+
+void ControlServer::addChannel(const std::string& name, Inserter* inserter)
+{
+    channels_.emplace_back(name, inserter);
+}
+
+bool ControlServer::listenTcp(const std::pair<std::string, uint32_t>& address)
+{
+    sockaddr_in socketAddress = {};
+    socketAddress.sin_family = AF_INET;
+    socketAddress.sin_port = htons(static_cast<uint16_t>(address.second));
+    if (inet_pton(AF_INET, address.first.c_str(), &socketAddress.sin_addr) != 1)
+    {
+        Logger::error("Invalid control address %s", address.first.c_str());
+        return false;
+    }
+
+    auto listenSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listenSocket < 0)
+    {
+        Logger::error("Unable to create control socket: %s", strerror(errno));
+        return false;
+    }
+
+    const int32_t enable = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0 ||
+        listen(listenSocket, listenBacklog) != 0)
+    {
+        Logger::error("Unable to listen on control address %s:%u: %s",
+            address.first.c_str(),
+            address.second,
+            strerror(errno));
+        close(listenSocket);
+        return false;
+    }
+
+    listenSockets_.push_back(listenSocket);
+    Logger::log("Control API listening on http://%s:%u", address.first.c_str(), address.second);
+    return true;
+}
+
+bool ControlServer::listenUnix(const std::string& path)
+{
+    sockaddr_un socketAddress = {};
+    socketAddress.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(socketAddress.sun_path))
+    {
+        Logger::error("Control socket path %s is too long", path.c_str());
+        return false;
+    }
+    strncpy(socketAddress.sun_path, path.c_str(), sizeof(socketAddress.sun_path) - 1);
+
+    auto listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listenSocket < 0)
+    {
+        Logger::error("Unable to create control socket: %s", strerror(errno));
+        return false;
+    }
+
+    unlink(path.c_str());
+    if (bind(listenSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0 ||
+        listen(listenSocket, listenBacklog) != 0)
+    {
+        Logger::error("Unable to listen on control socket %s: %s", path.c_str(), strerror(errno));
+        close(listenSocket);
+        return false;
+    }
+
+    listenSockets_.push_back(listenSocket);
+    unixSocketPath_ = path;
+    Logger::log("Control API listening on unix socket %s", path.c_str());
+    return true;
+}
+
+void ControlServer::run()
+{
+    if (listenSockets_.empty())
+    {
+        return;
+    }
+
+    running_ = true;
+    thread_ = std::thread(&ControlServer::threadFunction, this);
+}
+
+void ControlServer::stop()
+{
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+void ControlServer::threadFunction()
+{
+    std::vector<pollfd> pollFds;
+    for (const auto listenSocket : listenSockets_)
+    {
+        pollFds.push_back({listenSocket, POLLIN, 0});
+    }
+
+    while (running_)
+    {
+        const auto result = poll(pollFds.data(), pollFds.size(), static_cast<int32_t>(pollTimeout.count()));
+        if (result <= 0)
+        {
+            continue;
+        }
+
+        for (const auto& pollFd : pollFds)
+        {
+            if ((pollFd.revents & POLLIN) == 0)
+            {
+                continue;
+            }
+
+            const auto connection = accept4(pollFd.fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0)
+            {
+                continue;
+            }
+            handleConnection(connection);
+            close(connection);
+        }
+    }
+}
+
+void ControlServer::handleConnection(const int32_t connection)
+{
+    timeval timeout = {};
+    timeout.tv_sec = connectionTimeout.count();
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    std::array<char, 2048> buffer;
+    size_t headerEnd = std::string::npos;
+    size_t contentLength = 0;
+
+    while (request.size() < maxRequestSize)
+    {
+        const auto received = recv(connection, buffer.data(), buffer.size(), 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return;
+        }
+        request.append(buffer.data(), static_cast<size_t>(received));
+
+        if (headerEnd == std::string::npos)
+        {
+            headerEnd = request.find("\r\n\r\n");
+            if (headerEnd == std::string::npos)
+            {
+                continue;
+            }
+
+            const auto lengthHeader = strcasestr(request.c_str(), "\r\ncontent-length:");
+            if (lengthHeader && static_cast<size_t>(lengthHeader - request.c_str()) < headerEnd)
+            {
+                contentLength = std::strtoul(lengthHeader + 17, nullptr, 10);
+            }
+        }
+
+        if (request.size() >= headerEnd + 4 + contentLength)
+        {
+            break;
+        }
+    }
+
+    if (headerEnd == std::string::npos)
+    {
+        return;
+    }
+
+    const auto methodEnd = request.find(' ');
+    const auto pathEnd = methodEnd == std::string::npos ? std::string::npos : request.find(' ', methodEnd + 1);
+    Response response;
+    if (pathEnd == std::string::npos || pathEnd > headerEnd)
+    {
+        response.status = 400;
+        response.body = "{\"error\":\"malformed request\"}";
+    }
+    else
+    {
+        response = handleRequest(request.substr(0, methodEnd),
+            request.substr(methodEnd + 1, pathEnd - methodEnd - 1),
+            request.substr(headerEnd + 4, contentLength));
+    }
+
+    std::array<char, 256> header;
+    snprintf(header.data(),
+        header.size(),
+        "HTTP/1.1 %u %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        response.status,
+        statusText(response.status),
+        response.contentType,
+        response.body.size() + 1);
+    writeAll(connection, std::string(header.data()) + response.body + "\n");
+}
+
+ControlServer::Response ControlServer::handleRequest(const std::string& method,
+    const std::string& path,
+    const std::string& body)
+{
+    if (path == "/metrics")
+    {
+        if (method != "GET")
+        {
+            return {405, "{\"error\":\"use GET\"}"};
+        }
+
+        Response response;
+        response.body = metrics::registry().render();
+        response.contentType = "text/plain; version=0.0.4";
+        return response;
+    }
+
+    if (path == "/channels")
+    {
+        if (method != "GET")
+        {
+            return {405, "{\"error\":\"use GET\"}"};
+        }
+        return channelStatus();
+    }
+
+    const auto prefixSize = strlen(channelsPrefix);
+    const auto commandStart = path.rfind('/');
+    if (path.compare(0, prefixSize, channelsPrefix) != 0 || commandStart < prefixSize)
+    {
+        return {404, "{\"error\":\"unknown path\"}"};
+    }
+
+    const auto name = path.substr(prefixSize, commandStart - prefixSize);
+    const auto command = path.substr(commandStart + 1);
+    for (const auto& channel : channels_)
+    {
+        if (channel.first != name)
+        {
+            continue;
+        }
+
+        if (method != "POST")
+        {
+            return {405, "{\"error\":\"use POST\"}"};
+        }
+        return handleSpliceRequest(channel.second, command, body);
+    }
+
+    return {404, "{\"error\":\"unknown channel\"}"};
+}
+
+ControlServer::Response ControlServer::handleSpliceRequest(Inserter* inserter,
+    const std::string& command,
+    const std::string& body)
+{
+    SpliceRequest request;
+    request.triggerTime = std::chrono::steady_clock::now();
+    std::string value;
+
+    if (command == "time_signal")
+    {
+        request.command = SpliceCommand::TIME_SIGNAL;
+    }
+    else if (command == "splice_insert")
+    {
+        if (utils::jsonValue(body, "type", value))
+        {
+            if (value == "in")
+            {
+                request.type = SpliceType::IN;
+            }
+            else if (value != "out")
+            {
+                return {400, "{\"error\":\"type must be out or in\"}"};
+            }
+        }
+
+        if (utils::jsonValue(body, "immediate", value))
+        {
+            request.immediate = value == "true";
+        }
+    }
+    else
+    {
+        return {404, "{\"error\":\"unknown command, use splice_insert or time_signal\"}"};
+    }
+
+    if (utils::jsonValue(body, "duration", value) && !SpliceFactory::readDuration(value, request))
+    {
+        return {400, "{\"error\":\"duration must be a whole number of seconds from 1\"}"};
+    }
+
+    if (utils::jsonValue(body, "event_id", value) && !SpliceFactory::readEventId(value, request))
+    {
+        return {400, "{\"error\":\"event_id must be a number from 0 to 4294967295\"}"};
+    }
+
+    if (!SpliceFactory::readSegmentation(body, request))
+    {
+        return {400, "{\"error\":\"invalid segmentation_descriptor field\"}"};
+    }
+
+    const auto id = inserter->requestSplice(request);
+    if (id == 0)
+    {
+        return {503, "{\"error\":\"splice request queue full\"}"};
+    }
+
+    return {202, "{\"request\":" + std::to_string(id) + "}"};
+}
+
+ControlServer::Response ControlServer::channelStatus() const
+{
+    Response response;
+    response.body = "{\"channels\":[";
+    for (size_t i = 0; i < channels_.size(); ++i)
+    {
+        const auto stats = channels_[i].second->spliceRequestStats();
+        // Looks up the channel's registered series.
+        const ChannelMetrics channelMetrics(channels_[i].first);
+        const auto latency = channelMetrics.latency.snapshot();
+        std::array<char, 640> entry;
+        snprintf(entry.data(),
+            entry.size(),
+            "%s{\"name\":\"%s\",\"spliceRequests\":%llu,\"rejectedRequests\":%llu,\"measuredRequests\":%llu,"
+            "\"lastTriggerToWireUs\":%llu,\"maxTriggerToWireUs\":%llu,\"meanTriggerToWireUs\":%llu,"
+            "\"latencyP50Ms\":%.3f,\"latencyP99Ms\":%.3f}",
+            i == 0 ? "" : ",",
+            channels_[i].first.c_str(),
+            static_cast<unsigned long long>(stats.requests),
+            static_cast<unsigned long long>(stats.rejected),
+            static_cast<unsigned long long>(stats.measured),
+            static_cast<unsigned long long>(stats.lastLatencyUs),
+            static_cast<unsigned long long>(stats.maxLatencyUs),
+            static_cast<unsigned long long>(stats.measured != 0 ? stats.totalLatencyUs / stats.measured : 0),
+            channelMetrics.latency.quantile(latency, 0.5) * 1000.0,
+            channelMetrics.latency.quantile(latency, 0.99) * 1000.0);
+        response.body += entry.data();
+    }
+    response.body += "]}";
+    return response;
+}
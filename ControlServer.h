@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Inserter.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Local HTTP/JSON control endpoint on TCP and/or a Unix socket. Serves requests on its own thread and hands cues to
+ * the channels through their lock-free request queues:
+ *
+ *   POST /channels/<name>/splice_insert  {"type": "out"|"in", "duration": <s>, "immediate": true|false}
+ *   POST /channels/<name>/time_signal
+ *   GET  /channels
+ *   GET  /metrics                        Prometheus text format
+ */
+class ControlServer
+{
+public:
+    ControlServer();
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    /**
+     * Channels must be added before run.
+     */
+    void addChannel(const std::string& name, Inserter* inserter);
+
+    bool listenTcp(const std::pair<std::string, uint32_t>& address);
+    bool listenUnix(const std::string& path);
+
+    void run();
+    void stop();
+
+private:
+    struct Response
+    {
+        uint32_t status = 200;
+        std::string body;
+        const char* contentType = "application/json";
+    };
+
+    std::vector<std::pair<std::string, Inserter*>> channels_;
+    std::vector<int32_t> listenSockets_;
+    std::string unixSocketPath_;
+    std::atomic_bool running_;
+    std::thread thread_;
+
+    void threadFunction();
+    void handleConnection(const int32_t connection);
+    Response handleRequest(const std::string& method, const std::string& path, const std::string& body);
+    Response handleSpliceRequest(Inserter* inserter, const std::string& command, const std::string& body);
+    Response channelStatus() const;
+};
@@ -0,0 +1,694 @@
+#include "CueMonitor.h"
+#include "ChannelMetrics.h"
+#include "Logger.h"
+#include "SpliceInfoSection.h"
+#include "UdpReceiver.h"
+#include "VideoClock.h"
+#include "utils/Crc32.h"
+#include "utils/PsiSection.h"
+#include "utils/ThreadAffinity.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+
+const uint16_t defaultScte35Pid = 35;
+const size_t maxPendingCues = 32;
+// A splice point within one frame at 25 fps of an IDR counts as aligned.
+const int64_t alignmentTolerance = utils::ts::ptsClockRate / 25;
+// Cues still without an IDR after their splice point this much later are reported with the IDR before them only.
+const int64_t idrWait = utils::ts::ptsClockRate * 10;
+const size_t chunkSize = 4096 * utils::ts::packetSize;
+const size_t inputWindowSize = 16 * 1024 * 1024;
+
+const char* commandName(const SpliceCommandType command)
+{
+    switch (command)
+    {
+    case SpliceCommandType::SPLICE_NULL:
+        return "splice_null";
+    case SpliceCommandType::SPLICE_INSERT:
+        return "splice_insert";
+    case SpliceCommandType::TIME_SIGNAL:
+        return "time_signal";
+    case SpliceCommandType::BANDWIDTH_RESERVATION:
+        return "bandwidth_reservation";
+    default:
+        return "other";
+    }
+}
+
+double milliseconds(const int64_t ticks)
+{
+    return static_cast<double>(ticks) * 1000.0 / utils::ts::ptsClockRate;
+}
+
+} // namespace
+
+class CueMonitor::Impl
+{
+public:
+    explicit Impl(const ChannelConfig& config);
+    ~Impl();
+
+    void run();
+    void stop();
+    bool runFile();
+
+private:
+    static constexpr std::chrono::seconds dropLogInterval = std::chrono::seconds(10);
+
+    enum class Result
+    {
+        ALIGNED,
+        MISALIGNED,
+        NO_IDR
+    };
+
+    struct PendingCue
+    {
+        SpliceCommandType command = SpliceCommandType::SPLICE_NULL;
+        SpliceType type = SpliceType::OUT;
+        uint32_t eventId = 0;
+        int32_t segmentationTypeId = -1;
+        uint64_t splicePts = 0;
+        // Video position when the section arrived, negative preroll means the cue came too late.
+        bool hasArrivalPts = false;
+        uint64_t arrivalPts = 0;
+        bool hasIdrBefore = false;
+        uint64_t idrBefore = 0;
+    };
+
+    struct Counters
+    {
+        uint64_t sections = 0;
+        uint64_t crcErrors = 0;
+        uint64_t invalidSections = 0;
+        uint64_t heartbeats = 0;
+        uint64_t repeats = 0;
+        uint64_t cues = 0;
+        uint64_t aligned = 0;
+        uint64_t misaligned = 0;
+        uint64_t noIdr = 0;
+        uint64_t late = 0;
+    };
+
+    struct Metrics
+    {
+        explicit Metrics(const std::string& channel);
+
+        metrics::Counter& sections;
+        metrics::Counter& crcErrors;
+        metrics::Counter& invalidSections;
+        metrics::Counter& aligned;
+        metrics::Counter& misaligned;
+        metrics::Counter& noIdr;
+        metrics::Counter& late;
+        metrics::Histogram& idrDistance;
+    };
+
+    std::string name_;
+    std::string inputFileName_;
+    std::pair<std::string, uint32_t> inputAddress_;
+    UdpOptions udpOptions_;
+    std::vector<uint32_t> cores_;
+    FILE* report_;
+    VideoClock videoClock_;
+    utils::ts::SectionAssembler scte35Assembler_;
+    uint16_t scte35Pid_;
+    bool hasIdr_;
+    uint64_t lastIdrPts_;
+    std::array<PendingCue, maxPendingCues> pendingCues_;
+    size_t pendingCount_;
+    Counters counters_;
+    ChannelMetrics channelMetrics_;
+    Metrics metrics_;
+    std::atomic_bool running_;
+    std::thread thread_;
+
+    void threadFunction();
+    void onPackets(const uint8_t* data, const size_t size);
+    void onSection(const uint8_t* section, const size_t size);
+    void onIdr(const uint64_t idrPts);
+    void expirePending();
+    void resolve(const size_t index, const bool hasIdrAfter, const uint64_t idrAfter);
+    void logSummary() const;
+};
+
+CueMonitor::Impl::Metrics::Metrics(const std::string& channel)
+    : sections(metrics::registry().counter("scte35_monitor_sections_total",
+          "SCTE-35 sections seen on the monitored input",
+          {{"channel", channel}})),
+      crcErrors(metrics::registry().counter("scte35_monitor_crc_errors_total",
+          "SCTE-35 sections that failed their CRC check",
+          {{"channel", channel}})),
+      invalidSections(metrics::registry().counter("scte35_monitor_invalid_sections_total",
+          "SCTE-35 sections with a valid CRC that could not be parsed",
+          {{"channel", channel}})),
+      aligned(metrics::registry().counter("scte35_monitor_cues_total",
+          "Cues by the distance of their splice point to the nearest video IDR",
+          {{"channel", channel}, {"result", "aligned"}})),
+      misaligned(metrics::registry().counter("scte35_monitor_cues_total",
+          "Cues by the distance of their splice point to the nearest video IDR",
+          {{"channel", channel}, {"result", "misaligned"}})),
+      noIdr(metrics::registry().counter("scte35_monitor_cues_total",
+          "Cues by the distance of their splice point to the nearest video IDR",
+          {{"channel", channel}, {"result", "no_idr"}})),
+      late(metrics::registry().counter("scte35_monitor_late_cues_total",
+          "Cues that arrived after their splice point",
+          {{"channel", channel}})),
+      idrDistance(metrics::registry().histogram("scte35_monitor_idr_distance_seconds",
+          "Absolute distance between the splice point of a cue and the nearest video IDR",
+          {{"channel", channel}},
+          metrics::latencyBuckets()))
+{
+}
+
+CueMonitor::Impl::Impl(const ChannelConfig& config)
+    : name_(config.name),
+      inputFileName_(config.inputFile),
+      inputAddress_(config.inputAddress),
+      udpOptions_(config.udpOptions),
+      cores_(config.cores),
+      report_(nullptr),
+      scte35Pid_(defaultScte35Pid),
+      hasIdr_(false),
+      lastIdrPts_(0),
+      pendingCount_(0),
+      channelMetrics_(config.name),
+      metrics_(config.name),
+      running_(false)
+{
+    if (config.monitorReport.empty())
+    {
+        return;
+    }
+
+    report_ = fopen(config.monitorReport.c_str(), "w");
+    if (!report_)
+    {
+        Logger::error("[%s] Unable to open monitor report %s: %s",
+            name_.c_str(),
+            config.monitorReport.c_str(),
+            strerror(errno));
+        return;
+    }
+    fprintf(report_,
+        "splice_pts,command,type,event_id,segmentation_type_id,arrival_pts,preroll_ms,idr_pts,idr_offset_ms,result\n");
+}
+
+CueMonitor::Impl::~Impl()
+{
+    stop();
+
+    if (report_)
+    {
+        fclose(report_);
+    }
+}
+
+void CueMonitor::Impl::run()
+{
+    running_ = true;
+    thread_ = std::thread(&CueMonitor::Impl::threadFunction, this);
+}
+
+void CueMonitor::Impl::stop()
+{
+    if (!running_)
+    {
+        return;
+    }
+
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    logSummary();
+}
+
+void CueMonitor::Impl::threadFunction()
+{
+    if (!utils::setCurrentThreadAffinity(cores_))
+    {
+        Logger::warning("[%s] Unable to set monitor thread affinity", name_.c_str());
+    }
+
+    UdpReceiver receiver(inputAddress_, udpOptions_);
+    uint64_t loggedDrops = 0;
+    uint64_t countedDrops = 0;
+    auto lastDropLog = std::chrono::steady_clock::now();
+
+    while (running_)
+    {
+        const auto received = receiver.receive();
+        if (received < 0)
+        {
+            Logger::error("[%s] Input socket error: %s", name_.c_str(), strerror(errno));
+            break;
+        }
+
+        size_t receivedBytes = 0;
+        for (int32_t i = 0; i < received; ++i)
+        {
+            receivedBytes += receiver.size(i);
+            onPackets(receiver.data(i), receiver.size(i));
+        }
+        channelMetrics_.packetsIn.add(receivedBytes / utils::ts::packetSize);
+        channelMetrics_.bytesIn.add(receivedBytes);
+        expirePending();
+
+        if (receiver.drops() != countedDrops)
+        {
+            channelMetrics_.udpDrops.add(receiver.drops() - countedDrops);
+            countedDrops = receiver.drops();
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (receiver.drops() != loggedDrops && now - lastDropLog >= dropLogInterval)
+        {
+            Logger::warning("[%s] Input socket dropped %llu datagrams",
+                name_.c_str(),
+                static_cast<unsigned long long>(receiver.drops() - loggedDrops));
+            loggedDrops = receiver.drops();
+            lastDropLog = now;
+        }
+    }
+}
+
+bool CueMonitor::Impl::runFile()
+{
+    const auto start = std::chrono::steady_clock::now();
+    const auto inputFile = open(inputFileName_.c_str(), O_RDONLY);
+    if (inputFile < 0)
+    {
+        Logger::error("[%s] Unable to open input file %s: %s", name_.c_str(), inputFileName_.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat inputStat = {};
+    fstat(inputFile, &inputStat);
+    const auto inputSize = static_cast<size_t>(inputStat.st_size);
+    const uint8_t* input = nullptr;
+    if (inputSize != 0)
+    {
+        auto mapping = mmap(nullptr, inputSize, PROT_READ, MAP_PRIVATE, inputFile, 0);
+        if (mapping == MAP_FAILED)
+        {
+            Logger::error("[%s] Unable to map input file %s: %s", name_.c_str(), inputFileName_.c_str(),
+                strerror(errno));
+            close(inputFile);
+            return false;
+        }
+        madvise(mapping, inputSize, MADV_SEQUENTIAL);
+        input = static_cast<const uint8_t*>(mapping);
+    }
+    close(inputFile);
+
+    auto offset = utils::ts::findSync(input, inputSize);
+    size_t droppedSize = 0;
+    while (offset + utils::ts::packetSize <= inputSize)
+    {
+        if (offset - droppedSize >= 2 * inputWindowSize)
+        {
+            madvise(const_cast<uint8_t*>(input) + droppedSize, inputWindowSize, MADV_DONTNEED);
+            droppedSize += inputWindowSize;
+        }
+
+        const auto size = std::min(chunkSize, (inputSize - offset) / utils::ts::packetSize * utils::ts::packetSize);
+        onPackets(input + offset, size);
+        expirePending();
+        offset += size;
+    }
+
+    if (input)
+    {
+        munmap(const_cast<uint8_t*>(input), inputSize);
+    }
+
+    while (pendingCount_ != 0)
+    {
+        resolve(0, false, 0);
+    }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Logger::log("[%s] Monitored %s: %.1f MB in %.3f s, %.1f Mbit/s",
+        name_.c_str(),
+        inputFileName_.c_str(),
+        static_cast<double>(inputSize) / 1e6,
+        seconds,
+        seconds > 0.0 ? static_cast<double>(inputSize) * 8.0 / 1e6 / seconds : 0.0);
+    logSummary();
+
+    return counters_.crcErrors == 0 && counters_.invalidSections == 0 && counters_.misaligned == 0 &&
+        counters_.noIdr == 0 && counters_.late == 0;
+}
+
+void CueMonitor::Impl::onPackets(const uint8_t* data, const size_t size)
+{
+    for (size_t offset = 0; offset + utils::ts::packetSize <= size; offset += utils::ts::packetSize)
+    {
+        const auto packet = data + offset;
+        if (packet[0] != utils::ts::syncByte)
+        {
+            continue;
+        }
+
+        videoClock_.onPacket(packet);
+
+        const auto announcedPid = videoClock_.scte35Pid();
+        const auto scte35Pid = announcedPid != utils::ts::nullPid ? announcedPid : defaultScte35Pid;
+        if (scte35Pid != scte35Pid_)
+        {
+            Logger::log("[%s] Monitoring SCTE-35 PID %u", name_.c_str(), scte35Pid);
+            scte35Pid_ = scte35Pid;
+            scte35Assembler_.reset();
+        }
+
+        if (utils::ts::pid(packet) == scte35Pid_)
+        {
+            scte35Assembler_.push(packet, [this](const uint8_t* section, size_t size) { onSection(section, size); });
+        }
+
+        uint64_t idrPts = 0;
+        if (videoClock_.lastIdrPts(idrPts) && (!hasIdr_ || idrPts != lastIdrPts_))
+        {
+            hasIdr_ = true;
+            lastIdrPts_ = idrPts;
+            onIdr(idrPts);
+        }
+    }
+}
+
+void CueMonitor::Impl::onSection(const uint8_t* section, const size_t size)
+{
+    ++counters_.sections;
+    metrics_.sections.increment();
+
+    if (utils::crc32Mpeg(section, size) != 0)
+    {
+        ++counters_.crcErrors;
+        metrics_.crcErrors.increment();
+        Logger::warning("[%s] SCTE-35 section of %zu bytes failed its CRC check", name_.c_str(), size);
+        return;
+    }
+
+    SpliceInfo info;
+    if (!readSpliceInfoSection(section, size, info))
+    {
+        ++counters_.invalidSections;
+        metrics_.invalidSections.increment();
+        Logger::warning("[%s] Unable to parse SCTE-35 section of %zu bytes, table id 0x%02x",
+            name_.c_str(),
+            size,
+            section[0]);
+        return;
+    }
+
+    PendingCue cue;
+    cue.command = info.command;
+    cue.hasArrivalPts = videoClock_.currentPts(cue.arrivalPts);
+    if (info.segmentationCount != 0)
+    {
+        cue.eventId = info.segmentation[0].eventId;
+        cue.segmentationTypeId = info.segmentation[0].typeId;
+    }
+
+    bool timeSpecified = false;
+    switch (info.command)
+    {
+    case SpliceCommandType::SPLICE_NULL:
+        ++counters_.heartbeats;
+        return;
+    case SpliceCommandType::SPLICE_INSERT:
+        cue.eventId = info.spliceInsert.eventId;
+        cue.type = info.spliceInsert.type;
+        if (info.spliceInsert.cancel)
+        {
+            Logger::log("[%s] SCTE-35 splice_insert cancel, event %u", name_.c_str(), cue.eventId);
+            return;
+        }
+        timeSpecified = !info.spliceInsert.immediate;
+        cue.splicePts = info.spliceInsert.spliceTime;
+        break;
+    case SpliceCommandType::TIME_SIGNAL:
+        timeSpecified = info.timeSpecified;
+        cue.splicePts = info.spliceTime;
+        break;
+    default:
+        Logger::debug("[%s] SCTE-35 %s command 0x%02x",
+            name_.c_str(),
+            commandName(info.command),
+            static_cast<uint32_t>(info.command));
+        return;
+    }
+
+    if (!timeSpecified)
+    {
+        ++counters_.cues;
+        Logger::log("[%s] SCTE-35 %s %s event %u, immediate at pts %llu, not verified",
+            name_.c_str(),
+            commandName(cue.command),
+            cue.type == SpliceType::OUT ? "OUT" : "IN",
+            cue.eventId,
+            static_cast<unsigned long long>(cue.arrivalPts));
+        return;
+    }
+    cue.splicePts = (cue.splicePts + info.ptsAdjustment) % utils::ts::ptsModulo;
+
+    // Encoders and inserters repeat each cue until its splice point, only the first copy is verified.
+    for (size_t i = 0; i < pendingCount_; ++i)
+    {
+        const auto& pendingCue = pendingCues_[i];
+        if (pendingCue.command == cue.command && pendingCue.eventId == cue.eventId &&
+            pendingCue.splicePts == cue.splicePts)
+        {
+            ++counters_.repeats;
+            return;
+        }
+    }
+
+    if (hasIdr_ && utils::ts::ptsDifference(lastIdrPts_, cue.splicePts) <= 0)
+    {
+        cue.hasIdrBefore = true;
+        cue.idrBefore = lastIdrPts_;
+    }
+
+    if (pendingCount_ == maxPendingCues)
+    {
+        resolve(0, false, 0);
+    }
+    pendingCues_[pendingCount_++] = cue;
+    ++counters_.cues;
+
+    Logger::debug("[%s] SCTE-35 %s event %u for pts %llu received at pts %llu",
+        name_.c_str(),
+        commandName(cue.command),
+        cue.eventId,
+        static_cast<unsigned long long>(cue.splicePts),
+        static_cast<unsigned long long>(cue.arrivalPts));
+}
+
+void CueMonitor::Impl::onIdr(const uint64_t idrPts)
+{
+    for (size_t i = 0; i < pendingCount_;)
+    {
+        auto& cue = pendingCues_[i];
+        if (utils::ts::ptsDifference(idrPts, cue.splicePts) < 0)
+        {
+            cue.hasIdrBefore = true;
+            cue.idrBefore = idrPts;
+            ++i;
+            continue;
+        }
+        resolve(i, true, idrPts);
+    }
+}
+
+void CueMonitor::Impl::expirePending()
+{
+    uint64_t now = 0;
+    if (pendingCount_ == 0 || !videoClock_.currentPts(now))
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < pendingCount_;)
+    {
+        if (utils::ts::ptsDifference(now, pendingCues_[i].splicePts) > idrWait)
+        {
+            resolve(i, false, 0);
+            continue;
+        }
+        ++i;
+    }
+}
+
+void CueMonitor::Impl::resolve(const size_t index, const bool hasIdrAfter, const uint64_t idrAfter)
+{
+    const auto cue = pendingCues_[index];
+    std::copy(pendingCues_.begin() + index + 1, pendingCues_.begin() + pendingCount_, pendingCues_.begin() + index);
+    --pendingCount_;
+
+    // The nearest of the last IDR before and the first IDR at or after the splice point.
+    bool hasIdr = false;
+    int64_t idrOffset = 0;
+    uint64_t idrPts = 0;
+    if (cue.hasIdrBefore)
+    {
+        hasIdr = true;
+        idrPts = cue.idrBefore;
+        idrOffset = utils::ts::ptsDifference(cue.idrBefore, cue.splicePts);
+    }
+    if (hasIdrAfter)
+    {
+        const auto offsetAfter = utils::ts::ptsDifference(idrAfter, cue.splicePts);
+        if (!hasIdr || offsetAfter < -idrOffset)
+        {
+            hasIdr = true;
+            idrPts = idrAfter;
+            idrOffset = offsetAfter;
+        }
+    }
+
+    Result result = Result::NO_IDR;
+    if (hasIdr)
+    {
+        result = std::abs(idrOffset) <= alignmentTolerance ? Result::ALIGNED : Result::MISALIGNED;
+        metrics_.idrDistance.observe(std::chrono::nanoseconds(std::abs(idrOffset) * 100000 / 9));
+    }
+
+    switch (result)
+    {
+    case Result::ALIGNED:
+        ++counters_.aligned;
+        metrics_.aligned.increment();
+        break;
+    case Result::MISALIGNED:
+        ++counters_.misaligned;
+        metrics_.misaligned.increment();
+        break;
+    case Result::NO_IDR:
+        ++counters_.noIdr;
+        metrics_.noIdr.increment();
+        break;
+    }
+
+    const auto preroll = cue.hasArrivalPts ? utils::ts::ptsDifference(cue.splicePts, cue.arrivalPts) : 0;
+    if (cue.hasArrivalPts && preroll < 0)
+    {
+        ++counters_.late;
+        metrics_.late.increment();
+    }
+
+    const char* resultNames[] = {"aligned", "misaligned", "no_idr"};
+    const auto resultName = resultNames[static_cast<size_t>(result)];
+    const auto typeName = cue.command == SpliceCommandType::SPLICE_INSERT
+        ? (cue.type == SpliceType::OUT ? "OUT" : "IN")
+        : "";
+
+    const auto logFunction = result == Result::ALIGNED && preroll >= 0 ? Logger::log : Logger::warning;
+    logFunction("[%s] SCTE-35 %s%s%s event %u at pts %llu: preroll %.3f s%s, nearest IDR %+.1f ms, %s",
+        name_.c_str(),
+        commandName(cue.command),
+        typeName[0] != '\0' ? " " : "",
+        typeName,
+        cue.eventId,
+        static_cast<unsigned long long>(cue.splicePts),
+        cue.hasArrivalPts ? milliseconds(preroll) / 1000.0 : 0.0,
+        cue.hasArrivalPts ? (preroll < 0 ? " (late)" : "") : " (unknown)",
+        hasIdr ? milliseconds(idrOffset) : 0.0,
+        resultName);
+
+    if (report_)
+    {
+        fprintf(report_,
+            "%llu,%s,%s,%u,",
+            static_cast<unsigned long long>(cue.splicePts),
+            commandName(cue.command),
+            typeName,
+            cue.eventId);
+        if (cue.segmentationTypeId >= 0)
+        {
+            fprintf(report_, "0x%02x", static_cast<uint32_t>(cue.segmentationTypeId));
+        }
+        if (cue.hasArrivalPts)
+        {
+            fprintf(report_, ",%llu,%.1f,", static_cast<unsigned long long>(cue.arrivalPts), milliseconds(preroll));
+        }
+        else
+        {
+            fprintf(report_, ",,,");
+        }
+        if (hasIdr)
+        {
+            fprintf(report_, "%llu,%.1f", static_cast<unsigned long long>(idrPts), milliseconds(idrOffset));
+        }
+        else
+        {
+            fprintf(report_, ",");
+        }
+        fprintf(report_, ",%s\n", resultName);
+        fflush(report_);
+    }
+}
+
+void CueMonitor::Impl::logSummary() const
+{
+    Logger::log("[%s] SCTE-35 monitor: %llu sections, %llu CRC errors, %llu invalid, %llu splice_null, %llu repeats, "
+                "%llu cues: %llu aligned, %llu misaligned, %llu without IDR, %llu late",
+        name_.c_str(),
+        static_cast<unsigned long long>(counters_.sections),
+        static_cast<unsigned long long>(counters_.crcErrors),
+        static_cast<unsigned long long>(counters_.invalidSections),
+        static_cast<unsigned long long>(counters_.heartbeats),
+        static_cast<unsigned long long>(counters_.repeats),
+        static_cast<unsigned long long>(counters_.cues),
+        static_cast<unsigned long long>(counters_.aligned),
+        static_cast<unsigned long long>(counters_.misaligned),
+        static_cast<unsigned long long>(counters_.noIdr),
+        static_cast<unsigned long long>(counters_.late));
+}
+
+CueMonitor::CueMonitor(const ChannelConfig& config) : impl_(std::make_unique<CueMonitor::Impl>(config)) {}
+
+CueMonitor::~CueMonitor() // NOLINT(modernize-use-equals-default)
+{
+}
+
+void CueMonitor::run()
+{
+    impl_->run();
+}
+
+void CueMonitor::stop()
+{
+    impl_->stop();
+}
+
+uint64_t CueMonitor::requestSplice(const SpliceRequest& /*request*/)
+{
+    return 0;
+}
+
+SpliceRequestStats CueMonitor::spliceRequestStats() const
+{
+    return {};
+}
+
+bool CueMonitor::runFile()
+{
+    return impl_->runFile();
+}
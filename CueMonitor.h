@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "Inserter.h"
+#include <memory>
+
+/**
+ * SCTE-35 verify mode. Taps a TS from UDP or a file without changing it, reassembles and CRC checks every section on
+ * the SCTE-35 PID of the PMT (35 until a PMT announces one) and reports, for every cue, how far ahead of its splice
+ * point it arrived and how far the splice point is from the nearest video IDR.
+ *
+ * The packet path only follows PIDs and copies section bytes into reserved buffers, it does not allocate.
+ */
+class CueMonitor : public Inserter
+{
+public:
+    explicit CueMonitor(const ChannelConfig& config);
+
+    ~CueMonitor() override;
+
+    /**
+     * Starts monitoring the UDP input on a thread of its own.
+     */
+    void run() override;
+    void stop() override;
+
+    /**
+     * Monitors never insert cues.
+     * @return 0.
+     */
+    uint64_t requestSplice(const SpliceRequest& request) override;
+    SpliceRequestStats spliceRequestStats() const override;
+
+    /**
+     * Monitors the input file to its end, blocking.
+     * @return False if the file could not be read, or a section failed its CRC check or a cue its IDR check.
+     */
+    bool runFile();
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,583 @@
+#include "CueScheduler.h"
+#include "Logger.h"
+#include "utils/Json.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+std::string trim(const std::string& text)
+{
+    const auto first = text.find_first_not_of(" \t\r\n\"");
+    if (first == std::string::npos)
+    {
+        return {};
+    }
+    return text.substr(first, text.find_last_not_of(" \t\r\n\"") + 1 - first);
+}
+
+bool parseCommand(const std::string& text, SpliceRequest& request)
+{
+    if (text == "out")
+    {
+        request.command = SpliceCommand::SPLICE_INSERT;
+        request.type = SpliceType::OUT;
+    }
+    else if (text == "in")
+    {
+        request.command = SpliceCommand::SPLICE_INSERT;
+        request.type = SpliceType::IN;
+    }
+    else if (text == "signal" || text == "time_signal")
+    {
+        request.command = SpliceCommand::TIME_SIGNAL;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool parseDuration(const std::string& text, SpliceRequest& request)
+{
+    return text.empty() || SpliceFactory::readDuration(text, request);
+}
+
+bool parseEventId(const std::string& text, SpliceRequest& request)
+{
+    return text.empty() || SpliceFactory::readEventId(text, request);
+}
+
+void hashText(uint64_t& hash, const std::string& text)
+{
+    for (const auto character : text)
+    {
+        hash = (hash ^ static_cast<uint8_t>(character)) * 0x100000001B3ull;
+    }
+    hash = (hash ^ 0xFF) * 0x100000001B3ull;
+}
+
+const char* commandName(const SpliceRequest& request)
+{
+    if (request.command == SpliceCommand::TIME_SIGNAL)
+    {
+        return "time_signal";
+    }
+    return request.type == SpliceType::IN ? "in" : "out";
+}
+
+} // namespace
+
+CueScheduler::CueScheduler(const std::string& channel, const std::chrono::seconds preroll, FireFunction fire)
+    : channel_(channel),
+      preroll_(static_cast<uint64_t>(preroll.count()) * utils::ts::ptsClockRate),
+      fire_(std::move(fire)),
+      spliceInterval_(0),
+      spliceDuration_(0),
+      immediate_(false),
+      autoReturn_(false),
+      lastPts_(0),
+      fireError_(metrics::registry().histogram("scte35_cue_fire_error_seconds",
+          "Time from the scheduled stream position of a cue until it fired",
+          {{"channel", channel}},
+          metrics::latencyBuckets())),
+      state_(nullptr),
+      scheduleHash_(0xCBF29CE484222325ull),
+      loggedStateFull_(false)
+{
+}
+
+bool CueScheduler::load(const ChannelConfig& config)
+{
+    spliceInterval_ = config.spliceInterval;
+    spliceDuration_ = config.spliceDuration;
+    immediate_ = config.immediate;
+    autoReturn_ = config.autoReturn;
+    hashText(scheduleHash_,
+        std::to_string(spliceInterval_.count()) + ":" + std::to_string(spliceDuration_.count()) + ":" +
+            std::to_string(immediate_) + ":" + std::to_string(autoReturn_));
+
+    for (const auto& text : config.cues)
+    {
+        if (!addCue(text))
+        {
+            return false;
+        }
+    }
+    return config.cueScheduleFile.empty() || loadSchedule(config.cueScheduleFile);
+}
+
+bool CueScheduler::addCue(const std::string& text)
+{
+    Cue cue;
+    if (!parseLine(text, cue))
+    {
+        Logger::error("[%s] Invalid cue %s", channel_.c_str(), text.c_str());
+        return false;
+    }
+    hashText(scheduleHash_, text);
+    unresolved_.push_back(cue);
+    return true;
+}
+
+bool CueScheduler::parseTime(const std::string& text, Cue& cue) const
+{
+    char* end = nullptr;
+    if (text.compare(0, 4, "pts:") == 0)
+    {
+        cue.timeBase = TimeBase::PTS;
+        cue.ticks = std::strtoull(text.c_str() + 4, &end, 10) % utils::ts::ptsModulo;
+        return end != text.c_str() + 4 && *end == '\0';
+    }
+
+    if (text.find('T') != std::string::npos)
+    {
+        tm utc = {};
+        double seconds = 0.0;
+        int32_t consumed = 0;
+        if (sscanf(text.c_str(), "%d-%d-%dT%d:%d:%lf%n", &utc.tm_year, &utc.tm_mon, &utc.tm_mday, &utc.tm_hour,
+                &utc.tm_min, &seconds, &consumed) != 6 ||
+            (text[consumed] != '\0' && (text[consumed] != 'Z' || text[consumed + 1] != '\0')))
+        {
+            return false;
+        }
+
+        utc.tm_year -= 1900;
+        utc.tm_mon -= 1;
+        utc.tm_sec = static_cast<int32_t>(seconds);
+        cue.timeBase = TimeBase::WALL_CLOCK;
+        cue.wallClock = std::chrono::system_clock::from_time_t(timegm(&utc)) +
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::duration<double>(seconds - utc.tm_sec));
+        return true;
+    }
+
+    const auto offset = std::strtod(text.c_str(), &end);
+    cue.timeBase = TimeBase::OFFSET;
+    cue.ticks = static_cast<uint64_t>(offset * utils::ts::ptsClockRate);
+    return end != text.c_str() && offset >= 0.0;
+}
+
+bool CueScheduler::parseLine(const std::string& text, Cue& cue) const
+{
+    cue.request.type = SpliceType::OUT;
+    char separator = ':';
+    std::vector<std::string> fields;
+
+    // CSV lines separate with commas, the short form of --cue with colons after the offset.
+    if (text.find(',') != std::string::npos)
+    {
+        separator = ',';
+    }
+
+    std::stringstream stream(text);
+    std::string field;
+    while (std::getline(stream, field, separator))
+    {
+        fields.push_back(trim(field));
+    }
+    if (fields.empty() || fields.size() > (separator == ',' ? 4u : 3u))
+    {
+        return false;
+    }
+
+    auto timeText = fields[0];
+    if (separator == ':' && timeText == "pts" && fields.size() > 1)
+    {
+        timeText += ":" + fields[1];
+        fields.erase(fields.begin() + 1);
+    }
+
+    if (!parseTime(timeText, cue) || (fields.size() > 1 && !parseCommand(fields[1], cue.request)) ||
+        (fields.size() > 2 && !parseDuration(fields[2], cue.request)) ||
+        (fields.size() > 3 && !parseEventId(fields[3], cue.request)))
+    {
+        return false;
+    }
+
+    cue.request.immediate = cue.request.command == SpliceCommand::SPLICE_INSERT &&
+        cue.request.type == SpliceType::OUT && immediate_;
+    return true;
+}
+
+bool CueScheduler::loadSchedule(const std::string& fileName)
+{
+    std::ifstream file(fileName);
+    if (!file)
+    {
+        Logger::error("[%s] Unable to open cue schedule %s", channel_.c_str(), fileName.c_str());
+        return false;
+    }
+
+    std::stringstream content;
+    content << file.rdbuf();
+    const auto document = content.str();
+    hashText(scheduleHash_, document);
+    const auto loaded = unresolved_.size();
+    const auto first = document.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && (document[first] == '[' || document[first] == '{'))
+    {
+        if (!parseJson(document))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        std::string line;
+        bool firstLine = true;
+        while (std::getline(content, line))
+        {
+            // A leading "time,command,..." line is a CSV header.
+            const auto text = trim(line);
+            const auto isHeader = firstLine && text.compare(0, 4, "time") == 0;
+            firstLine = false;
+            if (text.empty() || text[0] == '#' || isHeader)
+            {
+                continue;
+            }
+            if (!addCue(text))
+            {
+                return false;
+            }
+        }
+    }
+
+    Logger::log("[%s] Loaded %zu cues from %s", channel_.c_str(), unresolved_.size() - loaded, fileName.c_str());
+    return true;
+}
+
+bool CueScheduler::parseJson(const std::string& document)
+{
+    size_t position = 0;
+    while ((position = document.find('{', position)) != std::string::npos)
+    {
+        const auto end = document.find('}', position);
+        if (end == std::string::npos)
+        {
+            return false;
+        }
+        const auto object = document.substr(position, end + 1 - position);
+        position = end + 1;
+
+        Cue cue;
+        cue.request.type = SpliceType::OUT;
+        std::string value;
+        bool valid = true;
+        if (utils::jsonValue(object, "pts", value))
+        {
+            valid = parseTime("pts:" + value, cue);
+        }
+        else if (utils::jsonValue(object, "time", value) || utils::jsonValue(object, "offset", value))
+        {
+            valid = parseTime(value, cue);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        valid = valid && (!utils::jsonValue(object, "command", value) || parseCommand(value, cue.request));
+        valid = valid && (!utils::jsonValue(object, "duration", value) || parseDuration(value, cue.request));
+        valid = valid && (!utils::jsonValue(object, "event_id", value) || parseEventId(value, cue.request));
+        valid = valid && SpliceFactory::readSegmentation(object, cue.request);
+        if (!valid)
+        {
+            Logger::error("[%s] Invalid cue %s", channel_.c_str(), object.c_str());
+            return false;
+        }
+
+        cue.request.immediate = cue.request.command == SpliceCommand::SPLICE_INSERT &&
+            cue.request.type == SpliceType::OUT &&
+            (utils::jsonValue(object, "immediate", value) ? value == "true" : immediate_);
+        unresolved_.push_back(cue);
+    }
+    return true;
+}
+
+void CueScheduler::onVideoClock(const VideoClock& videoClock)
+{
+    uint64_t pts = 0;
+    uint64_t firstPts = 0;
+    if (!videoClock.currentPts(pts) || !videoClock.firstPts(firstPts))
+    {
+        return;
+    }
+
+    const auto firstCall = lastPts_ == 0;
+    const auto now = utils::ts::unwrapPts(lastPts_, pts);
+    if (!firstCall)
+    {
+        const auto step = static_cast<int64_t>(now - lastPts_);
+        if (step > maxPtsStep || step < -maxPtsStep)
+        {
+            rebase(step, now);
+        }
+    }
+    lastPts_ = now;
+
+    if (firstCall)
+    {
+        // The wheel is empty until now, so this only moves it to the stream position.
+        wheel_.advance(now / tickSize, [](uint64_t, PendingCue&&) {});
+
+        if (restore(now))
+        {
+            unresolved_.clear();
+        }
+        else if (spliceInterval_.count() != 0)
+        {
+            PendingCue out;
+            out.request.type = SpliceType::OUT;
+            out.request.immediate = immediate_;
+            out.firePts = now + static_cast<uint64_t>(spliceInterval_.count()) * utils::ts::ptsClockRate;
+            out.interval = true;
+            schedule(std::move(out));
+        }
+    }
+
+    if (!unresolved_.empty())
+    {
+        resolve(now, utils::ts::unwrapPts(now, firstPts));
+    }
+
+    if (state_)
+    {
+        state_->storePts(pts);
+        if (firstCall)
+        {
+            state_->storeScheduleHash(scheduleHash_);
+        }
+    }
+
+    wheel_.advance(now / tickSize, [this, now](uint64_t, PendingCue&& pendingCue) {
+        onFire(std::move(pendingCue), now);
+    });
+}
+
+void CueScheduler::resolve(const uint64_t now, const uint64_t firstPts)
+{
+    const auto wallClockNow = std::chrono::system_clock::now();
+    for (const auto& cue : unresolved_)
+    {
+        PendingCue pendingCue;
+        pendingCue.request = cue.request;
+
+        switch (cue.timeBase)
+        {
+        case TimeBase::OFFSET:
+            pendingCue.splicePts = firstPts + cue.ticks;
+            break;
+        case TimeBase::PTS:
+            pendingCue.splicePts = utils::ts::unwrapPts(now, cue.ticks);
+            pendingCue.streamPts = true;
+            break;
+        case TimeBase::WALL_CLOCK:
+        {
+            const auto ahead = std::chrono::duration_cast<std::chrono::microseconds>(cue.wallClock - wallClockNow);
+            const auto ticks = ahead.count() * static_cast<int64_t>(utils::ts::ptsClockRate) / 1000000;
+            pendingCue.splicePts = static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(now) + ticks, 1));
+            break;
+        }
+        }
+
+        const auto lead = pendingCue.request.immediate ? 0 : preroll_;
+        pendingCue.firePts = pendingCue.splicePts > lead ? pendingCue.splicePts - lead : 0;
+        schedule(std::move(pendingCue));
+    }
+    unresolved_.clear();
+}
+
+bool CueScheduler::restore(const uint64_t now)
+{
+    if (!state_)
+    {
+        return false;
+    }
+
+    // Cues without a stored hash are from a run that stopped before its schedule was complete.
+    const auto storedHash = state_->scheduleHash();
+    const auto cues = state_->cues();
+    state_->clearCues();
+    if (storedHash == 0)
+    {
+        return false;
+    }
+    if (storedHash != scheduleHash_)
+    {
+        Logger::log("[%s] Cue configuration changed, dropping %zu stored cues", channel_.c_str(), cues.size());
+        return false;
+    }
+
+    const auto storedPts = utils::ts::unwrapPts(now, state_->lastPts());
+    const auto gap = storedPts > now ? storedPts - now : now - storedPts;
+    if (gap > maxRestoreGap)
+    {
+        Logger::warning("[%s] Stream position moved %llu s since the state was stored, dropping %zu stored cues",
+            channel_.c_str(),
+            static_cast<unsigned long long>(gap / utils::ts::ptsClockRate),
+            cues.size());
+        return false;
+    }
+
+    for (const auto& cue : cues)
+    {
+        PendingCue pendingCue;
+        pendingCue.request.command = static_cast<SpliceCommand>(cue.command);
+        pendingCue.request.type = static_cast<SpliceType>(cue.type);
+        pendingCue.request.immediate = (cue.flags & ChannelState::Cue::immediate) != 0;
+        pendingCue.request.duration = std::chrono::seconds(cue.duration);
+        if ((cue.flags & ChannelState::Cue::hasEventId) != 0)
+        {
+            pendingCue.request.eventId = cue.eventId;
+        }
+        if ((cue.flags & ChannelState::Cue::hasSegmentation) != 0)
+        {
+            pendingCue.request.segmentation = cue.segmentation;
+        }
+        if ((cue.flags & ChannelState::Cue::hasSplicePts) != 0)
+        {
+            pendingCue.splicePts = utils::ts::unwrapPts(now, cue.splicePts);
+        }
+        pendingCue.firePts = utils::ts::unwrapPts(now, cue.firePts);
+        pendingCue.interval = (cue.flags & ChannelState::Cue::interval) != 0;
+        pendingCue.streamPts = (cue.flags & ChannelState::Cue::streamPts) != 0;
+        schedule(std::move(pendingCue));
+    }
+
+    Logger::log("[%s] Restored %zu pending cues", channel_.c_str(), cues.size());
+    return true;
+}
+
+void CueScheduler::rebase(const int64_t step, const uint64_t now)
+{
+    Logger::warning("[%s] Video PTS jumped %lld ms, moving %zu pending cues with it",
+        channel_.c_str(),
+        static_cast<long long>(step * 1000 / static_cast<int64_t>(utils::ts::ptsClockRate)),
+        wheel_.size());
+
+    std::vector<PendingCue> pendingCues;
+    pendingCues.reserve(wheel_.size());
+    wheel_.reset(now / tickSize, [&pendingCues](uint64_t, PendingCue&& pendingCue) {
+        pendingCues.push_back(std::move(pendingCue));
+    });
+
+    const auto move = [step](const uint64_t pts) -> uint64_t {
+        return pts == 0 ? 0 : static_cast<uint64_t>(std::max<int64_t>(static_cast<int64_t>(pts) + step, 1));
+    };
+    for (auto& pendingCue : pendingCues)
+    {
+        if (state_)
+        {
+            state_->clearCue(pendingCue.stateSlot);
+        }
+        if (!pendingCue.streamPts)
+        {
+            pendingCue.splicePts = move(pendingCue.splicePts);
+            pendingCue.firePts = move(pendingCue.firePts);
+        }
+        schedule(std::move(pendingCue));
+    }
+}
+
+void CueScheduler::schedule(PendingCue pendingCue)
+{
+    if (state_)
+    {
+        ChannelState::Cue cue = {};
+        cue.flags = static_cast<uint8_t>((pendingCue.request.immediate ? ChannelState::Cue::immediate : 0) |
+            (pendingCue.interval ? ChannelState::Cue::interval : 0) |
+            (pendingCue.streamPts ? ChannelState::Cue::streamPts : 0) |
+            (pendingCue.splicePts != 0 ? ChannelState::Cue::hasSplicePts : 0) |
+            (pendingCue.request.eventId ? ChannelState::Cue::hasEventId : 0) |
+            (pendingCue.request.segmentation ? ChannelState::Cue::hasSegmentation : 0));
+        cue.command = static_cast<uint8_t>(pendingCue.request.command);
+        cue.type = static_cast<uint8_t>(pendingCue.request.type);
+        cue.eventId = pendingCue.request.eventId.value_or(0);
+        cue.duration = static_cast<uint32_t>(pendingCue.request.duration.count());
+        cue.splicePts = pendingCue.splicePts % utils::ts::ptsModulo;
+        cue.firePts = pendingCue.firePts % utils::ts::ptsModulo;
+        if (pendingCue.request.segmentation)
+        {
+            cue.segmentation = *pendingCue.request.segmentation;
+        }
+
+        pendingCue.stateSlot = state_->storeCue(cue);
+        if (pendingCue.stateSlot == ChannelState::maxCues && !loggedStateFull_)
+        {
+            Logger::warning("[%s] State file holds %zu cues, later cues are not stored",
+                channel_.c_str(),
+                ChannelState::maxCues);
+            loggedStateFull_ = true;
+        }
+    }
+
+    // Rounded up, so that a cue never fires before its scheduled position.
+    const auto expiry = (pendingCue.firePts + tickSize - 1) / tickSize;
+    wheel_.insert(expiry, std::move(pendingCue));
+}
+
+void CueScheduler::onFire(PendingCue pendingCue, const uint64_t now)
+{
+    if (state_)
+    {
+        state_->clearCue(pendingCue.stateSlot);
+    }
+
+    if (pendingCue.interval)
+    {
+        // The cadence of the former wall clock timers: in after the duration, the next out after the interval. A
+        // late cue delays the ones after it, missed intervals are dropped instead of fired in a burst.
+        PendingCue next;
+        next.interval = true;
+        auto delay = spliceInterval_;
+        if (pendingCue.request.type == SpliceType::OUT && !autoReturn_)
+        {
+            next.request.type = SpliceType::IN;
+            delay = spliceDuration_;
+        }
+        else
+        {
+            next.request.type = SpliceType::OUT;
+            next.request.immediate = immediate_;
+            delay += pendingCue.request.type == SpliceType::OUT ? spliceDuration_ : std::chrono::seconds(0);
+        }
+        const auto delayTicks = static_cast<uint64_t>(delay.count()) * utils::ts::ptsClockRate;
+        next.firePts = std::max(pendingCue.firePts, now) + delayTicks;
+        schedule(std::move(next));
+    }
+
+    const auto errorTicks = now > pendingCue.firePts ? now - pendingCue.firePts : 0;
+    fireError_.observe(std::chrono::microseconds(errorTicks * 1000000 / utils::ts::ptsClockRate));
+
+    if (pendingCue.splicePts != 0 && pendingCue.splicePts <= now)
+    {
+        Logger::warning("[%s] Cue %s at pts %llu has already passed, skipping it",
+            channel_.c_str(),
+            commandName(pendingCue.request),
+            static_cast<unsigned long long>(pendingCue.splicePts % utils::ts::ptsModulo));
+        return;
+    }
+
+    Logger::log("[%s] Cue %s fired at pts %llu, %.1f ms after its scheduled pts %llu",
+        channel_.c_str(),
+        commandName(pendingCue.request),
+        static_cast<unsigned long long>(now % utils::ts::ptsModulo),
+        static_cast<double>(errorTicks) * 1000.0 / utils::ts::ptsClockRate,
+        static_cast<unsigned long long>(pendingCue.firePts % utils::ts::ptsModulo));
+
+    auto request = pendingCue.request;
+    if (pendingCue.splicePts != 0)
+    {
+        request.spliceTime = pendingCue.splicePts % utils::ts::ptsModulo;
+    }
+    request.triggerTime = std::chrono::steady_clock::now();
+    fire_(request);
+}
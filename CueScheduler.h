@@ -0,0 +1,129 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "ChannelState.h"
+#include "Metrics.h"
+#include "SpliceFactory.h"
+#include "VideoClock.h"
+#include "utils/TimerWheel.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Fires the cues of a channel at stream positions. Cues come from a schedule (offsets from the first video PTS,
+ * absolute PTS or UTC wall clock times) and from the splice interval, and wait in a timer wheel keyed to the video
+ * PTS, so thousands of pending cues cost O(1) per insert and per fired cue. A cue fires one preroll ahead of its
+ * splice time; interval cues follow the same out/in cadence as before, measured in stream time. A PTS jump of more
+ * than a few seconds is a discontinuity, not elapsed time: the pending cues move with it, except those scheduled at
+ * an absolute PTS.
+ *
+ * With a state file the pending cues are stored as they are scheduled and fired. A restart with the same cue
+ * configuration continues from the stored cues instead of resolving the schedule again, unless the stream position
+ * moved too far meanwhile.
+ *
+ * The cues must be loaded before the first onVideoClock call, which must always come from the same thread.
+ */
+class CueScheduler
+{
+public:
+    using FireFunction = std::function<void(const SpliceRequest& request)>;
+
+    CueScheduler(const std::string& channel, const std::chrono::seconds preroll, FireFunction fire);
+
+    /**
+     * Persists the pending cues to state, which must outlive the scheduler. Must be called before load.
+     */
+    void setState(ChannelState* state) { state_ = state; }
+
+    /**
+     * Adds the interval cadence, the --cue entries and the cue schedule file of config.
+     * @return False if a cue or the schedule file is invalid.
+     */
+    bool load(const ChannelConfig& config);
+
+    /**
+     * @param text <offset s>[:out|in|signal][:<duration s>], or one CSV schedule line.
+     */
+    bool addCue(const std::string& text);
+
+    /**
+     * Loads a CSV file with one "<time>,<out|in|signal>[,<duration s>[,<event id>]]" per line, or a JSON array of
+     * objects with time, command, duration, event_id and segmentation_descriptor fields. Times are "+<seconds>" from
+     * the first video PTS, "pts:<90 kHz ticks>" or "YYYY-MM-DDTHH:MM:SS[.fff]Z".
+     */
+    bool loadSchedule(const std::string& fileName);
+
+    /**
+     * Advances to the current video position and fires the cues that are due.
+     */
+    void onVideoClock(const VideoClock& videoClock);
+
+    /**
+     * @return Cues not fired yet, the next interval cue included.
+     */
+    size_t pending() const { return unresolved_.size() + wheel_.size(); }
+
+private:
+    enum class TimeBase
+    {
+        OFFSET,
+        PTS,
+        WALL_CLOCK
+    };
+
+    struct Cue
+    {
+        TimeBase timeBase = TimeBase::OFFSET;
+        // 90 kHz offset from the first video PTS, or a 33-bit PTS.
+        uint64_t ticks = 0;
+        std::chrono::system_clock::time_point wallClock;
+        SpliceRequest request;
+    };
+
+    struct PendingCue
+    {
+        SpliceRequest request;
+        // Unwrapped PTS, 0 for interval cues whose splice time the engine chooses.
+        uint64_t splicePts = 0;
+        uint64_t firePts = 0;
+        bool interval = false;
+        // Scheduled at an absolute PTS, which a discontinuity does not move.
+        bool streamPts = false;
+        size_t stateSlot = ChannelState::maxCues;
+    };
+
+    // Wheel resolution in 90 kHz ticks.
+    static const uint64_t tickSize = 900;
+    // Stored cues are dropped if the stream position moved further than this while the channel was down.
+    static const uint64_t maxRestoreGap = 600 * utils::ts::ptsClockRate;
+    // A larger step between two video clock updates is a discontinuity.
+    static const int64_t maxPtsStep = 5 * utils::ts::ptsClockRate;
+
+    std::string channel_;
+    uint64_t preroll_;
+    FireFunction fire_;
+    std::chrono::seconds spliceInterval_;
+    std::chrono::seconds spliceDuration_;
+    bool immediate_;
+    bool autoReturn_;
+    std::vector<Cue> unresolved_;
+    utils::TimerWheel<PendingCue> wheel_;
+    uint64_t lastPts_;
+    metrics::Histogram& fireError_;
+    ChannelState* state_;
+    // FNV-1a of the cue configuration, a stored schedule is only restored for the same configuration.
+    uint64_t scheduleHash_;
+    bool loggedStateFull_;
+
+    bool parseTime(const std::string& text, Cue& cue) const;
+    bool parseLine(const std::string& text, Cue& cue) const;
+    bool parseJson(const std::string& document);
+    void resolve(const uint64_t now, const uint64_t firstPts);
+    bool restore(const uint64_t now);
+    void rebase(const int64_t step, const uint64_t now);
+    void schedule(PendingCue pendingCue);
+    void onFire(PendingCue pendingCue, const uint64_t now);
+};
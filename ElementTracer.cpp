@@ -0,0 +1,564 @@
+#include "ElementTracer.h"
+#include "Logger.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+
+struct ElementTracer::Span
+{
+    uint64_t startNs;
+    uint32_t totalNs;
+    // totalNs without the traced pushes the element made downstream.
+    uint32_t selfNs;
+    uint64_t pts;
+    // Element that pushed the buffer, nullptr if it is not traced.
+    const Element* from;
+    uint32_t bytes;
+    pid_t threadId;
+    // Index into Element::pads.
+    uint16_t pad;
+};
+
+struct ElementTracer::Element
+{
+    ElementTracer* tracer;
+    std::string name;
+    std::string factory;
+    std::mutex mutex;
+    // A deque, growing it never copies the spans under the lock of a streaming thread.
+    std::deque<Span> spans;
+    std::vector<std::pair<const GstPad*, std::string>> pads;
+    // Streaming threads that pushed into the element and their names.
+    std::vector<std::pair<pid_t, std::string>> threads;
+};
+
+/**
+ * Time a sampled buffer took from entering an element to leaving it.
+ */
+struct ElementTracer::Latency
+{
+    const Element* element;
+    const Span* enter;
+    const Span* leave;
+};
+
+namespace
+{
+
+const uint32_t maxDepth = 32;
+
+/**
+ * A push into a traced element that has not returned yet.
+ */
+struct Frame
+{
+    ElementTracer::Element* element;
+    const ElementTracer::Element* from;
+    const GstPad* pad;
+    GstClockTime start;
+    // Time spent in the pushes nested in this one.
+    GstClockTime children;
+    uint64_t pts;
+    uint32_t bytes;
+};
+
+struct ThreadState
+{
+    std::array<Frame, maxDepth> frames;
+    uint32_t depth = 0;
+    // Pushes nested in an unsampled one, they are only counted to find where it returns.
+    uint32_t skipped = 0;
+    // Sampling counter of buffers without a PTS.
+    uint32_t unstampedBuffers = 0;
+    pid_t threadId = 0;
+};
+
+thread_local ThreadState threadState;
+
+/**
+ * Tracer the hooks are registered for, it has no state of its own.
+ */
+struct HookTracer
+{
+    GstTracer parent;
+};
+
+struct HookTracerClass
+{
+    GstTracerClass parentClass;
+};
+
+G_DEFINE_TYPE(HookTracer, hook_tracer, GST_TYPE_TRACER)
+
+void hook_tracer_class_init(HookTracerClass* /*tracerClass*/) {}
+
+void hook_tracer_init(HookTracer* /*tracer*/) {}
+
+GQuark elementQuark()
+{
+    static const auto quark = g_quark_from_static_string("scte35-element-tracer");
+    return quark;
+}
+
+ElementTracer::Element* tracedElement(GstObject* object)
+{
+    return object ? static_cast<ElementTracer::Element*>(g_object_get_qdata(G_OBJECT(object), elementQuark()))
+                  : nullptr;
+}
+
+bool isSampled(GstBuffer* buffer, const uint32_t sampleInterval, ThreadState& state)
+{
+    if (GST_BUFFER_PTS_IS_VALID(buffer))
+    {
+        // Fibonacci hashing spreads the regular steps of the PTS over the interval.
+        return ((GST_BUFFER_PTS(buffer) * 0x9e3779b97f4a7c15ULL) >> 32) % sampleInterval == 0;
+    }
+    return ++state.unstampedBuffers % sampleInterval == 0;
+}
+
+uint32_t clampNs(const uint64_t ns)
+{
+    return static_cast<uint32_t>(std::min<uint64_t>(ns, UINT32_MAX));
+}
+
+std::string jsonString(const std::string& text)
+{
+    std::string result("\"");
+    for (const auto character : text)
+    {
+        if (character == '"' || character == '\\')
+        {
+            result.push_back('\\');
+            result.push_back(character);
+        }
+        else if (static_cast<unsigned char>(character) < 0x20)
+        {
+            std::array<char, 8> escaped{};
+            snprintf(escaped.data(), escaped.size(), "\\u%04x", static_cast<uint32_t>(character));
+            result.append(escaped.data());
+        }
+        else
+        {
+            result.push_back(character);
+        }
+    }
+    result.push_back('"');
+    return result;
+}
+
+template<typename T>
+double percentile(const std::vector<T>& sorted, const double q)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    return static_cast<double>(sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * sorted.size()))]);
+}
+
+} // namespace
+
+ElementTracer::ElementTracer(const std::string& channel, const std::string& fileName, const uint32_t sampleInterval)
+    : channel_(channel),
+      fileName_(fileName),
+      sampleInterval_(std::max(sampleInterval, 1U)),
+      spans_(0),
+      droppedSpans_(0),
+      finished_(false)
+{
+    installHooks();
+    Logger::log("[%s] Tracing 1 in %u buffers to %s", channel_.c_str(), sampleInterval_, fileName_.c_str());
+}
+
+ElementTracer::~ElementTracer()
+{
+    finish();
+}
+
+void ElementTracer::addElement(GstElement* element)
+{
+    auto traced = std::make_unique<Element>();
+    traced->tracer = this;
+    traced->name = GST_OBJECT_NAME(element);
+    auto factory = gst_element_get_factory(element);
+    traced->factory = factory ? GST_OBJECT_NAME(factory) : "";
+
+    g_object_set_qdata(G_OBJECT(element), elementQuark(), traced.get());
+    elements_.push_back(std::move(traced));
+}
+
+void ElementTracer::finish()
+{
+    if (finished_)
+    {
+        return;
+    }
+    finished_ = true;
+
+    uint64_t originNs = UINT64_MAX;
+    uint64_t endNs = 0;
+    // Buffers leaving each element, matched by PTS against the buffers that entered it.
+    std::map<const Element*, std::vector<const Span*>> leaving;
+    for (const auto& element : elements_)
+    {
+        for (const auto& span : element->spans)
+        {
+            originNs = std::min(originNs, span.startNs);
+            endNs = std::max(endNs, span.startNs + span.totalNs);
+            if (span.from && span.pts != GST_CLOCK_TIME_NONE)
+            {
+                leaving[span.from].push_back(&span);
+            }
+        }
+    }
+    if (endNs == 0)
+    {
+        Logger::warning("[%s] No buffers traced, no trace written", channel_.c_str());
+        return;
+    }
+
+    std::vector<Latency> latencies;
+    for (const auto& element : elements_)
+    {
+        const auto left = leaving.find(element.get());
+        if (left == leaving.end())
+        {
+            continue;
+        }
+
+        std::unordered_map<uint64_t, const Span*> entered;
+        for (const auto& span : element->spans)
+        {
+            if (span.pts != GST_CLOCK_TIME_NONE)
+            {
+                entered.emplace(span.pts, &span);
+            }
+        }
+        for (const auto span : left->second)
+        {
+            const auto enter = entered.find(span->pts);
+            if (enter != entered.end() && enter->second->startNs <= span->startNs)
+            {
+                latencies.push_back({element.get(), enter->second, span});
+                entered.erase(enter);
+            }
+        }
+    }
+
+    if (writeTrace(latencies, originNs))
+    {
+        Logger::log("[%s] Trace of %llu buffer pushes over %.1f s written to %s",
+            channel_.c_str(),
+            static_cast<unsigned long long>(std::min(spans_.load(), maxSpans)),
+            static_cast<double>(endNs - originNs) / 1e9,
+            fileName_.c_str());
+    }
+    if (droppedSpans_ != 0)
+    {
+        Logger::warning("[%s] Trace full, the last %llu buffer pushes were not traced",
+            channel_.c_str(),
+            static_cast<unsigned long long>(droppedSpans_.load()));
+    }
+    logSummary(latencies, originNs, endNs);
+}
+
+bool ElementTracer::writeTrace(const std::vector<Latency>& latencies, const uint64_t originNs) const
+{
+    auto file = fopen(fileName_.c_str(), "w");
+    if (!file)
+    {
+        Logger::error("[%s] Unable to open trace file %s: %s", channel_.c_str(), fileName_.c_str(), strerror(errno));
+        return false;
+    }
+
+    const auto microseconds = [originNs](const uint64_t ns) { return static_cast<double>(ns - originNs) / 1000.0; };
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file,
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":%s}}",
+        jsonString(channel_).c_str());
+
+    std::map<pid_t, std::string> threads;
+    for (const auto& element : elements_)
+    {
+        threads.insert(element->threads.begin(), element->threads.end());
+    }
+    for (const auto& thread : threads)
+    {
+        fprintf(file,
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":%s}}",
+            static_cast<int32_t>(thread.first),
+            jsonString(thread.second).c_str());
+    }
+
+    // Spans nest on their thread by time, total is the duration and self the element's own processing.
+    for (const auto& element : elements_)
+    {
+        const auto name = jsonString(element->name);
+        const auto factory = jsonString(element->factory);
+        for (const auto& span : element->spans)
+        {
+            fprintf(file,
+                ",\n{\"name\":%s,\"cat\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"pad\":%s,\"from\":%s,\"bytes\":%u,\"self_us\":%.3f",
+                name.c_str(),
+                factory.c_str(),
+                static_cast<int32_t>(span.threadId),
+                microseconds(span.startNs),
+                static_cast<double>(span.totalNs) / 1000.0,
+                jsonString(element->pads[span.pad].second).c_str(),
+                jsonString(span.from ? span.from->name : "").c_str(),
+                span.bytes,
+                static_cast<double>(span.selfNs) / 1000.0);
+            if (span.pts != GST_CLOCK_TIME_NONE)
+            {
+                fprintf(file, ",\"pts_ns\":%llu", static_cast<unsigned long long>(span.pts));
+            }
+            fprintf(file, "}}");
+        }
+    }
+
+    // Flow arrows from a buffer entering an element to the same buffer leaving it, across queue threads.
+    for (size_t i = 0; i < latencies.size(); ++i)
+    {
+        const auto& latency = latencies[i];
+        fprintf(file,
+            ",\n{\"name\":%s,\"cat\":\"latency\",\"ph\":\"s\",\"id\":%zu,\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+            jsonString(latency.element->name).c_str(),
+            i,
+            static_cast<int32_t>(latency.enter->threadId),
+            microseconds(latency.enter->startNs));
+        fprintf(file,
+            ",\n{\"name\":%s,\"cat\":\"latency\",\"ph\":\"f\",\"bp\":\"e\",\"id\":%zu,\"pid\":1,\"tid\":%d,"
+            "\"ts\":%.3f}",
+            jsonString(latency.element->name).c_str(),
+            i,
+            static_cast<int32_t>(latency.leave->threadId),
+            microseconds(latency.leave->startNs));
+    }
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0)
+    {
+        Logger::error("[%s] Unable to write trace file %s: %s", channel_.c_str(), fileName_.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void ElementTracer::logSummary(const std::vector<Latency>& latencies, const uint64_t originNs, const uint64_t endNs)
+    const
+{
+    // Sampled time scaled by the sample interval, in percent of the traced time of one thread.
+    const auto busyPercent = [this, originNs, endNs](const uint64_t sampledNs) {
+        return static_cast<double>(sampledNs) * sampleInterval_ * 100.0 / static_cast<double>(endNs - originNs);
+    };
+
+    std::map<const Element*, std::vector<uint64_t>> elementLatencies;
+    for (const auto& latency : latencies)
+    {
+        elementLatencies[latency.element].push_back(latency.leave->startNs - latency.enter->startNs);
+    }
+
+    Logger::log("[%s] %-20s %-16s %8s %9s %9s %9s %9s %7s %14s %14s",
+        channel_.c_str(),
+        "element",
+        "factory",
+        "buffers",
+        "p50 us",
+        "p90 us",
+        "p99 us",
+        "max us",
+        "busy %",
+        "latency p50 ms",
+        "latency p99 ms");
+
+    std::map<pid_t, std::pair<std::string, uint64_t>> threads;
+    for (const auto& element : elements_)
+    {
+        if (element->spans.empty())
+        {
+            continue;
+        }
+
+        std::vector<uint32_t> selfNs;
+        selfNs.reserve(element->spans.size());
+        uint64_t totalSelfNs = 0;
+        for (const auto& span : element->spans)
+        {
+            selfNs.push_back(span.selfNs);
+            totalSelfNs += span.selfNs;
+            threads[span.threadId].second += span.selfNs;
+        }
+        for (const auto& thread : element->threads)
+        {
+            threads[thread.first].first = thread.second;
+        }
+        std::sort(selfNs.begin(), selfNs.end());
+
+        std::array<char, 16> latencyP50{"-"};
+        std::array<char, 16> latencyP99{"-"};
+        auto latency = elementLatencies.find(element.get());
+        if (latency != elementLatencies.end())
+        {
+            std::sort(latency->second.begin(), latency->second.end());
+            snprintf(latencyP50.data(), latencyP50.size(), "%.3f", percentile(latency->second, 0.5) / 1e6);
+            snprintf(latencyP99.data(), latencyP99.size(), "%.3f", percentile(latency->second, 0.99) / 1e6);
+        }
+
+        Logger::log("[%s] %-20s %-16s %8zu %9.1f %9.1f %9.1f %9.1f %7.2f %14s %14s",
+            channel_.c_str(),
+            element->name.c_str(),
+            element->factory.c_str(),
+            selfNs.size(),
+            percentile(selfNs, 0.5) / 1000.0,
+            percentile(selfNs, 0.9) / 1000.0,
+            percentile(selfNs, 0.99) / 1000.0,
+            static_cast<double>(selfNs.back()) / 1000.0,
+            busyPercent(totalSelfNs),
+            latencyP50.data(),
+            latencyP99.data());
+    }
+
+    for (const auto& thread : threads)
+    {
+        Logger::log("[%s] Streaming thread %d %s: %.2f %% busy in traced elements",
+            channel_.c_str(),
+            static_cast<int32_t>(thread.first),
+            thread.second.first.c_str(),
+            busyPercent(thread.second.second));
+    }
+}
+
+void ElementTracer::installHooks()
+{
+    // gstreamer cannot remove tracer hooks, they stay installed for the process and skip untraced elements.
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+        auto tracer = GST_TRACER(g_object_new(hook_tracer_get_type(), nullptr));
+        gst_object_ref_sink(tracer);
+        gst_tracing_register_hook(tracer, "pad-push-pre", G_CALLBACK(onPushPre));
+        gst_tracing_register_hook(tracer, "pad-push-list-pre", G_CALLBACK(onPushListPre));
+        gst_tracing_register_hook(tracer, "pad-push-post", G_CALLBACK(onPushPost));
+        gst_tracing_register_hook(tracer, "pad-push-list-post", G_CALLBACK(onPushPost));
+        gst_object_unref(tracer);
+    });
+}
+
+void ElementTracer::onPushPre(GObject* /*tracer*/, GstClockTime timestamp, GstPad* pad, GstBuffer* buffer)
+{
+    enter(timestamp, pad, buffer, nullptr);
+}
+
+void ElementTracer::onPushListPre(GObject* /*tracer*/,
+    GstClockTime timestamp,
+    GstPad* pad,
+    GstBufferList* bufferList)
+{
+    enter(timestamp, pad, gst_buffer_list_length(bufferList) != 0 ? gst_buffer_list_get(bufferList, 0) : nullptr,
+        bufferList);
+}
+
+void ElementTracer::enter(GstClockTime timestamp, GstPad* pad, GstBuffer* buffer, GstBufferList* bufferList)
+{
+    auto& state = threadState;
+    if (state.skipped != 0 || state.depth == maxDepth)
+    {
+        ++state.skipped;
+        return;
+    }
+
+    // The peer cannot change while the push is in progress, so it is read without the object lock.
+    const auto peer = GST_PAD_PEER(pad);
+    auto element = peer ? tracedElement(GST_OBJECT_PARENT(peer)) : nullptr;
+    if (state.depth == 0 && (!element || !buffer || !isSampled(buffer, element->tracer->sampleInterval_, state)))
+    {
+        state.skipped = 1;
+        return;
+    }
+
+    auto& frame = state.frames[state.depth++];
+    frame.element = element;
+    frame.from = tracedElement(GST_OBJECT_PARENT(pad));
+    frame.pad = peer;
+    frame.start = timestamp;
+    frame.children = 0;
+    frame.pts = buffer ? GST_BUFFER_PTS(buffer) : GST_CLOCK_TIME_NONE;
+    frame.bytes = static_cast<uint32_t>(
+        bufferList ? gst_buffer_list_calculate_size(bufferList) : (buffer ? gst_buffer_get_size(buffer) : 0));
+}
+
+void ElementTracer::onPushPost(GObject* /*tracer*/, GstClockTime timestamp, GstPad* /*pad*/, GstFlowReturn /*result*/)
+{
+    auto& state = threadState;
+    if (state.skipped != 0)
+    {
+        --state.skipped;
+        return;
+    }
+    if (state.depth == 0)
+    {
+        // The push started before the hooks were installed.
+        return;
+    }
+
+    const auto& frame = state.frames[--state.depth];
+    const auto totalNs = timestamp - frame.start;
+    if (state.depth != 0)
+    {
+        state.frames[state.depth - 1].children += totalNs;
+    }
+
+    auto element = frame.element;
+    if (!element)
+    {
+        return;
+    }
+    auto tracer = element->tracer;
+    if (tracer->spans_.fetch_add(1, std::memory_order_relaxed) >= maxSpans)
+    {
+        tracer->droppedSpans_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (state.threadId == 0)
+    {
+        state.threadId = static_cast<pid_t>(syscall(SYS_gettid));
+    }
+
+    std::lock_guard<std::mutex> lock(element->mutex);
+    auto pad = std::find_if(element->pads.begin(),
+        element->pads.end(),
+        [&frame](const std::pair<const GstPad*, std::string>& known) { return known.first == frame.pad; });
+    if (pad == element->pads.end())
+    {
+        element->pads.emplace_back(frame.pad, GST_OBJECT_NAME(frame.pad));
+        pad = element->pads.end() - 1;
+    }
+    if (std::none_of(element->threads.begin(),
+            element->threads.end(),
+            [&state](const std::pair<pid_t, std::string>& known) { return known.first == state.threadId; }))
+    {
+        std::array<char, 16> threadName{};
+        pthread_getname_np(pthread_self(), threadName.data(), threadName.size());
+        element->threads.emplace_back(state.threadId, threadName.data());
+    }
+
+    element->spans.push_back({frame.start,
+        clampNs(totalNs),
+        clampNs(totalNs - std::min(frame.children, totalNs)),
+        frame.pts,
+        frame.from,
+        frame.bytes,
+        state.threadId,
+        static_cast<uint16_t>(pad - element->pads.begin())});
+}
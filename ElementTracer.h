@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <gst/gst.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Samples the buffers pushed between the elements of one pipeline through the gstreamer tracer hooks, pad-push-pre
+ * and pad-push-post. Every push into a traced element becomes a span on the streaming thread that made it; the pushes
+ * the element makes downstream nest in it and are subtracted, which leaves the processing time of the element itself.
+ *
+ * Buffers are sampled by a hash of their PTS, so a sampled buffer is traced on every thread it crosses and the time
+ * it spends in a queue is the difference between entering the queue and leaving it. Unsampled pushes only cost the
+ * hook calls. finish writes the spans as a Chrome trace, loadable in Perfetto or chrome://tracing, and logs the
+ * percentiles of every element.
+ */
+class ElementTracer
+{
+public:
+    struct Element;
+
+    /**
+     * @param sampleInterval Traces 1 in sampleInterval buffers.
+     */
+    ElementTracer(const std::string& channel, const std::string& fileName, const uint32_t sampleInterval);
+    ~ElementTracer();
+
+    ElementTracer(const ElementTracer&) = delete;
+    ElementTracer& operator=(const ElementTracer&) = delete;
+
+    /**
+     * Traces the pushes into element from now on. The element must be destroyed before the tracer.
+     */
+    void addElement(GstElement* element);
+
+    /**
+     * Stops tracing, writes the trace file and logs the summary. The pipeline must no longer be streaming.
+     */
+    void finish();
+
+private:
+    struct Span;
+    struct Latency;
+
+    // Spans kept per tracer, about 50 MB.
+    static constexpr uint64_t maxSpans = 1000000;
+
+    std::string channel_;
+    std::string fileName_;
+    uint32_t sampleInterval_;
+    std::vector<std::unique_ptr<Element>> elements_;
+    std::atomic<uint64_t> spans_;
+    std::atomic<uint64_t> droppedSpans_;
+    bool finished_;
+
+    bool writeTrace(const std::vector<Latency>& latencies, const uint64_t originNs) const;
+    void logSummary(const std::vector<Latency>& latencies, const uint64_t originNs, const uint64_t endNs) const;
+
+    static void installHooks();
+    static void onPushPre(GObject* /*tracer*/, GstClockTime timestamp, GstPad* pad, GstBuffer* buffer);
+    static void onPushListPre(GObject* /*tracer*/, GstClockTime timestamp, GstPad* pad, GstBufferList* bufferList);
+    static void onPushPost(GObject* /*tracer*/, GstClockTime timestamp, GstPad* /*pad*/, GstFlowReturn /*result*/);
+    static void enter(GstClockTime timestamp, GstPad* pad, GstBuffer* buffer, GstBufferList* bufferList);
+};
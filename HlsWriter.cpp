@@ -0,0 +1,531 @@
+#include "HlsWriter.h"
+#include "Logger.h"
+#include "SpliceInfoSection.h"
+#include "utils/Crc32.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+const char* playlistName = "index.m3u8";
+// An in cue of the stream this close to the end of an out cue's duration replaces the implicit in point.
+const int64_t implicitInTolerance = utils::ts::ptsClockRate;
+
+double seconds(const int64_t ticks)
+{
+    return static_cast<double>(ticks) / utils::ts::ptsClockRate;
+}
+
+bool isBreakStart(const uint8_t typeId)
+{
+    // Break, provider and distributor advertisement, provider and distributor placement opportunity start.
+    return typeId == 0x22 || typeId == 0x30 || typeId == 0x32 || typeId == 0x34 || typeId == 0x36;
+}
+
+bool isBreakEnd(const uint8_t typeId)
+{
+    return typeId == 0x23 || typeId == 0x31 || typeId == 0x33 || typeId == 0x35 || typeId == 0x37;
+}
+
+void appendFormat(std::string& destination, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+void appendFormat(std::string& destination, const char* format, ...)
+{
+    char buffer[256];
+    va_list arguments;
+    va_start(arguments, format);
+    const auto size = vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+    if (size > 0)
+    {
+        destination.append(buffer, std::min(static_cast<size_t>(size), sizeof(buffer) - 1));
+    }
+}
+
+} // namespace
+
+HlsWriter::HlsWriter(const std::string& channel, const HlsOptions& options)
+    : name_(channel),
+      options_(options),
+      open_(true),
+      finished_(false),
+      pat_{},
+      pmt_{},
+      hasPat_(false),
+      hasPmt_(false),
+      lastVideoPts_(0),
+      hasVideoPts_(false),
+      cutPts_(0),
+      hasCutCue_(false),
+      cutCue_{},
+      segmentFile_(-1),
+      sequence_(0),
+      segmentStartPts_(0),
+      inBreak_(false),
+      breakStartPts_(0),
+      breakDuration_(0),
+      targetDuration_(static_cast<uint32_t>(std::ceil(options.segmentDuration.count() / 1000.0)) + targetHeadroom)
+{
+    if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        Logger::error("[%s] Unable to create HLS directory %s: %s",
+            name_.c_str(),
+            options_.directory.c_str(),
+            strerror(errno));
+        open_ = false;
+        return;
+    }
+    partial_.reserve(utils::ts::packetSize);
+}
+
+HlsWriter::~HlsWriter()
+{
+    finish();
+}
+
+void HlsWriter::write(const uint8_t* data, const size_t size)
+{
+    if (!open_ || finished_)
+    {
+        return;
+    }
+
+    size_t offset = 0;
+    if (!partial_.empty())
+    {
+        offset = std::min(utils::ts::packetSize - partial_.size(), size);
+        partial_.insert(partial_.end(), data, data + offset);
+        if (partial_.size() < utils::ts::packetSize)
+        {
+            return;
+        }
+        if (onPacket(partial_.data()))
+        {
+            startSegment();
+        }
+        writeSegment(partial_.data(), partial_.size());
+        partial_.clear();
+    }
+
+    // Runs of packets between cuts go to the segment file as they are.
+    auto runStart = offset;
+    for (; size - offset >= utils::ts::packetSize; offset += utils::ts::packetSize)
+    {
+        if (onPacket(data + offset))
+        {
+            writeSegment(data + runStart, offset - runStart);
+            runStart = offset;
+            startSegment();
+        }
+    }
+    writeSegment(data + runStart, offset - runStart);
+    partial_.assign(data + offset, data + size);
+}
+
+void HlsWriter::finish()
+{
+    if (!open_ || finished_)
+    {
+        return;
+    }
+    finished_ = true;
+
+    if (segmentFile_ < 0)
+    {
+        return;
+    }
+    closeSegment(lastVideoPts_);
+    writePlaylist(true);
+    Logger::log("[%s] HLS output %s ended after %llu segments",
+        name_.c_str(),
+        options_.directory.c_str(),
+        static_cast<unsigned long long>(sequence_));
+}
+
+bool HlsWriter::onPacket(const uint8_t* packet)
+{
+    if (packet[0] != utils::ts::syncByte)
+    {
+        return false;
+    }
+
+    uint64_t previousIdrPts = 0;
+    const auto hadIdr = videoClock_.lastIdrPts(previousIdrPts);
+    videoClock_.onPacket(packet);
+
+    const auto pid = utils::ts::pid(packet);
+    const auto scte35Pid = videoClock_.scte35Pid() == utils::ts::nullPid ? defaultScte35Pid : videoClock_.scte35Pid();
+    if (pid == utils::ts::patPid && utils::ts::payloadUnitStart(packet))
+    {
+        std::copy(packet, packet + utils::ts::packetSize, pat_.begin());
+        hasPat_ = true;
+    }
+    else if (pid == videoClock_.pmtPid() && utils::ts::payloadUnitStart(packet))
+    {
+        std::copy(packet, packet + utils::ts::packetSize, pmt_.begin());
+        hasPmt_ = true;
+    }
+    else if (pid == scte35Pid)
+    {
+        scte35Assembler_.push(packet, [this](const uint8_t* section, size_t size) { onSection(section, size); });
+    }
+
+    uint64_t pts = 0;
+    if (pid != videoClock_.videoPid() || !utils::ts::readPesPts(packet, pts))
+    {
+        return false;
+    }
+    lastVideoPts_ = pts;
+    hasVideoPts_ = true;
+
+    uint64_t idrPts = 0;
+    const auto isIdr = videoClock_.lastIdrPts(idrPts) && idrPts == pts && (!hadIdr || previousIdrPts != idrPts);
+
+    if (segmentFile_ < 0)
+    {
+        // Packets before the first IDR are not decodable, the first segment starts there.
+        cutPts_ = pts;
+        hasCutCue_ = false;
+        return isIdr;
+    }
+
+    if (!cues_.empty() && utils::ts::ptsDifference(pts, cues_.front().pts) >= 0)
+    {
+        // One cut for all cues due, tagged by the first break start or end among them.
+        cutPts_ = pts;
+        hasCutCue_ = true;
+        cutCue_ = cues_.front();
+        auto due = cues_.begin();
+        for (; due != cues_.end() && utils::ts::ptsDifference(pts, due->pts) >= 0; ++due)
+        {
+            if (cutCue_.type == CueType::SPLICE_POINT)
+            {
+                cutCue_ = *due;
+            }
+        }
+        cues_.erase(cues_.begin(), due);
+        if (!isIdr)
+        {
+            Logger::warning("[%s] HLS cut for the splice point at pts %llu is not at an IDR, pts %llu",
+                name_.c_str(),
+                static_cast<unsigned long long>(cutCue_.pts),
+                static_cast<unsigned long long>(pts));
+        }
+        return true;
+    }
+
+    const auto segmentTicks = options_.segmentDuration.count() * static_cast<int64_t>(utils::ts::ptsClockRate) / 1000;
+    if (isIdr && utils::ts::ptsDifference(pts, segmentStartPts_) >= segmentTicks)
+    {
+        cutPts_ = pts;
+        hasCutCue_ = false;
+        return true;
+    }
+    return false;
+}
+
+void HlsWriter::onSection(const uint8_t* section, const size_t size)
+{
+    SpliceInfo info;
+    if (utils::crc32Mpeg(section, size) != 0 || !readSpliceInfoSection(section, size, info))
+    {
+        return;
+    }
+
+    Cue cue{};
+    bool timeSpecified = false;
+    uint64_t spliceTime = 0;
+    if (info.command == SpliceCommandType::SPLICE_INSERT)
+    {
+        const auto& spliceInsert = info.spliceInsert;
+        if (spliceInsert.cancel)
+        {
+            return;
+        }
+        cue.type = spliceInsert.type == SpliceType::OUT ? CueType::OUT : CueType::IN;
+        cue.duration = spliceInsert.hasDuration ? spliceInsert.breakDuration : 0;
+        timeSpecified = !spliceInsert.immediate;
+        spliceTime = spliceInsert.spliceTime;
+    }
+    else if (info.command == SpliceCommandType::TIME_SIGNAL)
+    {
+        cue.type = CueType::SPLICE_POINT;
+        if (info.segmentationCount != 0 && !info.segmentation[0].cancel)
+        {
+            const auto& descriptor = info.segmentation[0];
+            if (isBreakStart(descriptor.typeId))
+            {
+                cue.type = CueType::OUT;
+                cue.duration = descriptor.hasDuration ? descriptor.duration : 0;
+            }
+            else if (isBreakEnd(descriptor.typeId))
+            {
+                cue.type = CueType::IN;
+            }
+        }
+        timeSpecified = info.timeSpecified;
+        spliceTime = info.spliceTime;
+    }
+    else
+    {
+        return;
+    }
+
+    if (timeSpecified)
+    {
+        cue.pts = (spliceTime + info.ptsAdjustment) % utils::ts::ptsModulo;
+    }
+    else if (hasVideoPts_)
+    {
+        cue.pts = lastVideoPts_;
+    }
+    else
+    {
+        return;
+    }
+    addCue(cue);
+}
+
+void HlsWriter::addCue(const Cue& cue)
+{
+    // Encoders and inserters repeat each cue until its splice point, and a cue whose splice point was cut already
+    // is a late repeat.
+    if (hasVideoPts_ && utils::ts::ptsDifference(cue.pts, lastVideoPts_) < 0)
+    {
+        return;
+    }
+    for (const auto& pendingCue : cues_)
+    {
+        if (pendingCue.pts == cue.pts && pendingCue.type == cue.type && !pendingCue.implicit)
+        {
+            return;
+        }
+    }
+    if (cues_.size() >= maxCues)
+    {
+        Logger::warning("[%s] Too many pending HLS cuts, dropping the splice point at pts %llu",
+            name_.c_str(),
+            static_cast<unsigned long long>(cue.pts));
+        return;
+    }
+
+    if (cue.type == CueType::IN)
+    {
+        cues_.erase(std::remove_if(cues_.begin(),
+                        cues_.end(),
+                        [&cue](const Cue& pendingCue) {
+                            return pendingCue.implicit &&
+                                std::abs(utils::ts::ptsDifference(pendingCue.pts, cue.pts)) <= implicitInTolerance;
+                        }),
+            cues_.end());
+    }
+
+    const auto insert = [this](const Cue& newCue) {
+        const auto position = std::find_if(cues_.begin(), cues_.end(), [&newCue](const Cue& pendingCue) {
+            return utils::ts::ptsDifference(pendingCue.pts, newCue.pts) > 0;
+        });
+        cues_.insert(position, newCue);
+    };
+    insert(cue);
+
+    if (cue.type == CueType::OUT && cue.duration != 0)
+    {
+        const auto inPts = (cue.pts + cue.duration) % utils::ts::ptsModulo;
+        const auto hasIn = std::any_of(cues_.begin(), cues_.end(), [inPts](const Cue& pendingCue) {
+            return pendingCue.type == CueType::IN &&
+                std::abs(utils::ts::ptsDifference(pendingCue.pts, inPts)) <= implicitInTolerance;
+        });
+        if (!hasIn)
+        {
+            insert(Cue{inPts, CueType::IN, 0, true});
+        }
+    }
+}
+
+void HlsWriter::startSegment()
+{
+    if (segmentFile_ >= 0)
+    {
+        closeSegment(cutPts_);
+    }
+
+    segmentTags_.clear();
+    if (hasCutCue_ && cutCue_.type == CueType::OUT)
+    {
+        inBreak_ = true;
+        breakStartPts_ = cutPts_;
+        breakDuration_ = cutCue_.duration;
+        if (breakDuration_ != 0)
+        {
+            appendFormat(segmentTags_, "#EXT-X-CUE-OUT:DURATION=%.3f\n", seconds(breakDuration_));
+        }
+        else
+        {
+            segmentTags_ = "#EXT-X-CUE-OUT\n";
+        }
+    }
+    else if (hasCutCue_ && cutCue_.type == CueType::IN)
+    {
+        // An in point of a break that was never seen still ends an unknown one in the player, only tag a real break.
+        if (inBreak_)
+        {
+            segmentTags_ = "#EXT-X-CUE-IN\n";
+        }
+        inBreak_ = false;
+    }
+    else if (inBreak_)
+    {
+        appendFormat(segmentTags_,
+            "#EXT-X-CUE-OUT-CONT:ElapsedTime=%.3f",
+            seconds(utils::ts::ptsDifference(cutPts_, breakStartPts_)));
+        if (breakDuration_ != 0)
+        {
+            appendFormat(segmentTags_, ",Duration=%.3f", seconds(breakDuration_));
+        }
+        segmentTags_ += "\n";
+    }
+
+    if (hasCutCue_)
+    {
+        Logger::log("[%s] HLS segment %llu starts at the %s splice point at pts %llu",
+            name_.c_str(),
+            static_cast<unsigned long long>(sequence_),
+            cutCue_.type == CueType::OUT ? "out" : (cutCue_.type == CueType::IN ? "in" : "time_signal"),
+            static_cast<unsigned long long>(cutPts_));
+    }
+
+    const auto path = segmentPath(sequence_);
+    segmentFile_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segmentFile_ < 0)
+    {
+        Logger::error("[%s] Unable to open HLS segment %s: %s", name_.c_str(), path.c_str(), strerror(errno));
+        open_ = false;
+        return;
+    }
+    segmentStartPts_ = cutPts_;
+
+    // Every segment is decodable on its own.
+    if (hasPat_)
+    {
+        writeSegment(pat_.data(), pat_.size());
+    }
+    if (hasPmt_)
+    {
+        writeSegment(pmt_.data(), pmt_.size());
+    }
+}
+
+void HlsWriter::closeSegment(const uint64_t endPts)
+{
+    close(segmentFile_);
+    segmentFile_ = -1;
+
+    const auto duration = seconds(std::max<int64_t>(utils::ts::ptsDifference(endPts, segmentStartPts_), 0));
+    if (std::lround(duration) > static_cast<long>(targetDuration_))
+    {
+        Logger::warning("[%s] HLS segment %llu is %.3f s long, over the target duration of %u s",
+            name_.c_str(),
+            static_cast<unsigned long long>(sequence_),
+            duration,
+            targetDuration_);
+    }
+    segments_.push_back(Segment{sequence_, duration, std::move(segmentTags_)});
+    segmentTags_.clear();
+    ++sequence_;
+
+    while (segments_.size() > options_.listSize)
+    {
+        expiredSegments_.push_back(segments_.front().sequence);
+        segments_.pop_front();
+    }
+    while (expiredSegments_.size() > keptSegments)
+    {
+        const auto path = segmentPath(expiredSegments_.front());
+        if (unlink(path.c_str()) != 0 && errno != ENOENT)
+        {
+            Logger::warning("[%s] Unable to delete HLS segment %s: %s", name_.c_str(), path.c_str(), strerror(errno));
+        }
+        expiredSegments_.pop_front();
+    }
+
+    writePlaylist(false);
+}
+
+void HlsWriter::writeSegment(const uint8_t* data, const size_t size)
+{
+    if (segmentFile_ < 0)
+    {
+        return;
+    }
+
+    size_t written = 0;
+    while (written < size)
+    {
+        const auto result = ::write(segmentFile_, data + written, size - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Logger::error("[%s] Unable to write HLS segment %llu: %s",
+                name_.c_str(),
+                static_cast<unsigned long long>(sequence_),
+                strerror(errno));
+            return;
+        }
+        written += static_cast<size_t>(result);
+    }
+}
+
+void HlsWriter::writePlaylist(const bool ended)
+{
+    std::string playlist;
+    appendFormat(playlist,
+        "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%u\n#EXT-X-MEDIA-SEQUENCE:%llu\n",
+        targetDuration_,
+        static_cast<unsigned long long>(segments_.empty() ? sequence_ : segments_.front().sequence));
+    for (const auto& segment : segments_)
+    {
+        playlist += segment.tags;
+        appendFormat(playlist,
+            "#EXTINF:%.3f,\nsegment%llu.ts\n",
+            segment.duration,
+            static_cast<unsigned long long>(segment.sequence));
+    }
+    if (ended)
+    {
+        playlist += "#EXT-X-ENDLIST\n";
+    }
+
+    // Players never see a partly written playlist.
+    const auto path = options_.directory + "/" + playlistName;
+    const auto temporaryPath = path + ".tmp";
+    auto file = fopen(temporaryPath.c_str(), "w");
+    if (!file)
+    {
+        Logger::error("[%s] Unable to open HLS playlist %s: %s",
+            name_.c_str(),
+            temporaryPath.c_str(),
+            strerror(errno));
+        return;
+    }
+    const auto written = fwrite(playlist.data(), 1, playlist.size(), file);
+    if (fclose(file) != 0 || written != playlist.size() || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        Logger::error("[%s] Unable to write HLS playlist %s: %s", name_.c_str(), path.c_str(), strerror(errno));
+    }
+}
+
+std::string HlsWriter::segmentPath(const uint64_t sequence) const
+{
+    return options_.directory + "/segment" + std::to_string(sequence) + ".ts";
+}
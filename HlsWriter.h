@@ -0,0 +1,127 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "VideoClock.h"
+#include "utils/PsiSection.h"
+#include "utils/TsPacket.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * Writes a TS output as HLS to a local directory: segments that start at a video IDR once the segment duration is
+ * reached, and a rolling playlist, index.m3u8. The SCTE-35 cues of the stream are followed as a packager would, and
+ * every splice point forces a cut at the first video PES at or after it, so breaks start and end on a segment
+ * boundary. The segment at an out point carries EXT-X-CUE-OUT, the segments of the break EXT-X-CUE-OUT-CONT and the
+ * segment at the in point EXT-X-CUE-IN; an out cue with a duration and no in cue returns after the duration.
+ *
+ * Packets go to the segment files straight from the buffers passed to write, only the PAT and PMT that start every
+ * segment are copies. Called from one thread.
+ */
+class HlsWriter
+{
+public:
+    HlsWriter(const std::string& channel, const HlsOptions& options);
+
+    /**
+     * Calls finish.
+     */
+    ~HlsWriter();
+
+    HlsWriter(const HlsWriter&) = delete;
+    HlsWriter& operator=(const HlsWriter&) = delete;
+
+    /**
+     * @return False if the directory could not be created.
+     */
+    [[nodiscard]] bool isOpen() const { return open_; }
+
+    const std::string& directory() const { return options_.directory; }
+
+    /**
+     * Writes the TS packets of data, a trailing partial packet is kept until the next call.
+     */
+    void write(const uint8_t* data, const size_t size);
+
+    /**
+     * Closes the current segment and ends the playlist.
+     */
+    void finish();
+
+private:
+    enum class CueType
+    {
+        OUT,
+        IN,
+        // time_signal without a segmentation type of a break start or end: cut, no tag.
+        SPLICE_POINT
+    };
+
+    struct Cue
+    {
+        uint64_t pts;
+        CueType type;
+        // 90 kHz ticks, 0 if the cue has no duration.
+        uint64_t duration;
+        // In point after the duration of an out cue, replaced by an in cue of the stream near it.
+        bool implicit;
+    };
+
+    struct Segment
+    {
+        uint64_t sequence;
+        double duration;
+        std::string tags;
+    };
+
+    static const uint16_t defaultScte35Pid = 35;
+    static const uint32_t maxCues = 64;
+    // Expired segments kept on disk for players that loaded an older playlist.
+    static const size_t keptSegments = 2;
+    // Seconds a segment may run past the segment duration while it waits for an IDR. EXT-X-TARGETDURATION must not
+    // change, so it is fixed to the segment duration plus this headroom.
+    static const uint32_t targetHeadroom = 2;
+
+    std::string name_;
+    HlsOptions options_;
+    bool open_;
+    bool finished_;
+    VideoClock videoClock_;
+    utils::ts::SectionAssembler scte35Assembler_;
+    std::array<uint8_t, utils::ts::packetSize> pat_;
+    std::array<uint8_t, utils::ts::packetSize> pmt_;
+    bool hasPat_;
+    bool hasPmt_;
+    std::vector<uint8_t> partial_;
+    std::vector<Cue> cues_;
+    uint64_t lastVideoPts_;
+    bool hasVideoPts_;
+
+    // Set by onPacket when the packet starts a segment.
+    uint64_t cutPts_;
+    bool hasCutCue_;
+    Cue cutCue_;
+
+    int32_t segmentFile_;
+    uint64_t sequence_;
+    uint64_t segmentStartPts_;
+    std::string segmentTags_;
+    bool inBreak_;
+    uint64_t breakStartPts_;
+    uint64_t breakDuration_;
+    std::deque<Segment> segments_;
+    std::deque<uint64_t> expiredSegments_;
+    uint32_t targetDuration_;
+
+    bool onPacket(const uint8_t* packet);
+    void onSection(const uint8_t* section, const size_t size);
+    void addCue(const Cue& cue);
+    void startSegment();
+    void closeSegment(const uint64_t endPts);
+    void writeSegment(const uint8_t* data, const size_t size);
+    void writePlaylist(const bool ended);
+    std::string segmentPath(const uint64_t sequence) const;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "SpliceFactory.h"
+#include "SpliceRequestQueue.h"
+
+/**
+ * Common control interface of the SCTE-35 insertion engines.
+ */
+class Inserter
+{
+public:
+    virtual ~Inserter() = default;
+
+    virtual void run() = 0;
+    virtual void stop() = 0;
+
+    /**
+     * Queues an on-demand cue from any thread, it is sent from the main loop like the interval cues.
+     * @return Id assigned to the request, 0 if the channel's request queue is full.
+     */
+    virtual uint64_t requestSplice(const SpliceRequest& request) = 0;
+
+    virtual SpliceRequestStats spliceRequestStats() const = 0;
+};
@@ -1,42 +1,479 @@
 #include "Logger.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
-#include <chrono>
-#include <array>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <strings.h>
+#include <thread>
+#include <vector>
 
 namespace Logger
 {
 
-void log(const char* format, ...)
+namespace
+{
+
+const size_t cacheLineSize = 64;
+const size_t ringSize = 128;
+const size_t maxMessageSize = 496;
+const auto drainInterval = std::chrono::milliseconds(5);
+
+struct Entry
+{
+    int64_t timeNs;
+    Level level;
+    uint16_t size;
+    std::array<char, maxMessageSize> text;
+};
+
+/**
+ * Single producer, single consumer ring owned by one logging thread and drained by the writer thread.
+ */
+struct Ring
+{
+    explicit Ring(const uint32_t threadIndex)
+        : threadIndex(threadIndex),
+          abandoned(false),
+          dropped(0),
+          head(0),
+          tail(0)
+    {
+    }
+
+    const uint32_t threadIndex;
+    std::atomic<bool> abandoned;
+    std::atomic<uint64_t> dropped;
+    alignas(cacheLineSize) std::atomic<size_t> head;
+    alignas(cacheLineSize) std::atomic<size_t> tail;
+    std::array<Entry, ringSize> entries;
+};
+
+/**
+ * Gives every thread its ring on first use and marks it abandoned on thread exit, the writer frees it once drained.
+ */
+struct RingHandle
+{
+    RingHandle();
+    ~RingHandle() { ring->abandoned.store(true, std::memory_order_release); }
+
+    std::shared_ptr<Ring> ring;
+};
+
+struct State
+{
+    State() : level(Level::INFO), running(false), json(false), output(stdout), nextThreadIndex(0), totalDropped(0) {}
+
+    std::atomic<Level> level;
+    std::atomic<bool> running;
+    bool json;
+    FILE* output;
+
+    std::mutex ringsMutex;
+    std::vector<std::shared_ptr<Ring>> rings;
+    uint32_t nextThreadIndex;
+    std::atomic<uint64_t> totalDropped;
+
+    std::mutex writerMutex;
+    std::condition_variable writerCondition;
+    std::atomic<bool> wakeWriter{false};
+    std::thread writer;
+
+    // Formatting state shared by the writer thread and the synchronous path.
+    std::mutex outputMutex;
+    time_t cachedSecond = -1;
+    std::array<char, 32> cachedTime{};
+    std::string line;
+};
+
+State& state()
+{
+    static State instance;
+    return instance;
+}
+
+RingHandle::RingHandle()
+{
+    auto& loggerState = state();
+    std::lock_guard<std::mutex> lock(loggerState.ringsMutex);
+    ring = std::make_shared<Ring>(loggerState.nextThreadIndex++);
+    loggerState.rings.push_back(ring);
+}
+
+const char* levelName(const Level level)
+{
+    switch (level)
+    {
+    case Level::VERBOSE:
+        return "VERBOSE";
+    case Level::INFO:
+        return "INFO";
+    case Level::WARNING:
+        return "WARNING";
+    case Level::ERROR:
+        return "ERROR";
+    }
+    return "";
+}
+
+/**
+ * localtime_r is only called when the second changes, the milliseconds are appended to the cached prefix.
+ */
+void formatTime(State& loggerState, const int64_t timeNs, std::string& line)
+{
+    const auto second = static_cast<time_t>(timeNs / 1000000000);
+    if (second != loggerState.cachedSecond)
+    {
+        tm localTime = {};
+        localtime_r(&second, &localTime);
+        strftime(loggerState.cachedTime.data(), loggerState.cachedTime.size(), "%Y-%m-%d %H:%M:%S", &localTime);
+        loggerState.cachedSecond = second;
+    }
+
+    std::array<char, 8> milliseconds{};
+    snprintf(milliseconds.data(), milliseconds.size(), ".%03u", static_cast<uint32_t>(timeNs / 1000000 % 1000));
+    line.append(loggerState.cachedTime.data());
+    line.append(milliseconds.data());
+}
+
+void appendJsonString(std::string& line, const char* text, const size_t size)
+{
+    line.push_back('"');
+    for (size_t i = 0; i < size; ++i)
+    {
+        const auto character = static_cast<unsigned char>(text[i]);
+        if (character == '"' || character == '\\')
+        {
+            line.push_back('\\');
+            line.push_back(static_cast<char>(character));
+        }
+        else if (character < 0x20)
+        {
+            std::array<char, 8> escaped{};
+            snprintf(escaped.data(), escaped.size(), "\\u%04x", character);
+            line.append(escaped.data());
+        }
+        else
+        {
+            line.push_back(static_cast<char>(character));
+        }
+    }
+    line.push_back('"');
+}
+
+void appendLine(State& loggerState,
+    const int64_t timeNs,
+    const Level level,
+    const uint32_t threadIndex,
+    const char* text,
+    size_t size)
+{
+    auto& line = loggerState.line;
+
+    if (!loggerState.json)
+    {
+        line.push_back('[');
+        formatTime(loggerState, timeNs, line);
+        line.append("] ");
+        if (level != Level::INFO)
+        {
+            line.append(levelName(level));
+            line.append(": ");
+        }
+        line.append(text, size);
+        line.push_back('\n');
+        return;
+    }
+
+    line.append("{\"time\":\"");
+    formatTime(loggerState, timeNs, line);
+    line.append("\",\"level\":\"");
+    line.append(levelName(level));
+    line.append("\",\"thread\":");
+    line.append(std::to_string(threadIndex));
+
+    // Channel log lines start with "[name] ", which becomes its own field.
+    if (size > 3 && text[0] == '[')
+    {
+        const auto end = static_cast<const char*>(memchr(text, ']', size));
+        if (end != nullptr && static_cast<size_t>(end - text) + 1 < size && end[1] == ' ')
+        {
+            line.append(",\"channel\":");
+            appendJsonString(line, text + 1, static_cast<size_t>(end - text) - 1);
+            size -= static_cast<size_t>(end - text) + 2;
+            text = end + 2;
+        }
+    }
+
+    line.append(",\"message\":");
+    appendJsonString(line, text, size);
+    line.append("}\n");
+}
+
+int64_t nowNs()
 {
-    const auto now = std::chrono::system_clock::now();
-    const auto nowTimeT = std::chrono::system_clock::to_time_t(now);
-    tm localTime = {};
-    localtime_r(&nowTimeT, &localTime);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Moves everything queued so far to the output in timestamp order with a single flush.
+ * @return False if all rings were empty.
+ */
+bool drain(State& loggerState)
+{
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(loggerState.ringsMutex);
+        rings = loggerState.rings;
+    }
+
+    struct Pending
+    {
+        const Entry* entry;
+        uint32_t threadIndex;
+    };
+    std::vector<Pending> pending;
+    std::vector<std::pair<Ring*, size_t>> consumed;
+
+    for (const auto& ring : rings)
+    {
+        const auto tail = ring->tail.load(std::memory_order_relaxed);
+        const auto head = ring->head.load(std::memory_order_acquire);
+        for (auto position = tail; position != head; ++position)
+        {
+            pending.push_back({&ring->entries[position % ringSize], ring->threadIndex});
+        }
+        if (head != tail)
+        {
+            consumed.emplace_back(ring.get(), head);
+        }
+    }
+
+    std::stable_sort(pending.begin(), pending.end(), [](const Pending& left, const Pending& right) {
+        return left.entry->timeNs < right.entry->timeNs;
+    });
+
+    std::lock_guard<std::mutex> outputLock(loggerState.outputMutex);
+    auto& line = loggerState.line;
+    line.clear();
+    for (const auto& item : pending)
+    {
+        appendLine(loggerState, item.entry->timeNs, item.entry->level, item.threadIndex, item.entry->text.data(),
+            item.entry->size);
+    }
 
-    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+    for (const auto& ring : rings)
+    {
+        const auto dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped != 0)
+        {
+            std::array<char, 96> message{};
+            const auto size = snprintf(message.data(), message.size(),
+                "Logger dropped %llu messages from thread %u", static_cast<unsigned long long>(dropped),
+                ring->threadIndex);
+            appendLine(loggerState, nowNs(), Level::WARNING, ring->threadIndex, message.data(),
+                static_cast<size_t>(size));
+        }
+    }
 
-    std::array<char, 2048> logString{};
-    std::array<char, 64> timeString{};
+    if (!line.empty())
+    {
+        fwrite(line.data(), 1, line.size(), loggerState.output);
+        fflush(loggerState.output);
+    }
 
-    snprintf(timeString.data(),
-        timeString.size(),
-        "%04d-%02d-%02d %02d:%02d:%02d.%03u",
-        static_cast<uint16_t>(localTime.tm_year + 1900),
-        static_cast<uint8_t>(localTime.tm_mon + 1),
-        static_cast<uint8_t>(localTime.tm_mday),
-        static_cast<uint8_t>(localTime.tm_hour),
-        static_cast<uint8_t>(localTime.tm_min),
-        static_cast<uint8_t>(localTime.tm_sec),
-        static_cast<uint32_t>(ms % 1000));
+    for (const auto& item : consumed)
+    {
+        item.first->tail.store(item.second, std::memory_order_release);
+    }
 
+    {
+        std::lock_guard<std::mutex> lock(loggerState.ringsMutex);
+        loggerState.rings.erase(std::remove_if(loggerState.rings.begin(), loggerState.rings.end(),
+                                    [](const std::shared_ptr<Ring>& ring) {
+                                        return ring->abandoned.load(std::memory_order_acquire) &&
+                                            ring->tail.load(std::memory_order_relaxed) ==
+                                            ring->head.load(std::memory_order_acquire);
+                                    }),
+            loggerState.rings.end());
+    }
+
+    return !pending.empty();
+}
+
+void writerFunction()
+{
+    auto& loggerState = state();
+    while (loggerState.running.load(std::memory_order_acquire))
+    {
+        if (drain(loggerState))
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(loggerState.writerMutex);
+        loggerState.writerCondition.wait_for(lock, drainInterval, [&loggerState]() {
+            return !loggerState.running.load(std::memory_order_acquire) ||
+                loggerState.wakeWriter.exchange(false, std::memory_order_relaxed);
+        });
+    }
+    drain(loggerState);
+}
+
+void write(const Level level, const char* format, va_list args)
+{
+    auto& loggerState = state();
+    if (level < loggerState.level.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    if (!loggerState.running.load(std::memory_order_acquire))
+    {
+        std::array<char, maxMessageSize> text{};
+        const auto size = vsnprintf(text.data(), text.size(), format, args);
+
+        std::lock_guard<std::mutex> lock(loggerState.outputMutex);
+        loggerState.line.clear();
+        appendLine(loggerState, nowNs(), level, 0, text.data(), std::min(static_cast<size_t>(std::max(size, 0)),
+            text.size() - 1));
+        fwrite(loggerState.line.data(), 1, loggerState.line.size(), loggerState.output);
+        fflush(loggerState.output);
+        return;
+    }
+
+    thread_local RingHandle handle;
+    auto& ring = *handle.ring;
+
+    const auto head = ring.head.load(std::memory_order_relaxed);
+    const auto used = head - ring.tail.load(std::memory_order_acquire);
+    if (used == ringSize)
+    {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        loggerState.totalDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto& entry = ring.entries[head % ringSize];
+    entry.timeNs = nowNs();
+    entry.level = level;
+    const auto size = vsnprintf(entry.text.data(), entry.text.size(), format, args);
+    entry.size = static_cast<uint16_t>(std::min(static_cast<size_t>(std::max(size, 0)), entry.text.size() - 1));
+    ring.head.store(head + 1, std::memory_order_release);
+
+    // The writer polls, a burst that fills half the ring wakes it early.
+    if (used == ringSize / 2)
+    {
+        loggerState.wakeWriter.store(true, std::memory_order_relaxed);
+        loggerState.writerCondition.notify_one();
+    }
+}
+
+} // namespace
+
+void start(FILE* output, const bool json)
+{
+    auto& loggerState = state();
+    if (loggerState.running.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loggerState.outputMutex);
+        loggerState.output = output;
+        loggerState.json = json;
+    }
+    loggerState.running.store(true, std::memory_order_release);
+    loggerState.writer = std::thread(writerFunction);
+}
+
+void stop()
+{
+    auto& loggerState = state();
+    if (!loggerState.running.load(std::memory_order_acquire))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loggerState.writerMutex);
+        loggerState.running.store(false, std::memory_order_release);
+    }
+    loggerState.writerCondition.notify_one();
+    loggerState.writer.join();
+}
+
+void setLevel(const Level level)
+{
+    state().level.store(level, std::memory_order_relaxed);
+}
+
+bool parseLevel(const char* name, Level& level)
+{
+    if (strcasecmp(name, "debug") == 0)
+    {
+        level = Level::VERBOSE;
+        return true;
+    }
+
+    const std::array<Level, 4> levels = {Level::VERBOSE, Level::INFO, Level::WARNING, Level::ERROR};
+    for (const auto candidate : levels)
+    {
+        if (strcasecmp(name, levelName(candidate)) == 0)
+        {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t droppedMessages()
+{
+    return state().totalDropped.load(std::memory_order_relaxed);
+}
+
+void log(const char* format, ...)
+{
     va_list args;
     va_start(args, format);
+    write(Level::INFO, format, args);
+    va_end(args);
+}
 
-    vsnprintf(logString.data(), logString.size(), format, args);
-    fprintf(stdout, "[%s] %s\n", timeString.data(), logString.data());
-    fflush(stdout);
+void debug(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    write(Level::VERBOSE, format, args);
+    va_end(args);
+}
+
+void warning(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    write(Level::WARNING, format, args);
+    va_end(args);
+}
+
+void error(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    write(Level::ERROR, format, args);
+    va_end(args);
 }
 
 }
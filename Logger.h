@@ -1,8 +1,52 @@
 #pragma once
 
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * Asynchronous logger. The calling thread only formats the message into its own lock-free ring buffer; a writer
+ * thread timestamps, formats and writes the lines. Until start is called, and after stop, lines are written
+ * synchronously to the last output given to start (stdout by default). A full ring drops the message rather than
+ * blocking, the writer reports the number dropped.
+ */
 namespace Logger
 {
 
-void log(const char* format, ...);
+// DEBUG is a macro in debug builds.
+enum class Level
+{
+    VERBOSE,
+    INFO,
+    WARNING,
+    ERROR
+};
+
+/**
+ * Starts the writer thread.
+ * @param json Write one JSON object per line instead of plain text.
+ */
+void start(FILE* output = stdout, const bool json = false);
+
+/**
+ * Writes the queued messages and stops the writer thread.
+ */
+void stop();
+
+void setLevel(const Level level);
+
+/**
+ * @return False if name is not one of verbose (or debug), info, warning, error.
+ */
+bool parseLevel(const char* name, Level& level);
+
+/**
+ * @return Messages dropped so far because a thread's ring was full.
+ */
+uint64_t droppedMessages();
+
+void log(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void debug(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void warning(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void error(const char* format, ...) __attribute__((format(printf, 1, 2)));
 
 }
@@ -0,0 +1,286 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace metrics
+{
+
+namespace
+{
+
+std::atomic<size_t> nextThreadShard(0);
+
+std::string formatLabels(const Labels& labels)
+{
+    std::string result;
+    for (const auto& label : labels)
+    {
+        result += result.empty() ? "" : ",";
+        result += label.first + "=\"";
+        for (const auto character : label.second)
+        {
+            if (character == '"' || character == '\\')
+            {
+                result += '\\';
+            }
+            result += character;
+        }
+        result += "\"";
+    }
+    return result;
+}
+
+std::string formatValue(const double value)
+{
+    std::array<char, 64> buffer;
+    snprintf(buffer.data(), buffer.size(), "%.9g", value);
+    return buffer.data();
+}
+
+std::string seriesName(const std::string& name, const std::string& labels, const std::string& extraLabel = "")
+{
+    if (labels.empty() && extraLabel.empty())
+    {
+        return name;
+    }
+    return name + "{" + labels + (labels.empty() || extraLabel.empty() ? "" : ",") + extraLabel + "}";
+}
+
+} // namespace
+
+namespace detail
+{
+
+size_t threadShard()
+{
+    thread_local const size_t shard = nextThreadShard.fetch_add(1, std::memory_order_relaxed) % shardCount;
+    return shard;
+}
+
+} // namespace detail
+
+uint64_t Counter::value() const
+{
+    uint64_t result = 0;
+    for (const auto& shard : shards_)
+    {
+        result += shard.value.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+Histogram::Histogram(std::vector<double> bounds) : bounds_(std::move(bounds))
+{
+    if (bounds_.size() >= maxBuckets)
+    {
+        bounds_.resize(maxBuckets - 1);
+    }
+
+    for (const auto bound : bounds_)
+    {
+        boundsNanoseconds_.push_back(static_cast<int64_t>(bound * 1e9));
+    }
+}
+
+void Histogram::observe(const std::chrono::nanoseconds value)
+{
+    const auto nanoseconds = std::max<int64_t>(value.count(), 0);
+    const auto bucket = static_cast<size_t>(
+        std::lower_bound(boundsNanoseconds_.begin(), boundsNanoseconds_.end(), nanoseconds) -
+        boundsNanoseconds_.begin());
+
+    auto& shard = shards_[detail::threadShard()];
+    shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    shard.sumNanoseconds.fetch_add(static_cast<uint64_t>(nanoseconds), std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+    Snapshot result;
+    result.cumulativeCounts.resize(bounds_.size() + 1, 0);
+    uint64_t sumNanoseconds = 0;
+
+    for (const auto& shard : shards_)
+    {
+        for (size_t i = 0; i <= bounds_.size(); ++i)
+        {
+            result.cumulativeCounts[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+        sumNanoseconds += shard.sumNanoseconds.load(std::memory_order_relaxed);
+    }
+
+    for (size_t i = 1; i < result.cumulativeCounts.size(); ++i)
+    {
+        result.cumulativeCounts[i] += result.cumulativeCounts[i - 1];
+    }
+    result.count = result.cumulativeCounts.back();
+    result.sumSeconds = static_cast<double>(sumNanoseconds) / 1e9;
+    return result;
+}
+
+double Histogram::quantile(const Snapshot& snapshot, const double q) const
+{
+    if (snapshot.count == 0 || bounds_.empty())
+    {
+        return 0.0;
+    }
+
+    const auto rank = q * static_cast<double>(snapshot.count);
+    for (size_t i = 0; i < bounds_.size(); ++i)
+    {
+        const auto count = static_cast<double>(snapshot.cumulativeCounts[i]);
+        if (count < rank)
+        {
+            continue;
+        }
+
+        const auto lowerBound = i == 0 ? 0.0 : bounds_[i - 1];
+        const auto lowerCount = i == 0 ? 0.0 : static_cast<double>(snapshot.cumulativeCounts[i - 1]);
+        if (count == lowerCount)
+        {
+            return bounds_[i];
+        }
+        return lowerBound + (bounds_[i] - lowerBound) * (rank - lowerCount) / (count - lowerCount);
+    }
+    return bounds_.back();
+}
+
+Registry::Series& Registry::findSeries(const std::string& name,
+    const std::string& help,
+    const Type type,
+    const Labels& labels)
+{
+    auto& family = families_[name];
+    if (family.series.empty())
+    {
+        family.help = help;
+        family.type = type;
+    }
+
+    const auto formattedLabels = formatLabels(labels);
+    for (auto& series : family.series)
+    {
+        if (series.labels == formattedLabels)
+        {
+            return series;
+        }
+    }
+
+    family.series.emplace_back();
+    family.series.back().labels = formattedLabels;
+    return family.series.back();
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help, const Labels& labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = findSeries(name, help, Type::COUNTER, labels);
+    if (!series.counter)
+    {
+        series.counter = std::make_unique<Counter>();
+    }
+    return *series.counter;
+}
+
+Histogram& Registry::histogram(const std::string& name,
+    const std::string& help,
+    const Labels& labels,
+    const std::vector<double>& bounds)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = findSeries(name, help, Type::HISTOGRAM, labels);
+    if (!series.histogram)
+    {
+        series.histogram = std::make_unique<Histogram>(bounds);
+    }
+    return *series.histogram;
+}
+
+void Registry::gauge(const std::string& name,
+    const std::string& help,
+    const Labels& labels,
+    const void* owner,
+    GaugeFunction function)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = findSeries(name, help, Type::GAUGE, labels);
+    series.gauge = std::move(function);
+    series.owner = owner;
+}
+
+void Registry::removeGauges(const void* owner)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& family : families_)
+    {
+        auto& series = family.second.series;
+        series.erase(std::remove_if(series.begin(),
+                         series.end(),
+                         [owner](const Series& entry) { return entry.gauge && entry.owner == owner; }),
+            series.end());
+    }
+}
+
+std::string Registry::render() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string result;
+
+    for (const auto& entry : families_)
+    {
+        const auto& name = entry.first;
+        const auto& family = entry.second;
+        if (family.series.empty())
+        {
+            continue;
+        }
+
+        const char* typeName = family.type == Type::COUNTER ? "counter"
+            : family.type == Type::GAUGE                    ? "gauge"
+                                                            : "histogram";
+        result += "# HELP " + name + " " + family.help + "\n";
+        result += "# TYPE " + name + " " + typeName + "\n";
+
+        for (const auto& series : family.series)
+        {
+            if (series.counter)
+            {
+                result += seriesName(name, series.labels) + " " + std::to_string(series.counter->value()) + "\n";
+            }
+            else if (series.gauge)
+            {
+                result += seriesName(name, series.labels) + " " + formatValue(series.gauge()) + "\n";
+            }
+            else if (series.histogram)
+            {
+                const auto snapshot = series.histogram->snapshot();
+                const auto& bounds = series.histogram->bounds();
+                for (size_t i = 0; i <= bounds.size(); ++i)
+                {
+                    const auto bound = i < bounds.size() ? formatValue(bounds[i]) : std::string("+Inf");
+                    result += seriesName(name + "_bucket", series.labels, "le=\"" + bound + "\"") + " " +
+                        std::to_string(snapshot.cumulativeCounts[i]) + "\n";
+                }
+                result += seriesName(name + "_sum", series.labels) + " " + formatValue(snapshot.sumSeconds) + "\n";
+                result += seriesName(name + "_count", series.labels) + " " + std::to_string(snapshot.count) + "\n";
+            }
+        }
+    }
+
+    return result;
+}
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+const std::vector<double>& latencyBuckets()
+{
+    static const std::vector<double> buckets =
+        {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+    return buckets;
+}
+
+} // namespace metrics
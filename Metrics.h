@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Process wide metrics in the Prometheus text exposition format. Counters and histograms are sharded per thread:
+ * each writer thread updates its own cache line with a relaxed atomic add, and the shards are only summed when the
+ * metrics are scraped. Gauges are callbacks evaluated at scrape time.
+ */
+namespace metrics
+{
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+namespace detail
+{
+
+const size_t shardCount = 16;
+const size_t cacheLineSize = 64;
+
+/**
+ * Shard index of the calling thread, threads are assigned round robin on their first update.
+ */
+size_t threadShard();
+
+struct alignas(cacheLineSize) CounterShard
+{
+    std::atomic<uint64_t> value{0};
+};
+
+} // namespace detail
+
+class Counter
+{
+public:
+    void add(const uint64_t value) { shards_[detail::threadShard()].value.fetch_add(value, std::memory_order_relaxed); }
+    void increment() { add(1); }
+
+    uint64_t value() const;
+
+private:
+    std::array<detail::CounterShard, detail::shardCount> shards_;
+};
+
+/**
+ * Histogram of durations. Bucket bounds are upper bounds in seconds, a +Inf bucket is implied. At most 23 bounds are
+ * used.
+ */
+class Histogram
+{
+public:
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(const std::chrono::nanoseconds value);
+
+    struct Snapshot
+    {
+        std::vector<uint64_t> cumulativeCounts;
+        uint64_t count = 0;
+        double sumSeconds = 0.0;
+    };
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    Snapshot snapshot() const;
+
+    /**
+     * Estimates a quantile in seconds by interpolating within its bucket, the +Inf bucket reports the largest bound.
+     * @param q Quantile between 0 and 1.
+     */
+    double quantile(const Snapshot& snapshot, const double q) const;
+
+private:
+    static const size_t maxBuckets = 24;
+
+    // Buckets live inside the shard so that no two threads ever write to the same cache line.
+    struct alignas(detail::cacheLineSize) Shard
+    {
+        std::array<std::atomic<uint64_t>, maxBuckets> buckets{};
+        std::atomic<uint64_t> sumNanoseconds{0};
+    };
+
+    std::vector<double> bounds_;
+    std::vector<int64_t> boundsNanoseconds_;
+    std::array<Shard, detail::shardCount> shards_;
+};
+
+class Registry
+{
+public:
+    using GaugeFunction = std::function<double()>;
+
+    /**
+     * Returns the counter of name and labels, creating it on first use. The reference stays valid for the lifetime
+     * of the process.
+     */
+    Counter& counter(const std::string& name, const std::string& help, const Labels& labels);
+
+    Histogram& histogram(const std::string& name,
+        const std::string& help,
+        const Labels& labels,
+        const std::vector<double>& bounds);
+
+    /**
+     * Adds a gauge evaluated on the scraping thread, it must be removed with removeGauges before anything it
+     * captures is destroyed.
+     */
+    void gauge(const std::string& name,
+        const std::string& help,
+        const Labels& labels,
+        const void* owner,
+        GaugeFunction function);
+
+    void removeGauges(const void* owner);
+
+    std::string render() const;
+
+private:
+    enum class Type
+    {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    struct Series
+    {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Histogram> histogram;
+        GaugeFunction gauge;
+        const void* owner = nullptr;
+    };
+
+    struct Family
+    {
+        std::string help;
+        Type type = Type::COUNTER;
+        std::vector<Series> series;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+
+    Series& findSeries(const std::string& name, const std::string& help, const Type type, const Labels& labels);
+};
+
+Registry& registry();
+
+/**
+ * Latency bucket bounds from 100 us to 10 s.
+ */
+const std::vector<double>& latencyBuckets();
+
+} // namespace metrics
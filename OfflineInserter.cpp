@@ -0,0 +1,297 @@
+#define GST_USE_UNSTABLE_API 1
+
+#include "OfflineInserter.h"
+#include "CueScheduler.h"
+#include "HlsWriter.h"
+#include "Logger.h"
+#include "SpliceFactory.h"
+#include "SpliceInjector.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+const uint16_t scte35Pid = 35;
+const size_t chunkPackets = 64;
+const size_t writeSize = 4 * 1024 * 1024;
+// Processed input pages are dropped in windows of this size, bounding the resident part of the mapping.
+const size_t inputWindowSize = 16 * 1024 * 1024;
+
+} // namespace
+
+const size_t OfflineInserter::maxResidentBytes = 2 * inputWindowSize + writeSize * 2;
+
+class OfflineInserter::Impl
+{
+public:
+    explicit Impl(const ChannelConfig& config);
+
+    bool run(OfflineStats& stats);
+
+private:
+    static constexpr std::chrono::seconds splicePreroll = std::chrono::seconds(4);
+
+    std::string name_;
+    std::string inputFileName_;
+    std::string outputFileName_;
+    bool hasInterval_;
+    SpliceFactory spliceFactory_;
+    SpliceInjector spliceInjector_;
+    CueScheduler cueScheduler_;
+    bool cuesValid_;
+    uint32_t insertedCues_;
+    int32_t outputFile_;
+    std::unique_ptr<HlsWriter> hls_;
+    std::vector<uint8_t> output_;
+
+    void insertCue(const SpliceRequest& request);
+    bool writeOutput(OfflineStats& stats);
+};
+
+OfflineInserter::Impl::Impl(const ChannelConfig& config)
+    : name_(config.name),
+      inputFileName_(config.inputFile),
+      outputFileName_(config.outputFile),
+      hasInterval_(config.spliceInterval.count() != 0),
+      spliceFactory_(config.spliceDuration, config.immediate, config.autoReturn),
+      spliceInjector_(scte35Pid),
+      cueScheduler_(config.name, splicePreroll, [this](const SpliceRequest& request) { insertCue(request); }),
+      cuesValid_(cueScheduler_.load(config)),
+      insertedCues_(0),
+      outputFile_(-1)
+{
+    if (config.mergeUpstreamCues)
+    {
+        spliceFactory_.setEventIdBase(SpliceFactory::mergedEventIdBase);
+        spliceInjector_.mergeUpstream([this](const uint8_t* section, const size_t size) {
+            spliceFactory_.reserveEventIds(section, size);
+        });
+    }
+    if (!config.hls.directory.empty())
+    {
+        hls_ = std::make_unique<HlsWriter>(config.name, config.hls);
+    }
+    output_.reserve(writeSize + chunkPackets * utils::ts::packetSize * 2);
+}
+
+void OfflineInserter::Impl::insertCue(const SpliceRequest& request)
+{
+    // Interval cues have no splice time of their own, they splice one preroll ahead like the live engines.
+    uint64_t spliceTime = 0;
+    bool aligned = false;
+    if (request.spliceTime)
+    {
+        spliceTime = *request.spliceTime;
+    }
+    else if (!spliceInjector_.videoClock().splicePts(
+                 static_cast<uint64_t>(splicePreroll.count()) * utils::ts::ptsClockRate, spliceTime, aligned))
+    {
+        return;
+    }
+
+    std::array<uint8_t, maxSpliceInfoSectionSize> section;
+    const auto spliceInfo = spliceFactory_.makeSpliceInfo(request, spliceTime);
+
+    if (request.command == SpliceCommand::TIME_SIGNAL)
+    {
+        Logger::log("[%s] SCTE-35 time_signal: pts %llu", name_.c_str(), static_cast<unsigned long long>(spliceTime));
+    }
+    else
+    {
+        const auto& spliceInsert = spliceInfo.spliceInsert;
+        Logger::log("[%s] SCTE-35 splice_insert: %s pts %llu, %s, immediate %c, duration %llu s",
+            name_.c_str(),
+            request.type == SpliceType::IN ? "IN" : "OUT",
+            static_cast<unsigned long long>(spliceTime),
+            aligned ? "GOP aligned" : "not GOP aligned",
+            spliceInsert.immediate ? 't' : 'f',
+            static_cast<unsigned long long>(spliceInsert.breakDuration / utils::ts::ptsClockRate));
+    }
+
+    const auto sectionSize = writeSpliceInfoSection(spliceInfo, section.data(), section.size());
+    if (sectionSize != 0)
+    {
+        spliceInjector_.queueSection(section.data(), sectionSize);
+        ++insertedCues_;
+    }
+}
+
+bool OfflineInserter::Impl::writeOutput(OfflineStats& stats)
+{
+    if (hls_)
+    {
+        hls_->write(output_.data(), output_.size());
+    }
+
+    size_t written = 0;
+    while (outputFile_ >= 0 && written < output_.size())
+    {
+        const auto result = write(outputFile_, output_.data() + written, output_.size() - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Logger::error("[%s] Unable to write output file: %s", name_.c_str(), strerror(errno));
+            return false;
+        }
+        written += static_cast<size_t>(result);
+    }
+    stats.bytesOut += output_.size();
+    output_.clear();
+    return true;
+}
+
+bool OfflineInserter::Impl::run(OfflineStats& stats)
+{
+    const auto start = std::chrono::steady_clock::now();
+    if (!cuesValid_)
+    {
+        return false;
+    }
+
+    const auto inputFile = open(inputFileName_.c_str(), O_RDONLY);
+    if (inputFile < 0)
+    {
+        Logger::error("[%s] Unable to open input file %s: %s", name_.c_str(), inputFileName_.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat inputStat = {};
+    fstat(inputFile, &inputStat);
+    const auto inputSize = static_cast<size_t>(inputStat.st_size);
+    const uint8_t* input = nullptr;
+    if (inputSize != 0)
+    {
+        auto mapping = mmap(nullptr, inputSize, PROT_READ, MAP_PRIVATE, inputFile, 0);
+        if (mapping == MAP_FAILED)
+        {
+            Logger::error("[%s] Unable to map input file %s: %s", name_.c_str(), inputFileName_.c_str(),
+                strerror(errno));
+            close(inputFile);
+            return false;
+        }
+        madvise(mapping, inputSize, MADV_SEQUENTIAL);
+        input = static_cast<const uint8_t*>(mapping);
+    }
+    close(inputFile);
+
+    if (hls_ && !hls_->isOpen())
+    {
+        if (input)
+        {
+            munmap(const_cast<uint8_t*>(input), inputSize);
+        }
+        return false;
+    }
+
+    // Truncating the input would fault the reads of its mapping.
+    struct stat outputStat = {};
+    if (!outputFileName_.empty() && stat(outputFileName_.c_str(), &outputStat) == 0 &&
+        outputStat.st_dev == inputStat.st_dev && outputStat.st_ino == inputStat.st_ino)
+    {
+        Logger::error("[%s] Output file %s is the input file", name_.c_str(), outputFileName_.c_str());
+        if (input)
+        {
+            munmap(const_cast<uint8_t*>(input), inputSize);
+        }
+        return false;
+    }
+
+    // With an HLS output the output file is optional.
+    outputFile_ = outputFileName_.empty() ? -1 : open(outputFileName_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFile_ < 0 && !outputFileName_.empty())
+    {
+        Logger::error("[%s] Unable to open output file %s: %s", name_.c_str(), outputFileName_.c_str(),
+            strerror(errno));
+        if (input)
+        {
+            munmap(const_cast<uint8_t*>(input), inputSize);
+        }
+        return false;
+    }
+
+    auto offset = utils::ts::findSync(input, inputSize);
+    if (offset != 0 && offset != inputSize)
+    {
+        Logger::warning("[%s] Skipping %zu bytes before the first sync byte", name_.c_str(), offset);
+    }
+
+    bool result = true;
+    const auto chunkSize = chunkPackets * utils::ts::packetSize;
+    size_t droppedSize = 0;
+    while (result && offset + utils::ts::packetSize <= inputSize)
+    {
+        if (offset - droppedSize >= 2 * inputWindowSize)
+        {
+            madvise(const_cast<uint8_t*>(input) + droppedSize, inputWindowSize, MADV_DONTNEED);
+            droppedSize += inputWindowSize;
+        }
+
+        const auto size = std::min(chunkSize, (inputSize - offset) / utils::ts::packetSize * utils::ts::packetSize);
+        cueScheduler_.onVideoClock(spliceInjector_.videoClock());
+        spliceInjector_.process(input + offset, size, output_);
+        offset += size;
+        stats.bytesIn += size;
+
+        if (output_.size() >= writeSize)
+        {
+            result = writeOutput(stats);
+        }
+    }
+    result = result && writeOutput(stats);
+
+    if (input)
+    {
+        munmap(const_cast<uint8_t*>(input), inputSize);
+    }
+    if (outputFile_ >= 0)
+    {
+        close(outputFile_);
+        outputFile_ = -1;
+    }
+    if (hls_)
+    {
+        hls_->finish();
+    }
+
+    if (!hasInterval_ && cueScheduler_.pending() != 0)
+    {
+        Logger::warning("[%s] %zu cues are beyond the end of the input", name_.c_str(), cueScheduler_.pending());
+    }
+
+    stats.cues = insertedCues_;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Logger::log("[%s] Wrote %s: %.1f MB in %.3f s, %.1f MB/s, %u cues",
+        name_.c_str(),
+        outputFileName_.empty() ? hls_->directory().c_str() : outputFileName_.c_str(),
+        static_cast<double>(stats.bytesOut) / 1e6,
+        stats.seconds,
+        stats.seconds > 0.0 ? static_cast<double>(stats.bytesIn) / 1e6 / stats.seconds : 0.0,
+        stats.cues);
+    return result;
+}
+
+OfflineInserter::OfflineInserter(const ChannelConfig& config) : impl_(std::make_unique<OfflineInserter::Impl>(config))
+{
+}
+
+OfflineInserter::~OfflineInserter() // NOLINT(modernize-use-equals-default)
+{
+}
+
+bool OfflineInserter::run(OfflineStats& stats)
+{
+    return impl_->run(stats);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Result of one offline run.
+ */
+struct OfflineStats
+{
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint32_t cues = 0;
+    double seconds = 0.0;
+};
+
+/**
+ * File to file insertion for archived streams. The input file is memory mapped and run through the passthrough
+ * SpliceInjector as fast as the disk allows, with cues placed at offsets from the first video PTS instead of wall
+ * clock timers.
+ */
+class OfflineInserter
+{
+public:
+    /**
+     * Upper bound of the memory one run keeps resident: the mapped input window and the output buffer.
+     */
+    static const size_t maxResidentBytes;
+
+    explicit OfflineInserter(const ChannelConfig& config);
+    ~OfflineInserter();
+
+    /**
+     * Processes the whole input file, blocking until it is written.
+     * @return False if the input or output could not be opened, a cue was invalid or a write failed.
+     */
+    bool run(OfflineStats& stats);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
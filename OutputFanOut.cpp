@@ -0,0 +1,225 @@
+#include "OutputFanOut.h"
+#include "HlsWriter.h"
+#include "Logger.h"
+#include "UdpSender.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+OutputFanOut::Output::Output(const std::string& channel, const std::string& name)
+    : name(name),
+      file(-1),
+      queuedBytes(0),
+      running(true),
+      drops(metrics::registry().counter("scte35_output_drops_total",
+          "Output bytes dropped because the queue of the output was full",
+          {{"channel", channel}, {"output", name}})),
+      loggedDrops(drops.value())
+{
+}
+
+OutputFanOut::OutputFanOut(const ChannelConfig& config) : name_(config.name), queueSize_(config.outputQueueSize)
+{
+    if (!config.outputAddress.first.empty())
+    {
+        addUdpOutput(config.outputAddress, config.udpOptions);
+    }
+    for (const auto& address : config.extraOutputAddresses)
+    {
+        addUdpOutput(address, config.udpOptions);
+    }
+    if (!config.outputFile.empty())
+    {
+        addFileOutput(config.outputFile);
+    }
+    for (const auto& fileName : config.extraOutputFiles)
+    {
+        addFileOutput(fileName);
+    }
+    if (!config.hls.directory.empty())
+    {
+        addHlsOutput(config.hls);
+    }
+
+    for (auto& output : outputs_)
+    {
+        auto outputPointer = output.get();
+        metrics::registry().gauge("scte35_output_queued_bytes",
+            "Output bytes queued for the output",
+            {{"channel", name_}, {"output", output->name}},
+            this,
+            [outputPointer]() {
+                std::lock_guard<std::mutex> lock(outputPointer->mutex);
+                return static_cast<double>(outputPointer->queuedBytes);
+            });
+        output->thread = std::thread(&OutputFanOut::threadFunction, this, std::ref(*output));
+    }
+
+    Logger::log("[%s] %zu outputs, %zu kB queue each", name_.c_str(), outputs_.size(), queueSize_ / 1024);
+}
+
+OutputFanOut::~OutputFanOut()
+{
+    metrics::registry().removeGauges(this);
+    for (auto& output : outputs_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(output->mutex);
+            output->running = false;
+        }
+        output->condition.notify_one();
+    }
+
+    for (auto& output : outputs_)
+    {
+        if (output->thread.joinable())
+        {
+            output->thread.join();
+        }
+        if (output->file >= 0)
+        {
+            close(output->file);
+        }
+    }
+}
+
+bool OutputFanOut::isOpen() const
+{
+    for (const auto& output : outputs_)
+    {
+        if ((!output->sender || !output->sender->isOpen()) && (!output->hls || !output->hls->isOpen()) &&
+            output->file < 0)
+        {
+            return false;
+        }
+    }
+    return !outputs_.empty();
+}
+
+void OutputFanOut::send(const Chunk& chunk)
+{
+    if (chunk.size == 0)
+    {
+        return;
+    }
+
+    for (auto& output : outputs_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(output->mutex);
+            if (output->queuedBytes + chunk.size <= queueSize_)
+            {
+                output->chunks.push_back(chunk);
+                output->queuedBytes += chunk.size;
+                output->condition.notify_one();
+                continue;
+            }
+        }
+
+        // Whole chunks are dropped, so the output stays aligned to TS packets.
+        output->drops.add(chunk.size);
+        const auto now = std::chrono::steady_clock::now();
+        if (now - output->lastDropLog >= dropLogInterval)
+        {
+            const auto dropped = output->drops.value();
+            Logger::warning("[%s] Output %s is falling behind, dropped %llu bytes",
+                name_.c_str(),
+                output->name.c_str(),
+                static_cast<unsigned long long>(dropped - output->loggedDrops));
+            output->loggedDrops = dropped;
+            output->lastDropLog = now;
+        }
+    }
+}
+
+void OutputFanOut::addUdpOutput(const std::pair<std::string, uint32_t>& address, const UdpOptions& options)
+{
+    auto output = std::make_unique<Output>(name_, address.first + ":" + std::to_string(address.second));
+    output->sender = std::make_unique<UdpSender>(address, options);
+    outputs_.push_back(std::move(output));
+}
+
+void OutputFanOut::addFileOutput(const std::string& fileName)
+{
+    auto output = std::make_unique<Output>(name_, fileName);
+    output->file = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output->file < 0)
+    {
+        Logger::error("[%s] Unable to open output file %s: %s", name_.c_str(), fileName.c_str(), strerror(errno));
+    }
+    outputs_.push_back(std::move(output));
+}
+
+void OutputFanOut::addHlsOutput(const HlsOptions& options)
+{
+    auto output = std::make_unique<Output>(name_, options.directory);
+    output->hls = std::make_unique<HlsWriter>(name_, options);
+    outputs_.push_back(std::move(output));
+}
+
+void OutputFanOut::threadFunction(Output& output)
+{
+    std::unique_lock<std::mutex> lock(output.mutex);
+    for (;;)
+    {
+        output.condition.wait(lock, [&output]() { return !output.chunks.empty() || !output.running; });
+        if (output.chunks.empty())
+        {
+            break;
+        }
+
+        const auto chunk = std::move(output.chunks.front());
+        output.chunks.pop_front();
+        lock.unlock();
+        write(output, chunk);
+        lock.lock();
+        output.queuedBytes -= chunk.size;
+    }
+
+    if (output.sender)
+    {
+        output.sender->flush();
+    }
+    if (output.hls)
+    {
+        output.hls->finish();
+    }
+}
+
+void OutputFanOut::write(Output& output, const Chunk& chunk)
+{
+    if (output.sender)
+    {
+        output.sender->send(chunk.data, chunk.size);
+        return;
+    }
+    if (output.hls)
+    {
+        output.hls->write(chunk.data, chunk.size);
+        return;
+    }
+    if (output.file < 0)
+    {
+        return;
+    }
+
+    size_t written = 0;
+    while (written < chunk.size)
+    {
+        const auto result = ::write(output.file, chunk.data + written, chunk.size - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Logger::error("[%s] Unable to write output file %s: %s",
+                name_.c_str(),
+                output.name.c_str(),
+                strerror(errno));
+            return;
+        }
+        written += static_cast<size_t>(result);
+    }
+}
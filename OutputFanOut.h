@@ -0,0 +1,90 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "Metrics.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HlsWriter;
+class UdpSender;
+
+/**
+ * Sends the output of one mux to all UDP destinations, files and the HLS output of a channel. Every output has its
+ * own thread and a queue of references to the chunks the mux wrote, so a chunk is shared by the outputs instead of
+ * copied. An output that falls behind, e.g. a file on a stalled disk, drops whole chunks once it has outputQueueSize
+ * bytes queued instead of holding up the mux and the other outputs.
+ */
+class OutputFanOut
+{
+public:
+    /**
+     * Output bytes and the owner that keeps them valid until every output wrote them.
+     */
+    struct Chunk
+    {
+        std::shared_ptr<const void> owner;
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    explicit OutputFanOut(const ChannelConfig& config);
+
+    /**
+     * Writes the queued chunks and stops the output threads.
+     */
+    ~OutputFanOut();
+
+    OutputFanOut(const OutputFanOut&) = delete;
+    OutputFanOut& operator=(const OutputFanOut&) = delete;
+
+    /**
+     * @return False if any output could not be opened.
+     */
+    [[nodiscard]] bool isOpen() const;
+
+    /**
+     * Queues chunk on every output, never blocks on an output.
+     */
+    void send(const Chunk& chunk);
+
+private:
+    static constexpr std::chrono::seconds dropLogInterval = std::chrono::seconds(10);
+
+    struct Output
+    {
+        Output(const std::string& channel, const std::string& name);
+
+        std::string name;
+        std::unique_ptr<UdpSender> sender;
+        std::unique_ptr<HlsWriter> hls;
+        int32_t file;
+        std::mutex mutex;
+        std::condition_variable condition;
+        // Chunks stay counted in queuedBytes until they are written.
+        std::deque<Chunk> chunks;
+        size_t queuedBytes;
+        bool running;
+        metrics::Counter& drops;
+        uint64_t loggedDrops;
+        std::chrono::steady_clock::time_point lastDropLog;
+        std::thread thread;
+    };
+
+    std::string name_;
+    size_t queueSize_;
+    std::vector<std::unique_ptr<Output>> outputs_;
+
+    void addUdpOutput(const std::pair<std::string, uint32_t>& address, const UdpOptions& options);
+    void addFileOutput(const std::string& fileName);
+    void addHlsOutput(const HlsOptions& options);
+    void threadFunction(Output& output);
+    void write(Output& output, const Chunk& chunk);
+};
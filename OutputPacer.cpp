@@ -0,0 +1,433 @@
+#include "OutputPacer.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <sys/prctl.h>
+
+namespace
+{
+
+const uint64_t pcrModulo = utils::ts::ptsModulo * 300;
+const std::chrono::seconds discontinuityThreshold(1);
+// Wakes early from the condition and sleeps the rest with clock_nanosleep, which is far more precise.
+const std::chrono::milliseconds preciseSleepTime(2);
+const int64_t pcrTolerancePpm = 30;
+
+const std::vector<double> pacingBuckets = {0.0000005,
+    0.000001,
+    0.0000025,
+    0.000005,
+    0.00001,
+    0.000025,
+    0.00005,
+    0.0001,
+    0.00025,
+    0.0005,
+    0.001,
+    0.0025,
+    0.01};
+
+/**
+ * @return Signed distance from 27 MHz PCR from to PCR to, across a wrap of the PCR range.
+ */
+int64_t pcrDifference(const uint64_t to, const uint64_t from)
+{
+    auto difference = static_cast<int64_t>((to + pcrModulo - from) % pcrModulo);
+    if (difference >= static_cast<int64_t>(pcrModulo / 2))
+    {
+        difference -= static_cast<int64_t>(pcrModulo);
+    }
+    return difference;
+}
+
+void writeNullPacket(uint8_t* packet)
+{
+    utils::ts::writeHeader(packet, utils::ts::nullPid, false, 0);
+    memset(packet + 4, 0xFF, utils::ts::packetSize - 4);
+}
+
+} // namespace
+
+OutputPacer::OutputPacer(const std::string& output, const PacingOptions& options, SendFunction send)
+    : output_(output),
+      options_(options),
+      send_(std::move(send)),
+      pcrPid_(utils::ts::nullPid),
+      anchored_(false),
+      anchorPcr_(0),
+      filteredErrorNs_(0),
+      loggedDrops_(0),
+      running_(true),
+      sendError_(metrics::registry().histogram("scte35_paced_send_error_seconds",
+          "Absolute difference between the due and the actual send time of the paced datagrams",
+          {{"output", output}},
+          pacingBuckets)),
+      pcrJitterHistogram_(metrics::registry().histogram("scte35_paced_pcr_jitter_seconds",
+          "Absolute difference between the send time and the PCR difference of consecutive paced PCRs",
+          {{"output", output}},
+          pacingBuckets)),
+      stuffingPackets_(metrics::registry().counter("scte35_paced_stuffing_packets_total",
+          "Null packets sent to keep the output at its constant bitrate",
+          {{"output", output}})),
+      drops_(metrics::registry().counter("scte35_paced_drops_total",
+          "Packets dropped because the pacing queue was full",
+          {{"output", output}}))
+{
+    loggedDrops_ = drops_.value();
+    partial_.reserve(utils::ts::packetSize);
+    thread_ = std::thread(&OutputPacer::threadFunction, this);
+
+    if (options_.cbrBitrate != 0)
+    {
+        Logger::log("Output %s paced at %.3f Mbps CBR, delay %lld ms",
+            output_.c_str(),
+            static_cast<double>(options_.cbrBitrate) / 1000000.0,
+            static_cast<long long>(options_.delay.count()));
+    }
+    else
+    {
+        Logger::log("Output %s paced by PCR, delay %lld ms",
+            output_.c_str(),
+            static_cast<long long>(options_.delay.count()));
+    }
+}
+
+OutputPacer::~OutputPacer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    condition_.notify_one();
+    thread_.join();
+}
+
+void OutputPacer::push(const uint8_t* data, const size_t size)
+{
+    const auto now = Clock::now();
+    size_t offset = 0;
+
+    if (!partial_.empty())
+    {
+        offset = std::min(utils::ts::packetSize - partial_.size(), size);
+        partial_.insert(partial_.end(), data, data + offset);
+        if (partial_.size() < utils::ts::packetSize)
+        {
+            return;
+        }
+        onPacket(partial_.data(), now);
+        partial_.clear();
+    }
+
+    for (; size - offset >= utils::ts::packetSize; offset += utils::ts::packetSize)
+    {
+        onPacket(data + offset, now);
+    }
+    partial_.insert(partial_.end(), data + offset, data + size);
+
+    // Without PCRs, e.g. before the PCR PID starts or after it stopped, the packets leave unpaced.
+    if (!unscheduled_.empty() && now - unscheduled_.front().arrival > options_.delay)
+    {
+        scheduleUnpaced();
+    }
+    commit();
+}
+
+void OutputPacer::flush()
+{
+    scheduleUnpaced();
+    commit();
+}
+
+void OutputPacer::onPacket(const uint8_t* data, const Clock::time_point now)
+{
+    Packet packet;
+    memcpy(packet.data.data(), data, utils::ts::packetSize);
+    packet.arrival = now;
+    packet.time = now;
+    packet.hasPcr = false;
+
+    const auto pid = utils::ts::pid(data);
+    uint64_t pcr = 0;
+    if ((pcrPid_ == utils::ts::nullPid || pid == pcrPid_) && utils::ts::readPcr(data, pcr))
+    {
+        pcrPid_ = pid;
+        packet.hasPcr = true;
+        const auto hasPreviousPcr = !unscheduled_.empty() && unscheduled_.front().hasPcr;
+        const auto previousTime = hasPreviousPcr ? unscheduled_.front().time : Clock::time_point();
+        const auto time = pcrTime(pcr, now);
+
+        // The packets since the previous PCR are spread evenly up to this one.
+        const auto count = static_cast<int64_t>(unscheduled_.size());
+        for (int64_t i = 0; i < count; ++i)
+        {
+            unscheduled_[i].time = hasPreviousPcr && time > previousTime ?
+                previousTime + (time - previousTime) * i / count :
+                time;
+        }
+        ready_.insert(ready_.end(), unscheduled_.begin(), unscheduled_.end());
+        unscheduled_.clear();
+        packet.time = time;
+    }
+    unscheduled_.push_back(packet);
+}
+
+OutputPacer::Clock::time_point OutputPacer::pcrTime(const uint64_t pcr, const Clock::time_point now)
+{
+    const auto expected = now + options_.delay;
+    const auto time = anchorTime_ + std::chrono::nanoseconds(pcrDifference(pcr, anchorPcr_) * 1000 / 27);
+    const auto error = std::chrono::duration_cast<std::chrono::nanoseconds>(expected - time);
+
+    if (!anchored_ || std::chrono::abs(error) > discontinuityThreshold)
+    {
+        if (anchored_)
+        {
+            Logger::warning("Output %s PCR is %.1f ms off its send time, re-anchoring the pacing",
+                output_.c_str(),
+                std::chrono::duration<double, std::milli>(error).count());
+        }
+        anchored_ = true;
+        anchorPcr_ = pcr;
+        anchorTime_ = expected;
+        filteredErrorNs_ = 0;
+        return expected;
+    }
+
+    // Inside a quarter of the delay the queue absorbs the drift, beyond it the clock slews at the PCR tolerance.
+    filteredErrorNs_ += (error.count() - filteredErrorNs_) / 256;
+    const auto interval = std::max<int64_t>(std::chrono::nanoseconds(time - anchorTime_).count(), 0);
+    const auto maxStep = interval * pcrTolerancePpm / 1000000;
+    const auto deadband = std::chrono::nanoseconds(options_.delay).count() / 4;
+    auto step = int64_t(0);
+    if (std::abs(filteredErrorNs_) > deadband)
+    {
+        step = std::clamp(filteredErrorNs_, -maxStep, maxStep);
+    }
+
+    // The anchor moves to every PCR, so the PCR differences stay far from a wrap.
+    anchorPcr_ = pcr;
+    anchorTime_ = time + std::chrono::nanoseconds(step);
+    return anchorTime_;
+}
+
+void OutputPacer::scheduleUnpaced()
+{
+    for (auto& packet : unscheduled_)
+    {
+        packet.time = packet.hasPcr ? packet.time : packet.arrival + options_.delay;
+    }
+    ready_.insert(ready_.end(), unscheduled_.begin(), unscheduled_.end());
+    unscheduled_.clear();
+}
+
+void OutputPacer::commit()
+{
+    if (ready_.empty())
+    {
+        return;
+    }
+
+    size_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto free = maxQueuedPackets - std::min(scheduled_.size(), maxQueuedPackets);
+        const auto accepted = std::min(free, ready_.size());
+        scheduled_.insert(scheduled_.end(), ready_.begin(), ready_.begin() + static_cast<ptrdiff_t>(accepted));
+        dropped = ready_.size() - accepted;
+    }
+    condition_.notify_one();
+    ready_.clear();
+
+    if (dropped == 0)
+    {
+        return;
+    }
+    drops_.add(dropped);
+    const auto now = Clock::now();
+    if (now - lastDropLog_ >= dropLogInterval)
+    {
+        const auto drops = drops_.value();
+        Logger::warning("Output %s pacing queue full, dropped %llu packets",
+            output_.c_str(),
+            static_cast<unsigned long long>(drops - loggedDrops_));
+        loggedDrops_ = drops;
+        lastDropLog_ = now;
+    }
+}
+
+void OutputPacer::threadFunction()
+{
+    // The default timer slack of 50 us would dominate the pacing error.
+    prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+    lastStatsLog_ = Clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (options_.cbrBitrate != 0)
+    {
+        paceCbr(lock);
+    }
+    else
+    {
+        pacePcr(lock);
+    }
+}
+
+void OutputPacer::pacePcr(std::unique_lock<std::mutex>& lock)
+{
+    std::array<uint8_t, packetsPerDatagram * utils::ts::packetSize> datagram;
+    while (running_)
+    {
+        if (scheduled_.empty())
+        {
+            condition_.wait(lock);
+            continue;
+        }
+
+        const auto due = scheduled_.front().time;
+        if (!waitUntil(lock, due))
+        {
+            break;
+        }
+
+        size_t count = 0;
+        do
+        {
+            memcpy(datagram.data() + count * utils::ts::packetSize,
+                scheduled_.front().data.data(),
+                utils::ts::packetSize);
+            scheduled_.pop_front();
+            ++count;
+        } while (count < packetsPerDatagram && !scheduled_.empty() && !scheduled_.front().hasPcr);
+
+        lock.unlock();
+        sendDatagram(datagram.data(), count, due, 0.0);
+        lock.lock();
+    }
+}
+
+void OutputPacer::paceCbr(std::unique_lock<std::mutex>& lock)
+{
+    std::array<uint8_t, packetsPerDatagram * utils::ts::packetSize> datagram;
+    const auto packetNs =
+        static_cast<double>(utils::ts::packetSize * 8) * 1e9 / static_cast<double>(options_.cbrBitrate);
+
+    condition_.wait(lock, [this]() { return !scheduled_.empty() || !running_; });
+    const auto start = running_ ? scheduled_.front().time : Clock::now();
+    uint64_t slot = 0;
+
+    while (running_)
+    {
+        // Slot times follow from the slot count, so the rounding errors do not add up.
+        const auto slotTime = [&](const uint64_t packet) {
+            return start + std::chrono::nanoseconds(std::llround(static_cast<double>(packet) * packetNs));
+        };
+        const auto due = slotTime(slot * packetsPerDatagram);
+        if (!waitUntil(lock, due))
+        {
+            break;
+        }
+
+        const auto late = Clock::now() - due;
+        if (late > options_.delay)
+        {
+            const auto skipped = static_cast<uint64_t>(
+                std::chrono::duration<double, std::nano>(late).count() / (packetNs * packetsPerDatagram));
+            Logger::warning("Output %s pacing fell %.1f ms behind, skipping %llu slots",
+                output_.c_str(),
+                std::chrono::duration<double, std::milli>(late).count(),
+                static_cast<unsigned long long>(skipped));
+            slot += skipped;
+            continue;
+        }
+
+        uint64_t nulls = 0;
+        for (size_t i = 0; i < packetsPerDatagram; ++i)
+        {
+            const auto packet = datagram.data() + i * utils::ts::packetSize;
+            const auto packetTime = slotTime(slot * packetsPerDatagram + i);
+            if (scheduled_.empty() || scheduled_.front().time > packetTime)
+            {
+                writeNullPacket(packet);
+                ++nulls;
+                continue;
+            }
+
+            const auto& next = scheduled_.front();
+            memcpy(packet, next.data.data(), utils::ts::packetSize);
+            uint64_t pcr = 0;
+            if (next.hasPcr && utils::ts::readPcr(packet, pcr))
+            {
+                // The PCR moves with the packet from its due time to its slot.
+                const auto shift = std::chrono::duration_cast<std::chrono::nanoseconds>(packetTime - next.time);
+                utils::ts::writePcr(packet, (pcr + static_cast<uint64_t>(shift.count()) * 27 / 1000) % pcrModulo);
+            }
+            scheduled_.pop_front();
+        }
+
+        lock.unlock();
+        stuffingPackets_.add(nulls);
+        sendDatagram(datagram.data(), packetsPerDatagram, due, packetNs);
+        lock.lock();
+        ++slot;
+    }
+}
+
+bool OutputPacer::waitUntil(std::unique_lock<std::mutex>& lock, const Clock::time_point time)
+{
+    while (running_ && Clock::now() < time - preciseSleepTime)
+    {
+        condition_.wait_until(lock, time - preciseSleepTime);
+    }
+    if (!running_)
+    {
+        return false;
+    }
+
+    const auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    timespec wakeTime = {};
+    wakeTime.tv_sec = static_cast<time_t>(sinceEpoch / 1000000000);
+    wakeTime.tv_nsec = static_cast<long>(sinceEpoch % 1000000000);
+    lock.unlock();
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, nullptr) == EINTR)
+    {
+    }
+    lock.lock();
+    return running_;
+}
+
+void OutputPacer::sendDatagram(const uint8_t* data,
+    const size_t packets,
+    const Clock::time_point due,
+    const double packetNs)
+{
+    send_(data, packets * utils::ts::packetSize);
+
+    const auto sent = Clock::now();
+    sendError_.observe(std::chrono::abs(std::chrono::duration_cast<std::chrono::nanoseconds>(sent - due)));
+    for (size_t i = 0; i < packets; ++i)
+    {
+        // A PCR is measured at the position of its packet in the stream, at the bitrate with CBR.
+        const auto packetTime = sent + std::chrono::nanoseconds(std::llround(static_cast<double>(i) * packetNs));
+        std::chrono::nanoseconds jitter;
+        if (pcrJitter_.onPacket(data + i * utils::ts::packetSize, packetTime, jitter))
+        {
+            pcrJitterHistogram_.observe(std::chrono::abs(jitter));
+        }
+    }
+
+    if (sent - lastStatsLog_ >= statsInterval)
+    {
+        const auto sendError = sendError_.snapshot();
+        const auto pcrJitter = pcrJitterHistogram_.snapshot();
+        Logger::log("Output %s pacing: send error p50 %.1f us, p99 %.1f us, PCR jitter p99 %.1f us, %llu null packets",
+            output_.c_str(),
+            sendError_.quantile(sendError, 0.5) * 1e6,
+            sendError_.quantile(sendError, 0.99) * 1e6,
+            pcrJitterHistogram_.quantile(pcrJitter, 0.99) * 1e6,
+            static_cast<unsigned long long>(stuffingPackets_.value()));
+        lastStatsLog_ = sent;
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "Metrics.h"
+#include "utils/PcrJitter.h"
+#include "utils/TsPacket.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Paces a TS output, see PacingOptions. Every packet gets a send time from the PCRs around it: a PCR packet is due
+ * the delay after the PCR clock reaches its value, and the packets between two PCRs are spread evenly between them.
+ * A thread sleeps until each datagram is due; a datagram never continues past a PCR packet, so PCR packets leave at
+ * their PCR. With a CBR bitrate the thread instead sends 7 packets every slot of the bitrate, stuffed with null
+ * packets when none is due, and restamps each PCR with the time of its slot.
+ *
+ * The PCR clock is anchored at the first PCR. It is slewed at no more than the 30 ppm PCR tolerance once the PCRs
+ * arrive off their send times by more than a quarter of the delay, so a drifting input clock neither grows nor drains
+ * the queue, and a PCR more than a second off re-anchors it.
+ */
+class OutputPacer
+{
+public:
+    using SendFunction = std::function<void(const uint8_t* data, const size_t size)>;
+
+    /**
+     * @param output Name of the output in the metrics and log messages.
+     * @param send Sends one datagram, called on the pacing thread.
+     */
+    OutputPacer(const std::string& output, const PacingOptions& options, SendFunction send);
+    ~OutputPacer();
+
+    OutputPacer(const OutputPacer&) = delete;
+    OutputPacer& operator=(const OutputPacer&) = delete;
+
+    /**
+     * Queues the TS packets of data, a trailing partial packet is kept until the next call. Called from one thread.
+     */
+    void push(const uint8_t* data, const size_t size);
+
+    /**
+     * Schedules the packets that still wait for their next PCR, at their arrival plus the delay.
+     */
+    void flush();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Packet
+    {
+        std::array<uint8_t, utils::ts::packetSize> data;
+        Clock::time_point arrival;
+        // Send time, only set for PCR packets until the packet is scheduled.
+        Clock::time_point time;
+        bool hasPcr;
+    };
+
+    static const size_t packetsPerDatagram = 7;
+    static const size_t maxQueuedPackets = 65536;
+    static constexpr std::chrono::seconds statsInterval = std::chrono::seconds(60);
+    static constexpr std::chrono::seconds dropLogInterval = std::chrono::seconds(10);
+
+    std::string output_;
+    PacingOptions options_;
+    SendFunction send_;
+
+    // Only touched by the pushing thread.
+    std::vector<uint8_t> partial_;
+    std::vector<Packet> unscheduled_;
+    std::vector<Packet> ready_;
+    uint16_t pcrPid_;
+    bool anchored_;
+    uint64_t anchorPcr_;
+    Clock::time_point anchorTime_;
+    int64_t filteredErrorNs_;
+    uint64_t loggedDrops_;
+    Clock::time_point lastDropLog_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<Packet> scheduled_;
+    bool running_;
+
+    // Only touched by the pacing thread.
+    utils::ts::PcrJitter pcrJitter_;
+    Clock::time_point lastStatsLog_;
+
+    metrics::Histogram& sendError_;
+    metrics::Histogram& pcrJitterHistogram_;
+    metrics::Counter& stuffingPackets_;
+    metrics::Counter& drops_;
+
+    std::thread thread_;
+
+    void onPacket(const uint8_t* data, const Clock::time_point now);
+    Clock::time_point pcrTime(const uint64_t pcr, const Clock::time_point now);
+    void scheduleUnpaced();
+    void commit();
+    void threadFunction();
+    void pacePcr(std::unique_lock<std::mutex>& lock);
+    void paceCbr(std::unique_lock<std::mutex>& lock);
+    bool waitUntil(std::unique_lock<std::mutex>& lock, const Clock::time_point time);
+    /**
+     * @param packetNs Time of one packet at the constant bitrate, 0 when pacing by PCR.
+     */
+    void sendDatagram(const uint8_t* data, const size_t packets, const Clock::time_point due, const double packetNs);
+};
@@ -0,0 +1,477 @@
+#include "PacketRing.h"
+#include "Logger.h"
+#include <arpa/inet.h>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+
+const int32_t pollTimeoutMs = 100;
+// Blocks are handed to user space when full or after this, bounding the latency at low bitrates.
+const uint32_t blockTimeoutMs = 1;
+const auto statisticsInterval = std::chrono::seconds(1);
+
+uint16_t read16(const uint8_t* data)
+{
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+uint32_t read32(const uint8_t* data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+uint64_t routeKey(const uint32_t address, const uint16_t port)
+{
+    return (static_cast<uint64_t>(address) << 16) | port;
+}
+
+} // namespace
+
+struct PacketRing::Subscription::Queue
+{
+    explicit Queue(PacketRing* ring)
+        : ring(ring),
+          eventFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          drops(0)
+    {
+    }
+
+    ~Queue()
+    {
+        Datagram datagram;
+        while (datagrams.pop(datagram))
+        {
+            ring->releaseBlock(datagram.block);
+        }
+        if (eventFd >= 0)
+        {
+            close(eventFd);
+        }
+    }
+
+    void signal() const
+    {
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto result = write(eventFd, &one, sizeof(one));
+    }
+
+    PacketRing* ring;
+    utils::LockFreeQueue<Datagram, 16384> datagrams;
+    int32_t eventFd;
+    std::atomic<uint64_t> drops;
+    // Set by the ring thread while walking a block that queued datagrams here.
+    bool pendingSignal = false;
+};
+
+PacketRing::Subscription::Subscription(std::shared_ptr<PacketRing> ring,
+    std::shared_ptr<Queue> queue,
+    const uint64_t key)
+    : ring_(std::move(ring)),
+      queue_(std::move(queue)),
+      key_(key),
+      socket_(-1)
+{
+}
+
+PacketRing::Subscription::~Subscription()
+{
+    release();
+    ring_->removeRoute(key_);
+    if (socket_ >= 0)
+    {
+        close(socket_);
+    }
+}
+
+int32_t PacketRing::Subscription::fileDescriptor() const
+{
+    return queue_->eventFd;
+}
+
+int32_t PacketRing::Subscription::receive(const size_t maxCount, const int32_t timeoutMs)
+{
+    release();
+
+    for (uint32_t attempt = 0; attempt < 2 && batch_.empty(); ++attempt)
+    {
+        if (attempt == 1)
+        {
+            pollfd pollFd = {queue_->eventFd, POLLIN, 0};
+            poll(&pollFd, 1, timeoutMs);
+        }
+
+        // The event is cleared before the queue is read, a datagram queued meanwhile signals it again.
+        uint64_t events = 0;
+        [[maybe_unused]] const auto result = read(queue_->eventFd, &events, sizeof(events));
+
+        Datagram datagram;
+        while (batch_.size() < maxCount && queue_->datagrams.pop(datagram))
+        {
+            batch_.push_back(datagram);
+        }
+    }
+
+    if (batch_.size() == maxCount)
+    {
+        // More may be queued, keep the descriptor readable for callers that poll it.
+        queue_->signal();
+    }
+    return static_cast<int32_t>(batch_.size());
+}
+
+uint64_t PacketRing::Subscription::drops() const
+{
+    return queue_->drops.load(std::memory_order_relaxed);
+}
+
+void PacketRing::Subscription::release()
+{
+    for (const auto& datagram : batch_)
+    {
+        ring_->releaseBlock(datagram.block);
+    }
+    batch_.clear();
+}
+
+std::unique_ptr<PacketRing::Subscription> PacketRing::subscribe(const std::string& interfaceName,
+    const std::pair<std::string, uint32_t>& address)
+{
+    in_addr destination = {};
+    if (inet_pton(AF_INET, address.first.c_str(), &destination) != 1 || address.second == 0 ||
+        address.second > 0xFFFF)
+    {
+        Logger::error("Invalid input address %s:%u", address.first.c_str(), address.second);
+        return nullptr;
+    }
+
+    static std::mutex ringsMutex;
+    static std::unordered_map<std::string, std::weak_ptr<PacketRing>> rings;
+
+    std::shared_ptr<PacketRing> ring;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        ring = rings[interfaceName].lock();
+        if (!ring)
+        {
+            ring.reset(new PacketRing(interfaceName));
+            if (!ring->open())
+            {
+                return nullptr;
+            }
+            rings[interfaceName] = ring;
+        }
+    }
+
+    const auto key = routeKey(ntohl(destination.s_addr), static_cast<uint16_t>(address.second));
+    auto queue = std::make_shared<Subscription::Queue>(ring.get());
+    if (queue->eventFd < 0)
+    {
+        Logger::error("Unable to create the event of %s:%u: %s",
+            address.first.c_str(),
+            address.second,
+            strerror(errno));
+        return nullptr;
+    }
+    if (!ring->addRoute(key, queue))
+    {
+        Logger::error("%s:%u is already received on %s", address.first.c_str(), address.second, interfaceName.c_str());
+        return nullptr;
+    }
+
+    const auto interfaceIndex = ring->interfaceIndex_;
+    std::unique_ptr<Subscription> subscription(new Subscription(std::move(ring), std::move(queue), key));
+    // A bound socket holds the port, so that unicast senders get no port unreachable, and the multicast membership.
+    // The datagrams are taken from the ring, its minimal buffer just overflows.
+    subscription->socket_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    const int32_t reuse = 1;
+    const int32_t bufferSize = 1;
+    sockaddr_in bindAddress = {};
+    bindAddress.sin_family = AF_INET;
+    bindAddress.sin_addr = destination;
+    bindAddress.sin_port = htons(static_cast<uint16_t>(address.second));
+    if (subscription->socket_ < 0 ||
+        setsockopt(subscription->socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        setsockopt(subscription->socket_, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) != 0 ||
+        bind(subscription->socket_, reinterpret_cast<const sockaddr*>(&bindAddress), sizeof(bindAddress)) != 0)
+    {
+        Logger::error("Unable to bind %s:%u: %s", address.first.c_str(), address.second, strerror(errno));
+    }
+    if (IN_MULTICAST(ntohl(destination.s_addr)))
+    {
+        ip_mreqn membership = {};
+        membership.imr_multiaddr = destination;
+        membership.imr_ifindex = interfaceIndex;
+        if (subscription->socket_ < 0 ||
+            setsockopt(subscription->socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+        {
+            Logger::error("Unable to join multicast group %s on %s: %s",
+                address.first.c_str(),
+                interfaceName.c_str(),
+                strerror(errno));
+        }
+    }
+    return subscription;
+}
+
+PacketRing::PacketRing(const std::string& interfaceName)
+    : interfaceName_(interfaceName),
+      interfaceIndex_(0),
+      socket_(-1),
+      ring_(nullptr),
+      blockReferences_(blockCount),
+      routes_(std::make_shared<Routes>()),
+      running_(false),
+      kernelDrops_(metrics::registry().counter("scte35_packet_ring_drops_total",
+          "Packets dropped by the kernel because the packet ring of the interface was full",
+          {{"interface", interfaceName}}))
+{
+}
+
+PacketRing::~PacketRing()
+{
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+
+    // Queues still referenced by the routes hand their datagrams back before the ring is unmapped.
+    routes_.reset();
+    if (ring_)
+    {
+        munmap(ring_, blockSize * blockCount);
+    }
+    if (socket_ >= 0)
+    {
+        close(socket_);
+    }
+}
+
+bool PacketRing::open()
+{
+    interfaceIndex_ = static_cast<int32_t>(if_nametoindex(interfaceName_.c_str()));
+    if (interfaceIndex_ == 0)
+    {
+        Logger::error("Unknown packet ring interface %s", interfaceName_.c_str());
+        return false;
+    }
+
+    // SOCK_DGRAM strips the link layer header, frames start at the IP header.
+    socket_ = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_IP));
+    if (socket_ < 0)
+    {
+        Logger::error("Unable to create the packet socket on %s: %s", interfaceName_.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Only UDP reaches the ring: ip[9] == IPPROTO_UDP.
+    std::array<sock_filter, 4> filter = {{
+        {BPF_LD | BPF_B | BPF_ABS, 0, 0, 9},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 1, IPPROTO_UDP},
+        {BPF_RET | BPF_K, 0, 0, 0xFFFFFFFF},
+        {BPF_RET | BPF_K, 0, 0, 0},
+    }};
+    sock_fprog program = {static_cast<uint16_t>(filter.size()), filter.data()};
+    if (setsockopt(socket_, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0)
+    {
+        Logger::warning("Unable to attach the UDP filter on %s: %s", interfaceName_.c_str(), strerror(errno));
+    }
+
+    const int32_t version = TPACKET_V3;
+    tpacket_req3 request = {};
+    request.tp_block_size = blockSize;
+    request.tp_block_nr = blockCount;
+    request.tp_frame_size = frameSize;
+    request.tp_frame_nr = blockSize / frameSize * blockCount;
+    request.tp_retire_blk_tov = blockTimeoutMs;
+    if (setsockopt(socket_, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0 ||
+        setsockopt(socket_, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0)
+    {
+        Logger::error("Unable to set up the packet ring on %s: %s", interfaceName_.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto mapping = mmap(nullptr, blockSize * blockCount, PROT_READ | PROT_WRITE, MAP_SHARED, socket_, 0);
+    if (mapping == MAP_FAILED)
+    {
+        Logger::error("Unable to map the packet ring on %s: %s", interfaceName_.c_str(), strerror(errno));
+        return false;
+    }
+    ring_ = static_cast<uint8_t*>(mapping);
+
+    sockaddr_ll linkAddress = {};
+    linkAddress.sll_family = AF_PACKET;
+    linkAddress.sll_protocol = htons(ETH_P_IP);
+    linkAddress.sll_ifindex = interfaceIndex_;
+    if (bind(socket_, reinterpret_cast<sockaddr*>(&linkAddress), sizeof(linkAddress)) != 0)
+    {
+        Logger::error("Unable to bind the packet socket to %s: %s", interfaceName_.c_str(), strerror(errno));
+        return false;
+    }
+
+    Logger::log("Packet ring on %s, %zu blocks of %zu kB", interfaceName_.c_str(), blockCount, blockSize / 1024);
+    running_ = true;
+    thread_ = std::thread(&PacketRing::threadFunction, this);
+    return true;
+}
+
+bool PacketRing::addRoute(const uint64_t key, std::shared_ptr<Subscription::Queue> queue)
+{
+    std::lock_guard<std::mutex> lock(routesMutex_);
+    if (routes_->count(key) != 0)
+    {
+        return false;
+    }
+
+    auto routes = std::make_shared<Routes>(*routes_);
+    routes->emplace(key, std::move(queue));
+    routes_ = std::move(routes);
+    return true;
+}
+
+void PacketRing::removeRoute(const uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(routesMutex_);
+    auto routes = std::make_shared<Routes>(*routes_);
+    routes->erase(key);
+    routes_ = std::move(routes);
+}
+
+void PacketRing::threadFunction()
+{
+    size_t block = 0;
+    auto lastStatistics = std::chrono::steady_clock::now();
+
+    while (running_)
+    {
+        const auto header = reinterpret_cast<tpacket_block_desc*>(ring_ + block * blockSize);
+        if ((__atomic_load_n(&header->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) != 0)
+        {
+            walkBlock(block);
+            block = (block + 1) % blockCount;
+        }
+        else
+        {
+            pollfd pollFd = {socket_, POLLIN | POLLERR, 0};
+            poll(&pollFd, 1, pollTimeoutMs);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - lastStatistics >= statisticsInterval)
+        {
+            countKernelDrops();
+            lastStatistics = now;
+        }
+    }
+}
+
+void PacketRing::walkBlock(const size_t block)
+{
+    std::shared_ptr<const Routes> routes;
+    {
+        std::lock_guard<std::mutex> lock(routesMutex_);
+        routes = routes_;
+    }
+
+    // The ring thread holds one reference while it walks the block, so that it is not handed back early.
+    blockReferences_[block].store(1, std::memory_order_relaxed);
+
+    const auto blockStart = ring_ + block * blockSize;
+    const auto header = reinterpret_cast<const tpacket_block_desc*>(blockStart);
+    auto frame = blockStart + header->hdr.bh1.offset_to_first_pkt;
+    std::vector<Subscription::Queue*> signalled;
+
+    for (uint32_t i = 0; i < header->hdr.bh1.num_pkts; ++i)
+    {
+        const auto packet = reinterpret_cast<const tpacket3_hdr*>(frame);
+        const auto link = reinterpret_cast<const sockaddr_ll*>(frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+        const auto ip = frame + packet->tp_net;
+        const size_t captured = packet->tp_snaplen;
+        frame += packet->tp_next_offset;
+
+        // Datagrams sent by this host show up too, on loopback twice.
+        if (link->sll_pkttype == PACKET_OUTGOING)
+        {
+            continue;
+        }
+
+        // Fragments and truncated frames are skipped, TS datagrams fit in one frame.
+        const size_t ipHeaderSize = (ip[0] & 0x0F) * 4;
+        if (captured < 28 || (ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP || ipHeaderSize < 20 ||
+            captured < ipHeaderSize + 8 || (read16(ip + 6) & 0x3FFF) != 0)
+        {
+            continue;
+        }
+
+        const auto udp = ip + ipHeaderSize;
+        const size_t udpSize = read16(udp + 4);
+        if (udpSize < 8 || ipHeaderSize + udpSize > captured)
+        {
+            continue;
+        }
+
+        const auto route = routes->find(routeKey(read32(ip + 16), read16(udp + 2)));
+        if (route == routes->end())
+        {
+            continue;
+        }
+
+        auto& queue = *route->second;
+        blockReferences_[block].fetch_add(1, std::memory_order_relaxed);
+        if (!queue.datagrams.push({udp + 8, static_cast<uint32_t>(udpSize - 8), static_cast<uint32_t>(block)}))
+        {
+            blockReferences_[block].fetch_sub(1, std::memory_order_relaxed);
+            queue.drops.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (!queue.pendingSignal)
+        {
+            queue.pendingSignal = true;
+            signalled.push_back(&queue);
+        }
+    }
+
+    for (auto queue : signalled)
+    {
+        queue->pendingSignal = false;
+        queue->signal();
+    }
+    releaseBlock(block);
+}
+
+void PacketRing::releaseBlock(const size_t block)
+{
+    if (blockReferences_[block].fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        const auto header = reinterpret_cast<tpacket_block_desc*>(ring_ + block * blockSize);
+        __atomic_store_n(&header->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+}
+
+void PacketRing::countKernelDrops()
+{
+    // Reading the statistics resets them.
+    tpacket_stats_v3 statistics = {};
+    socklen_t size = sizeof(statistics);
+    if (getsockopt(socket_, SOL_PACKET, PACKET_STATISTICS, &statistics, &size) != 0 || statistics.tp_drops == 0)
+    {
+        return;
+    }
+
+    kernelDrops_.add(statistics.tp_drops);
+    Logger::warning("Packet ring on %s dropped %u packets", interfaceName_.c_str(), statistics.tp_drops);
+}
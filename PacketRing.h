@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Metrics.h"
+#include "utils/LockFreeQueue.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Receive ring shared by all channels on one network interface: a PACKET_MMAP TPACKET_V3 ring on an AF_PACKET
+ * socket that the kernel fills in blocks of datagrams. One thread walks the filled blocks and hands the UDP payloads,
+ * by destination address and port, to the channels subscribed to them as pointers into the ring. A block goes back
+ * to the kernel once every channel released the datagrams it got from it, so payloads are not copied between the
+ * NIC and the inserter and one ring serves any number of multicast groups.
+ *
+ * A channel that stops receiving holds its blocks; once the ring is full the kernel drops packets for every channel
+ * on the interface. Requires CAP_NET_RAW.
+ */
+class PacketRing
+{
+public:
+    struct Datagram
+    {
+        const uint8_t* data;
+        uint32_t size;
+        uint32_t block;
+    };
+
+    /**
+     * Datagrams of one destination address and port, received by one thread.
+     */
+    class Subscription
+    {
+    public:
+        ~Subscription();
+
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+
+        /**
+         * Event file descriptor that is readable while datagrams are queued.
+         */
+        [[nodiscard]] int32_t fileDescriptor() const;
+
+        /**
+         * Releases the datagrams of the previous call and waits up to timeoutMs for new ones.
+         * @return Number of datagrams, at most maxCount, 0 on timeout.
+         */
+        int32_t receive(const size_t maxCount, const int32_t timeoutMs);
+
+        [[nodiscard]] const uint8_t* data(const size_t index) const { return batch_[index].data; }
+        [[nodiscard]] size_t size(const size_t index) const { return batch_[index].size; }
+
+        /**
+         * @return Datagrams dropped because this subscription's queue was full.
+         */
+        [[nodiscard]] uint64_t drops() const;
+
+    private:
+        friend class PacketRing;
+        struct Queue;
+
+        std::shared_ptr<PacketRing> ring_;
+        std::shared_ptr<Queue> queue_;
+        uint64_t key_;
+        int32_t socket_;
+        std::vector<Datagram> batch_;
+
+        Subscription(std::shared_ptr<PacketRing> ring, std::shared_ptr<Queue> queue, const uint64_t key);
+        void release();
+    };
+
+    /**
+     * Subscribes to the UDP datagrams for address on interfaceName, opening the ring of the interface on first use.
+     * A socket bound to address holds the port and joins multicast groups on the interface.
+     * @return nullptr if the ring could not be opened or the address is already subscribed.
+     */
+    static std::unique_ptr<Subscription> subscribe(const std::string& interfaceName,
+        const std::pair<std::string, uint32_t>& address);
+
+    ~PacketRing();
+
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+private:
+    static const size_t blockSize = 1 << 20;
+    static const size_t blockCount = 64;
+    static const size_t frameSize = 2048;
+
+    using Routes = std::unordered_map<uint64_t, std::shared_ptr<Subscription::Queue>>;
+
+    std::string interfaceName_;
+    int32_t interfaceIndex_;
+    int32_t socket_;
+    uint8_t* ring_;
+    std::vector<std::atomic<uint32_t>> blockReferences_;
+    std::mutex routesMutex_;
+    // Replaced as a whole on every change, the ring thread takes one copy per block.
+    std::shared_ptr<const Routes> routes_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+    metrics::Counter& kernelDrops_;
+
+    explicit PacketRing(const std::string& interfaceName);
+    bool open();
+    bool addRoute(const uint64_t key, std::shared_ptr<Subscription::Queue> queue);
+    void removeRoute(const uint64_t key);
+    void threadFunction();
+    void walkBlock(const size_t block);
+    void releaseBlock(const size_t block);
+    void countKernelDrops();
+};
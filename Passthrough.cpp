@@ -0,0 +1,413 @@
+#define GST_USE_UNSTABLE_API 1
+
+#include "Passthrough.h"
+#include "ChannelMetrics.h"
+#include "ChannelState.h"
+#include "CueScheduler.h"
+#include "Logger.h"
+#include "OutputFanOut.h"
+#include "RedundantReceiver.h"
+#include "SpliceFactory.h"
+#include "SpliceInjector.h"
+#include "SpliceRequestQueue.h"
+#include "UdpSender.h"
+#include "utils/PcrJitter.h"
+#include "utils/ThreadAffinity.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <gst/gst.h>
+#include <gst/mpegts/mpegts.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class Passthrough::Impl
+{
+public:
+    explicit Impl(const ChannelConfig& config);
+    ~Impl();
+
+    void run();
+    void stop();
+    uint64_t requestSplice(const SpliceRequest& request);
+    SpliceRequestStats spliceRequestStats() const;
+
+private:
+    static const uint16_t scte35Pid = 35;
+    static constexpr std::chrono::seconds splicePtsDelay = std::chrono::seconds(4);
+    static constexpr std::chrono::seconds dropLogInterval = std::chrono::seconds(10);
+
+    std::string name_;
+    std::vector<uint32_t> cores_;
+    RedundantReceiver receiver_;
+    std::unique_ptr<UdpSender> sender_;
+    int32_t outputFile_;
+    std::unique_ptr<OutputFanOut> fanOut_;
+    std::unique_ptr<ChannelState> state_;
+    SpliceFactory spliceFactory_;
+    SpliceInjector spliceInjector_;
+    SpliceRequestQueue spliceRequests_;
+    CueScheduler cueScheduler_;
+    ChannelMetrics metrics_;
+    utils::ts::PcrJitter pcrJitter_;
+    std::atomic_bool running_;
+    std::thread thread_;
+    std::vector<uint8_t> output_;
+    std::chrono::steady_clock::time_point startTime_;
+    bool warmStart_;
+    bool sentFirstPacket_;
+
+    void threadFunction();
+    void writeOutput();
+    void onOutputSent(const uint8_t* data, const size_t size);
+    void onCue(const SpliceRequest& request);
+    void onUpstreamSection(const uint8_t* section, const size_t size);
+    void sendScte35Splice(const SpliceRequest& request);
+};
+
+Passthrough::Impl::Impl(const ChannelConfig& config)
+    : name_(config.name),
+      cores_(config.cores),
+      receiver_(config.name,
+          config.inputAddress,
+          config.secondaryInputAddress,
+          config.udpOptions,
+          config.redundancyDelay),
+      outputFile_(-1),
+      spliceFactory_(config.spliceDuration, config.immediate, config.autoReturn),
+      spliceInjector_(scte35Pid),
+      spliceRequests_(config.name, [this](const SpliceRequest& request) { sendScte35Splice(request); }),
+      cueScheduler_(config.name, splicePtsDelay, [this](const SpliceRequest& request) { onCue(request); }),
+      metrics_(config.name),
+      running_(false),
+      warmStart_(false),
+      sentFirstPacket_(false)
+{
+    if (!config.stateFile.empty())
+    {
+        state_ = std::make_unique<ChannelState>(config.name, config.stateFile);
+        spliceFactory_.setState(state_.get());
+        cueScheduler_.setState(state_.get());
+
+        std::vector<uint8_t> pat;
+        std::vector<uint8_t> pmt;
+        if (state_->tables(pat, pmt))
+        {
+            // The cached tables let the first packets through with the rewritten PMT and a running video clock.
+            spliceInjector_.prime(pat, pmt);
+            warmStart_ = true;
+        }
+    }
+
+    if (config.mergeUpstreamCues)
+    {
+        spliceFactory_.setEventIdBase(SpliceFactory::mergedEventIdBase);
+        spliceInjector_.mergeUpstream([this](const uint8_t* section, const size_t size) {
+            onUpstreamSection(section, size);
+        });
+    }
+    cueScheduler_.load(config);
+
+    if (config.usesFanOut())
+    {
+        fanOut_ = std::make_unique<OutputFanOut>(config);
+    }
+    else if (config.outputFile.empty())
+    {
+        sender_ = std::make_unique<UdpSender>(config.outputAddress, config.udpOptions);
+    }
+    else
+    {
+        outputFile_ = open(config.outputFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (outputFile_ < 0)
+        {
+            Logger::error("Unable to open output file %s: %s", config.outputFile.c_str(), strerror(errno));
+        }
+    }
+}
+
+Passthrough::Impl::~Impl()
+{
+    stop();
+
+    if (outputFile_ >= 0)
+    {
+        close(outputFile_);
+    }
+}
+
+void Passthrough::Impl::threadFunction()
+{
+    if (!utils::setCurrentThreadAffinity(cores_))
+    {
+        Logger::warning("[%s] Unable to set passthrough thread affinity", name_.c_str());
+    }
+
+    uint64_t loggedDrops = 0;
+    uint64_t countedDrops = 0;
+    auto storedTablesVersion = spliceInjector_.tablesVersion();
+    bool spliceReady = false;
+    auto lastDropLog = std::chrono::steady_clock::now();
+
+    while (running_)
+    {
+        const auto received = receiver_.receive();
+        if (received < 0)
+        {
+            Logger::error("[%s] Input socket error: %s", name_.c_str(), strerror(errno));
+            break;
+        }
+
+        const auto receiveTime = std::chrono::steady_clock::now();
+        size_t receivedBytes = 0;
+        for (int32_t i = 0; i < received; ++i)
+        {
+            receivedBytes += receiver_.size(i);
+            spliceInjector_.process(receiver_.data(i), receiver_.size(i), output_);
+        }
+        metrics_.packetsIn.add(receivedBytes / utils::ts::packetSize);
+        metrics_.bytesIn.add(receivedBytes);
+        cueScheduler_.onVideoClock(spliceInjector_.videoClock());
+        writeOutput();
+
+        uint64_t pts = 0;
+        if (!spliceReady && spliceInjector_.videoClock().currentPts(pts))
+        {
+            // Cues can only be placed from here on, the cached tables of a warm start move this point forward.
+            spliceReady = true;
+            Logger::log("[%s] Video PTS known %.1f ms after start",
+                name_.c_str(),
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime_).count());
+        }
+
+        if (state_ && spliceInjector_.tablesVersion() != storedTablesVersion)
+        {
+            state_->storeTables(spliceInjector_.inputPat(), spliceInjector_.inputPmt());
+            storedTablesVersion = spliceInjector_.tablesVersion();
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (received > 0)
+        {
+            metrics_.latency.observe(now - receiveTime);
+        }
+
+        if (receiver_.drops() != countedDrops)
+        {
+            metrics_.udpDrops.add(receiver_.drops() - countedDrops);
+            countedDrops = receiver_.drops();
+        }
+
+        if (receiver_.drops() != loggedDrops && now - lastDropLog >= dropLogInterval)
+        {
+            Logger::warning("[%s] Input socket dropped %llu datagrams",
+                name_.c_str(),
+                static_cast<unsigned long long>(receiver_.drops() - loggedDrops));
+            loggedDrops = receiver_.drops();
+            lastDropLog = now;
+        }
+    }
+
+    if (sender_)
+    {
+        sender_->flush();
+    }
+}
+
+void Passthrough::Impl::writeOutput()
+{
+    if (fanOut_)
+    {
+        // The outputs share the batch, the next batch is written into a new buffer.
+        auto chunk = std::make_shared<std::vector<uint8_t>>(std::move(output_));
+        output_.clear();
+        output_.reserve(chunk->capacity());
+        fanOut_->send({chunk, chunk->data(), chunk->size()});
+        onOutputSent(chunk->data(), chunk->size());
+        return;
+    }
+    if (sender_)
+    {
+        sender_->send(output_.data(), output_.size());
+        onOutputSent(output_.data(), output_.size());
+        output_.clear();
+        return;
+    }
+
+    size_t written = 0;
+    while (written < output_.size())
+    {
+        const auto result = write(outputFile_, output_.data() + written, output_.size() - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Logger::error("[%s] Unable to write output file: %s", name_.c_str(), strerror(errno));
+            break;
+        }
+        written += static_cast<size_t>(result);
+    }
+    onOutputSent(output_.data(), written);
+    output_.clear();
+}
+
+void Passthrough::Impl::onOutputSent(const uint8_t* data, const size_t size)
+{
+    metrics_.packetsOut.add(size / utils::ts::packetSize);
+    metrics_.bytesOut.add(size);
+
+    const auto now = std::chrono::steady_clock::now();
+    if (!sentFirstPacket_ && size != 0)
+    {
+        sentFirstPacket_ = true;
+        metrics_.timeToFirstPacket.observe(now - startTime_);
+        Logger::log("[%s] First output packet %.1f ms after a %s start",
+            name_.c_str(),
+            std::chrono::duration<double, std::milli>(now - startTime_).count(),
+            warmStart_ ? "warm" : "cold");
+    }
+
+    for (size_t offset = 0; offset + utils::ts::packetSize <= size; offset += utils::ts::packetSize)
+    {
+        std::chrono::nanoseconds jitter;
+        if (pcrJitter_.onPacket(data + offset, now, jitter))
+        {
+            metrics_.pcrJitter.observe(std::chrono::abs(jitter));
+        }
+    }
+
+    spliceRequests_.onPacketsSent(data, size, spliceInjector_.scte35Pid());
+}
+
+void Passthrough::Impl::onCue(const SpliceRequest& request)
+{
+    if (spliceRequests_.push(request) == 0)
+    {
+        Logger::warning("[%s] Splice request queue full, skipping cue", name_.c_str());
+    }
+}
+
+void Passthrough::Impl::onUpstreamSection(const uint8_t* section, const size_t size)
+{
+    metrics_.upstreamSections.add(1);
+    if (!spliceFactory_.reserveEventIds(section, size))
+    {
+        Logger::debug("[%s] Upstream SCTE-35 section of %zu bytes not parsed, forwarding it", name_.c_str(), size);
+    }
+}
+
+void Passthrough::Impl::sendScte35Splice(const SpliceRequest& request)
+{
+    uint64_t spliceTime = 0;
+    bool aligned = false;
+    const auto& videoClock = spliceInjector_.videoClock();
+    if (request.spliceTime)
+    {
+        spliceTime = *request.spliceTime;
+    }
+    else if (!videoClock.splicePts(splicePtsDelay.count() * utils::ts::ptsClockRate, spliceTime, aligned) &&
+        !request.immediate)
+    {
+        Logger::warning("[%s] No video PTS received yet, skipping splice request %llu",
+            name_.c_str(),
+            static_cast<unsigned long long>(request.id));
+        return;
+    }
+
+    std::array<uint8_t, maxSpliceInfoSectionSize> section;
+    const auto spliceInfo = spliceFactory_.makeSpliceInfo(request, spliceTime);
+    if (request.command == SpliceCommand::TIME_SIGNAL)
+    {
+        Logger::log("[%s] SCTE-35 time_signal: pts %llu (%llu s), %s, request %llu",
+            name_.c_str(),
+            static_cast<unsigned long long>(spliceTime),
+            static_cast<unsigned long long>(spliceTime / utils::ts::ptsClockRate),
+            aligned ? "GOP aligned" : "not GOP aligned",
+            static_cast<unsigned long long>(request.id));
+    }
+    else
+    {
+        const auto& spliceInsert = spliceInfo.spliceInsert;
+        Logger::log("[%s] SCTE-35 splice_insert: %s pts %llu (%llu s), %s, immediate %c, duration %llu s, request %llu",
+            name_.c_str(),
+            request.type == SpliceType::IN ? "IN" : "OUT",
+            static_cast<unsigned long long>(spliceTime),
+            static_cast<unsigned long long>(spliceTime / utils::ts::ptsClockRate),
+            aligned ? "GOP aligned" : "not GOP aligned",
+            spliceInsert.immediate ? 't' : 'f',
+            static_cast<unsigned long long>(spliceInsert.breakDuration / utils::ts::ptsClockRate),
+            static_cast<unsigned long long>(request.id));
+    }
+
+    const auto sectionSize = writeSpliceInfoSection(spliceInfo, section.data(), section.size());
+    if (sectionSize != 0)
+    {
+        spliceRequests_.onSectionQueued(request, spliceInfo);
+        spliceInjector_.queueSection(section.data(), sectionSize);
+    }
+}
+
+void Passthrough::Impl::run()
+{
+    const auto outputOpen = (sender_ && sender_->isOpen()) || outputFile_ >= 0 || (fanOut_ && fanOut_->isOpen());
+    if (!receiver_.isOpen() || !outputOpen)
+    {
+        Logger::error("Unable to start passthrough, input or output not open.");
+        return;
+    }
+
+    running_ = true;
+    startTime_ = std::chrono::steady_clock::now();
+    thread_ = std::thread(&Passthrough::Impl::threadFunction, this);
+}
+
+void Passthrough::Impl::stop()
+{
+    running_ = false;
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+}
+
+uint64_t Passthrough::Impl::requestSplice(const SpliceRequest& request)
+{
+    return spliceRequests_.push(request);
+}
+
+SpliceRequestStats Passthrough::Impl::spliceRequestStats() const
+{
+    return spliceRequests_.stats();
+}
+
+Passthrough::Passthrough(const ChannelConfig& config) : impl_(std::make_unique<Passthrough::Impl>(config)) {}
+
+Passthrough::~Passthrough() // NOLINT(modernize-use-equals-default)
+{
+}
+
+void Passthrough::run()
+{
+    impl_->run();
+}
+
+void Passthrough::stop()
+{
+    impl_->stop();
+}
+
+uint64_t Passthrough::requestSplice(const SpliceRequest& request)
+{
+    return impl_->requestSplice(request);
+}
+
+SpliceRequestStats Passthrough::spliceRequestStats() const
+{
+    return impl_->spliceRequestStats();
+}
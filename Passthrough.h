@@ -0,0 +1,26 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "Inserter.h"
+#include <memory>
+
+/**
+ * Zero-remux insertion engine. Forwards the input TS packets unchanged except for the PMT, and splices the
+ * SCTE-35 packets into the stream's null packet slots.
+ */
+class Passthrough : public Inserter
+{
+public:
+    explicit Passthrough(const ChannelConfig& config);
+
+    ~Passthrough() override;
+
+    void run() override;
+    void stop() override;
+    uint64_t requestSplice(const SpliceRequest& request) override;
+    SpliceRequestStats spliceRequestStats() const override;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
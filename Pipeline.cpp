@@ -1,40 +1,137 @@
 #define GST_USE_UNSTABLE_API 1
 
 #include "Pipeline.h"
+#include "BufferPool.h"
+#include "ChannelMetrics.h"
+#include "ChannelState.h"
+#include "CueScheduler.h"
+#include "ElementTracer.h"
 #include "Logger.h"
+#include "OutputFanOut.h"
+#include "RedundantReceiver.h"
+#include "SpliceFactory.h"
+#include "SpliceRequestQueue.h"
+#include "UdpSender.h"
+#include "VideoClock.h"
 #include "utils/ScopedGLibObject.h"
 #include "utils/ScopedGstObject.h"
+#include "utils/PcrJitter.h"
+#include "utils/ThreadAffinity.h"
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <gst/app/app.h>
 #include <gst/gst.h>
 #include <gst/mpegts/mpegts.h>
-#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+
+/**
+ * @return Parser of a demuxed stream, nullptr for streams that mpegtsmux takes as they come out of tsdemux.
+ */
+const char* streamParser(const GstStructure* structure)
+{
+    gint mpegVersion = 0;
+    gst_structure_get_int(structure, "mpegversion", &mpegVersion);
+
+    if (gst_structure_has_name(structure, "video/x-h264"))
+    {
+        return "h264parse";
+    }
+    if (gst_structure_has_name(structure, "video/x-h265"))
+    {
+        return "h265parse";
+    }
+    if (gst_structure_has_name(structure, "video/mpeg"))
+    {
+        return mpegVersion == 4 ? "mpeg4videoparse" : "mpegvideoparse";
+    }
+    if (gst_structure_has_name(structure, "audio/mpeg"))
+    {
+        return mpegVersion == 1 ? "mpegaudioparse" : "aacparse";
+    }
+    if (gst_structure_has_name(structure, "audio/x-ac3") || gst_structure_has_name(structure, "audio/x-eac3"))
+    {
+        return "ac3parse";
+    }
+    return nullptr;
+}
+
+/**
+ * @return PID of a tsdemux source pad, named <type>_<program>_<PID in hex>, 0 if the name has none.
+ */
+uint16_t demuxPadPid(const std::string& padName)
+{
+    const auto separator = padName.rfind('_');
+    if (separator == std::string::npos)
+    {
+        return 0;
+    }
+
+    char* end = nullptr;
+    const auto pid = std::strtoul(padName.c_str() + separator + 1, &end, 16);
+    return *end == '\0' && pid < utils::ts::nullPid ? static_cast<uint16_t>(pid) : 0;
+}
+
+/**
+ * Reference to a mapped sink buffer, handed to the outputs of a fan-out without copying it.
+ */
+struct MappedBuffer
+{
+    explicit MappedBuffer(GstBuffer* buffer) : buffer(gst_buffer_ref(buffer)), mapInfo(), isMapped(false)
+    {
+        isMapped = gst_buffer_map(buffer, &mapInfo, GST_MAP_READ);
+    }
+
+    ~MappedBuffer()
+    {
+        if (isMapped)
+        {
+            gst_buffer_unmap(buffer, &mapInfo);
+        }
+        gst_buffer_unref(buffer);
+    }
+
+    MappedBuffer(const MappedBuffer&) = delete;
+    MappedBuffer& operator=(const MappedBuffer&) = delete;
+
+    GstBuffer* buffer;
+    GstMapInfo mapInfo;
+    bool isMapped;
+};
+
+} // namespace
 
 class Pipeline::Impl
 {
 public:
-    Impl(const std::pair<std::string, uint32_t>& inputAddress,
-        const std::pair<std::string, uint32_t>& outputAddress,
-        const std::chrono::milliseconds mpegTsBufferSize,
-        const std::chrono::seconds spliceInterval,
-        const std::chrono::seconds spliceDuration,
-        const bool immediate,
-        const bool autoReturn,
-        const std::string& outputFile);
+    explicit Impl(const ChannelConfig& config);
     ~Impl();
 
     void run();
     void stop();
+    uint64_t requestSplice(const SpliceRequest& request);
+    SpliceRequestStats spliceRequestStats() const;
 
     void onPipelineMessage(GstMessage* message);
-    void linkDemuxPad(GstPad* newPad, GstElement* parser, GstElement* queue);
+    void onPipelineSyncMessage(GstMessage* message);
     void onDemuxPadAdded(GstPad* newPad);
 
     static gboolean pipelineBusWatch(GstBus* /*bus*/, GstMessage* message, gpointer userData);
+    static GstBusSyncReply pipelineBusSyncHandler(GstBus* /*bus*/, GstMessage* message, gpointer userData);
     static void demuxPadAddedCallback(GstElement* /*src*/, GstPad* newPad, gpointer userData);
-    static gboolean sendScte35SpliceInCallback(gpointer userData);
-    static gboolean sendScte35SpliceOutCallback(gpointer userData);
+    static GstFlowReturn newSinkSampleCallback(GstAppSink* appSink, gpointer userData);
+    static GstPadProbeReturn muxSourceProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn sinkProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn sourceProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData);
+    static GstPadProbeReturn demuxEventProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData);
 
 private:
     enum class ElementLabel
@@ -43,71 +140,130 @@ private:
         UDP_QUEUE,
         TS_PARSE,
         TS_DEMUX,
-        H264_PARSE,
-        MPEG2_PARSE,
-        VIDEO_PARSE_QUEUE,
-        AAC_PARSE,
-        AUDIO_PARSE_QUEUE,
         TS_MUX,
         TS_MUX_QUEUE,
         SINK
     };
 
-    enum class SpliceType
-    {
-        IN,
-        OUT
-    };
-
     static const uint16_t scte35Pid = 35;
+    // mpegtsmux puts the PMT of its first program on 0x20 and its SI tables below it.
+    static const uint16_t muxPmtPid = 0x20;
     static constexpr std::chrono::seconds splicePtsDelay = std::chrono::seconds(4);
+    static constexpr std::chrono::seconds dropLogInterval = std::chrono::seconds(10);
 
     GstBus* pipelineMessageBus_;
     GstElement* pipeline_;
     std::map<ElementLabel, GstElement*> elements_;
-    std::chrono::seconds spliceInterval_;
-    std::chrono::seconds spliceDuration_;
-    bool immediate_;
-    bool autoReturn_;
-    uint32_t nextEventId_;
-    uint16_t nextUid_;
+    std::string name_;
+    std::vector<uint32_t> cores_;
+    LatencyOptions latencyOptions_;
+    std::unique_ptr<ChannelState> state_;
+    std::unique_ptr<ElementTracer> tracer_;
+    SpliceFactory spliceFactory_;
+    std::unique_ptr<RedundantReceiver> receiver_;
+    std::unique_ptr<BufferPool> inputPool_;
+    std::unique_ptr<UdpSender> sender_;
+    std::unique_ptr<OutputFanOut> fanOut_;
+    std::atomic_bool receiving_;
+    std::thread receiveThread_;
+    VideoClock videoClock_;
+    SpliceRequestQueue spliceRequests_;
+    CueScheduler cueScheduler_;
+    ChannelMetrics metrics_;
+    utils::ts::PcrJitter pcrJitter_;
+    std::chrono::steady_clock::time_point startTime_;
+    bool sentFirstPacket_;
+    bool mergeUpstreamCues_;
+    // The demuxer pad whose upstream SCTE-35 sections reach the mux, only touched on the demuxer thread.
+    GstPad* upstreamCuePad_;
 
+    void receiveThreadFunction();
+    bool pushPooledInput(GstAppSrc* appSrc, const int32_t received, uint64_t& droppedBytes);
+    void onMuxOutputBuffer(GstBuffer* buffer);
+    void onSinkBuffer(GstBuffer* buffer);
+    void onSourceBuffer(GstBuffer* buffer);
+    void addQueueGauges(GstElement* queue, const std::string& queueName);
+    GstElement* createElement(const char* name, const char* element);
     void makeElement(const ElementLabel elementLabel, const char* name, const char* element);
-    GstMpegtsSCTESIT* makeScteSit(const SpliceType spliceType);
-    void sendScte35Splice(const SpliceType spliceType);
+    GstMpegtsSection* makeSection(const SpliceRequest& request, SpliceInfo& spliceInfo);
+    void onCue(const SpliceRequest& request);
+    void sendScte35Splice(const SpliceRequest& request);
 };
 
-Pipeline::Impl::Impl(const std::pair<std::string, uint32_t>& inputAddress,
-    const std::pair<std::string, uint32_t>& outputAddress,
-    const std::chrono::milliseconds mpegTsBufferSize,
-    const std::chrono::seconds spliceInterval,
-    const std::chrono::seconds spliceDuration,
-    const bool immediate,
-    const bool autoReturn,
-    const std::string& outputFile)
+Pipeline::Impl::Impl(const ChannelConfig& config)
     : pipelineMessageBus_(nullptr),
-      spliceInterval_(spliceInterval),
-      spliceDuration_(spliceDuration),
-      immediate_(immediate),
-      autoReturn_(autoReturn),
-      nextEventId_(0),
-      nextUid_(0)
+      name_(config.name),
+      cores_(config.cores),
+      latencyOptions_(config.latencyOptions),
+      spliceFactory_(config.spliceDuration, config.immediate, config.autoReturn),
+      receiving_(false),
+      spliceRequests_(config.name, [this](const SpliceRequest& request) { sendScte35Splice(request); }),
+      cueScheduler_(config.name, splicePtsDelay, [this](const SpliceRequest& request) { onCue(request); }),
+      metrics_(config.name),
+      sentFirstPacket_(false),
+      mergeUpstreamCues_(config.mergeUpstreamCues),
+      upstreamCuePad_(nullptr)
 {
-    gst_init(nullptr, nullptr);
-
+    if (!config.stateFile.empty())
+    {
+        state_ = std::make_unique<ChannelState>(config.name, config.stateFile);
+        spliceFactory_.setState(state_.get());
+        cueScheduler_.setState(state_.get());
+    }
+    if (mergeUpstreamCues_)
+    {
+        spliceFactory_.setEventIdBase(SpliceFactory::mergedEventIdBase);
+    }
+    cueScheduler_.load(config);
+    if (!config.trace.file.empty())
+    {
+        tracer_ = std::make_unique<ElementTracer>(config.name, config.trace.file, config.trace.sampleInterval);
+    }
     pipeline_ = gst_pipeline_new("scte35-insert-pipeline");
-    makeElement(ElementLabel::UDP_SOURCE, "UDP_SOURCE", "udpsrc");
+    if (config.batchedUdp || !config.udpOptions.packetRingInterface.empty() || config.udpOptions.inputPoolBuffers != 0)
+    {
+        // The datagrams are copied into the pushed buffers, gstreamer would hold ring blocks for the buffer time.
+        receiver_ = std::make_unique<RedundantReceiver>(config.name,
+            config.inputAddress,
+            config.secondaryInputAddress,
+            config.udpOptions,
+            config.redundancyDelay);
+        if (config.udpOptions.inputPoolBuffers != 0)
+        {
+            inputPool_ = std::make_unique<BufferPool>(config.name,
+                "input",
+                BufferPool::inputBufferSize,
+                config.udpOptions.inputPoolBuffers,
+                config.udpOptions.inputPoolHugePages);
+            if (!inputPool_->isOpen())
+            {
+                Logger::error("[%s] No input buffer pool, allocating a buffer per datagram", name_.c_str());
+                inputPool_.reset();
+            }
+        }
+        makeElement(ElementLabel::UDP_SOURCE, "UDP_SOURCE", "appsrc");
+    }
+    else
+    {
+        makeElement(ElementLabel::UDP_SOURCE, "UDP_SOURCE", "udpsrc");
+    }
     makeElement(ElementLabel::UDP_QUEUE, "UDP_QUEUE", "queue");
     makeElement(ElementLabel::TS_PARSE, "TS_PARSE", "tsparse");
     makeElement(ElementLabel::TS_DEMUX, "TS_DEMUX", "tsdemux");
-    makeElement(ElementLabel::H264_PARSE, "H264_PARSE", "h264parse");
-    makeElement(ElementLabel::MPEG2_PARSE, "MPEG2_PARSE", "mpegvideoparse");
-    makeElement(ElementLabel::VIDEO_PARSE_QUEUE, "VIDEO_PARSE_QUEUE", "queue");
-    makeElement(ElementLabel::AAC_PARSE, "AAC_PARSE", "aacparse");
-    makeElement(ElementLabel::AUDIO_PARSE_QUEUE, "AUDIO_PARSE_QUEUE", "queue");
     makeElement(ElementLabel::TS_MUX, "TS_MUX", "mpegtsmux");
     makeElement(ElementLabel::TS_MUX_QUEUE, "TS_MUX_QUEUE", "queue");
-    if (outputFile.empty())
+    if (config.usesFanOut())
+    {
+        // The outputs share the mux buffers, the fan-out holds a reference until each output wrote them.
+        fanOut_ = std::make_unique<OutputFanOut>(config);
+        makeElement(ElementLabel::SINK, "SINK", "appsink");
+    }
+    else if (config.outputFile.empty() && (config.batchedUdp || config.udpOptions.pacing.enabled))
+    {
+        sender_ = std::make_unique<UdpSender>(config.outputAddress, config.udpOptions);
+        makeElement(ElementLabel::SINK, "SINK", "appsink");
+    }
+    else if (config.outputFile.empty())
     {
         makeElement(ElementLabel::SINK, "SINK", "udpsink");
     }
@@ -120,7 +276,7 @@ Pipeline::Impl::Impl(const std::pair<std::string, uint32_t>& inputAddress,
     {
         if (!gst_bin_add(GST_BIN(pipeline_), entry.second))
         {
-            Logger::log("Unable to add gst element");
+            Logger::error("Unable to add gst element");
             return;
         }
     }
@@ -140,56 +296,156 @@ Pipeline::Impl::Impl(const std::pair<std::string, uint32_t>& inputAddress,
             elements_[ElementLabel::SINK],
             nullptr))
     {
-        Logger::log("Elements could not be linked.");
+        Logger::error("Elements could not be linked.");
         return;
     }
 
+    {
+        // The splice PTS is read from the mux output, the packets that carry the splice_insert are in that time base.
+        utils::ScopedGLibObject muxSourcePad(gst_element_get_static_pad(elements_[ElementLabel::TS_MUX], "src"));
+        gst_pad_add_probe(muxSourcePad.get(),
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+            muxSourceProbe,
+            this,
+            nullptr);
+
+        // Output metrics and the trigger-to-wire latency are taken where the packets leave the pipeline.
+        utils::ScopedGLibObject sinkPad(gst_element_get_static_pad(elements_[ElementLabel::SINK], "sink"));
+        gst_pad_add_probe(sinkPad.get(),
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+            sinkProbe,
+            this,
+            nullptr);
+
+        utils::ScopedGLibObject sourcePad(gst_element_get_static_pad(elements_[ElementLabel::UDP_SOURCE], "src"));
+        gst_pad_add_probe(sourcePad.get(),
+            GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+            sourceProbe,
+            this,
+            nullptr);
+    }
+
+    addQueueGauges(elements_[ElementLabel::UDP_QUEUE], "UDP_QUEUE");
+    addQueueGauges(elements_[ElementLabel::TS_MUX_QUEUE], "TS_MUX_QUEUE");
+
     pipelineMessageBus_ = gst_pipeline_get_bus(GST_PIPELINE(pipeline_));
     gst_bus_add_watch(pipelineMessageBus_, reinterpret_cast<GstBusFunc>(pipelineBusWatch), this);
+    gst_bus_set_sync_handler(pipelineMessageBus_, pipelineBusSyncHandler, this, nullptr);
 
     g_signal_connect(elements_[ElementLabel::TS_DEMUX], "pad-added", G_CALLBACK(demuxPadAddedCallback), this);
 
-    g_object_set(elements_[ElementLabel::UDP_SOURCE],
-        "address",
-        inputAddress.first.c_str(),
-        "port",
-        inputAddress.second,
-        "auto-multicast",
-        true,
-        "buffer-size",
-        212992,
-        nullptr);
+    if (receiver_)
+    {
+        utils::ScopedGstObject caps(gst_caps_new_simple("video/mpegts",
+            "systemstream",
+            G_TYPE_BOOLEAN,
+            TRUE,
+            "packetsize",
+            G_TYPE_INT,
+            188,
+            nullptr));
+        g_object_set(elements_[ElementLabel::UDP_SOURCE],
+            "caps",
+            caps.get(),
+            "is-live",
+            TRUE,
+            "do-timestamp",
+            TRUE,
+            "format",
+            GST_FORMAT_TIME,
+            nullptr);
+    }
+    else
+    {
+        g_object_set(elements_[ElementLabel::UDP_SOURCE],
+            "address",
+            config.inputAddress.first.c_str(),
+            "port",
+            config.inputAddress.second,
+            "auto-multicast",
+            true,
+            "buffer-size",
+            config.udpOptions.socketBufferSize,
+            nullptr);
+    }
 
     g_object_set(elements_[ElementLabel::UDP_QUEUE],
         "min-threshold-time",
-        std::chrono::nanoseconds(mpegTsBufferSize).count(),
+        std::chrono::nanoseconds(latencyOptions_.bufferTime).count(),
         nullptr);
 
+    // Upstream sections reach mpegtsmux as events with their splice times in running time, the mux converts them
+    // to its output time base and sends them on its SCTE-35 PID together with the local cues.
+    g_object_set(elements_[ElementLabel::TS_DEMUX], "send-scte35-events", mergeUpstreamCues_ ? TRUE : FALSE, nullptr);
+
+    if (latencyOptions_.demuxLatency.count() >= 0)
+    {
+        g_object_set(elements_[ElementLabel::TS_DEMUX],
+            "latency",
+            static_cast<gint>(latencyOptions_.demuxLatency.count()),
+            nullptr);
+    }
+
     g_object_set(elements_[ElementLabel::TS_MUX], "scte-35-pid", scte35Pid, "scte-35-null-interval", 450000, nullptr);
+    if (sender_ || fanOut_)
+    {
+        g_object_set(elements_[ElementLabel::TS_MUX], "alignment", 7, nullptr);
+    }
+
+    if (latencyOptions_.muxLatency.count() >= 0)
+    {
+        g_object_set(elements_[ElementLabel::TS_MUX],
+            "latency",
+            static_cast<guint64>(std::chrono::nanoseconds(latencyOptions_.muxLatency).count()),
+            nullptr);
+    }
 
     g_object_set(elements_[ElementLabel::TS_MUX_QUEUE],
         "min-threshold-time",
-        std::chrono::nanoseconds(mpegTsBufferSize).count(),
+        std::chrono::nanoseconds(latencyOptions_.bufferTime).count(),
         nullptr);
 
-    if (outputFile.empty())
+    g_object_set(elements_[ElementLabel::SINK], "sync", latencyOptions_.syncOutput ? TRUE : FALSE, nullptr);
+
+    Logger::log("[%s] Buffer %lld ms, queue limit %lld ms%s, demux latency %lld ms, mux latency %lld ms, sync %c",
+        name_.c_str(),
+        static_cast<long long>(latencyOptions_.bufferTime.count()),
+        static_cast<long long>(latencyOptions_.queueMaxTime.count()),
+        latencyOptions_.leakyQueues ? " leaky" : "",
+        static_cast<long long>(latencyOptions_.demuxLatency.count()),
+        static_cast<long long>(latencyOptions_.muxLatency.count()),
+        latencyOptions_.syncOutput ? 'y' : 'n');
+
+    if (sender_ || fanOut_)
+    {
+        GstAppSinkCallbacks callbacks = {};
+        callbacks.new_sample = newSinkSampleCallback;
+        gst_app_sink_set_callbacks(GST_APP_SINK(elements_[ElementLabel::SINK]), &callbacks, this, nullptr);
+    }
+    else if (config.outputFile.empty())
     {
         g_object_set(elements_[ElementLabel::SINK],
             "host",
-            outputAddress.first.c_str(),
+            config.outputAddress.first.c_str(),
             "port",
-            outputAddress.second,
+            config.outputAddress.second,
             nullptr);
     }
     else
     {
-        g_object_set(elements_[ElementLabel::SINK], "location", outputFile.c_str(), nullptr);
+        g_object_set(elements_[ElementLabel::SINK], "location", config.outputFile.c_str(), nullptr);
     }
 }
 
 Pipeline::Impl::~Impl()
 {
+    stop();
+    metrics::registry().removeGauges(this);
     gst_element_set_state(pipeline_, GST_STATE_NULL);
+    if (tracer_)
+    {
+        tracer_->finish();
+    }
 
     if (pipelineMessageBus_)
     {
@@ -202,22 +458,6 @@ Pipeline::Impl::~Impl()
     {
         gst_object_unref(pipeline_);
     }
-
-    gst_deinit();
-}
-
-void Pipeline::Impl::linkDemuxPad(GstPad* newPad, GstElement* parser, GstElement* queue)
-{
-    utils::ScopedGLibObject parseSinkPad(gst_element_get_static_pad(parser, "sink"));
-    gst_pad_link(newPad, parseSinkPad.get());
-    gst_element_link(parser, queue);
-
-    utils::ScopedGLibObject parseQueueSourcePad(gst_element_get_static_pad(queue, "src"));
-
-    utils::ScopedGLibObject tsMuxSinkPad(
-        gst_element_get_compatible_pad(elements_[ElementLabel::TS_MUX], parseQueueSourcePad.get(), nullptr));
-
-    gst_pad_link(parseQueueSourcePad.get(), tsMuxSinkPad.get());
 }
 
 void Pipeline::Impl::onDemuxPadAdded(GstPad* newPad)
@@ -226,24 +466,118 @@ void Pipeline::Impl::onDemuxPadAdded(GstPad* newPad)
     auto newPadStruct = gst_caps_get_structure(newPadCaps.get(), 0);
     auto newPadType = gst_structure_get_name(newPadStruct);
 
-    Logger::log("Dynamic pad created, type %s", newPadType);
+    auto padName = gst_pad_get_name(newPad);
+    const auto pid = demuxPadPid(padName);
+    g_free(padName);
+
+    Logger::debug("[%s] Dynamic pad created, type %s, PID %u", name_.c_str(), newPadType, pid);
+
+    auto mux = elements_[ElementLabel::TS_MUX];
+    utils::ScopedGstObject muxCaps(gst_pad_template_get_caps(gst_element_get_pad_template(mux, "sink_%d")));
+    if (!gst_caps_can_intersect(newPadCaps.get(), muxCaps.get()))
+    {
+        Logger::warning("[%s] mpegtsmux cannot carry PID %u of type %s, dropping it", name_.c_str(), pid, newPadType);
+        return;
+    }
+
+    // Every PID gets its own branch, so any number of tracks pass. Only elementary streams that need framing get
+    // a parser, the others go from the queue straight into the mux.
+    const auto branchName = pid != 0 ? "PID_" + std::to_string(pid) : std::string(GST_PAD_NAME(newPad));
+    const auto parserElement = streamParser(newPadStruct);
+    auto queue = createElement((branchName + "_QUEUE").c_str(), "queue");
+    auto parser = parserElement ? createElement((branchName + "_PARSE").c_str(), parserElement) : nullptr;
+    if (!queue || (parserElement && !parser))
+    {
+        if (queue)
+        {
+            gst_object_unref(queue);
+        }
+        return;
+    }
 
-    if (g_str_has_prefix(newPadType, "video/x-h264"))
+    // A branch that cannot be linked completely leaves the pipeline again, with the mux pad requested for it.
+    const auto dropBranch = [this, mux, queue, parser](GstPad* muxSinkPad) {
+        if (muxSinkPad)
+        {
+            gst_element_release_request_pad(mux, muxSinkPad);
+            gst_object_unref(muxSinkPad);
+        }
+        gst_element_set_state(queue, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(pipeline_), queue);
+        if (parser)
+        {
+            gst_element_set_state(parser, GST_STATE_NULL);
+            gst_bin_remove(GST_BIN(pipeline_), parser);
+        }
+    };
+
+    gst_bin_add(GST_BIN(pipeline_), queue);
+    if (parser)
     {
-        linkDemuxPad(newPad, elements_[ElementLabel::H264_PARSE], elements_[ElementLabel::VIDEO_PARSE_QUEUE]);
+        gst_bin_add(GST_BIN(pipeline_), parser);
+        if (!gst_element_link(parser, queue))
+        {
+            Logger::error("[%s] Unable to link the %s of PID %u, dropping it", name_.c_str(), parserElement, pid);
+            dropBranch(nullptr);
+            return;
+        }
     }
-    else if (g_str_has_prefix(newPadType, "video/mpeg"))
+
+    // mpegtsmux takes the PID of a stream from the name of its sink pad. A PID the mux uses itself, or one it refuses,
+    // gets the next free PID of the mux instead.
+    utils::ScopedGLibObject queueSourcePad(gst_element_get_static_pad(queue, "src"));
+    const auto keepsPid = pid > muxPmtPid && pid != scte35Pid;
+    auto muxSinkPad = keepsPid ? gst_element_request_pad_simple(mux, ("sink_" + std::to_string(pid)).c_str()) : nullptr;
+    if (!muxSinkPad)
     {
-        linkDemuxPad(newPad, elements_[ElementLabel::MPEG2_PARSE], elements_[ElementLabel::VIDEO_PARSE_QUEUE]);
+        if (pid != 0)
+        {
+            Logger::warning("[%s] PID %u of type %s is taken by the mux, the mux assigns it another PID",
+                name_.c_str(),
+                pid,
+                newPadType);
+        }
+        muxSinkPad = gst_element_request_pad_simple(mux, "sink_%d");
     }
-    else if (g_str_has_prefix(newPadType, "audio/mpeg"))
+    if (!muxSinkPad || GST_PAD_LINK_FAILED(gst_pad_link(queueSourcePad.get(), muxSinkPad)))
     {
-        linkDemuxPad(newPad, elements_[ElementLabel::AAC_PARSE], elements_[ElementLabel::AUDIO_PARSE_QUEUE]);
+        Logger::error("[%s] Unable to link PID %u of type %s to mpegtsmux, dropping it",
+            name_.c_str(),
+            pid,
+            newPadType);
+        dropBranch(muxSinkPad);
+        return;
     }
-    else
+
+    // The branch runs before the demuxer pushes into it.
+    gst_element_sync_state_with_parent(queue);
+    if (parser)
     {
-        Logger::log("Unsupported MPEG-TS demux pad type %s", newPadType);
+        gst_element_sync_state_with_parent(parser);
     }
+
+    utils::ScopedGLibObject branchSinkPad(gst_element_get_static_pad(parser ? parser : queue, "sink"));
+    if (GST_PAD_LINK_FAILED(gst_pad_link(newPad, branchSinkPad.get())))
+    {
+        Logger::error("[%s] Unable to link demuxer pad of PID %u, dropping it", name_.c_str(), pid);
+        dropBranch(muxSinkPad);
+        return;
+    }
+    gst_object_unref(muxSinkPad);
+    addQueueGauges(queue, branchName + "_QUEUE");
+
+    if (mergeUpstreamCues_)
+    {
+        upstreamCuePad_ = upstreamCuePad_ ? upstreamCuePad_ : newPad;
+        gst_pad_add_probe(newPad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, demuxEventProbe, this, nullptr);
+    }
+
+    Logger::log("[%s] PID %u, type %s, %s%s",
+        name_.c_str(),
+        pid,
+        newPadType,
+        parser ? "parsed by " : "forwarded unparsed",
+        parser ? parserElement : "");
 }
 
 void Pipeline::Impl::onPipelineMessage(GstMessage* message)
@@ -265,14 +599,9 @@ void Pipeline::Impl::onPipelineMessage(GstMessage* message)
                     "_",
                     gst_element_state_get_name(newState),
                     nullptr);
-                Logger::log("GST_MESSAGE_STATE_CHANGED %s", dumpName);
+                Logger::debug("[%s] GST_MESSAGE_STATE_CHANGED %s", name_.c_str(), dumpName);
                 g_free(dumpName);
             }
-
-            if (newState == GST_STATE_PLAYING)
-            {
-                g_timeout_add_seconds(std::chrono::seconds(spliceInterval_).count(), sendScte35SpliceOutCallback, this);
-            }
         }
         break;
 
@@ -282,28 +611,28 @@ void Pipeline::Impl::onPipelineMessage(GstMessage* message)
         gchar* dbgInfo = nullptr;
 
         gst_message_parse_error(message, &err, &dbgInfo);
-        Logger::log("ERROR from element %s: %s", GST_OBJECT_NAME(message->src), err->message);
-        Logger::log("Debugging info: %s", dbgInfo ? dbgInfo : "none");
+        Logger::error("[%s] ERROR from element %s: %s", name_.c_str(), GST_OBJECT_NAME(message->src), err->message);
+        Logger::error("[%s] Debugging info: %s", name_.c_str(), dbgInfo ? dbgInfo : "none");
         g_error_free(err);
         g_free(dbgInfo);
     }
     break;
 
     case GST_MESSAGE_EOS:
-        Logger::log("EOS received");
+        Logger::log("[%s] EOS received", name_.c_str());
         gst_element_set_state(pipeline_, GST_STATE_NULL);
         break;
 
     case GST_MESSAGE_NEW_CLOCK:
-        Logger::log("New pipeline clock");
+        Logger::debug("New pipeline clock");
         break;
 
     case GST_MESSAGE_CLOCK_LOST:
-        Logger::log("Clock lost, restarting pipeline");
+        Logger::warning("[%s] Clock lost, restarting pipeline", name_.c_str());
         if (gst_element_set_state(pipeline_, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE ||
             gst_element_set_state(pipeline_, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
         {
-            Logger::log("Unable to restart the pipeline.");
+            Logger::error("Unable to restart the pipeline.");
             return;
         }
         break;
@@ -313,83 +642,169 @@ void Pipeline::Impl::onPipelineMessage(GstMessage* message)
     }
 }
 
-void Pipeline::Impl::makeElement(const ElementLabel elementLabel, const char* name, const char* element)
+void Pipeline::Impl::onPipelineSyncMessage(GstMessage* message)
 {
-    const auto& result = elements_.emplace(elementLabel, gst_element_factory_make(element, name));
-    if (!result.first->second)
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
     {
-        Logger::log("Unable to make gst element %s", element);
         return;
     }
 
+    GstStreamStatusType statusType;
+    GstElement* owner = nullptr;
+    gst_message_parse_stream_status(message, &statusType, &owner);
+
+    // ENTER is posted from the new streaming thread itself, so the affinity applies to that thread.
+    if (statusType == GST_STREAM_STATUS_TYPE_ENTER && !utils::setCurrentThreadAffinity(cores_))
+    {
+        Logger::warning("[%s] Unable to set streaming thread affinity for %s", name_.c_str(), GST_OBJECT_NAME(owner));
+    }
+}
+
+GstElement* Pipeline::Impl::createElement(const char* name, const char* element)
+{
+    auto result = gst_element_factory_make(element, name);
+    if (!result)
+    {
+        Logger::error("Unable to make gst element %s", element);
+        return nullptr;
+    }
+
     if (strncmp(element, "queue", 5) == 0)
     {
-        g_object_set(result.first->second, "max-size-buffers", 0, nullptr);
-        g_object_set(result.first->second, "max-size-bytes", 0, nullptr);
-        g_object_set(result.first->second, "max-size-time", 0, nullptr);
+        // Queues are only bounded by time, a stalled sink then costs at most queueMaxTime of buffers per queue.
+        g_object_set(result, "max-size-buffers", 0, nullptr);
+        g_object_set(result, "max-size-bytes", 0, nullptr);
+        g_object_set(result,
+            "max-size-time",
+            static_cast<guint64>(std::chrono::nanoseconds(latencyOptions_.queueMaxTime).count()),
+            nullptr);
+
+        if (latencyOptions_.leakyQueues && latencyOptions_.queueMaxTime.count() != 0)
+        {
+            // Leaky downstream: drop the oldest buffers.
+            g_object_set(result, "leaky", 2, nullptr);
+        }
+    }
+    if (tracer_)
+    {
+        tracer_->addElement(result);
     }
+    return result;
+}
+
+void Pipeline::Impl::makeElement(const ElementLabel elementLabel, const char* name, const char* element)
+{
+    elements_.emplace(elementLabel, createElement(name, element));
 }
 
-GstMpegtsSCTESIT* Pipeline::Impl::makeScteSit(const SpliceType spliceType)
+GstMpegtsSection* Pipeline::Impl::makeSection(const SpliceRequest& request, SpliceInfo& spliceInfo)
 {
-    int64_t position = -1;
-    gst_element_query_position(elements_[ElementLabel::TS_DEMUX], GST_FORMAT_TIME, &position);
-    const auto eventTime =
-        std::chrono::nanoseconds(GST_TIME_AS_NSECONDS(position)) + std::chrono::nanoseconds(splicePtsDelay);
+    uint64_t spliceTime = 0;
+    bool aligned = false;
+    auto timeBase = SpliceTimeBase::PTS;
+    if (request.spliceTime)
+    {
+        spliceTime = *request.spliceTime;
+    }
+    else if (!videoClock_.splicePts(splicePtsDelay.count() * utils::ts::ptsClockRate, spliceTime, aligned))
+    {
+        // No video PTS seen on the mux output yet, fall back to the demux running time.
+        int64_t position = -1;
+        gst_element_query_position(elements_[ElementLabel::TS_DEMUX], GST_FORMAT_TIME, &position);
+        spliceTime = GST_TIME_AS_NSECONDS(position) + std::chrono::nanoseconds(splicePtsDelay).count();
+        timeBase = SpliceTimeBase::RUNNING_TIME;
+    }
+
+    const auto seconds = timeBase == SpliceTimeBase::PTS
+        ? spliceTime / utils::ts::ptsClockRate
+        : std::chrono::duration_cast<std::chrono::seconds>(std::chrono::nanoseconds(spliceTime)).count();
 
-    Logger::log("SCTE-35 splice_insert: %s %llu ns (%llu) s, immediate %c, duration %llu s",
-        spliceType == SpliceType::IN ? "IN" : "OUT",
-        eventTime.count(),
-        std::chrono::duration_cast<std::chrono::seconds>(eventTime).count(),
-        immediate_ ? 't' : 'f',
-        spliceDuration_);
+    // mpegtsmux only converts running time splices from a GstMpegtsSCTESIT, PTS splices are encoded directly.
+    spliceInfo = SpliceInfo();
+    if (timeBase == SpliceTimeBase::PTS)
+    {
+        spliceInfo = spliceFactory_.makeSpliceInfo(request, spliceTime);
+    }
 
-    if (spliceType == SpliceType::IN)
+    if (request.command == SpliceCommand::TIME_SIGNAL)
     {
-        auto result = gst_mpegts_scte_splice_in_new(nextEventId_, eventTime.count());
-        for (size_t i = 0; i < result->splices->len; ++i)
+        Logger::log("[%s] SCTE-35 time_signal: %s %llu (%llu s), %s, request %llu",
+            name_.c_str(),
+            timeBase == SpliceTimeBase::PTS ? "pts" : "running time ns",
+            static_cast<unsigned long long>(spliceTime),
+            static_cast<unsigned long long>(seconds),
+            aligned ? "GOP aligned" : "not GOP aligned",
+            static_cast<unsigned long long>(request.id));
+
+        if (timeBase == SpliceTimeBase::RUNNING_TIME)
         {
-            auto event = reinterpret_cast<GstMpegtsSCTESpliceEvent*>(result->splices->pdata[i]);
-            event->unique_program_id = nextUid_;
+            spliceInfo.command = SpliceCommandType::TIME_SIGNAL;
+            return gst_mpegts_section_from_scte_sit(SpliceFactory::makeTimeSignal(spliceTime, timeBase), scte35Pid);
         }
-        ++nextEventId_;
-        ++nextUid_;
-        return result;
     }
     else
     {
-        const auto spliceTime = immediate_ ? std::numeric_limits<uint64_t>::max() : eventTime.count();
-        auto result =
-            gst_mpegts_scte_splice_out_new(nextEventId_, spliceTime, std::chrono::nanoseconds(spliceDuration_).count());
-        for (size_t i = 0; i < result->splices->len; ++i)
+        const auto spliceInsert = timeBase == SpliceTimeBase::PTS
+            ? spliceInfo.spliceInsert
+            : spliceFactory_.makeSpliceInsert(request, spliceTime, timeBase);
+
+        Logger::log("[%s] SCTE-35 splice_insert: %s %s %llu (%llu s), %s, immediate %c, duration %llu s, request %llu",
+            name_.c_str(),
+            request.type == SpliceType::IN ? "IN" : "OUT",
+            timeBase == SpliceTimeBase::PTS ? "pts" : "running time ns",
+            static_cast<unsigned long long>(spliceTime),
+            static_cast<unsigned long long>(seconds),
+            aligned ? "GOP aligned" : "not GOP aligned",
+            spliceInsert.immediate ? 't' : 'f',
+            static_cast<unsigned long long>(timeBase == SpliceTimeBase::PTS
+                    ? spliceInsert.breakDuration / utils::ts::ptsClockRate
+                    : spliceInsert.breakDuration / GST_SECOND),
+            static_cast<unsigned long long>(request.id));
+
+        if (timeBase == SpliceTimeBase::RUNNING_TIME)
         {
-            auto event = reinterpret_cast<GstMpegtsSCTESpliceEvent*>(result->splices->pdata[i]);
-            event->unique_program_id = nextUid_;
-            if (autoReturn_)
-            {
-                event->break_duration_auto_return = TRUE;
-            }
+            spliceInfo.command = SpliceCommandType::SPLICE_INSERT;
+            spliceInfo.spliceInsert = spliceInsert;
+            return gst_mpegts_section_from_scte_sit(SpliceFactory::makeScteSit(spliceInsert, timeBase), scte35Pid);
         }
-        ++nextEventId_;
-        return result;
     }
+
+    std::array<uint8_t, maxSpliceInfoSectionSize> section;
+    const auto size = writeSpliceInfoSection(spliceInfo, section.data(), section.size());
+    if (size == 0)
+    {
+        return nullptr;
+    }
+
+    // The section takes ownership of its data.
+    auto data = static_cast<guint8*>(g_malloc(size));
+    memcpy(data, section.data(), size);
+    return gst_mpegts_section_new(scte35Pid, data, size);
 }
 
-void Pipeline::Impl::sendScte35Splice(const Pipeline::Impl::SpliceType spliceType)
+void Pipeline::Impl::onCue(const SpliceRequest& request)
 {
-    auto scteSit = makeScteSit(spliceType);
-    utils::ScopedGstObject mpegTsSection(gst_mpegts_section_from_scte_sit(scteSit, scte35Pid));
-    gst_mpegts_section_send_event(mpegTsSection.get(), elements_[ElementLabel::TS_MUX]);
-
-    if (spliceType == SpliceType::IN || autoReturn_)
+    if (spliceRequests_.push(request) == 0)
     {
-        const auto delay = autoReturn_ ? spliceInterval_ + spliceDuration_ : spliceInterval_;
-        g_timeout_add_seconds(delay.count(), sendScte35SpliceOutCallback, this);
+        Logger::warning("[%s] Splice request queue full, skipping cue", name_.c_str());
     }
-    else
+}
+
+void Pipeline::Impl::sendScte35Splice(const SpliceRequest& request)
+{
+    SpliceInfo spliceInfo;
+    auto section = makeSection(request, spliceInfo);
+    if (!section)
     {
-        g_timeout_add_seconds(spliceDuration_.count(), sendScte35SpliceInCallback, this);
+        Logger::error("[%s] Unable to build the section of splice request %llu",
+            name_.c_str(),
+            static_cast<unsigned long long>(request.id));
+        return;
     }
+
+    utils::ScopedGstObject mpegTsSection(section);
+    spliceRequests_.onSectionQueued(request, spliceInfo);
+    gst_mpegts_section_send_event(mpegTsSection.get(), elements_[ElementLabel::TS_MUX]);
 }
 
 gboolean Pipeline::Impl::pipelineBusWatch(GstBus* /*bus*/, GstMessage* message, gpointer userData)
@@ -399,56 +814,366 @@ gboolean Pipeline::Impl::pipelineBusWatch(GstBus* /*bus*/, GstMessage* message,
     return TRUE;
 }
 
+GstBusSyncReply Pipeline::Impl::pipelineBusSyncHandler(GstBus* /*bus*/, GstMessage* message, gpointer userData)
+{
+    auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
+    impl->onPipelineSyncMessage(message);
+    return GST_BUS_PASS;
+}
+
 void Pipeline::Impl::demuxPadAddedCallback(GstElement* /*src*/, GstPad* newPad, gpointer userData)
 {
     auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
     impl->onDemuxPadAdded(newPad);
 }
 
-gboolean Pipeline::Impl::sendScte35SpliceInCallback(gpointer userData)
+GstFlowReturn Pipeline::Impl::newSinkSampleCallback(GstAppSink* appSink, gpointer userData)
+{
+    auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
+    auto sample = gst_app_sink_pull_sample(appSink);
+    if (!sample)
+    {
+        return GST_FLOW_EOS;
+    }
+
+    auto buffer = gst_sample_get_buffer(sample);
+    if (buffer && impl->fanOut_)
+    {
+        auto mappedBuffer = std::make_shared<MappedBuffer>(buffer);
+        if (mappedBuffer->isMapped)
+        {
+            impl->fanOut_->send({mappedBuffer, mappedBuffer->mapInfo.data, mappedBuffer->mapInfo.size});
+        }
+    }
+    else if (buffer)
+    {
+        GstMapInfo mapInfo;
+        if (gst_buffer_map(buffer, &mapInfo, GST_MAP_READ))
+        {
+            impl->sender_->send(mapInfo.data, mapInfo.size);
+            gst_buffer_unmap(buffer, &mapInfo);
+        }
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+GstPadProbeReturn Pipeline::Impl::muxSourceProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        auto bufferList = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        const auto length = gst_buffer_list_length(bufferList);
+        for (guint i = 0; i < length; ++i)
+        {
+            impl->onMuxOutputBuffer(gst_buffer_list_get(bufferList, i));
+        }
+    }
+    else
+    {
+        impl->onMuxOutputBuffer(GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void Pipeline::Impl::onMuxOutputBuffer(GstBuffer* buffer)
+{
+    GstMapInfo mapInfo;
+    if (!buffer || !gst_buffer_map(buffer, &mapInfo, GST_MAP_READ))
+    {
+        return;
+    }
+
+    for (size_t offset = 0; offset + utils::ts::packetSize <= mapInfo.size; offset += utils::ts::packetSize)
+    {
+        if (mapInfo.data[offset] == utils::ts::syncByte)
+        {
+            videoClock_.onPacket(mapInfo.data + offset);
+        }
+    }
+    gst_buffer_unmap(buffer, &mapInfo);
+
+    cueScheduler_.onVideoClock(videoClock_);
+}
+
+GstPadProbeReturn Pipeline::Impl::sinkProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
+{
+    auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        auto bufferList = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        const auto length = gst_buffer_list_length(bufferList);
+        for (guint i = 0; i < length; ++i)
+        {
+            impl->onSinkBuffer(gst_buffer_list_get(bufferList, i));
+        }
+    }
+    else
+    {
+        impl->onSinkBuffer(GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+void Pipeline::Impl::onSinkBuffer(GstBuffer* buffer)
+{
+    GstMapInfo mapInfo;
+    if (!buffer || !gst_buffer_map(buffer, &mapInfo, GST_MAP_READ))
+    {
+        return;
+    }
+
+    metrics_.packetsOut.add(mapInfo.size / utils::ts::packetSize);
+    metrics_.bytesOut.add(mapInfo.size);
+
+    const auto now = std::chrono::steady_clock::now();
+    if (!sentFirstPacket_ && mapInfo.size != 0)
+    {
+        // Includes the pad discovery of tsdemux and the buffering of the queues.
+        sentFirstPacket_ = true;
+        metrics_.timeToFirstPacket.observe(now - startTime_);
+        Logger::log("[%s] First output packet %.1f ms after start",
+            name_.c_str(),
+            std::chrono::duration<double, std::milli>(now - startTime_).count());
+    }
+    for (size_t offset = 0; offset + utils::ts::packetSize <= mapInfo.size; offset += utils::ts::packetSize)
+    {
+        std::chrono::nanoseconds jitter;
+        if (pcrJitter_.onPacket(mapInfo.data + offset, now, jitter))
+        {
+            metrics_.pcrJitter.observe(std::chrono::abs(jitter));
+        }
+    }
+
+    spliceRequests_.onPacketsSent(mapInfo.data, mapInfo.size, scte35Pid);
+    gst_buffer_unmap(buffer, &mapInfo);
+
+    // Input buffers are stamped with their capture running time, which mpegtsmux carries through to its output.
+    const auto timestamp = GST_BUFFER_DTS_OR_PTS(buffer);
+    const auto runningTime = gst_element_get_current_running_time(elements_[ElementLabel::SINK]);
+    if (GST_CLOCK_TIME_IS_VALID(timestamp) && GST_CLOCK_TIME_IS_VALID(runningTime) && runningTime >= timestamp)
+    {
+        metrics_.latency.observe(std::chrono::nanoseconds(runningTime - timestamp));
+    }
+}
+
+GstPadProbeReturn Pipeline::Impl::sourceProbe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer userData)
 {
     auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
-    impl->sendScte35Splice(SpliceType::IN);
-    return FALSE;
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    {
+        auto bufferList = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        const auto length = gst_buffer_list_length(bufferList);
+        for (guint i = 0; i < length; ++i)
+        {
+            impl->onSourceBuffer(gst_buffer_list_get(bufferList, i));
+        }
+    }
+    else
+    {
+        impl->onSourceBuffer(GST_PAD_PROBE_INFO_BUFFER(info));
+    }
+    return GST_PAD_PROBE_OK;
 }
 
-gboolean Pipeline::Impl::sendScte35SpliceOutCallback(gpointer userData)
+GstPadProbeReturn Pipeline::Impl::demuxEventProbe(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
 {
     auto impl = reinterpret_cast<Pipeline::Impl*>(userData);
-    impl->sendScte35Splice(SpliceType::OUT);
-    return FALSE;
+    auto event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CUSTOM_DOWNSTREAM)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    auto section = gst_event_parse_mpegts_section(event);
+    if (!section)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    utils::ScopedGstObject scopedSection(section);
+    if (section->section_type != GST_MPEGTS_SECTION_SCTE_SIT)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // tsdemux sends each section on all pads of the program, the mux must only see it once.
+    if (pad != impl->upstreamCuePad_)
+    {
+        return GST_PAD_PROBE_DROP;
+    }
+
+    impl->metrics_.upstreamSections.add(1);
+    impl->spliceFactory_.reserveEventIds(section->data, section->section_length);
+    return GST_PAD_PROBE_OK;
+}
+
+void Pipeline::Impl::onSourceBuffer(GstBuffer* buffer)
+{
+    const auto size = gst_buffer_get_size(buffer);
+    metrics_.packetsIn.add(size / utils::ts::packetSize);
+    metrics_.bytesIn.add(size);
+}
+
+void Pipeline::Impl::addQueueGauges(GstElement* queue, const std::string& queueName)
+{
+    const metrics::Labels labels = {{"channel", name_}, {"queue", queueName}};
+
+    metrics::registry().gauge("scte35_queue_level_buffers",
+        "Buffers held by a pipeline queue",
+        labels,
+        this,
+        [queue]() {
+            guint buffers = 0;
+            g_object_get(queue, "current-level-buffers", &buffers, nullptr);
+            return static_cast<double>(buffers);
+        });
+    metrics::registry().gauge("scte35_queue_level_bytes",
+        "Bytes held by a pipeline queue",
+        labels,
+        this,
+        [queue]() {
+            guint bytes = 0;
+            g_object_get(queue, "current-level-bytes", &bytes, nullptr);
+            return static_cast<double>(bytes);
+        });
+    metrics::registry().gauge("scte35_queue_level_seconds",
+        "Duration of the data held by a pipeline queue",
+        labels,
+        this,
+        [queue]() {
+            guint64 time = 0;
+            g_object_get(queue, "current-level-time", &time, nullptr);
+            return static_cast<double>(time) / GST_SECOND;
+        });
+}
+
+void Pipeline::Impl::receiveThreadFunction()
+{
+    if (!utils::setCurrentThreadAffinity(cores_))
+    {
+        Logger::warning("[%s] Unable to set receive thread affinity", name_.c_str());
+    }
+
+    auto appSrc = GST_APP_SRC(elements_[ElementLabel::UDP_SOURCE]);
+    uint64_t loggedDrops = 0;
+    uint64_t countedDrops = 0;
+    auto lastDropLog = std::chrono::steady_clock::now();
+    uint64_t poolDroppedBytes = 0;
+    auto lastPoolDropLog = lastDropLog;
+
+    while (receiving_)
+    {
+        const auto received = receiver_->receive();
+        if (received < 0)
+        {
+            Logger::error("[%s] Input socket error: %s", name_.c_str(), strerror(errno));
+            break;
+        }
+        else if (received == 0)
+        {
+            continue;
+        }
+
+        if (inputPool_)
+        {
+            if (!pushPooledInput(appSrc, received, poolDroppedBytes))
+            {
+                break;
+            }
+        }
+        else
+        {
+            auto bufferList = gst_buffer_list_new_sized(static_cast<guint>(received));
+            for (int32_t i = 0; i < received; ++i)
+            {
+                auto buffer = gst_buffer_new_allocate(nullptr, receiver_->size(i), nullptr);
+                gst_buffer_fill(buffer, 0, receiver_->data(i), receiver_->size(i));
+                gst_buffer_list_add(bufferList, buffer);
+            }
+
+            if (gst_app_src_push_buffer_list(appSrc, bufferList) != GST_FLOW_OK)
+            {
+                break;
+            }
+        }
+
+        if (receiver_->drops() != countedDrops)
+        {
+            metrics_.udpDrops.add(receiver_->drops() - countedDrops);
+            countedDrops = receiver_->drops();
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (receiver_->drops() != loggedDrops && now - lastDropLog >= dropLogInterval)
+        {
+            Logger::warning("[%s] Input socket dropped %llu datagrams",
+                name_.c_str(),
+                static_cast<unsigned long long>(receiver_->drops() - loggedDrops));
+            loggedDrops = receiver_->drops();
+            lastDropLog = now;
+        }
+        if (poolDroppedBytes != 0 && now - lastPoolDropLog >= dropLogInterval)
+        {
+            Logger::warning("[%s] Input buffer pool exhausted, dropped %llu bytes",
+                name_.c_str(),
+                static_cast<unsigned long long>(poolDroppedBytes));
+            poolDroppedBytes = 0;
+            lastPoolDropLog = now;
+        }
+    }
+}
+
+bool Pipeline::Impl::pushPooledInput(GstAppSrc* appSrc, const int32_t received, uint64_t& droppedBytes)
+{
+    // Once no pooled buffer is free the rest of the batch is dropped: the pipeline is not keeping up, and dropping the
+    // newest input bounds its memory where growing the queues would not.
+    return inputPool_->pack(
+        static_cast<size_t>(received),
+        [this](const size_t i) { return std::make_pair(receiver_->data(i), receiver_->size(i)); },
+        [appSrc](GstBuffer* buffer) { return gst_app_src_push_buffer(appSrc, buffer) == GST_FLOW_OK; },
+        droppedBytes);
 }
 
 void Pipeline::Impl::run()
 {
+    startTime_ = std::chrono::steady_clock::now();
     if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
     {
-        Logger::log("Unable to set the pipeline to the playing state.");
+        Logger::error("Unable to set the pipeline to the playing state.");
         return;
     }
+
+    if (receiver_ && receiver_->isOpen())
+    {
+        receiving_ = true;
+        receiveThread_ = std::thread(&Pipeline::Impl::receiveThreadFunction, this);
+    }
+}
+
+void Pipeline::Impl::stop()
+{
+    receiving_ = false;
+    if (receiveThread_.joinable())
+    {
+        receiveThread_.join();
+    }
 }
 
-void Pipeline::Impl::stop() {}
+uint64_t Pipeline::Impl::requestSplice(const SpliceRequest& request)
+{
+    return spliceRequests_.push(request);
+}
 
-Pipeline::Pipeline(const std::pair<std::string, uint32_t>& inputAddress,
-    const std::pair<std::string, uint32_t>& outputAddress,
-    const std::chrono::milliseconds mpegTsBufferSize,
-    const std::chrono::seconds spliceInterval,
-    const std::chrono::seconds spliceDuration,
-    const bool immediate,
-    const bool autoReturn,
-    const std::string& outputFile)
-    : impl_(std::make_unique<Pipeline::Impl>(inputAddress,
-          outputAddress,
-          mpegTsBufferSize,
-          spliceInterval,
-          spliceDuration,
-          immediate,
-          autoReturn,
-          outputFile))
+SpliceRequestStats Pipeline::Impl::spliceRequestStats() const
 {
+    return spliceRequests_.stats();
 }
 
+Pipeline::Pipeline(const ChannelConfig& config) : impl_(std::make_unique<Pipeline::Impl>(config)) {}
+
 Pipeline::~Pipeline() // NOLINT(modernize-use-equals-default)
 {
 }
@@ -462,3 +1187,13 @@ void Pipeline::stop()
 {
     impl_->stop();
 }
+
+uint64_t Pipeline::requestSplice(const SpliceRequest& request)
+{
+    return impl_->requestSplice(request);
+}
+
+SpliceRequestStats Pipeline::spliceRequestStats() const
+{
+    return impl_->spliceRequestStats();
+}
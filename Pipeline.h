@@ -1,28 +1,20 @@
 #pragma once
 
-#include <chrono>
-#include <cstdint>
-#include <map>
+#include "ChannelConfig.h"
+#include "Inserter.h"
 #include <memory>
-#include <string>
-#include <utility>
 
-class Pipeline
+class Pipeline : public Inserter
 {
 public:
-    explicit Pipeline(const std::pair<std::string, uint32_t>& inputAddress,
-        const std::pair<std::string, uint32_t>& outputAddress,
-        const std::chrono::milliseconds mpegTsBufferSize,
-        const std::chrono::seconds spliceInterval,
-        const std::chrono::seconds spliceDuration,
-        const bool immediate,
-        const bool autoReturn,
-        const std::string& outputFile);
+    explicit Pipeline(const ChannelConfig& config);
 
-    ~Pipeline();
+    ~Pipeline() override;
 
-    void run();
-    void stop();
+    void run() override;
+    void stop() override;
+    uint64_t requestSplice(const SpliceRequest& request) override;
+    SpliceRequestStats spliceRequestStats() const override;
 
 private:
     class Impl;
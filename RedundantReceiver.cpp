@@ -0,0 +1,397 @@
+#include "RedundantReceiver.h"
+#include "Logger.h"
+#include "utils/Crc32.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <poll.h>
+
+namespace
+{
+
+const std::chrono::milliseconds receiveTimeout(100);
+// The packet rings hold twice the delay at this bitrate, beyond it the oldest packets are dropped.
+const uint64_t maxBitrate = 200000000;
+const size_t minCapacity = 1024;
+// Packets of one input are searched for in this many packets of the other input.
+const size_t searchWindow = 512;
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+bool isNull(const uint8_t* packet)
+{
+    return utils::ts::pid(packet) == utils::ts::nullPid;
+}
+
+size_t ringCapacity(const std::chrono::milliseconds delay)
+{
+    const auto packets = maxBitrate / (utils::ts::packetSize * 8) * 2 * static_cast<uint64_t>(delay.count()) / 1000;
+    size_t capacity = minCapacity;
+    while (capacity < packets)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+} // namespace
+
+RedundantReceiver::Input::Input(const char* name, const std::string& channel, const size_t capacity)
+    : name(name),
+      packets(capacity * utils::ts::packetSize),
+      keys(capacity),
+      arrivals(capacity),
+      head(0),
+      count(0),
+      alignment(0),
+      lastKey(0),
+      nullRun(0),
+      lastArrival(nowNs()),
+      stalled(false),
+      received(metrics::registry().counter("scte35_redundant_input_packets_total",
+          "TS packets received on each input of a redundant pair",
+          {{"channel", channel}, {"input", name}})),
+      lost(metrics::registry().counter("scte35_redundant_input_lost_packets_total",
+          "Output packets missing on one input of a redundant pair",
+          {{"channel", channel}, {"input", name}})),
+      late(metrics::registry().counter("scte35_redundant_input_late_packets_total",
+          "Packets dropped because the output had moved past them when they arrived",
+          {{"channel", channel}, {"input", name}})),
+      overflows(metrics::registry().counter("scte35_redundant_input_overflows_total",
+          "Packets dropped because an input ring was full",
+          {{"channel", channel}, {"input", name}}))
+{
+}
+
+const uint8_t* RedundantReceiver::Input::packet(const size_t index) const
+{
+    return packets.data() + slot(index) * utils::ts::packetSize;
+}
+
+void RedundantReceiver::Input::push(const uint8_t* packet, const int64_t arrival)
+{
+    if (count == keys.size())
+    {
+        pop();
+        overflows.increment();
+    }
+
+    const auto index = slot(count);
+    std::copy(packet, packet + utils::ts::packetSize, packets.data() + index * utils::ts::packetSize);
+
+    // Null packets are all alike, they are told apart by the packet before them and their position in the run.
+    if (isNull(packet))
+    {
+        ++nullRun;
+        keys[index] = (lastKey ^ nullRun) * 0x9E3779B1;
+    }
+    else
+    {
+        nullRun = 0;
+        lastKey = utils::crc32Mpeg(packet, utils::ts::packetSize);
+        keys[index] = lastKey;
+    }
+    arrivals[index] = arrival;
+    ++count;
+}
+
+void RedundantReceiver::Input::pop()
+{
+    head = (head + 1) & (keys.size() - 1);
+    --count;
+}
+
+RedundantReceiver::RedundantReceiver(const std::string& channel,
+    const std::pair<std::string, uint32_t>& primaryAddress,
+    const std::pair<std::string, uint32_t>& secondaryAddress,
+    const UdpOptions& options,
+    const std::chrono::milliseconds delay)
+    : channel_(channel),
+      primary_(primaryAddress, options),
+      delay_(std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count()),
+      skew_(0),
+      lastTimeline_(0),
+      outputCount_(0)
+{
+    if (secondaryAddress.first.empty())
+    {
+        return;
+    }
+
+    secondary_ = std::make_unique<UdpReceiver>(secondaryAddress, options);
+    const auto capacity = ringCapacity(delay);
+    inputs_.reserve(2);
+    inputs_.emplace_back("primary", channel, capacity);
+    inputs_.emplace_back("secondary", channel, capacity);
+    history_.resize(capacity);
+    index_.resize(capacity * 4);
+    output_.reserve(2 * capacity * utils::ts::packetSize);
+
+    Logger::log("[%s] Redundant input, %lld ms delay, %zu packets per input",
+        channel_.c_str(),
+        static_cast<long long>(delay.count()),
+        capacity);
+}
+
+int32_t RedundantReceiver::receive()
+{
+    if (!secondary_)
+    {
+        return primary_.receive();
+    }
+
+    output_.clear();
+    std::array<pollfd, 2> pollFds = {};
+    pollFds[0] = {primary_.fileDescriptor(), POLLIN, 0};
+    pollFds[1] = {secondary_->fileDescriptor(), POLLIN, 0};
+    if (poll(pollFds.data(), pollFds.size(), pollTimeoutMs(nowNs())) < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    const auto now = nowNs();
+    UdpReceiver* receivers[] = {&primary_, secondary_.get()};
+    for (size_t i = 0; i < inputs_.size(); ++i)
+    {
+        if ((pollFds[i].revents & POLLIN) != 0)
+        {
+            const auto received = receivers[i]->receive();
+            if (received < 0)
+            {
+                return -1;
+            }
+            for (int32_t datagram = 0; datagram < received; ++datagram)
+            {
+                onDatagram(inputs_[i], receivers[i]->data(datagram), receivers[i]->size(datagram), now);
+            }
+        }
+    }
+
+    updateStalled(inputs_[0], inputs_[1], now);
+    updateStalled(inputs_[1], inputs_[0], now);
+    merge(now);
+    return output_.empty() ? 0 : 1;
+}
+
+void RedundantReceiver::onDatagram(Input& input, const uint8_t* data, const size_t size, const int64_t now)
+{
+    size_t packets = 0;
+    for (size_t offset = 0; offset + utils::ts::packetSize <= size; offset += utils::ts::packetSize)
+    {
+        if (data[offset] == utils::ts::syncByte)
+        {
+            input.push(data + offset, now);
+            ++packets;
+        }
+    }
+    input.received.add(packets);
+    input.lastArrival = now;
+}
+
+void RedundantReceiver::merge(const int64_t now)
+{
+    auto& primary = inputs_[0];
+    auto& secondary = inputs_[1];
+
+    while (true)
+    {
+        skipRepeated(primary);
+        skipRepeated(secondary);
+        if (primary.count == 0 && secondary.count == 0)
+        {
+            break;
+        }
+
+        // Null packets next to a loss have keys that differ between the inputs, any two are interchangeable.
+        if (primary.count != 0 && secondary.count != 0 &&
+            (primary.keys[primary.slot(0)] == secondary.keys[secondary.slot(0)] ||
+                (isNull(primary.packet(0)) && isNull(secondary.packet(0)))))
+        {
+            if (std::min(dueTime(primary), dueTime(secondary)) > now)
+            {
+                break;
+            }
+            measureSkew(secondary.arrivals[secondary.slot(0)] - primary.arrivals[primary.slot(0)]);
+            emit(primary);
+            primary.pop();
+            secondary.pop();
+            primary.alignment = outputCount_;
+            secondary.alignment = outputCount_;
+            continue;
+        }
+
+        // The inputs disagree on the next packet: the one whose next packet the other has further on lost it.
+        Input* next = nullptr;
+        if (secondary.count == 0 || (primary.count != 0 && holds(primary, secondary.keys[secondary.slot(0)])))
+        {
+            next = &primary;
+        }
+        else if (primary.count == 0 || holds(secondary, primary.keys[primary.slot(0)]))
+        {
+            next = &secondary;
+        }
+        else
+        {
+            // Both lost packets, the front that came first on the common timeline goes first.
+            next = dueTime(primary) <= dueTime(secondary) ? &primary : &secondary;
+        }
+
+        if (dueTime(*next) > now)
+        {
+            break;
+        }
+        emit(*next);
+        next->pop();
+        next->alignment = outputCount_;
+    }
+}
+
+void RedundantReceiver::skipRepeated(Input& input)
+{
+    while (input.count != 0 && input.alignment < outputCount_)
+    {
+        if (outputCount_ - input.alignment > history_.size())
+        {
+            input.lost.add(outputCount_ - history_.size() - input.alignment);
+            input.alignment = outputCount_ - history_.size();
+        }
+
+        const auto key = input.keys[input.slot(0)];
+        auto match = input.alignment;
+        if (history_[match & (history_.size() - 1)].key != key)
+        {
+            // A null packet behind the output was played out or replaced by another null packet, it is not needed.
+            if (isNull(input.packet(0)))
+            {
+                input.pop();
+                continue;
+            }
+
+            // Packets lost on this input were played out from the other one: find where this input continues. A
+            // match before the alignment means this input fell behind by more than the delay.
+            match = findOutput(key);
+        }
+
+        if (match == outputCount_)
+        {
+            // The output moved on since the packet was due: unless the other input still has it, it is too late.
+            const auto& other = &input == &inputs_[0] ? inputs_[1] : inputs_[0];
+            if (timeline(input) < lastTimeline_ && !holds(other, key))
+            {
+                input.pop();
+                input.late.increment();
+                continue;
+            }
+
+            // Nothing this input still has was played out yet, its next packet competes for the next position.
+            input.lost.add(outputCount_ - input.alignment);
+            input.alignment = outputCount_;
+            break;
+        }
+
+        const auto& output = history_[match & (history_.size() - 1)];
+        if (output.input != &input)
+        {
+            const auto arrival = input.arrivals[input.slot(0)];
+            measureSkew(&input == &inputs_[1] ? arrival - output.arrival : output.arrival - arrival);
+        }
+        input.lost.add(match > input.alignment ? match - input.alignment : 0);
+        input.alignment = match + 1;
+        input.pop();
+    }
+}
+
+uint64_t RedundantReceiver::findOutput(const uint32_t key) const
+{
+    const auto entry = index_[key & (index_.size() - 1)];
+    if (entry == 0 || outputCount_ - (entry - 1) > history_.size() ||
+        history_[(entry - 1) & (history_.size() - 1)].key != key)
+    {
+        return outputCount_;
+    }
+    return entry - 1;
+}
+
+bool RedundantReceiver::holds(const Input& input, const uint32_t key) const
+{
+    const auto end = std::min(input.count, searchWindow);
+    for (size_t i = 0; i < end; ++i)
+    {
+        if (input.keys[input.slot(i)] == key)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RedundantReceiver::emit(const Input& input)
+{
+    const auto packet = input.packet(0);
+    output_.insert(output_.end(), packet, packet + utils::ts::packetSize);
+    const auto key = input.keys[input.slot(0)];
+    history_[outputCount_ & (history_.size() - 1)] = {key, &input, input.arrivals[input.slot(0)]};
+    index_[key & (index_.size() - 1)] = outputCount_ + 1;
+    lastTimeline_ = timeline(input);
+    ++outputCount_;
+}
+
+void RedundantReceiver::updateStalled(Input& input, const Input& other, const int64_t now)
+{
+    const auto stallTime = std::max(2 * delay_, static_cast<int64_t>(200000000));
+    const auto stalled = now - input.lastArrival > stallTime;
+    if (stalled == input.stalled)
+    {
+        return;
+    }
+
+    input.stalled = stalled;
+    if (stalled)
+    {
+        Logger::warning("[%s] No packets on the %s input for %lld ms, continuing on the %s input",
+            channel_.c_str(),
+            input.name,
+            static_cast<long long>((now - input.lastArrival) / 1000000),
+            other.name);
+    }
+    else
+    {
+        Logger::log("[%s] Packets on the %s input again", channel_.c_str(), input.name);
+    }
+}
+
+void RedundantReceiver::measureSkew(const int64_t sample)
+{
+    skew_ += (sample - skew_) / 16;
+}
+
+int64_t RedundantReceiver::timeline(const Input& input) const
+{
+    // Arrival time of the front packet as if it came on the earlier input: the later input is moved back by the skew.
+    const auto skew = &input == &inputs_[0] ? std::min(skew_, int64_t(0)) : -std::max(skew_, int64_t(0));
+    return input.arrivals[input.slot(0)] + skew;
+}
+
+int64_t RedundantReceiver::dueTime(const Input& input) const
+{
+    return timeline(input) + delay_;
+}
+
+int32_t RedundantReceiver::pollTimeoutMs(const int64_t now) const
+{
+    auto timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(receiveTimeout).count();
+    for (const auto& input : inputs_)
+    {
+        if (input.count != 0)
+        {
+            timeout = std::min(timeout, std::max(dueTime(input) - now, int64_t(0)));
+        }
+    }
+    // Round up so that the first packet is due when poll returns.
+    return static_cast<int32_t>((timeout + 999999) / 1000000);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "Metrics.h"
+#include "UdpReceiver.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * UDP input with optional hitless redundancy in the style of SMPTE 2022-7. Without a secondary address it is the
+ * primary UdpReceiver. With one, both copies of the TS are received and merged per TS packet. Each packet is
+ * identified by a CRC32 of its bytes, null packets by the packet before them. A packet is played out a fixed delay
+ * after its first copy arrived and later copies are dropped. A packet lost on one input is taken from the other one
+ * in its original position, so as long as the skew between the inputs stays below the delay, losing packets or a
+ * whole input causes neither a gap nor a continuity error in the output. Beyond it the late input only fills in
+ * packets the output has not moved past yet.
+ *
+ * Not thread safe, receive and the accessors belong to the receiving thread.
+ */
+class RedundantReceiver
+{
+public:
+    RedundantReceiver(const std::string& channel,
+        const std::pair<std::string, uint32_t>& primaryAddress,
+        const std::pair<std::string, uint32_t>& secondaryAddress,
+        const UdpOptions& options,
+        const std::chrono::milliseconds delay);
+
+    RedundantReceiver(const RedundantReceiver&) = delete;
+    RedundantReceiver& operator=(const RedundantReceiver&) = delete;
+
+    [[nodiscard]] bool isOpen() const { return primary_.isOpen() && (!secondary_ || secondary_->isOpen()); }
+
+    /**
+     * Waits up to the receive timeout for datagrams. With redundancy the merged packets that are due are returned as
+     * a single buffer, which is empty until the first packets have waited out the delay.
+     * @return Number of buffers, 0 on timeout, -1 on socket error.
+     */
+    int32_t receive();
+
+    [[nodiscard]] const uint8_t* data(const size_t index) const
+    {
+        return secondary_ ? output_.data() : primary_.data(index);
+    }
+    [[nodiscard]] size_t size(const size_t index) const { return secondary_ ? output_.size() : primary_.size(index); }
+
+    /**
+     * @return Datagrams dropped by the kernel on both sockets.
+     */
+    [[nodiscard]] uint64_t drops() const { return primary_.drops() + (secondary_ ? secondary_->drops() : 0); }
+
+private:
+    /**
+     * Received packets of one input waiting to be played out or matched, oldest first.
+     */
+    struct Input
+    {
+        explicit Input(const char* name, const std::string& channel, const size_t capacity);
+
+        const char* name;
+        std::vector<uint8_t> packets;
+        std::vector<uint32_t> keys;
+        std::vector<int64_t> arrivals;
+        size_t head;
+        size_t count;
+        // Sequence number of the output packet the next received packet is expected to repeat.
+        uint64_t alignment;
+        uint32_t lastKey;
+        uint32_t nullRun;
+        int64_t lastArrival;
+        bool stalled;
+        metrics::Counter& received;
+        metrics::Counter& lost;
+        metrics::Counter& late;
+        metrics::Counter& overflows;
+
+        const uint8_t* packet(const size_t index) const;
+        size_t slot(const size_t index) const { return (head + index) & (keys.size() - 1); }
+        void push(const uint8_t* packet, const int64_t arrival);
+        void pop();
+    };
+
+    struct Output
+    {
+        uint32_t key;
+        const Input* input;
+        int64_t arrival;
+    };
+
+    std::string channel_;
+    UdpReceiver primary_;
+    std::unique_ptr<UdpReceiver> secondary_;
+    int64_t delay_;
+    // Smoothed arrival time of the secondary copy of a packet minus that of the primary copy, in ns.
+    int64_t skew_;
+    // Timeline of the latest output packet.
+    int64_t lastTimeline_;
+    std::vector<Input> inputs_;
+    // The latest output packets, indexed by output sequence number.
+    std::vector<Output> history_;
+    // Output sequence number plus one of the latest output packet with a key, by the low bits of the key. Entries
+    // overwritten by a colliding key make a repeated packet look new, which is rare at a quarter load.
+    std::vector<uint64_t> index_;
+    uint64_t outputCount_;
+    std::vector<uint8_t> output_;
+
+    void onDatagram(Input& input, const uint8_t* data, const size_t size, const int64_t now);
+    void merge(const int64_t now);
+    void skipRepeated(Input& input);
+    uint64_t findOutput(const uint32_t key) const;
+    bool holds(const Input& input, const uint32_t key) const;
+    void emit(const Input& input);
+    void measureSkew(const int64_t sample);
+    int64_t timeline(const Input& input) const;
+    int64_t dueTime(const Input& input) const;
+    void updateStalled(Input& input, const Input& other, const int64_t now);
+    int32_t pollTimeoutMs(const int64_t now) const;
+};
@@ -0,0 +1,315 @@
+#define GST_USE_UNSTABLE_API 1
+
+#include "SpliceFactory.h"
+#include "ChannelState.h"
+#include "utils/Json.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <limits>
+
+namespace
+{
+
+int32_t hexDigit(const char character)
+{
+    if (character >= '0' && character <= '9')
+    {
+        return character - '0';
+    }
+    if (character >= 'a' && character <= 'f')
+    {
+        return character - 'a' + 10;
+    }
+    if (character >= 'A' && character <= 'F')
+    {
+        return character - 'A' + 10;
+    }
+    return -1;
+}
+
+bool readByte(const std::string& json, const char* key, uint8_t& value)
+{
+    std::string text;
+    if (!utils::jsonValue(json, key, text))
+    {
+        return true;
+    }
+
+    char* end = nullptr;
+    const auto number = std::strtoul(text.c_str(), &end, 0);
+    value = static_cast<uint8_t>(number);
+    return end != text.c_str() && *end == '\0' && number <= 0xFF;
+}
+
+bool readDecimal(const std::string& text, const uint64_t maximum, uint64_t& value)
+{
+    // strtoull accepts a sign and leading whitespace, a negative number wraps.
+    if (text.empty() || text[0] < '0' || text[0] > '9')
+    {
+        return false;
+    }
+
+    char* end = nullptr;
+    const auto number = std::strtoull(text.c_str(), &end, 10);
+    value = static_cast<uint64_t>(number);
+    return *end == '\0' && number <= maximum;
+}
+
+} // namespace
+
+SpliceFactory::SpliceFactory(const std::chrono::seconds spliceDuration, const bool immediate, const bool autoReturn)
+    : spliceDuration_(spliceDuration),
+      immediate_(immediate),
+      autoReturn_(autoReturn),
+      nextEventId_(0),
+      nextUid_(0),
+      state_(nullptr)
+{
+}
+
+void SpliceFactory::setEventIdBase(const uint32_t base)
+{
+    std::lock_guard<std::mutex> lock(reservedMutex_);
+    nextEventId_ = std::max(nextEventId_, base);
+}
+
+bool SpliceFactory::reserveEventIds(const uint8_t* section, const size_t size)
+{
+    SpliceInfo info;
+    if (!readSpliceInfoSection(section, size, info))
+    {
+        return false;
+    }
+
+    std::array<uint32_t, SpliceInfo::maxSegmentationDescriptors + 1> eventIds;
+    size_t count = 0;
+    if (info.command == SpliceCommandType::SPLICE_INSERT)
+    {
+        eventIds[count++] = info.spliceInsert.eventId;
+    }
+    for (size_t i = 0; i < info.segmentationCount; ++i)
+    {
+        eventIds[count++] = info.segmentation[i].eventId;
+    }
+
+    std::lock_guard<std::mutex> lock(reservedMutex_);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!reservedEventIds_.insert(eventIds[i]).second)
+        {
+            continue;
+        }
+        reservedOrder_.push_back(eventIds[i]);
+        if (reservedOrder_.size() > maxReservedEventIds)
+        {
+            reservedEventIds_.erase(reservedOrder_.front());
+            reservedOrder_.pop_front();
+        }
+    }
+    return true;
+}
+
+uint32_t SpliceFactory::nextFreeEventId()
+{
+    std::lock_guard<std::mutex> lock(reservedMutex_);
+    while (reservedEventIds_.count(nextEventId_) != 0)
+    {
+        ++nextEventId_;
+    }
+    return nextEventId_++;
+}
+
+void SpliceFactory::setState(ChannelState* state)
+{
+    state_ = state;
+    if (state_ && state_->isWarm())
+    {
+        nextEventId_ = state_->nextEventId();
+        nextUid_ = state_->nextUid();
+    }
+}
+
+SpliceInsert SpliceFactory::makeSpliceInsert(const SpliceType spliceType,
+    const uint64_t spliceTime,
+    const SpliceTimeBase timeBase)
+{
+    SpliceRequest request;
+    request.type = spliceType;
+    request.immediate = spliceType == SpliceType::OUT && immediate_;
+    return makeSpliceInsert(request, spliceTime, timeBase);
+}
+
+SpliceInsert SpliceFactory::makeSpliceInsert(const SpliceRequest& request,
+    const uint64_t spliceTime,
+    const SpliceTimeBase timeBase)
+{
+    const auto spliceType = request.type;
+    const auto spliceDuration = request.duration.count() != 0 ? request.duration : spliceDuration_;
+
+    SpliceInsert result;
+    result.type = spliceType;
+    result.eventId = request.eventId ? *request.eventId : nextFreeEventId();
+    result.uniqueProgramId = nextUid_;
+    result.spliceTime = spliceTime;
+    result.immediate = request.immediate;
+
+    if (spliceType == SpliceType::IN)
+    {
+        ++nextUid_;
+    }
+    else
+    {
+        result.hasDuration = true;
+        result.breakDuration = timeBase == SpliceTimeBase::RUNNING_TIME
+            ? std::chrono::nanoseconds(spliceDuration).count()
+            : spliceDuration.count() * utils::ts::ptsClockRate;
+        result.autoReturn = autoReturn_;
+    }
+
+    if (state_)
+    {
+        state_->storeIds(nextEventId_, nextUid_);
+    }
+    return result;
+}
+
+SpliceInfo SpliceFactory::makeSpliceInfo(const SpliceRequest& request, const uint64_t spliceTime)
+{
+    SpliceInfo result;
+    uint32_t eventId = 0;
+    if (request.command == SpliceCommand::TIME_SIGNAL)
+    {
+        result.command = SpliceCommandType::TIME_SIGNAL;
+        result.timeSpecified = true;
+        result.spliceTime = spliceTime;
+        eventId = request.eventId ? *request.eventId : nextFreeEventId();
+        if (state_)
+        {
+            state_->storeIds(nextEventId_, nextUid_);
+        }
+    }
+    else
+    {
+        result.command = SpliceCommandType::SPLICE_INSERT;
+        result.spliceInsert = makeSpliceInsert(request, spliceTime, SpliceTimeBase::PTS);
+        eventId = result.spliceInsert.eventId;
+    }
+
+    if (request.segmentation)
+    {
+        auto& descriptor = result.segmentation[result.segmentationCount++];
+        descriptor = *request.segmentation;
+        descriptor.eventId = eventId;
+        descriptor.hasDuration = request.duration.count() != 0;
+        descriptor.duration = request.duration.count() * utils::ts::ptsClockRate;
+    }
+    return result;
+}
+
+bool SpliceFactory::readDuration(const std::string& text, SpliceRequest& request)
+{
+    uint64_t duration = 0;
+    if (!readDecimal(text, ((uint64_t(1) << 33) - 1) / utils::ts::ptsClockRate, duration) || duration == 0)
+    {
+        return false;
+    }
+    request.duration = std::chrono::seconds(duration);
+    return true;
+}
+
+bool SpliceFactory::readEventId(const std::string& text, SpliceRequest& request)
+{
+    uint64_t eventId = 0;
+    if (!readDecimal(text, std::numeric_limits<uint32_t>::max(), eventId))
+    {
+        return false;
+    }
+    request.eventId = static_cast<uint32_t>(eventId);
+    return true;
+}
+
+bool SpliceFactory::readSegmentation(const std::string& json, SpliceRequest& request)
+{
+    std::string upid;
+    if (!utils::jsonValue(json, "segmentation_type_id", upid))
+    {
+        return true;
+    }
+
+    SegmentationDescriptor descriptor;
+    if (!readByte(json, "segmentation_type_id", descriptor.typeId) ||
+        !readByte(json, "upid_type", descriptor.upidType) || !readByte(json, "segment_num", descriptor.segmentNumber) ||
+        !readByte(json, "segments_expected", descriptor.segmentsExpected))
+    {
+        return false;
+    }
+
+    if (utils::jsonValue(json, "upid", upid))
+    {
+        if (upid.size() % 2 != 0 || upid.size() / 2 > SegmentationDescriptor::maxUpidSize)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < upid.size(); i += 2)
+        {
+            const auto high = hexDigit(upid[i]);
+            const auto low = hexDigit(upid[i + 1]);
+            if (high < 0 || low < 0)
+            {
+                return false;
+            }
+            descriptor.upid[i / 2] = static_cast<uint8_t>((high << 4) | low);
+        }
+        descriptor.upidSize = static_cast<uint8_t>(upid.size() / 2);
+    }
+
+    request.segmentation = descriptor;
+    return true;
+}
+
+GstMpegtsSCTESIT* SpliceFactory::makeScteSit(const SpliceType spliceType,
+    const uint64_t spliceTime,
+    const SpliceTimeBase timeBase)
+{
+    return makeScteSit(makeSpliceInsert(spliceType, spliceTime, timeBase), timeBase);
+}
+
+GstMpegtsSCTESIT* SpliceFactory::makeScteSit(const SpliceInsert& spliceInsert, const SpliceTimeBase timeBase)
+{
+    const auto spliceTime = spliceInsert.immediate ? std::numeric_limits<uint64_t>::max() : spliceInsert.spliceTime;
+
+    GstMpegtsSCTESIT* result;
+    if (spliceInsert.type == SpliceType::IN)
+    {
+        result = gst_mpegts_scte_splice_in_new(spliceInsert.eventId, spliceTime);
+    }
+    else
+    {
+        result = gst_mpegts_scte_splice_out_new(spliceInsert.eventId, spliceTime, spliceInsert.breakDuration);
+    }
+    result->is_running_time = timeBase == SpliceTimeBase::RUNNING_TIME;
+
+    for (size_t i = 0; i < result->splices->len; ++i)
+    {
+        auto event = reinterpret_cast<GstMpegtsSCTESpliceEvent*>(result->splices->pdata[i]);
+        event->unique_program_id = spliceInsert.uniqueProgramId;
+        if (spliceInsert.autoReturn)
+        {
+            event->break_duration_auto_return = TRUE;
+        }
+    }
+
+    return result;
+}
+
+GstMpegtsSCTESIT* SpliceFactory::makeTimeSignal(const uint64_t spliceTime, const SpliceTimeBase timeBase)
+{
+    auto result = gst_mpegts_scte_sit_new();
+    result->splice_command_type = GST_MTS_SCTE_SPLICE_COMMAND_TIME;
+    result->splice_time_specified = TRUE;
+    result->splice_time = spliceTime;
+    result->is_running_time = timeBase == SpliceTimeBase::RUNNING_TIME;
+    return result;
+}
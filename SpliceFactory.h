@@ -0,0 +1,143 @@
+#pragma once
+
+#include "SpliceInfoSection.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <gst/mpegts/mpegts.h>
+
+class ChannelState;
+
+enum class SpliceTimeBase
+{
+    RUNNING_TIME,
+    PTS
+};
+
+enum class SpliceCommand
+{
+    SPLICE_INSERT,
+    TIME_SIGNAL
+};
+
+/**
+ * One cue to be sent, from the cue scheduler or the control API.
+ */
+struct SpliceRequest
+{
+    SpliceCommand command = SpliceCommand::SPLICE_INSERT;
+    SpliceType type = SpliceType::OUT;
+    bool immediate = false;
+    // Break duration of a splice out, 0 uses the channel's splice duration.
+    std::chrono::seconds duration = std::chrono::seconds(0);
+    // Scheduled cues carry their 33-bit splice PTS and event id, otherwise the engine and factory choose them.
+    std::optional<uint64_t> spliceTime;
+    std::optional<uint32_t> eventId;
+    // Adds a segmentation_descriptor, its event id and duration are taken from the request.
+    std::optional<SegmentationDescriptor> segmentation;
+    uint64_t id = 0;
+    std::chrono::steady_clock::time_point triggerTime;
+};
+
+/**
+ * Builds the splice_insert commands shared by all insertion engines and owns the event id and unique program id
+ * sequences.
+ */
+class SpliceFactory
+{
+public:
+    // First event id of local cues merged with upstream cues, upstream encoders count from 0.
+    static const uint32_t mergedEventIdBase = 0x80000000;
+
+    SpliceFactory(const std::chrono::seconds spliceDuration, const bool immediate, const bool autoReturn);
+
+    /**
+     * Continues the id sequences of a previous run from state and stores every allocation there, so that a restart
+     * never repeats a splice_event_id. state must outlive the factory.
+     */
+    void setState(ChannelState* state);
+
+    /**
+     * Moves the event id sequence to base unless it is already beyond it.
+     */
+    void setEventIdBase(const uint32_t base);
+
+    /**
+     * Keeps the event id sequence clear of the splice_event_id and segmentation_event_ids of an upstream
+     * splice_info_section. Safe to call from any thread.
+     * @return False if section is not a valid splice_info_section.
+     */
+    bool reserveEventIds(const uint8_t* section, const size_t size);
+
+    /**
+     * Allocates the ids of the next splice_insert.
+     * @param spliceTime Splice point in nanoseconds of running time (converted by mpegtsmux) or as a 90 kHz PTS
+     * written to the section as is, depending on timeBase.
+     */
+    SpliceInsert makeSpliceInsert(const SpliceType spliceType,
+        const uint64_t spliceTime,
+        const SpliceTimeBase timeBase);
+
+    /**
+     * As above with the immediate flag and break duration of a control API request, a zero duration uses the
+     * channel's splice duration.
+     */
+    SpliceInsert makeSpliceInsert(const SpliceRequest& request,
+        const uint64_t spliceTime,
+        const SpliceTimeBase timeBase);
+
+    /**
+     * Builds the splice_insert or time_signal of request with its segmentation_descriptor, for
+     * writeSpliceInfoSection.
+     * @param spliceTime 90 kHz PTS.
+     */
+    SpliceInfo makeSpliceInfo(const SpliceRequest& request, const uint64_t spliceTime);
+
+    /**
+     * Reads the segmentation_type_id, upid_type, upid (hex), segment_num and segments_expected fields of a JSON
+     * control request or schedule entry into request.segmentation.
+     * @return False if a field is invalid, true without a segmentation_type_id.
+     */
+    static bool readSegmentation(const std::string& json, SpliceRequest& request);
+
+    /**
+     * Reads a break duration in whole seconds into request.duration, from 1 up to the longest a 33-bit
+     * break_duration holds.
+     * @return False if text is not a decimal number in that range.
+     */
+    static bool readDuration(const std::string& text, SpliceRequest& request);
+
+    /**
+     * Reads a 32-bit decimal event id into request.eventId.
+     * @return False if text is not a decimal number in that range.
+     */
+    static bool readEventId(const std::string& text, SpliceRequest& request);
+
+    GstMpegtsSCTESIT* makeScteSit(const SpliceType spliceType,
+        const uint64_t spliceTime,
+        const SpliceTimeBase timeBase);
+
+    static GstMpegtsSCTESIT* makeScteSit(const SpliceInsert& spliceInsert, const SpliceTimeBase timeBase);
+
+    static GstMpegtsSCTESIT* makeTimeSignal(const uint64_t spliceTime, const SpliceTimeBase timeBase);
+
+private:
+    // Upstream ids kept clear of the sequence, the oldest are forgotten beyond this.
+    static const size_t maxReservedEventIds = 4096;
+
+    std::chrono::seconds spliceDuration_;
+    bool immediate_;
+    bool autoReturn_;
+    uint32_t nextEventId_;
+    uint16_t nextUid_;
+    ChannelState* state_;
+    std::mutex reservedMutex_;
+    std::unordered_set<uint32_t> reservedEventIds_;
+    std::deque<uint32_t> reservedOrder_;
+
+    uint32_t nextFreeEventId();
+};
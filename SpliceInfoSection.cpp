@@ -0,0 +1,544 @@
+#include "SpliceInfoSection.h"
+#include "utils/Crc32.h"
+#include <algorithm>
+
+namespace
+{
+
+const uint8_t spliceInfoTableId = 0xFC;
+const uint8_t availDescriptorTag = 0x00;
+const uint8_t segmentationDescriptorTag = 0x02;
+const uint32_t cueIdentifier = 0x43554549;
+const uint64_t maxTime = (uint64_t(1) << 33) - 1;
+const uint64_t maxSegmentationDuration = (uint64_t(1) << 40) - 1;
+
+/**
+ * Bounds checked big endian writer into the caller's buffer. Writes past the end are dropped and remembered.
+ */
+class Writer
+{
+public:
+    Writer(uint8_t* data, const size_t capacity) : data_(data), capacity_(capacity), size_(0), overflow_(false) {}
+
+    size_t size() const { return size_; }
+    bool overflow() const { return overflow_; }
+
+    void u8(const uint8_t value)
+    {
+        if (size_ < capacity_)
+        {
+            data_[size_] = value;
+        }
+        else
+        {
+            overflow_ = true;
+        }
+        ++size_;
+    }
+
+    void u16(const uint16_t value)
+    {
+        u8(static_cast<uint8_t>(value >> 8));
+        u8(static_cast<uint8_t>(value));
+    }
+
+    void u32(const uint32_t value)
+    {
+        u16(static_cast<uint16_t>(value >> 16));
+        u16(static_cast<uint16_t>(value));
+    }
+
+    /**
+     * A 33-bit time after 7 bits of flags: splice_time() with time_specified_flag, break_duration, pts_adjustment.
+     */
+    void time33(const uint8_t flags, const uint64_t value)
+    {
+        u8(static_cast<uint8_t>((flags & 0xFE) | ((value >> 32) & 0x01)));
+        u32(static_cast<uint32_t>(value));
+    }
+
+    /**
+     * Patches a 12 or 16 bit length written earlier as a placeholder, keeping the flag bits above it.
+     */
+    void patchLength(const size_t position, const size_t length, const uint16_t mask)
+    {
+        if (position + 1 < capacity_)
+        {
+            const auto value = static_cast<uint16_t>(((data_[position] << 8) & ~mask) | (length & mask));
+            data_[position] = static_cast<uint8_t>(value >> 8);
+            data_[position + 1] = static_cast<uint8_t>(value);
+        }
+    }
+
+    uint8_t* data() { return data_; }
+
+private:
+    uint8_t* data_;
+    size_t capacity_;
+    size_t size_;
+    bool overflow_;
+};
+
+void writeSpliceTime(Writer& writer, const bool timeSpecified, const uint64_t spliceTime)
+{
+    if (timeSpecified)
+    {
+        writer.time33(0xFE, spliceTime);
+    }
+    else
+    {
+        writer.u8(0x7F);
+    }
+}
+
+void writeSpliceInsert(Writer& writer, const SpliceInsert& spliceInsert)
+{
+    writer.u32(spliceInsert.eventId);
+    // splice_event_cancel_indicator, reserved.
+    writer.u8(spliceInsert.cancel ? 0xFF : 0x7F);
+    if (spliceInsert.cancel)
+    {
+        return;
+    }
+
+    // out_of_network_indicator, program_splice_flag, duration_flag, splice_immediate_flag, reserved.
+    writer.u8(static_cast<uint8_t>((spliceInsert.type == SpliceType::OUT ? 0x80 : 0x00) | 0x40 |
+        (spliceInsert.hasDuration ? 0x20 : 0x00) | (spliceInsert.immediate ? 0x10 : 0x00) | 0x0F));
+
+    if (!spliceInsert.immediate)
+    {
+        writeSpliceTime(writer, true, spliceInsert.spliceTime);
+    }
+
+    if (spliceInsert.hasDuration)
+    {
+        writer.time33(static_cast<uint8_t>((spliceInsert.autoReturn ? 0x80 : 0x00) | 0x7E), spliceInsert.breakDuration);
+    }
+
+    writer.u16(spliceInsert.uniqueProgramId);
+    // avail_num, avails_expected.
+    writer.u8(0);
+    writer.u8(0);
+}
+
+void writeSegmentationDescriptor(Writer& writer, const SegmentationDescriptor& descriptor)
+{
+    writer.u8(segmentationDescriptorTag);
+    const auto lengthPosition = writer.size();
+    writer.u8(0);
+    writer.u32(cueIdentifier);
+    writer.u32(descriptor.eventId);
+    writer.u8(descriptor.cancel ? 0xFF : 0x7F);
+
+    if (!descriptor.cancel)
+    {
+        // program_segmentation_flag, segmentation_duration_flag, delivery_not_restricted_flag and its restrictions.
+        auto flags = static_cast<uint8_t>(0x80 | (descriptor.hasDuration ? 0x40 : 0x00));
+        if (descriptor.deliveryNotRestricted)
+        {
+            flags |= 0x3F;
+        }
+        else
+        {
+            flags |= static_cast<uint8_t>((descriptor.webDeliveryAllowed ? 0x10 : 0x00) |
+                (descriptor.noRegionalBlackout ? 0x08 : 0x00) | (descriptor.archiveAllowed ? 0x04 : 0x00) |
+                (descriptor.deviceRestrictions & 0x03));
+        }
+        writer.u8(flags);
+
+        if (descriptor.hasDuration)
+        {
+            writer.u8(static_cast<uint8_t>(descriptor.duration >> 32));
+            writer.u32(static_cast<uint32_t>(descriptor.duration));
+        }
+
+        writer.u8(descriptor.upidType);
+        writer.u8(descriptor.upidSize);
+        for (size_t i = 0; i < descriptor.upidSize; ++i)
+        {
+            writer.u8(descriptor.upid[i]);
+        }
+
+        writer.u8(descriptor.typeId);
+        writer.u8(descriptor.segmentNumber);
+        writer.u8(descriptor.segmentsExpected);
+        if (descriptor.subSegmentsExpected != 0)
+        {
+            writer.u8(descriptor.subSegmentNumber);
+            writer.u8(descriptor.subSegmentsExpected);
+        }
+    }
+
+    writer.patchLength(lengthPosition - 1, writer.size() - lengthPosition - 1, 0x00FF);
+}
+
+/**
+ * Bounds checked big endian reader, reads past the end return zeros and are remembered.
+ */
+class Reader
+{
+public:
+    Reader(const uint8_t* data, const size_t size) : data_(data), size_(size), position_(0), underflow_(false) {}
+
+    size_t position() const { return position_; }
+    size_t remaining() const { return position_ < size_ ? size_ - position_ : 0; }
+    bool underflow() const { return underflow_; }
+
+    uint8_t peek() const { return position_ < size_ ? data_[position_] : 0; }
+
+    uint8_t u8()
+    {
+        if (position_ >= size_)
+        {
+            underflow_ = true;
+            return 0;
+        }
+        return data_[position_++];
+    }
+
+    uint16_t u16()
+    {
+        const auto high = u8();
+        return static_cast<uint16_t>((high << 8) | u8());
+    }
+
+    uint32_t u32()
+    {
+        const auto high = u16();
+        return (static_cast<uint32_t>(high) << 16) | u16();
+    }
+
+    /**
+     * A 33-bit time in the low bit of flags and the following 4 bytes, see Writer::time33.
+     */
+    uint64_t time33(uint8_t& flags)
+    {
+        flags = u8();
+        return (static_cast<uint64_t>(flags & 0x01) << 32) | u32();
+    }
+
+    void skip(const size_t size)
+    {
+        if (size > remaining())
+        {
+            underflow_ = true;
+            position_ = size_;
+            return;
+        }
+        position_ += size;
+    }
+
+    /**
+     * Limits reads to the next size bytes, e.g. to the body of a descriptor.
+     */
+    Reader sub(const size_t size)
+    {
+        const auto start = position_;
+        skip(size);
+        return Reader(data_ + std::min(start, size_), std::min(size, size_ - std::min(start, size_)));
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_;
+    bool underflow_;
+};
+
+/**
+ * @return False if no time is specified.
+ */
+bool readSpliceTime(Reader& reader, uint64_t& spliceTime)
+{
+    if ((reader.peek() & 0x80) == 0)
+    {
+        reader.u8();
+        return false;
+    }
+    uint8_t flags = 0;
+    spliceTime = reader.time33(flags);
+    return true;
+}
+
+void readSpliceInsert(Reader& reader, SpliceInsert& spliceInsert)
+{
+    spliceInsert.eventId = reader.u32();
+    spliceInsert.cancel = (reader.u8() & 0x80) != 0;
+    if (spliceInsert.cancel)
+    {
+        return;
+    }
+
+    const auto flags = reader.u8();
+    spliceInsert.type = (flags & 0x80) != 0 ? SpliceType::OUT : SpliceType::IN;
+    const auto programSplice = (flags & 0x40) != 0;
+    spliceInsert.hasDuration = (flags & 0x20) != 0;
+    spliceInsert.immediate = (flags & 0x10) != 0;
+
+    if (programSplice && !spliceInsert.immediate)
+    {
+        readSpliceTime(reader, spliceInsert.spliceTime);
+    }
+    else if (!programSplice)
+    {
+        const auto componentCount = reader.u8();
+        for (uint8_t i = 0; i < componentCount; ++i)
+        {
+            reader.u8();
+            uint64_t spliceTime = 0;
+            if (!spliceInsert.immediate && readSpliceTime(reader, spliceTime) && i == 0)
+            {
+                spliceInsert.spliceTime = spliceTime;
+            }
+        }
+    }
+
+    if (spliceInsert.hasDuration)
+    {
+        uint8_t durationFlags = 0;
+        spliceInsert.breakDuration = reader.time33(durationFlags);
+        spliceInsert.autoReturn = (durationFlags & 0x80) != 0;
+    }
+
+    spliceInsert.uniqueProgramId = reader.u16();
+    reader.skip(2);
+}
+
+void readSegmentationDescriptor(Reader& reader, SegmentationDescriptor& descriptor)
+{
+    descriptor.eventId = reader.u32();
+    descriptor.cancel = (reader.u8() & 0x80) != 0;
+    if (descriptor.cancel)
+    {
+        return;
+    }
+
+    const auto flags = reader.u8();
+    descriptor.hasDuration = (flags & 0x40) != 0;
+    descriptor.deliveryNotRestricted = (flags & 0x20) != 0;
+    if (!descriptor.deliveryNotRestricted)
+    {
+        descriptor.webDeliveryAllowed = (flags & 0x10) != 0;
+        descriptor.noRegionalBlackout = (flags & 0x08) != 0;
+        descriptor.archiveAllowed = (flags & 0x04) != 0;
+        descriptor.deviceRestrictions = flags & 0x03;
+    }
+
+    // Component segmentation: component_tag and a 33-bit pts_offset per component.
+    if ((flags & 0x80) == 0)
+    {
+        reader.skip(reader.u8() * size_t(6));
+    }
+
+    if (descriptor.hasDuration)
+    {
+        const uint64_t high = reader.u8();
+        descriptor.duration = (high << 32) | reader.u32();
+    }
+
+    descriptor.upidType = reader.u8();
+    const auto upidSize = reader.u8();
+    descriptor.upidSize = upidSize > SegmentationDescriptor::maxUpidSize
+        ? static_cast<uint8_t>(SegmentationDescriptor::maxUpidSize)
+        : upidSize;
+    for (size_t i = 0; i < upidSize; ++i)
+    {
+        const auto byte = reader.u8();
+        if (i < descriptor.upidSize)
+        {
+            descriptor.upid[i] = byte;
+        }
+    }
+
+    descriptor.typeId = reader.u8();
+    descriptor.segmentNumber = reader.u8();
+    descriptor.segmentsExpected = reader.u8();
+    if (reader.remaining() >= 2)
+    {
+        descriptor.subSegmentNumber = reader.u8();
+        descriptor.subSegmentsExpected = reader.u8();
+    }
+}
+
+bool isValid(const SpliceInfo& info)
+{
+    if (info.ptsAdjustment > maxTime || info.tier > 0xFFF ||
+        info.segmentationCount > SpliceInfo::maxSegmentationDescriptors)
+    {
+        return false;
+    }
+
+    if (info.command == SpliceCommandType::SPLICE_INSERT &&
+        (info.spliceInsert.spliceTime > maxTime || info.spliceInsert.breakDuration > maxTime))
+    {
+        return false;
+    }
+
+    if (info.command == SpliceCommandType::TIME_SIGNAL && info.spliceTime > maxTime)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < info.segmentationCount; ++i)
+    {
+        const auto& descriptor = info.segmentation[i];
+        if (descriptor.duration > maxSegmentationDuration || descriptor.upidSize > SegmentationDescriptor::maxUpidSize)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+size_t writeSpliceInfoSection(const SpliceInfo& info, uint8_t* destination, const size_t capacity)
+{
+    if (!isValid(info))
+    {
+        return 0;
+    }
+
+    Writer writer(destination, capacity);
+
+    // section_syntax_indicator 0, private_indicator 0, sap_type 3 (not specified), section_length patched below.
+    writer.u8(spliceInfoTableId);
+    writer.u16(0x3000);
+    writer.u8(0);
+    // encrypted_packet 0, encryption_algorithm 0.
+    writer.time33(0x00, info.ptsAdjustment);
+    writer.u8(info.cwIndex);
+
+    // tier and splice_command_length, patched below.
+    const auto commandLengthPosition = writer.size() + 1;
+    writer.u8(static_cast<uint8_t>(info.tier >> 4));
+    writer.u16(static_cast<uint16_t>((info.tier & 0x0F) << 12));
+    writer.u8(static_cast<uint8_t>(info.command));
+
+    const auto commandStart = writer.size();
+    switch (info.command)
+    {
+    case SpliceCommandType::SPLICE_INSERT:
+        writeSpliceInsert(writer, info.spliceInsert);
+        break;
+    case SpliceCommandType::TIME_SIGNAL:
+        writeSpliceTime(writer, info.timeSpecified, info.spliceTime);
+        break;
+    case SpliceCommandType::SPLICE_NULL:
+    case SpliceCommandType::BANDWIDTH_RESERVATION:
+        break;
+    }
+    writer.patchLength(commandLengthPosition, writer.size() - commandStart, 0x0FFF);
+
+    const auto descriptorLoopPosition = writer.size();
+    writer.u16(0);
+    if (info.hasAvailDescriptor)
+    {
+        writer.u8(availDescriptorTag);
+        writer.u8(8);
+        writer.u32(cueIdentifier);
+        writer.u32(info.providerAvailId);
+    }
+    for (size_t i = 0; i < info.segmentationCount; ++i)
+    {
+        writeSegmentationDescriptor(writer, info.segmentation[i]);
+    }
+    writer.patchLength(descriptorLoopPosition, writer.size() - descriptorLoopPosition - 2, 0xFFFF);
+
+    // E_CRC_32 only exists for encrypted sections.
+    writer.patchLength(1, writer.size() + 4 - 3, 0x0FFF);
+    if (writer.overflow() || writer.size() + 4 > capacity)
+    {
+        return 0;
+    }
+
+    const auto crc = utils::crc32Mpeg(destination, writer.size());
+    writer.u32(crc);
+    return writer.size();
+}
+
+bool readSpliceInfoSection(const uint8_t* section, const size_t size, SpliceInfo& info)
+{
+    // Fixed header, splice_command_length and descriptor_loop_length: 16 bytes, plus the CRC32.
+    if (size < 20 || section[0] != spliceInfoTableId || (((section[1] & 0x0F) << 8) | section[2]) + 3u != size ||
+        utils::crc32Mpeg(section, size) != 0)
+    {
+        return false;
+    }
+
+    info = SpliceInfo();
+    Reader reader(section, size - 4);
+    reader.skip(4);
+
+    uint8_t flags = 0;
+    info.ptsAdjustment = reader.time33(flags);
+    if ((flags & 0x80) != 0)
+    {
+        return false;
+    }
+    info.cwIndex = reader.u8();
+
+    const auto tierAndLength = reader.u8();
+    const auto lengthLow = reader.u16();
+    info.tier = static_cast<uint16_t>((tierAndLength << 4) | (lengthLow >> 12));
+    const size_t commandLength = lengthLow & 0x0FFF;
+    info.command = static_cast<SpliceCommandType>(reader.u8());
+
+    // Legacy sections signal an unknown command length as 0xFFF, which is only workable for commands parsed here.
+    const auto knownLength = commandLength != 0x0FFF;
+    auto command = reader.sub(knownLength ? commandLength : reader.remaining());
+    switch (info.command)
+    {
+    case SpliceCommandType::SPLICE_INSERT:
+        readSpliceInsert(command, info.spliceInsert);
+        break;
+    case SpliceCommandType::TIME_SIGNAL:
+        info.timeSpecified = readSpliceTime(command, info.spliceTime);
+        break;
+    case SpliceCommandType::SPLICE_NULL:
+    case SpliceCommandType::BANDWIDTH_RESERVATION:
+        break;
+    default:
+        if (!knownLength)
+        {
+            return false;
+        }
+        break;
+    }
+    if (command.underflow())
+    {
+        return false;
+    }
+    if (!knownLength)
+    {
+        reader = Reader(section + 14 + command.position(), size - 4 - 14 - command.position());
+    }
+
+    const size_t descriptorLoopLength = reader.u16();
+    auto descriptors = reader.sub(descriptorLoopLength);
+    while (descriptors.remaining() >= 2)
+    {
+        const auto tag = descriptors.u8();
+        auto descriptor = descriptors.sub(descriptors.u8());
+        if (descriptor.u32() != cueIdentifier)
+        {
+            continue;
+        }
+
+        if (tag == availDescriptorTag)
+        {
+            info.hasAvailDescriptor = true;
+            info.providerAvailId = descriptor.u32();
+        }
+        else if (tag == segmentationDescriptorTag && info.segmentationCount < SpliceInfo::maxSegmentationDescriptors)
+        {
+            readSegmentationDescriptor(descriptor, info.segmentation[info.segmentationCount++]);
+        }
+
+        if (descriptor.underflow())
+        {
+            return false;
+        }
+    }
+    return !reader.underflow() && !descriptors.underflow();
+}
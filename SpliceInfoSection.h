@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class SpliceType
+{
+    IN,
+    OUT
+};
+
+/**
+ * splice_command_type values of the commands the encoder writes. The parser also reports other command types, with
+ * only the common header fields set.
+ */
+enum class SpliceCommandType : uint8_t
+{
+    SPLICE_NULL = 0x00,
+    SPLICE_INSERT = 0x05,
+    TIME_SIGNAL = 0x06,
+    BANDWIDTH_RESERVATION = 0x07
+};
+
+/**
+ * Field values of one splice_insert command.
+ */
+struct SpliceInsert
+{
+    SpliceType type = SpliceType::OUT;
+    uint32_t eventId = 0;
+    // A cancel carries no further fields.
+    bool cancel = false;
+    uint16_t uniqueProgramId = 0;
+    bool immediate = false;
+    uint64_t spliceTime = 0;
+    bool hasDuration = false;
+    uint64_t breakDuration = 0;
+    bool autoReturn = false;
+};
+
+/**
+ * Fields of a segmentation_descriptor in program segmentation mode. Times are 90 kHz ticks.
+ */
+struct SegmentationDescriptor
+{
+    static const size_t maxUpidSize = 64;
+
+    uint32_t eventId = 0;
+    bool cancel = false;
+    uint8_t typeId = 0;
+    bool hasDuration = false;
+    uint64_t duration = 0;
+    bool deliveryNotRestricted = true;
+    bool webDeliveryAllowed = true;
+    bool noRegionalBlackout = true;
+    bool archiveAllowed = true;
+    uint8_t deviceRestrictions = 3;
+    uint8_t upidType = 0;
+    uint8_t upidSize = 0;
+    std::array<uint8_t, maxUpidSize> upid{};
+    uint8_t segmentNumber = 0;
+    uint8_t segmentsExpected = 0;
+    // Sub segment fields are only written when subSegmentsExpected is not 0.
+    uint8_t subSegmentNumber = 0;
+    uint8_t subSegmentsExpected = 0;
+};
+
+/**
+ * Everything the encoder needs for one splice_info_section, in fixed size storage so that a section can be built
+ * on the packet path.
+ */
+struct SpliceInfo
+{
+    static const size_t maxSegmentationDescriptors = 4;
+
+    SpliceCommandType command = SpliceCommandType::SPLICE_NULL;
+    uint64_t ptsAdjustment = 0;
+    uint8_t cwIndex = 0;
+    uint16_t tier = 0xFFF;
+
+    // SPLICE_INSERT
+    SpliceInsert spliceInsert;
+
+    // TIME_SIGNAL
+    bool timeSpecified = false;
+    uint64_t spliceTime = 0;
+
+    // Descriptor loop: an avail_descriptor, then the segmentation_descriptors.
+    bool hasAvailDescriptor = false;
+    uint32_t providerAvailId = 0;
+    std::array<SegmentationDescriptor, maxSegmentationDescriptors> segmentation;
+    size_t segmentationCount = 0;
+};
+
+/**
+ * Largest section writeSpliceInfoSection produces: four segmentation_descriptors with maximum UPIDs.
+ */
+const size_t maxSpliceInfoSectionSize = 512;
+
+/**
+ * Serializes info as an unencrypted SCTE-35 splice_info_section, CRC32 included, reserved bits set to ones.
+ * @return Section size, 0 if capacity is too small or a field is out of range.
+ */
+size_t writeSpliceInfoSection(const SpliceInfo& info, uint8_t* destination, const size_t capacity);
+
+/**
+ * Parses an unencrypted splice_info_section, checking its CRC32, without allocating. Component splice_inserts report
+ * the splice time of their first component, descriptors other than avail and segmentation descriptors and
+ * segmentation descriptors beyond maxSegmentationDescriptors are skipped.
+ * @return False if the section is malformed, encrypted or fails the CRC check.
+ */
+bool readSpliceInfoSection(const uint8_t* section, const size_t size, SpliceInfo& info);
@@ -0,0 +1,374 @@
+#include "SpliceInjector.h"
+#include "Logger.h"
+#include "utils/Crc32.h"
+#include <algorithm>
+
+namespace
+{
+
+const uint8_t patTableId = 0x00;
+const uint8_t pmtTableId = 0x02;
+const uint8_t spliceInfoTableId = 0xFC;
+const size_t maxSectionLength = 1021;
+
+uint32_t readCrc(const uint8_t* section, const size_t size)
+{
+    const auto crc = section + size - 4;
+    return (static_cast<uint32_t>(crc[0]) << 24) | (static_cast<uint32_t>(crc[1]) << 16) |
+        (static_cast<uint32_t>(crc[2]) << 8) | crc[3];
+}
+
+void writeCrc(std::vector<uint8_t>& section)
+{
+    const auto crc = utils::crc32Mpeg(section.data(), section.size());
+    section.push_back(static_cast<uint8_t>(crc >> 24));
+    section.push_back(static_cast<uint8_t>(crc >> 16));
+    section.push_back(static_cast<uint8_t>(crc >> 8));
+    section.push_back(static_cast<uint8_t>(crc));
+}
+
+} // namespace
+
+SpliceInjector::SpliceInjector(const uint16_t scte35Pid)
+    : scte35Pid_(scte35Pid),
+      mergeUpstream_(false),
+      pmtPid_(utils::ts::nullPid),
+      pcrPid_(utils::ts::nullPid),
+      inputPmtCrc_(0),
+      tablesVersion_(0),
+      sendPrimedPmt_(false),
+      pmtContinuityCounter_(0x0F),
+      replaceUpstream_(false),
+      loggedReplaceUpstream_(false),
+      pendingCount_(0),
+      scte35ContinuityCounter_(0x0F),
+      packetsWithoutNullSlot_(0)
+{
+}
+
+void SpliceInjector::queueSection(const uint8_t* section, const size_t size)
+{
+    std::vector<uint8_t> packets;
+
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    utils::ts::packetizeSection(scte35Pid(), section, size, scte35ContinuityCounter_, packets);
+    for (size_t offset = 0; offset < packets.size(); offset += utils::ts::packetSize)
+    {
+        auto& packet = pendingPackets_.emplace_back();
+        std::copy_n(packets.data() + offset, utils::ts::packetSize, packet.data());
+    }
+    pendingCount_.store(pendingPackets_.size(), std::memory_order_release);
+}
+
+void SpliceInjector::mergeUpstream(SectionFunction onSection)
+{
+    mergeUpstream_ = true;
+    onUpstreamSection_ = std::move(onSection);
+}
+
+void SpliceInjector::prime(const std::vector<uint8_t>& pat, const std::vector<uint8_t>& pmt)
+{
+    onPat(pat.data(), pat.size());
+    onPmt(pmt.data(), pmt.size());
+    videoClock_.prime(pat, pmt);
+    sendPrimedPmt_ = !outputPmt_.empty();
+}
+
+void SpliceInjector::process(const uint8_t* packets, const size_t size, std::vector<uint8_t>& output)
+{
+    if (sendPrimedPmt_)
+    {
+        utils::ts::packetizeSection(pmtPid_, outputPmt_.data(), outputPmt_.size(), pmtContinuityCounter_, output);
+        sendPrimedPmt_ = false;
+    }
+
+    for (size_t offset = 0; offset + utils::ts::packetSize <= size; offset += utils::ts::packetSize)
+    {
+        const auto packet = packets + offset;
+        if (packet[0] != utils::ts::syncByte)
+        {
+            continue;
+        }
+
+        const auto pid = utils::ts::pid(packet);
+
+        if (pid == utils::ts::nullPid)
+        {
+            packetsWithoutNullSlot_ = 0;
+            const auto outputOffset = output.size();
+            output.resize(outputOffset + utils::ts::packetSize);
+            if (!popPendingPacket(output.data() + outputOffset))
+            {
+                std::copy_n(packet, utils::ts::packetSize, output.data() + outputOffset);
+            }
+            continue;
+        }
+
+        videoClock_.onPacket(packet);
+
+        if (pid == utils::ts::patPid)
+        {
+            patAssembler_.push(packet, [this](const uint8_t* section, size_t sectionSize) {
+                onPat(section, sectionSize);
+            });
+        }
+        else if (pid == pmtPid_)
+        {
+            pmtAssembler_.push(packet, [this, &output](const uint8_t* section, size_t sectionSize) {
+                onPmt(section, sectionSize);
+                if (!outputPmt_.empty())
+                {
+                    utils::ts::packetizeSection(pmtPid_,
+                        outputPmt_.data(),
+                        outputPmt_.size(),
+                        pmtContinuityCounter_,
+                        output);
+                }
+            });
+            continue;
+        }
+        else if (pid == scte35Pid() && mergeUpstream_)
+        {
+            upstreamAssembler_.push(packet, [this](const uint8_t* section, size_t sectionSize) {
+                onUpstreamSection(section, sectionSize);
+            });
+            continue;
+        }
+        else if (pid == scte35Pid() && replaceUpstream_)
+        {
+            if (!loggedReplaceUpstream_)
+            {
+                Logger::warning("Input already carries SCTE-35 on PID %u, dropping its packets", pid);
+                loggedReplaceUpstream_ = true;
+            }
+            continue;
+        }
+
+        output.insert(output.end(), packet, packet + utils::ts::packetSize);
+
+        if (pendingCount_.load(std::memory_order_acquire) != 0 && ++packetsWithoutNullSlot_ >= nullSlotWindow)
+        {
+            const auto outputOffset = output.size();
+            output.resize(outputOffset + utils::ts::packetSize);
+            popPendingPacket(output.data() + outputOffset);
+            packetsWithoutNullSlot_ = 0;
+        }
+    }
+}
+
+void SpliceInjector::onPat(const uint8_t* section, const size_t size)
+{
+    if (size < 12 || section[0] != patTableId || utils::crc32Mpeg(section, size) != 0)
+    {
+        return;
+    }
+
+    for (size_t offset = 8; offset + 4 <= size - 4; offset += 4)
+    {
+        const auto programNumber = static_cast<uint16_t>((section[offset] << 8) | section[offset + 1]);
+        if (programNumber == 0)
+        {
+            continue;
+        }
+
+        const auto pmtPid = static_cast<uint16_t>(((section[offset + 2] & 0x1F) << 8) | section[offset + 3]);
+        if (pmtPid != pmtPid_)
+        {
+            Logger::log("Program %u PMT on PID %u", programNumber, pmtPid);
+            pmtPid_ = pmtPid;
+            pmtAssembler_.reset();
+            outputPmt_.clear();
+            inputPmtCrc_ = 0;
+            inputPat_.assign(section, section + size);
+            ++tablesVersion_;
+        }
+        return;
+    }
+}
+
+void SpliceInjector::onPmt(const uint8_t* section, const size_t size)
+{
+    if (size < 16 || section[0] != pmtTableId || utils::crc32Mpeg(section, size) != 0)
+    {
+        return;
+    }
+
+    const auto crc = readCrc(section, size);
+    if (crc == inputPmtCrc_ && !outputPmt_.empty())
+    {
+        return;
+    }
+    inputPmtCrc_ = crc;
+    inputPmt_.assign(section, section + size);
+    ++tablesVersion_;
+
+    pcrPid_ = static_cast<uint16_t>(((section[8] & 0x1F) << 8) | section[9]);
+    const size_t programInfoLength = ((section[10] & 0x0F) << 8) | section[11];
+    const size_t esLoopStart = 12 + programInfoLength;
+    const size_t esLoopEnd = size - 4;
+    if (esLoopStart > esLoopEnd)
+    {
+        outputPmt_.clear();
+        return;
+    }
+
+    bool hasRegistration = false;
+    for (size_t offset = 12; offset + 2 <= esLoopStart; offset += 2 + section[offset + 1])
+    {
+        if (section[offset] == 0x05 && section[offset + 1] >= 4 && offset + 6 <= esLoopStart &&
+            memcmp(section + offset + 2, "CUEI", 4) == 0)
+        {
+            hasRegistration = true;
+        }
+    }
+
+    bool hasScte35Stream = false;
+    uint8_t conflictingStreamType = scte35StreamType;
+    std::vector<uint16_t> streamPids;
+    auto scte35Pid = this->scte35Pid();
+    for (size_t offset = esLoopStart; offset + 5 <= esLoopEnd;)
+    {
+        const auto streamType = section[offset];
+        const auto pid = static_cast<uint16_t>(((section[offset + 1] & 0x1F) << 8) | section[offset + 2]);
+        const size_t esInfoLength = ((section[offset + 3] & 0x0F) << 8) | section[offset + 4];
+        streamPids.push_back(pid);
+        if (mergeUpstream_ && streamType == scte35StreamType && !hasScte35Stream && pid != scte35Pid)
+        {
+            adoptScte35Pid(pid);
+            scte35Pid = pid;
+        }
+        if (pid == scte35Pid)
+        {
+            if (streamType == scte35StreamType)
+            {
+                hasScte35Stream = true;
+            }
+            else
+            {
+                conflictingStreamType = streamType;
+            }
+        }
+        offset += 5 + esInfoLength;
+    }
+
+    if (conflictingStreamType != scte35StreamType)
+    {
+        const auto movedPid = freePid(streamPids);
+        Logger::warning("PMT already uses PID %u for stream type 0x%02x, moving the SCTE-35 sections to PID %u",
+            scte35Pid,
+            conflictingStreamType,
+            movedPid);
+        moveScte35Pid(movedPid);
+        scte35Pid = movedPid;
+        hasScte35Stream = false;
+    }
+    replaceUpstream_ = hasScte35Stream && !mergeUpstream_;
+
+    const std::array<uint8_t, 6> registrationDescriptor = {0x05, 0x04, 'C', 'U', 'E', 'I'};
+    const std::array<uint8_t, 5> scte35Stream = {scte35StreamType,
+        static_cast<uint8_t>(0xE0 | ((scte35Pid >> 8) & 0x1F)),
+        static_cast<uint8_t>(scte35Pid & 0xFF),
+        0xF0,
+        0x00};
+
+    outputPmt_.clear();
+    outputPmt_.insert(outputPmt_.end(), section, section + 12);
+    if (!hasRegistration)
+    {
+        outputPmt_.insert(outputPmt_.end(), registrationDescriptor.begin(), registrationDescriptor.end());
+    }
+    outputPmt_.insert(outputPmt_.end(), section + 12, section + esLoopEnd);
+    if (!hasScte35Stream)
+    {
+        outputPmt_.insert(outputPmt_.end(), scte35Stream.begin(), scte35Stream.end());
+    }
+
+    const auto newProgramInfoLength = programInfoLength + (hasRegistration ? 0 : registrationDescriptor.size());
+    const auto newSectionLength = outputPmt_.size() + 4 - 3;
+    if (newSectionLength > maxSectionLength)
+    {
+        Logger::warning("Rewritten PMT exceeds the maximum section length, forwarding it unchanged");
+        outputPmt_.assign(section, section + size);
+        return;
+    }
+
+    outputPmt_[1] = static_cast<uint8_t>((outputPmt_[1] & 0xF0) | ((newSectionLength >> 8) & 0x0F));
+    outputPmt_[2] = static_cast<uint8_t>(newSectionLength & 0xFF);
+    outputPmt_[10] = static_cast<uint8_t>((outputPmt_[10] & 0xF0) | ((newProgramInfoLength >> 8) & 0x0F));
+    outputPmt_[11] = static_cast<uint8_t>(newProgramInfoLength & 0xFF);
+    writeCrc(outputPmt_);
+
+    Logger::log("PMT version %u rewritten, PCR PID %u, SCTE-35 PID %u",
+        (section[5] >> 1) & 0x1F,
+        pcrPid_,
+        scte35Pid);
+}
+
+void SpliceInjector::onUpstreamSection(const uint8_t* section, const size_t size)
+{
+    if (size < 3 || section[0] != spliceInfoTableId || utils::crc32Mpeg(section, size) != 0)
+    {
+        return;
+    }
+
+    if (onUpstreamSection_)
+    {
+        onUpstreamSection_(section, size);
+    }
+    queueSection(section, size);
+}
+
+void SpliceInjector::adoptScte35Pid(const uint16_t pid)
+{
+    Logger::log("Merging the cues into the SCTE-35 PID %u of the input", pid);
+    moveScte35Pid(pid);
+    upstreamAssembler_.reset();
+}
+
+void SpliceInjector::moveScte35Pid(const uint16_t pid)
+{
+    // Sections queued before the PMT was seen move to the new PID, their continuity counter stays in sequence.
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    scte35Pid_.store(pid, std::memory_order_relaxed);
+    for (auto& packet : pendingPackets_)
+    {
+        packet[1] = static_cast<uint8_t>((packet[1] & 0xE0) | ((pid >> 8) & 0x1F));
+        packet[2] = static_cast<uint8_t>(pid & 0xFF);
+    }
+}
+
+uint16_t SpliceInjector::freePid(const std::vector<uint16_t>& streamPids) const
+{
+    // The first PID after the configured one that no stream, the PMT or the PCR uses, skipping the reserved PIDs.
+    const uint16_t firstPid = 0x20;
+    auto pid = scte35Pid();
+    for (uint16_t tried = 0; tried < utils::ts::nullPid - firstPid; ++tried)
+    {
+        pid = pid + 1 >= utils::ts::nullPid || pid < firstPid ? firstPid : static_cast<uint16_t>(pid + 1);
+        if (pid != pmtPid_ && pid != pcrPid_ &&
+            std::find(streamPids.begin(), streamPids.end(), pid) == streamPids.end())
+        {
+            return pid;
+        }
+    }
+    return utils::ts::nullPid;
+}
+
+bool SpliceInjector::popPendingPacket(uint8_t* destination)
+{
+    if (pendingCount_.load(std::memory_order_acquire) == 0)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(pendingMutex_);
+    if (pendingPackets_.empty())
+    {
+        return false;
+    }
+
+    std::copy_n(pendingPackets_.front().data(), utils::ts::packetSize, destination);
+    pendingPackets_.pop_front();
+    pendingCount_.store(pendingPackets_.size(), std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "VideoClock.h"
+#include "utils/PsiSection.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+/**
+ * Inserts SCTE-35 sections into an MPEG-TS packet stream without remuxing. The PMT of the first program is
+ * rewritten to announce the SCTE-35 PID, queued SCTE-35 packets replace null packets (or are inserted between
+ * packets when the stream carries no stuffing), and all other packets are forwarded byte-identical. If the PMT
+ * already uses the SCTE-35 PID for another stream type, the sections move to a PID the PMT does not use.
+ *
+ * In merge mode the SCTE-35 PID of the input is kept: its sections are reassembled and queued like local ones, so
+ * both go out as whole sections on that PID under one continuity counter.
+ */
+class SpliceInjector
+{
+public:
+    using SectionFunction = std::function<void(const uint8_t* section, const size_t size)>;
+
+    /**
+     * @param scte35Pid PID of the queued sections, replaced by the input's SCTE-35 PID in merge mode or by a free PID
+     * if the input uses it for another stream type.
+     */
+    explicit SpliceInjector(const uint16_t scte35Pid);
+
+    /**
+     * Enables merge mode, onSection sees every upstream splice_info_section on the process thread before it is
+     * queued. Must be called before the first process call.
+     */
+    void mergeUpstream(SectionFunction onSection);
+
+    /**
+     * @return PID the SCTE-35 sections go out on.
+     */
+    uint16_t scte35Pid() const { return scte35Pid_.load(std::memory_order_relaxed); }
+
+    /**
+     * Packetizes a complete splice_info_section for insertion. Safe to call from any thread.
+     */
+    void queueSection(const uint8_t* section, const size_t size);
+
+    /**
+     * Processes whole TS packets and appends the resulting packets to output. Must only be called from one thread.
+     */
+    void process(const uint8_t* packets, const size_t size, std::vector<uint8_t>& output);
+
+    /**
+     * Video position of the processed stream, the splice PTS must be taken from here.
+     */
+    const VideoClock& videoClock() const { return videoClock_; }
+
+    /**
+     * Starts from a PAT and PMT cached from an earlier run: the rewritten PMT goes out ahead of the first packet and
+     * the video clock follows the video PID right away. A differing PMT in the input replaces them as usual.
+     */
+    void prime(const std::vector<uint8_t>& pat, const std::vector<uint8_t>& pmt);
+
+    /**
+     * Latest valid PAT and PMT sections of the input, for caching. tablesVersion changes whenever one of them does.
+     */
+    const std::vector<uint8_t>& inputPat() const { return inputPat_; }
+    const std::vector<uint8_t>& inputPmt() const { return inputPmt_; }
+    uint32_t tablesVersion() const { return tablesVersion_; }
+
+private:
+    using Packet = std::array<uint8_t, utils::ts::packetSize>;
+
+    static const uint8_t scte35StreamType = 0x86;
+    static const uint32_t nullSlotWindow = 64;
+
+    std::atomic<uint16_t> scte35Pid_;
+    bool mergeUpstream_;
+    SectionFunction onUpstreamSection_;
+    utils::ts::SectionAssembler upstreamAssembler_;
+    uint16_t pmtPid_;
+    uint16_t pcrPid_;
+    utils::ts::SectionAssembler patAssembler_;
+    utils::ts::SectionAssembler pmtAssembler_;
+    uint32_t inputPmtCrc_;
+    std::vector<uint8_t> outputPmt_;
+    std::vector<uint8_t> inputPat_;
+    std::vector<uint8_t> inputPmt_;
+    uint32_t tablesVersion_;
+    bool sendPrimedPmt_;
+    uint8_t pmtContinuityCounter_;
+    // The input carries SCTE-35 on the PID of the queued sections, its packets are replaced by ours.
+    bool replaceUpstream_;
+    bool loggedReplaceUpstream_;
+    VideoClock videoClock_;
+
+    std::mutex pendingMutex_;
+    std::deque<Packet> pendingPackets_;
+    std::atomic<size_t> pendingCount_;
+    uint8_t scte35ContinuityCounter_;
+    uint32_t packetsWithoutNullSlot_;
+
+    void onPat(const uint8_t* section, const size_t size);
+    void onPmt(const uint8_t* section, const size_t size);
+    void onUpstreamSection(const uint8_t* section, const size_t size);
+    void adoptScte35Pid(const uint16_t pid);
+    void moveScte35Pid(const uint16_t pid);
+    uint16_t freePid(const std::vector<uint16_t>& streamPids) const;
+    bool popPendingPacket(uint8_t* destination);
+};
@@ -0,0 +1,241 @@
+#include "SpliceRequestQueue.h"
+#include "Logger.h"
+#include "utils/TsPacket.h"
+
+namespace
+{
+
+const uint8_t spliceInfoTableId = 0xFC;
+const uint8_t spliceNullCommandType = 0x00;
+const uint8_t spliceInsertCommandType = 0x05;
+const uint8_t timeSignalCommandType = 0x06;
+const uint8_t segmentationDescriptorTag = 0x02;
+// Event ids are 32 bits, these mark a section without one and a section whose id lies beyond its first packet.
+const uint64_t noEventId = uint64_t(1) << 32;
+const uint64_t unknownEventId = uint64_t(1) << 33;
+
+int64_t steadyNanoseconds(const std::chrono::steady_clock::time_point timePoint)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint.time_since_epoch()).count();
+}
+
+uint32_t readUint32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+        (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+uint64_t eventId(const SpliceInfo& spliceInfo)
+{
+    if (spliceInfo.command == SpliceCommandType::SPLICE_INSERT)
+    {
+        return spliceInfo.spliceInsert.eventId;
+    }
+    return spliceInfo.segmentationCount != 0 ? spliceInfo.segmentation[0].eventId : noEventId;
+}
+
+/**
+ * Event id of the splice_info_section that starts at byte section of packet, read as far as the packet reaches.
+ */
+uint64_t sectionEventId(const uint8_t* packet, const size_t section)
+{
+    const auto command = section + 14;
+    if (packet[section + 13] == spliceInsertCommandType)
+    {
+        return command + 4 <= utils::ts::packetSize ? readUint32(packet + command) : unknownEventId;
+    }
+    if (packet[section + 13] != timeSignalCommandType)
+    {
+        return noEventId;
+    }
+
+    // time_signal: a splice_time of 1 or 5 bytes, then the descriptor loop.
+    if (command >= utils::ts::packetSize)
+    {
+        return unknownEventId;
+    }
+    const auto loop = command + ((packet[command] & 0x80) != 0 ? 5 : 1);
+    if (loop + 2 > utils::ts::packetSize)
+    {
+        return unknownEventId;
+    }
+    const auto loopEnd = loop + 2 + ((static_cast<size_t>(packet[loop]) << 8) | packet[loop + 1]);
+    for (auto descriptor = loop + 2; descriptor + 2 <= loopEnd; descriptor += 2 + packet[descriptor + 1])
+    {
+        if (descriptor + 2 > utils::ts::packetSize)
+        {
+            return unknownEventId;
+        }
+        if (packet[descriptor] == segmentationDescriptorTag)
+        {
+            // Tag, length and the CUEI identifier come before segmentation_event_id.
+            return descriptor + 10 <= utils::ts::packetSize ? readUint32(packet + descriptor + 6) : unknownEventId;
+        }
+    }
+    return noEventId;
+}
+
+} // namespace
+
+SpliceRequestQueue::SpliceRequestQueue(const std::string& channel, Handler handler)
+    : channel_(channel),
+      handler_(std::move(handler)),
+      wakeupPending_(false),
+      pendingTriggerNs_(0),
+      pendingId_(0),
+      pendingEventId_(noEventId),
+      nextId_(0),
+      requestCount_(0),
+      rejectedCount_(0),
+      measuredCount_(0),
+      lastLatencyUs_(0),
+      maxLatencyUs_(0),
+      totalLatencyUs_(0),
+      schedulingLateness_(metrics::registry().histogram("scte35_splice_scheduling_lateness_seconds",
+          "Time from the trigger of a cue until it is handled on the main loop",
+          {{"channel", channel}},
+          metrics::latencyBuckets())),
+      triggerToWire_(metrics::registry().histogram("scte35_splice_trigger_to_wire_seconds",
+          "Time from the trigger of a cue until the first packet of its section is sent",
+          {{"channel", channel}},
+          metrics::latencyBuckets()))
+{
+}
+
+SpliceRequestQueue::~SpliceRequestQueue()
+{
+    while (g_source_remove_by_user_data(this))
+    {
+    }
+}
+
+uint64_t SpliceRequestQueue::push(SpliceRequest request)
+{
+    request.id = nextId_.fetch_add(1, std::memory_order_relaxed) + 1;
+    const auto id = request.id;
+    if (!requests_.push(std::move(request)))
+    {
+        rejectedCount_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    requestCount_.fetch_add(1, std::memory_order_relaxed);
+
+    // One idle source drains everything queued before it runs, later pushes only add a source once it has started.
+    if (!wakeupPending_.exchange(true, std::memory_order_acq_rel))
+    {
+        g_idle_add_full(G_PRIORITY_HIGH, drainCallback, this, nullptr);
+    }
+    return id;
+}
+
+void SpliceRequestQueue::onSectionQueued(const SpliceRequest& request, const SpliceInfo& spliceInfo)
+{
+    // Only one measurement is in flight, a section queued behind it is not timed. Sections are only queued from the
+    // engine's thread, so once no measurement is pending nothing else sets one: the ids are stored first and
+    // published with the trigger time, and the packet path never reads the ids of another request.
+    if (pendingTriggerNs_.load(std::memory_order_acquire) != 0)
+    {
+        return;
+    }
+    const auto triggerNs = steadyNanoseconds(request.triggerTime);
+    pendingId_.store(request.id, std::memory_order_relaxed);
+    pendingEventId_.store(eventId(spliceInfo), std::memory_order_relaxed);
+    pendingTriggerNs_.store(triggerNs != 0 ? triggerNs : 1, std::memory_order_release);
+}
+
+void SpliceRequestQueue::findSectionStart(const uint8_t* packets, const size_t size, const uint16_t pid)
+{
+    for (size_t offset = 0; offset + utils::ts::packetSize <= size; offset += utils::ts::packetSize)
+    {
+        const auto packet = packets + offset;
+        if (packet[0] != utils::ts::syncByte || utils::ts::pid(packet) != pid || !utils::ts::payloadUnitStart(packet))
+        {
+            continue;
+        }
+
+        const auto payload = utils::ts::payloadOffset(packet);
+        if (payload >= utils::ts::packetSize)
+        {
+            continue;
+        }
+
+        // Skip the splice_null sections mpegtsmux sends on its own, splice_command_type is at byte 13, and sections
+        // of other events, such as merged upstream cues. A section whose id is not in its first packet counts.
+        const auto section = payload + 1 + packet[payload];
+        if (section + 14 > utils::ts::packetSize || packet[section] != spliceInfoTableId ||
+            packet[section + 13] == spliceNullCommandType)
+        {
+            continue;
+        }
+        const auto sectionId = sectionEventId(packet, section);
+        if (sectionId == unknownEventId || sectionId == pendingEventId_.load(std::memory_order_relaxed))
+        {
+            onSectionOnWire();
+            return;
+        }
+    }
+}
+
+void SpliceRequestQueue::onSectionOnWire()
+{
+    // The id is read before the measurement is released, the engine may store the next one right after.
+    if (pendingTriggerNs_.load(std::memory_order_acquire) == 0)
+    {
+        return;
+    }
+    const auto id = pendingId_.load(std::memory_order_relaxed);
+    const auto triggerNs = pendingTriggerNs_.exchange(0, std::memory_order_acq_rel);
+    if (triggerNs == 0)
+    {
+        return;
+    }
+
+    const auto nowNs = steadyNanoseconds(std::chrono::steady_clock::now());
+    const auto latencyUs = static_cast<uint64_t>(nowNs > triggerNs ? (nowNs - triggerNs) / 1000 : 0);
+    triggerToWire_.observe(std::chrono::microseconds(latencyUs));
+
+    lastLatencyUs_.store(latencyUs, std::memory_order_relaxed);
+    totalLatencyUs_.fetch_add(latencyUs, std::memory_order_relaxed);
+    measuredCount_.fetch_add(1, std::memory_order_relaxed);
+    auto maxLatencyUs = maxLatencyUs_.load(std::memory_order_relaxed);
+    while (latencyUs > maxLatencyUs &&
+        !maxLatencyUs_.compare_exchange_weak(maxLatencyUs, latencyUs, std::memory_order_relaxed))
+    {
+    }
+
+    Logger::log("[%s] Splice request %llu on the wire %.3f ms after its trigger",
+        channel_.c_str(),
+        static_cast<unsigned long long>(id),
+        static_cast<double>(latencyUs) / 1000.0);
+}
+
+SpliceRequestStats SpliceRequestQueue::stats() const
+{
+    SpliceRequestStats result;
+    result.requests = requestCount_.load(std::memory_order_relaxed);
+    result.rejected = rejectedCount_.load(std::memory_order_relaxed);
+    result.measured = measuredCount_.load(std::memory_order_relaxed);
+    result.lastLatencyUs = lastLatencyUs_.load(std::memory_order_relaxed);
+    result.maxLatencyUs = maxLatencyUs_.load(std::memory_order_relaxed);
+    result.totalLatencyUs = totalLatencyUs_.load(std::memory_order_relaxed);
+    return result;
+}
+
+gboolean SpliceRequestQueue::drainCallback(gpointer userData)
+{
+    auto queue = reinterpret_cast<SpliceRequestQueue*>(userData);
+    queue->drain();
+    return G_SOURCE_REMOVE;
+}
+
+void SpliceRequestQueue::drain()
+{
+    wakeupPending_.store(false, std::memory_order_release);
+
+    SpliceRequest request;
+    while (requests_.pop(request))
+    {
+        schedulingLateness_.observe(std::chrono::steady_clock::now() - request.triggerTime);
+        handler_(request);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Metrics.h"
+#include "SpliceFactory.h"
+#include "utils/LockFreeQueue.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <glib-2.0/glib.h>
+#include <string>
+
+/**
+ * Trigger-to-wire latency of the splice requests of one channel, in microseconds.
+ */
+struct SpliceRequestStats
+{
+    uint64_t requests = 0;
+    uint64_t rejected = 0;
+    uint64_t measured = 0;
+    uint64_t lastLatencyUs = 0;
+    uint64_t maxLatencyUs = 0;
+    uint64_t totalLatencyUs = 0;
+};
+
+/**
+ * Hands splice requests from any thread to the GLib main loop without locks, and measures the time from each
+ * request's trigger until the first packet of its section leaves the channel. The section is recognized on the wire
+ * by its splice_event_id, or by the segmentation_event_id of its first segmentation_descriptor, so upstream sections
+ * merged into the same PID are not taken for it.
+ */
+class SpliceRequestQueue
+{
+public:
+    using Handler = std::function<void(const SpliceRequest&)>;
+
+    SpliceRequestQueue(const std::string& channel, Handler handler);
+    ~SpliceRequestQueue();
+
+    /**
+     * Safe to call from any thread, handler runs on the main loop.
+     * @return Id assigned to the request, 0 if the queue is full.
+     */
+    uint64_t push(SpliceRequest request);
+
+    /**
+     * Called by the engine when the section of request, built from spliceInfo, has been handed to the packet path.
+     */
+    void onSectionQueued(const SpliceRequest& request, const SpliceInfo& spliceInfo);
+
+    /**
+     * True while a queued section has not been seen on the wire.
+     */
+    bool isLatencyPending() const { return pendingTriggerNs_.load(std::memory_order_relaxed) != 0; }
+
+    /**
+     * Called from the packet path with TS packets that have just been sent. Only scans them for the start of a
+     * splice_info_section on pid while a measurement is pending.
+     */
+    void onPacketsSent(const uint8_t* packets, const size_t size, const uint16_t pid)
+    {
+        if (isLatencyPending())
+        {
+            findSectionStart(packets, size, pid);
+        }
+    }
+
+    SpliceRequestStats stats() const;
+
+private:
+    static const size_t capacity = 64;
+
+    std::string channel_;
+    Handler handler_;
+    utils::LockFreeQueue<SpliceRequest, capacity> requests_;
+    std::atomic_bool wakeupPending_;
+    std::atomic<int64_t> pendingTriggerNs_;
+    std::atomic<uint64_t> pendingId_;
+    std::atomic<uint64_t> pendingEventId_;
+    std::atomic<uint64_t> nextId_;
+
+    std::atomic<uint64_t> requestCount_;
+    std::atomic<uint64_t> rejectedCount_;
+    std::atomic<uint64_t> measuredCount_;
+    std::atomic<uint64_t> lastLatencyUs_;
+    std::atomic<uint64_t> maxLatencyUs_;
+    std::atomic<uint64_t> totalLatencyUs_;
+    metrics::Histogram& schedulingLateness_;
+    metrics::Histogram& triggerToWire_;
+
+    static gboolean drainCallback(gpointer userData);
+    void drain();
+    void findSectionStart(const uint8_t* packets, const size_t size, const uint16_t pid);
+    void onSectionOnWire();
+};
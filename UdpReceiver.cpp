@@ -0,0 +1,173 @@
+#include "UdpReceiver.h"
+#include "Logger.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <unistd.h>
+
+namespace
+{
+
+const std::chrono::milliseconds receiveTimeout(100);
+
+}
+
+UdpReceiver::UdpReceiver(const std::pair<std::string, uint32_t>& address, const UdpOptions& options)
+    : socket_(-1),
+      batchSize_(options.batchSize),
+      lastOverflowCount_(0),
+      drops_(0)
+{
+    if (!options.packetRingInterface.empty())
+    {
+        ring_ = PacketRing::subscribe(options.packetRingInterface, address);
+        if (ring_)
+        {
+            Logger::log("Input %s:%u from the packet ring on %s, batch %u",
+                address.first.c_str(),
+                address.second,
+                options.packetRingInterface.c_str(),
+                options.batchSize);
+        }
+        return;
+    }
+
+    buffers_.resize(options.batchSize * maxDatagramSize);
+    control_.resize(options.batchSize * controlSize);
+    iovecs_.resize(options.batchSize);
+    messages_.resize(options.batchSize);
+    for (size_t i = 0; i < options.batchSize; ++i)
+    {
+        iovecs_[i].iov_base = buffers_.data() + i * maxDatagramSize;
+        iovecs_[i].iov_len = maxDatagramSize;
+        messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sockaddr_in socketAddress = {};
+    socketAddress.sin_family = AF_INET;
+    socketAddress.sin_port = htons(static_cast<uint16_t>(address.second));
+    if (inet_pton(AF_INET, address.first.c_str(), &socketAddress.sin_addr) != 1)
+    {
+        Logger::error("Invalid input address %s", address.first.c_str());
+        return;
+    }
+
+    auto udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSocket < 0)
+    {
+        Logger::error("Unable to create input socket: %s", strerror(errno));
+        return;
+    }
+
+    const int32_t enable = 1;
+    setsockopt(udpSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) != 0)
+    {
+        Logger::warning("Unable to enable SO_RXQ_OVFL, drops will not be counted: %s", strerror(errno));
+    }
+
+    // SO_RCVBUFFORCE exceeds rmem_max when running with CAP_NET_ADMIN, otherwise fall back to the capped SO_RCVBUF.
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_RCVBUFFORCE, &options.socketBufferSize, sizeof(int32_t)) != 0 &&
+        setsockopt(udpSocket, SOL_SOCKET, SO_RCVBUF, &options.socketBufferSize, sizeof(int32_t)) != 0)
+    {
+        Logger::warning("Unable to set input socket buffer size %d: %s", options.socketBufferSize, strerror(errno));
+    }
+
+    if (options.busyPollUs != 0 &&
+        setsockopt(udpSocket, SOL_SOCKET, SO_BUSY_POLL, &options.busyPollUs, sizeof(uint32_t)) != 0)
+    {
+        Logger::warning("Unable to set SO_BUSY_POLL %u us: %s", options.busyPollUs, strerror(errno));
+    }
+
+    timeval timeout = {};
+    timeout.tv_usec = std::chrono::microseconds(receiveTimeout).count();
+    setsockopt(udpSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (bind(udpSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0)
+    {
+        Logger::error("Unable to bind input socket to %s:%u: %s",
+            address.first.c_str(),
+            address.second,
+            strerror(errno));
+        close(udpSocket);
+        return;
+    }
+
+    if (IN_MULTICAST(ntohl(socketAddress.sin_addr.s_addr)))
+    {
+        ip_mreq membership = {};
+        membership.imr_multiaddr = socketAddress.sin_addr;
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(udpSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+        {
+            Logger::error("Unable to join multicast group %s: %s", address.first.c_str(), strerror(errno));
+        }
+    }
+
+    int32_t actualBufferSize = 0;
+    socklen_t optionSize = sizeof(actualBufferSize);
+    getsockopt(udpSocket, SOL_SOCKET, SO_RCVBUF, &actualBufferSize, &optionSize);
+    Logger::log("Input %s:%u, socket buffer %d bytes, batch %u, busy poll %u us",
+        address.first.c_str(),
+        address.second,
+        actualBufferSize,
+        options.batchSize,
+        options.busyPollUs);
+
+    socket_ = udpSocket;
+}
+
+UdpReceiver::~UdpReceiver()
+{
+    if (socket_ >= 0)
+    {
+        close(socket_);
+    }
+}
+
+int32_t UdpReceiver::receive()
+{
+    if (ring_)
+    {
+        return ring_->receive(batchSize_, static_cast<int32_t>(receiveTimeout.count()));
+    }
+
+    for (size_t i = 0; i < messages_.size(); ++i)
+    {
+        messages_[i].msg_hdr.msg_control = control_.data() + i * controlSize;
+        messages_[i].msg_hdr.msg_controllen = controlSize;
+        messages_[i].msg_hdr.msg_flags = 0;
+    }
+
+    const auto result = recvmmsg(socket_, messages_.data(), messages_.size(), MSG_WAITFORONE, nullptr);
+    if (result < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    for (int32_t i = 0; i < result; ++i)
+    {
+        auto& header = messages_[i].msg_hdr;
+        if ((header.msg_flags & MSG_TRUNC) != 0)
+        {
+            Logger::warning("Input datagram larger than %zu bytes truncated", maxDatagramSize);
+        }
+
+        for (auto controlMessage = CMSG_FIRSTHDR(&header); controlMessage;
+             controlMessage = CMSG_NXTHDR(&header, controlMessage))
+        {
+            if (controlMessage->cmsg_level == SOL_SOCKET && controlMessage->cmsg_type == SO_RXQ_OVFL)
+            {
+                uint32_t overflowCount = 0;
+                memcpy(&overflowCount, CMSG_DATA(controlMessage), sizeof(overflowCount));
+                drops_ += overflowCount - lastOverflowCount_;
+                lastOverflowCount_ = overflowCount;
+            }
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "PacketRing.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Receives UDP datagrams in batches with recvmmsg, joining the multicast group if the address is one. Kernel
+ * receive queue drops are counted through SO_RXQ_OVFL. With a packet ring interface in the options the datagrams
+ * are taken from the shared PacketRing of that interface instead, and stay valid until the next receive call.
+ */
+class UdpReceiver
+{
+public:
+    UdpReceiver(const std::pair<std::string, uint32_t>& address, const UdpOptions& options);
+    ~UdpReceiver();
+
+    UdpReceiver(const UdpReceiver&) = delete;
+    UdpReceiver& operator=(const UdpReceiver&) = delete;
+
+    [[nodiscard]] bool isOpen() const { return socket_ >= 0 || ring_; }
+    [[nodiscard]] int32_t fileDescriptor() const { return ring_ ? ring_->fileDescriptor() : socket_; }
+
+    /**
+     * Waits up to the receive timeout for at least one datagram and reads as many as are queued, up to the batch
+     * size.
+     * @return Number of datagrams received, 0 on timeout, -1 on socket error.
+     */
+    int32_t receive();
+
+    [[nodiscard]] const uint8_t* data(const size_t index) const
+    {
+        return ring_ ? ring_->data(index) : buffers_.data() + index * maxDatagramSize;
+    }
+    [[nodiscard]] size_t size(const size_t index) const
+    {
+        return ring_ ? ring_->size(index) : messages_[index].msg_len;
+    }
+
+    /**
+     * @return Datagrams dropped by the kernel because the socket receive buffer was full, since the socket opened. On a
+     * packet ring, datagrams dropped because the input's queue was full.
+     */
+    [[nodiscard]] uint64_t drops() const { return ring_ ? ring_->drops() : drops_; }
+
+private:
+    static const size_t maxDatagramSize = 9216;
+    static const size_t controlSize = 64;
+
+    int32_t socket_;
+    std::unique_ptr<PacketRing::Subscription> ring_;
+    size_t batchSize_;
+    std::vector<uint8_t> buffers_;
+    std::vector<uint8_t> control_;
+    std::vector<iovec> iovecs_;
+    std::vector<mmsghdr> messages_;
+    uint32_t lastOverflowCount_;
+    uint64_t drops_;
+};
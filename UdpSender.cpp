@@ -0,0 +1,176 @@
+#include "UdpSender.h"
+#include "Logger.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <unistd.h>
+
+UdpSender::UdpSender(const std::pair<std::string, uint32_t>& address, const UdpOptions& options)
+    : socket_(-1),
+      batchSize_(std::max(options.batchSize, 1U)),
+      iovecs_(batchSize_),
+      messages_(batchSize_)
+{
+    partial_.reserve(datagramSize);
+
+    sockaddr_in socketAddress = {};
+    socketAddress.sin_family = AF_INET;
+    socketAddress.sin_port = htons(static_cast<uint16_t>(address.second));
+    if (inet_pton(AF_INET, address.first.c_str(), &socketAddress.sin_addr) != 1)
+    {
+        Logger::error("Invalid output address %s", address.first.c_str());
+        return;
+    }
+
+    auto udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpSocket < 0)
+    {
+        Logger::error("Unable to create output socket: %s", strerror(errno));
+        return;
+    }
+
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_SNDBUFFORCE, &options.socketBufferSize, sizeof(int32_t)) != 0 &&
+        setsockopt(udpSocket, SOL_SOCKET, SO_SNDBUF, &options.socketBufferSize, sizeof(int32_t)) != 0)
+    {
+        Logger::warning("Unable to set output socket buffer size %d: %s", options.socketBufferSize, strerror(errno));
+    }
+
+    if (connect(udpSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0)
+    {
+        Logger::error("Unable to connect output socket to %s:%u: %s",
+            address.first.c_str(),
+            address.second,
+            strerror(errno));
+        close(udpSocket);
+        return;
+    }
+
+    socket_ = udpSocket;
+
+    if (options.pacing.enabled)
+    {
+        pacer_ = std::make_unique<OutputPacer>(address.first + ":" + std::to_string(address.second),
+            options.pacing,
+            [this](const uint8_t* data, const size_t size) { sendDatagram(data, size); });
+    }
+}
+
+UdpSender::~UdpSender()
+{
+    if (socket_ >= 0)
+    {
+        flush();
+        pacer_.reset();
+        close(socket_);
+    }
+}
+
+void UdpSender::send(const uint8_t* data, const size_t size)
+{
+    if (pacer_)
+    {
+        pacer_->push(data, size);
+        return;
+    }
+
+    size_t offset = 0;
+    size_t count = 0;
+
+    if (!partial_.empty())
+    {
+        const auto chunk = std::min(datagramSize - partial_.size(), size);
+        partial_.insert(partial_.end(), data, data + chunk);
+        offset = chunk;
+        if (partial_.size() < datagramSize)
+        {
+            return;
+        }
+
+        iovecs_[count].iov_base = partial_.data();
+        iovecs_[count].iov_len = partial_.size();
+        if (++count == batchSize_)
+        {
+            sendBatch(count);
+            count = 0;
+        }
+    }
+
+    while (size - offset >= datagramSize)
+    {
+        iovecs_[count].iov_base = const_cast<uint8_t*>(data + offset);
+        iovecs_[count].iov_len = datagramSize;
+        offset += datagramSize;
+        if (++count == batchSize_)
+        {
+            sendBatch(count);
+            count = 0;
+        }
+    }
+
+    if (count != 0)
+    {
+        sendBatch(count);
+    }
+
+    partial_.clear();
+    partial_.insert(partial_.end(), data + offset, data + size);
+}
+
+void UdpSender::flush()
+{
+    if (pacer_)
+    {
+        pacer_->flush();
+        return;
+    }
+
+    if (partial_.empty())
+    {
+        return;
+    }
+
+    iovecs_[0].iov_base = partial_.data();
+    iovecs_[0].iov_len = partial_.size();
+    sendBatch(1);
+    partial_.clear();
+}
+
+void UdpSender::sendBatch(const size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        messages_[i].msg_hdr = {};
+        messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    size_t sent = 0;
+    while (sent < count)
+    {
+        const auto result = sendmmsg(socket_, messages_.data() + sent, count - sent, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Logger::error("Unable to send output datagrams: %s", strerror(errno));
+            return;
+        }
+        sent += static_cast<size_t>(result);
+    }
+}
+
+void UdpSender::sendDatagram(const uint8_t* data, const size_t size)
+{
+    while (::send(socket_, data, size, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            Logger::error("Unable to send output datagram: %s", strerror(errno));
+            return;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ChannelConfig.h"
+#include "OutputPacer.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Sends a TS byte stream as datagrams of 7 packets, batching all complete datagrams of a call into one sendmmsg.
+ * With pacing enabled the datagrams are handed to an OutputPacer and sent one by one from its thread instead.
+ */
+class UdpSender
+{
+public:
+    UdpSender(const std::pair<std::string, uint32_t>& address, const UdpOptions& options);
+    ~UdpSender();
+
+    UdpSender(const UdpSender&) = delete;
+    UdpSender& operator=(const UdpSender&) = delete;
+
+    [[nodiscard]] bool isOpen() const { return socket_ >= 0; }
+
+    /**
+     * Sends all complete datagrams in data, a trailing partial datagram is kept until the next call.
+     */
+    void send(const uint8_t* data, const size_t size);
+
+    /**
+     * Sends a pending partial datagram.
+     */
+    void flush();
+
+private:
+    static const size_t datagramSize = 7 * 188;
+
+    int32_t socket_;
+    size_t batchSize_;
+    std::vector<uint8_t> partial_;
+    std::vector<iovec> iovecs_;
+    std::vector<mmsghdr> messages_;
+    std::unique_ptr<OutputPacer> pacer_;
+
+    void sendBatch(const size_t count);
+    void sendDatagram(const uint8_t* data, const size_t size);
+};
@@ -0,0 +1,363 @@
+#include "VideoClock.h"
+#include "Logger.h"
+#include "utils/Crc32.h"
+#include <algorithm>
+
+namespace
+{
+
+const uint8_t patTableId = 0x00;
+const uint8_t pmtTableId = 0x02;
+const uint8_t scte35StreamType = 0x86;
+const uint64_t maximumPcrAdvance = utils::ts::ptsClockRate;
+const uint64_t minimumGopDuration = utils::ts::ptsClockRate / 10;
+const uint64_t maximumGopDuration = utils::ts::ptsClockRate * 30;
+
+enum class VideoCodec
+{
+    NONE,
+    MPEG2,
+    H264,
+    HEVC
+};
+
+VideoCodec videoCodec(const uint8_t streamType)
+{
+    switch (streamType)
+    {
+    case 0x01:
+    case 0x02:
+        return VideoCodec::MPEG2;
+    case 0x1B:
+        return VideoCodec::H264;
+    case 0x24:
+        return VideoCodec::HEVC;
+    default:
+        return VideoCodec::NONE;
+    }
+}
+
+} // namespace
+
+VideoClock::VideoClock()
+    : pmtPid_(utils::ts::nullPid),
+      videoPid_(utils::ts::nullPid),
+      videoStreamType_(0),
+      pcrPid_(utils::ts::nullPid),
+      scte35Pid_(utils::ts::nullPid),
+      lastPcr_(0),
+      hasPcr_(false),
+      gopHistory_{},
+      gopCount_(0),
+      firstVideoPts_(0),
+      videoPts_(0),
+      pcr_(0),
+      pcrAtVideoPts_(0),
+      pcrToPtsOffset_(0),
+      lastIdrPts_(0),
+      gopDuration_(0)
+{
+}
+
+void VideoClock::onPacket(const uint8_t* packet)
+{
+    const auto pid = utils::ts::pid(packet);
+
+    if (pid == pcrPid_)
+    {
+        uint64_t pcr = 0;
+        if (utils::ts::readPcr(packet, pcr))
+        {
+            lastPcr_ = utils::ts::unwrapPts(lastPcr_, (pcr / 300) % utils::ts::ptsModulo);
+            hasPcr_ = true;
+            pcr_.store(lastPcr_, std::memory_order_relaxed);
+        }
+    }
+
+    if (pid == videoPid_)
+    {
+        onVideoPacket(packet);
+    }
+    else if (pid == utils::ts::patPid)
+    {
+        patAssembler_.push(packet, [this](const uint8_t* section, size_t size) { onPat(section, size); });
+    }
+    else if (pid == pmtPid_)
+    {
+        pmtAssembler_.push(packet, [this](const uint8_t* section, size_t size) { onPmt(section, size); });
+    }
+}
+
+bool VideoClock::splicePts(const uint64_t delay, uint64_t& pts, bool& aligned) const
+{
+    const auto now = nowPts();
+    if (now == 0)
+    {
+        return false;
+    }
+
+    const auto target = now + delay;
+    const auto lastIdrPts = lastIdrPts_.load(std::memory_order_relaxed);
+    const auto gopDuration = gopDuration_.load(std::memory_order_relaxed);
+
+    aligned = lastIdrPts != 0 && gopDuration != 0 && lastIdrPts <= target;
+    if (aligned)
+    {
+        const auto gops = (target - lastIdrPts + gopDuration - 1) / gopDuration;
+        pts = (lastIdrPts + gops * gopDuration) % utils::ts::ptsModulo;
+    }
+    else
+    {
+        pts = target % utils::ts::ptsModulo;
+    }
+    return true;
+}
+
+bool VideoClock::currentPts(uint64_t& pts) const
+{
+    const auto now = nowPts();
+    if (now == 0)
+    {
+        return false;
+    }
+
+    pts = now % utils::ts::ptsModulo;
+    return true;
+}
+
+bool VideoClock::lastIdrPts(uint64_t& pts) const
+{
+    const auto lastIdrPts = lastIdrPts_.load(std::memory_order_relaxed);
+    if (lastIdrPts == 0)
+    {
+        return false;
+    }
+
+    pts = lastIdrPts % utils::ts::ptsModulo;
+    return true;
+}
+
+bool VideoClock::firstPts(uint64_t& pts) const
+{
+    const auto firstVideoPts = firstVideoPts_.load(std::memory_order_relaxed);
+    if (firstVideoPts == 0)
+    {
+        return false;
+    }
+
+    pts = firstVideoPts % utils::ts::ptsModulo;
+    return true;
+}
+
+void VideoClock::prime(const std::vector<uint8_t>& pat, const std::vector<uint8_t>& pmt)
+{
+    onPat(pat.data(), pat.size());
+    onPmt(pmt.data(), pmt.size());
+}
+
+void VideoClock::onPat(const uint8_t* section, const size_t size)
+{
+    if (size < 12 || section[0] != patTableId || utils::crc32Mpeg(section, size) != 0)
+    {
+        return;
+    }
+
+    for (size_t offset = 8; offset + 4 <= size - 4; offset += 4)
+    {
+        const auto programNumber = static_cast<uint16_t>((section[offset] << 8) | section[offset + 1]);
+        if (programNumber == 0)
+        {
+            continue;
+        }
+
+        const auto pmtPid = static_cast<uint16_t>(((section[offset + 2] & 0x1F) << 8) | section[offset + 3]);
+        if (pmtPid != pmtPid_)
+        {
+            pmtPid_ = pmtPid;
+            pmtAssembler_.reset();
+        }
+        return;
+    }
+}
+
+void VideoClock::onPmt(const uint8_t* section, const size_t size)
+{
+    if (size < 16 || section[0] != pmtTableId || utils::crc32Mpeg(section, size) != 0)
+    {
+        return;
+    }
+
+    pcrPid_ = static_cast<uint16_t>(((section[8] & 0x1F) << 8) | section[9]);
+    const size_t programInfoLength = ((section[10] & 0x0F) << 8) | section[11];
+
+    bool hasVideo = false;
+    auto scte35Pid = utils::ts::nullPid;
+    for (size_t offset = 12 + programInfoLength; offset + 5 <= size - 4;)
+    {
+        const auto streamType = section[offset];
+        const auto pid = static_cast<uint16_t>(((section[offset + 1] & 0x1F) << 8) | section[offset + 2]);
+        const size_t esInfoLength = ((section[offset + 3] & 0x0F) << 8) | section[offset + 4];
+
+        if (!hasVideo && videoCodec(streamType) != VideoCodec::NONE)
+        {
+            hasVideo = true;
+            if (pid != videoPid_)
+            {
+                Logger::log("Tracking video PID %u, stream type 0x%02x, PCR PID %u", pid, streamType, pcrPid_);
+                videoPid_ = pid;
+                videoStreamType_ = streamType;
+            }
+        }
+        else if (streamType == scte35StreamType && scte35Pid == utils::ts::nullPid)
+        {
+            scte35Pid = pid;
+        }
+        offset += 5 + esInfoLength;
+    }
+    scte35Pid_ = scte35Pid;
+}
+
+void VideoClock::onVideoPacket(const uint8_t* packet)
+{
+    uint64_t pts = 0;
+    if (!utils::ts::readPesPts(packet, pts))
+    {
+        return;
+    }
+
+    const auto videoPts = utils::ts::unwrapPts(videoPts_.load(std::memory_order_relaxed), pts);
+    videoPts_.store(videoPts, std::memory_order_relaxed);
+    if (firstVideoPts_.load(std::memory_order_relaxed) == 0)
+    {
+        firstVideoPts_.store(videoPts, std::memory_order_relaxed);
+    }
+
+    if (hasPcr_)
+    {
+        pcrToPtsOffset_.store(utils::ts::ptsDifference(pts, lastPcr_), std::memory_order_relaxed);
+        pcrAtVideoPts_.store(lastPcr_, std::memory_order_relaxed);
+    }
+
+    if (isKeyframeStart(packet))
+    {
+        updateGopDuration(videoPts);
+    }
+}
+
+bool VideoClock::isKeyframeStart(const uint8_t* packet) const
+{
+    if (utils::ts::randomAccessIndicator(packet))
+    {
+        return true;
+    }
+
+    // Encoders that do not signal random access points: look for the keyframe start codes in the first packet.
+    const auto offset = utils::ts::payloadOffset(packet);
+    if (offset + 9 > utils::ts::packetSize)
+    {
+        return false;
+    }
+
+    const auto codec = videoCodec(videoStreamType_);
+    const auto end = packet + utils::ts::packetSize;
+    for (auto position = packet + offset + 9 + packet[offset + 8]; position + 5 < end; ++position)
+    {
+        if (position[0] != 0x00 || position[1] != 0x00 || position[2] != 0x01)
+        {
+            continue;
+        }
+
+        const auto code = position[3];
+        switch (codec)
+        {
+        case VideoCodec::H264:
+        {
+            const auto nalType = code & 0x1F;
+            if (nalType == 5 || nalType == 7)
+            {
+                return true;
+            }
+            if (nalType == 1)
+            {
+                return false;
+            }
+            break;
+        }
+        case VideoCodec::HEVC:
+        {
+            const auto nalType = (code >> 1) & 0x3F;
+            if ((nalType >= 16 && nalType <= 21) || nalType == 32 || nalType == 33)
+            {
+                return true;
+            }
+            if (nalType < 16)
+            {
+                return false;
+            }
+            break;
+        }
+        case VideoCodec::MPEG2:
+            if (code == 0xB3 || code == 0xB8)
+            {
+                return true;
+            }
+            if (code == 0x00)
+            {
+                return ((position[5] >> 3) & 0x07) == 1;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+void VideoClock::updateGopDuration(const uint64_t idrPts)
+{
+    const auto lastIdrPts = lastIdrPts_.load(std::memory_order_relaxed);
+    lastIdrPts_.store(idrPts, std::memory_order_relaxed);
+    if (lastIdrPts == 0 || idrPts <= lastIdrPts)
+    {
+        return;
+    }
+
+    const auto duration = idrPts - lastIdrPts;
+    if (duration < minimumGopDuration || duration > maximumGopDuration)
+    {
+        return;
+    }
+
+    gopHistory_[gopCount_ % gopHistorySize] = duration;
+    ++gopCount_;
+
+    // The median ignores extra IDRs inserted at scene cuts.
+    auto history = gopHistory_;
+    const auto count = std::min(gopCount_, gopHistorySize);
+    std::nth_element(history.begin(), history.begin() + count / 2, history.begin() + count);
+    const auto gopDuration = history[count / 2];
+
+    if (gopDuration != gopDuration_.load(std::memory_order_relaxed))
+    {
+        Logger::log("Video GOP duration %.3f s, PCR to PTS offset %.3f s",
+            static_cast<double>(gopDuration) / utils::ts::ptsClockRate,
+            static_cast<double>(pcrToPtsOffset_.load(std::memory_order_relaxed)) / utils::ts::ptsClockRate);
+        gopDuration_.store(gopDuration, std::memory_order_relaxed);
+    }
+}
+
+uint64_t VideoClock::nowPts() const
+{
+    const auto videoPts = videoPts_.load(std::memory_order_relaxed);
+    const auto pcr = pcr_.load(std::memory_order_relaxed);
+    const auto pcrAtVideoPts = pcrAtVideoPts_.load(std::memory_order_relaxed);
+
+    if (videoPts == 0 || pcrAtVideoPts == 0 || pcr <= pcrAtVideoPts)
+    {
+        return videoPts;
+    }
+
+    // The PCR keeps advancing between video PES headers, so the video position moves on with it.
+    return videoPts + std::min(pcr - pcrAtVideoPts, maximumPcrAdvance);
+}
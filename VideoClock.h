@@ -0,0 +1,100 @@
+#pragma once
+
+#include "utils/PsiSection.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Follows the video PID of the first program in a TS packet stream: the latest video PTS (unwrapped from 33 bits),
+ * the PCR to PTS offset and the PTS of IDR/GOP starts. From this it predicts the next GOP boundary so that splice
+ * points land on a keyframe.
+ *
+ * onPacket must only be called from one thread, splicePts may be called from any thread.
+ */
+class VideoClock
+{
+public:
+    VideoClock();
+
+    void onPacket(const uint8_t* packet);
+
+    /**
+     * Applies a PAT and PMT cached from an earlier run, so that the video PID is followed from the first packet.
+     */
+    void prime(const std::vector<uint8_t>& pat, const std::vector<uint8_t>& pmt);
+
+    /**
+     * @param delay Minimum distance in 90 kHz ticks between the current video position and the splice point.
+     * @param pts Set to the 33-bit splice PTS.
+     * @param aligned Set if pts was snapped to a predicted GOP boundary.
+     * @return False until the video PID has carried a PTS.
+     */
+    bool splicePts(const uint64_t delay, uint64_t& pts, bool& aligned) const;
+
+    /**
+     * @return Current video position as a 33-bit PTS, false until the video PID has carried a PTS.
+     */
+    bool currentPts(uint64_t& pts) const;
+
+    /**
+     * @return 33-bit PTS of the first video PES, false until the video PID has carried a PTS.
+     */
+    bool firstPts(uint64_t& pts) const;
+
+    /**
+     * @return 33-bit PTS of the latest IDR/GOP start, false until one was seen.
+     */
+    bool lastIdrPts(uint64_t& pts) const;
+
+    /**
+     * @return PID of the first SCTE-35 stream (stream type 0x86) in the PMT, the null PID if there is none. Only
+     * valid on the onPacket thread.
+     */
+    uint16_t scte35Pid() const { return scte35Pid_; }
+
+    /**
+     * @return PMT and video PID of the first program, the null PID until the PAT and PMT were seen. Only valid on
+     * the onPacket thread.
+     */
+    uint16_t pmtPid() const { return pmtPid_; }
+    uint16_t videoPid() const { return videoPid_; }
+
+    /**
+     * @return Distance in 90 kHz ticks between the PTS of the latest video PES and the PCR at its arrival.
+     */
+    int64_t pcrToPtsOffset() const { return pcrToPtsOffset_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t gopHistorySize = 8;
+
+    utils::ts::SectionAssembler patAssembler_;
+    utils::ts::SectionAssembler pmtAssembler_;
+    uint16_t pmtPid_;
+    uint16_t videoPid_;
+    uint8_t videoStreamType_;
+    uint16_t pcrPid_;
+    uint16_t scte35Pid_;
+
+    uint64_t lastPcr_;
+    bool hasPcr_;
+    std::array<uint64_t, gopHistorySize> gopHistory_;
+    size_t gopCount_;
+
+    // Unwrapped 90 kHz values shared with splicePts, 0 until known.
+    std::atomic<uint64_t> firstVideoPts_;
+    std::atomic<uint64_t> videoPts_;
+    std::atomic<uint64_t> pcr_;
+    std::atomic<uint64_t> pcrAtVideoPts_;
+    std::atomic<int64_t> pcrToPtsOffset_;
+    std::atomic<uint64_t> lastIdrPts_;
+    std::atomic<uint64_t> gopDuration_;
+
+    void onPat(const uint8_t* section, const size_t size);
+    void onPmt(const uint8_t* section, const size_t size);
+    void onVideoPacket(const uint8_t* packet);
+    bool isKeyframeStart(const uint8_t* packet) const;
+    void updateGopDuration(const uint64_t idrPts);
+    uint64_t nowPts() const;
+};
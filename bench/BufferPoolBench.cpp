@@ -0,0 +1,190 @@
+#include "BufferPool.h"
+#include "utils/TsPacket.h"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <gst/app/app.h>
+#include <gst/gst.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Counts the heap allocations of pushing received datagrams into a pipeline, appsrc ! queue ! fakesink, with a new
+ * buffer per datagram as the remuxing mode does by default and with the pooled input buffers of --input-pool. malloc
+ * and friends are interposed, allocations are counted on the receiving thread and on all threads after a warm-up. The
+ * pooled path packs the datagrams with BufferPool::pack into the buffers the pipeline uses.
+ */
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+namespace
+{
+
+const uint32_t warmUpBatches = 500;
+const uint32_t batches = 5000;
+const uint32_t batchSize = 32;
+const size_t datagramSize = 7 * utils::ts::packetSize;
+// A batch of 32 datagrams fills five pooled buffers, this holds 64 batches.
+const uint32_t poolBuffers = 320;
+const auto batchPause = std::chrono::microseconds(500);
+
+std::atomic_bool counting(false);
+std::atomic<uint64_t> allocations(0);
+thread_local bool isReceiveThread = false;
+thread_local uint64_t receiveThreadAllocations = 0;
+
+void countAllocation()
+{
+    if (counting.load(std::memory_order_relaxed))
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (isReceiveThread)
+        {
+            ++receiveThreadAllocations;
+        }
+    }
+}
+
+struct Result
+{
+    double receiveThreadPerBatch;
+    double allThreadsPerBatch;
+    double nsPerBatch;
+    // Batches partly dropped because every pooled buffer was in use.
+    uint32_t drops;
+};
+
+Result measure(BufferPool* pool)
+{
+    auto pipeline = gst_parse_launch("appsrc name=source is-live=true ! queue ! fakesink sync=false", nullptr);
+    auto source = gst_bin_get_by_name(GST_BIN(pipeline), "source");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    std::vector<uint8_t> datagrams(batchSize * datagramSize);
+    for (size_t offset = 0; offset < datagrams.size(); offset += utils::ts::packetSize)
+    {
+        utils::ts::writeHeader(datagrams.data() + offset, utils::ts::nullPid, false, 0);
+    }
+
+    auto appSrc = GST_APP_SRC(source);
+    uint32_t drops = 0;
+    const auto push = [&]() {
+        if (!pool)
+        {
+            auto bufferList = gst_buffer_list_new_sized(batchSize);
+            for (uint32_t i = 0; i < batchSize; ++i)
+            {
+                auto buffer = gst_buffer_new_allocate(nullptr, datagramSize, nullptr);
+                gst_buffer_fill(buffer, 0, datagrams.data() + i * datagramSize, datagramSize);
+                gst_buffer_list_add(bufferList, buffer);
+            }
+            gst_app_src_push_buffer_list(appSrc, bufferList);
+            return;
+        }
+
+        // The packing of the receive thread of the remuxing mode.
+        uint64_t droppedBytes = 0;
+        pool->pack(
+            batchSize,
+            [&datagrams](const size_t i) { return std::make_pair(datagrams.data() + i * datagramSize, datagramSize); },
+            [appSrc](GstBuffer* buffer) { return gst_app_src_push_buffer(appSrc, buffer) == GST_FLOW_OK; },
+            droppedBytes);
+        drops += droppedBytes != 0 ? 1 : 0;
+    };
+
+    isReceiveThread = true;
+    for (uint32_t batch = 0; batch < warmUpBatches; ++batch)
+    {
+        push();
+        std::this_thread::sleep_for(batchPause);
+    }
+
+    receiveThreadAllocations = 0;
+    allocations = 0;
+    drops = 0;
+    std::chrono::nanoseconds pushTime(0);
+    counting = true;
+    for (uint32_t batch = 0; batch < batches; ++batch)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        push();
+        pushTime += std::chrono::steady_clock::now() - start;
+        std::this_thread::sleep_for(batchPause);
+    }
+    counting = false;
+    isReceiveThread = false;
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(source);
+    gst_object_unref(pipeline);
+    return {static_cast<double>(receiveThreadAllocations) / batches,
+        static_cast<double>(allocations.load()) / batches,
+        static_cast<double>(pushTime.count()) / batches,
+        drops};
+}
+
+} // namespace
+
+extern "C"
+{
+void* malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+    countAllocation();
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+}
+}
+
+int32_t main(int32_t argc, char** argv)
+{
+    gst_init(&argc, &argv);
+
+    const auto allocated = measure(nullptr);
+    BufferPool pool("bench", "input", BufferPool::inputBufferSize, poolBuffers, false);
+    if (!pool.isOpen())
+    {
+        printf("Unable to start the buffer pool\n");
+        return 1;
+    }
+    const auto pooled = measure(&pool);
+
+    printf("%u batches of %u datagrams of %zu bytes\n", batches, batchSize, datagramSize);
+    printf("buffer per datagram: %.2f allocations per batch on the receive thread, %.2f on all threads, %.0f ns\n",
+        allocated.receiveThreadPerBatch,
+        allocated.allThreadsPerBatch,
+        allocated.nsPerBatch);
+    printf("pooled buffers:      %.2f allocations per batch on the receive thread, %.2f on all threads, %.0f ns, "
+           "%u batches dropped\n",
+        pooled.receiveThreadPerBatch,
+        pooled.allThreadsPerBatch,
+        pooled.nsPerBatch,
+        pooled.drops);
+    return 0;
+}
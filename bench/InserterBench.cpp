@@ -0,0 +1,661 @@
+#include "Logger.h"
+#include "OfflineInserter.h"
+#include "Passthrough.h"
+#include "Pipeline.h"
+#include "SpliceInfoSection.h"
+#include "TsGenerator.h"
+#include "UdpReceiver.h"
+#include "UdpSender.h"
+#include "VideoClock.h"
+#include "utils/PsiSection.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <gst/gst.h>
+#include <limits>
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Runs the insertion modes on a synthetic stream and reports packets/s, CPU time per Mbps, input to output latency
+ * percentiles and splice accuracy as one JSON object per mode and line. The live modes read the stream from a
+ * loopback UDP port, paced at the mux rate, and send to another one that the bench reads back; the offline mode runs
+ * on a generated file. Splice accuracy is the distance between the splice PTS of each output cue and the nearest IDR
+ * picture of the output.
+ */
+
+namespace
+{
+
+const char* usageString = "Usage: inserter-bench [--mode <passthrough|batched|remux|offline>]... [--duration <s>]\n"
+                          "    [--bitrate <Mbps>] [--pids <video pid>[,<audio pid>...]] [--gop <frames>]\n"
+                          "    [--frame-rate <24|25|30|50|60>] [--pcr-interval <ms>] [--cue-interval <s>]\n"
+                          "    [--port <first UDP port>] [--low-latency] [--output <file>]";
+
+const auto drainTime = std::chrono::seconds(2);
+const size_t datagramPackets = 7;
+
+struct Options
+{
+    bench::TsGeneratorConfig stream;
+    std::vector<std::string> modes;
+    std::chrono::seconds duration = std::chrono::seconds(30);
+    std::chrono::seconds cueInterval = std::chrono::seconds(10);
+    uint32_t port = 20000;
+    bool lowLatency = false;
+    std::string output;
+};
+
+struct Result
+{
+    double seconds = 0.0;
+    uint64_t packetsIn = 0;
+    uint64_t packetsOut = 0;
+    double cpuSeconds = 0.0;
+    // Milliseconds from sending a picture to receiving it, empty for the offline mode.
+    std::vector<double> latencies;
+    uint32_t cues = 0;
+    uint32_t verifiedCues = 0;
+    uint32_t alignedCues = 0;
+    double maxSpliceErrorMs = 0.0;
+    double sumSpliceErrorMs = 0.0;
+};
+
+double threadCpuSeconds()
+{
+    rusage usage = {};
+    getrusage(RUSAGE_THREAD, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+        static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+double processCpuSeconds()
+{
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+        static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * Send times of the pictures, indexed by picture number, written by the sending thread and read by the receiving
+ * thread. 0 until sent.
+ */
+class SendTimes
+{
+public:
+    SendTimes(const bench::TsGenerator& generator, const size_t pictures)
+        : firstPts_(generator.firstPts()),
+          frameDuration_(generator.frameDuration()),
+          times_(pictures)
+    {
+    }
+
+    void onPacket(const uint8_t* packet, const uint16_t videoPid, const int64_t nowNs)
+    {
+        uint64_t pts = 0;
+        size_t picture = 0;
+        if (utils::ts::pid(packet) == videoPid && utils::ts::readPesPts(packet, pts) && index(pts, picture))
+        {
+            times_[picture].store(nowNs, std::memory_order_relaxed);
+        }
+    }
+
+    int64_t sendTime(const uint64_t pts) const
+    {
+        size_t picture = 0;
+        return index(pts, picture) ? times_[picture].load(std::memory_order_relaxed) : 0;
+    }
+
+    uint64_t firstPts() const { return firstPts_; }
+
+private:
+    uint64_t firstPts_;
+    uint64_t frameDuration_;
+    std::vector<std::atomic<int64_t>> times_;
+
+    bool index(const uint64_t pts, size_t& picture) const
+    {
+        const auto distance = utils::ts::ptsDifference(pts, firstPts_) + static_cast<int64_t>(frameDuration_ / 2);
+        if (distance < 0)
+        {
+            return false;
+        }
+        picture = static_cast<size_t>(distance) / frameDuration_;
+        return picture < times_.size();
+    }
+};
+
+/**
+ * Follows the output of an engine: the IDR pictures and the SCTE-35 cues for splice accuracy, and with send times the
+ * latency of each picture.
+ */
+class OutputAnalyzer
+{
+public:
+    OutputAnalyzer(const uint16_t videoPid, const SendTimes* sendTimes)
+        : videoPid_(videoPid),
+          sendTimes_(sendTimes),
+          hasPtsOffset_(false),
+          ptsOffset_(0),
+          packets_(0)
+    {
+    }
+
+    /**
+     * @param rebasePts Map the output PTS to the input PTS through the first output picture, for engines that
+     * restamp the stream.
+     */
+    void setRebasePts(const bool rebasePts) { hasPtsOffset_ = !rebasePts; }
+
+    void onPacket(const uint8_t* packet, const int64_t nowNs)
+    {
+        ++packets_;
+        videoClock_.onPacket(packet);
+
+        uint64_t idrPts = 0;
+        if (videoClock_.lastIdrPts(idrPts) && (idrs_.empty() || idrs_.back() != idrPts))
+        {
+            idrs_.push_back(idrPts);
+        }
+
+        const auto pid = utils::ts::pid(packet);
+        uint64_t pts = 0;
+        if (sendTimes_ && pid == videoPid_ && utils::ts::readPesPts(packet, pts))
+        {
+            if (!hasPtsOffset_)
+            {
+                hasPtsOffset_ = true;
+                ptsOffset_ = utils::ts::ptsDifference(pts, sendTimes_->firstPts());
+            }
+            const auto sendTime = sendTimes_->sendTime((pts - ptsOffset_) & (utils::ts::ptsModulo - 1));
+            if (sendTime != 0)
+            {
+                latencies_.push_back(static_cast<double>(nowNs - sendTime) / 1e6);
+            }
+        }
+
+        if (pid != utils::ts::nullPid && pid == videoClock_.scte35Pid())
+        {
+            scte35Assembler_.push(packet,
+                [this](const uint8_t* section, const size_t size) { onSection(section, size); });
+        }
+    }
+
+    /**
+     * Adds the splice accuracy of the cues that lie before the last IDR picture to result.
+     */
+    void finish(Result& result)
+    {
+        result.packetsOut = packets_;
+        result.latencies = std::move(latencies_);
+        result.cues = static_cast<uint32_t>(splicePts_.size());
+        if (idrs_.empty())
+        {
+            return;
+        }
+
+        for (const auto splicePts : splicePts_)
+        {
+            if (utils::ts::ptsDifference(idrs_.back(), splicePts) < 0)
+            {
+                continue;
+            }
+
+            auto error = std::numeric_limits<int64_t>::max();
+            for (const auto idr : idrs_)
+            {
+                error = std::min(error, std::abs(utils::ts::ptsDifference(idr, splicePts)));
+            }
+            const auto errorMs = static_cast<double>(error) / 90.0;
+            ++result.verifiedCues;
+            result.alignedCues += error == 0 ? 1 : 0;
+            result.sumSpliceErrorMs += errorMs;
+            result.maxSpliceErrorMs = std::max(result.maxSpliceErrorMs, errorMs);
+        }
+    }
+
+private:
+    uint16_t videoPid_;
+    const SendTimes* sendTimes_;
+    bool hasPtsOffset_;
+    int64_t ptsOffset_;
+    uint64_t packets_;
+    VideoClock videoClock_;
+    utils::ts::SectionAssembler scte35Assembler_;
+    std::vector<uint64_t> idrs_;
+    std::vector<uint64_t> splicePts_;
+    std::vector<double> latencies_;
+
+    void onSection(const uint8_t* section, const size_t size)
+    {
+        SpliceInfo info;
+        if (!readSpliceInfoSection(section, size, info))
+        {
+            return;
+        }
+
+        uint64_t spliceTime = 0;
+        if (info.command == SpliceCommandType::SPLICE_INSERT && !info.spliceInsert.cancel &&
+            !info.spliceInsert.immediate)
+        {
+            spliceTime = info.spliceInsert.spliceTime;
+        }
+        else if (info.command == SpliceCommandType::TIME_SIGNAL && info.timeSpecified)
+        {
+            spliceTime = info.spliceTime;
+        }
+        else
+        {
+            return;
+        }
+        splicePts_.push_back((spliceTime + info.ptsAdjustment) & (utils::ts::ptsModulo - 1));
+    }
+};
+
+ChannelConfig makeChannelConfig(const Options& options, const std::string& mode)
+{
+    ChannelConfig config;
+    config.name = "bench-" + mode;
+    config.spliceInterval = options.cueInterval;
+    config.spliceDuration = std::max(std::chrono::seconds(1), options.cueInterval / 2);
+    config.passthrough = mode == "passthrough" || mode == "batched";
+    config.batchedUdp = mode == "batched";
+    if (options.lowLatency)
+    {
+        config.latencyOptions = LatencyOptions::lowLatency();
+    }
+    return config;
+}
+
+void sendStream(const Options& options,
+    bench::TsGenerator& generator,
+    UdpSender& sender,
+    SendTimes& sendTimes,
+    double& cpuSeconds)
+{
+    std::array<uint8_t, datagramPackets * utils::ts::packetSize> datagram;
+    const auto duration = static_cast<double>(options.duration.count());
+    const auto start = std::chrono::steady_clock::now();
+
+    while (generator.time() < duration)
+    {
+        std::this_thread::sleep_until(start +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(generator.time())));
+
+        const auto nowNs = std::chrono::steady_clock::now().time_since_epoch().count();
+        for (size_t i = 0; i < datagramPackets; ++i)
+        {
+            const auto packet = datagram.data() + i * utils::ts::packetSize;
+            generator.next(packet);
+            sendTimes.onPacket(packet, options.stream.videoPid, nowNs);
+        }
+        sender.send(datagram.data(), datagram.size());
+    }
+    sender.flush();
+    cpuSeconds = threadCpuSeconds();
+}
+
+gboolean quitCallback(gpointer data)
+{
+    g_main_loop_quit(static_cast<GMainLoop*>(data));
+    return FALSE;
+}
+
+bool runLive(const Options& options, const std::string& mode, const uint32_t port, Result& result)
+{
+    auto config = makeChannelConfig(options, mode);
+    config.inputAddress = {"127.0.0.1", port};
+    config.outputAddress = {"127.0.0.1", port + 1};
+
+    bench::TsGenerator generator(options.stream);
+    SendTimes sendTimes(generator, static_cast<size_t>(options.duration.count() + 1) * options.stream.frameRate);
+    OutputAnalyzer analyzer(options.stream.videoPid, &sendTimes);
+    analyzer.setRebasePts(mode == "remux");
+
+    UdpReceiver receiver(config.outputAddress, config.udpOptions);
+    UdpSender sender(config.inputAddress, config.udpOptions);
+    if (!receiver.isOpen() || !sender.isOpen())
+    {
+        fprintf(stderr, "Unable to open the loopback sockets on ports %u and %u\n", port, port + 1);
+        return false;
+    }
+
+    std::atomic<bool> receiving(true);
+    double receiveCpuSeconds = 0.0;
+    std::thread receiveThread([&]() {
+        while (receiving)
+        {
+            const auto received = receiver.receive();
+            const auto nowNs = std::chrono::steady_clock::now().time_since_epoch().count();
+            for (int32_t i = 0; i < received; ++i)
+            {
+                for (size_t offset = 0; offset + utils::ts::packetSize <= receiver.size(i);
+                     offset += utils::ts::packetSize)
+                {
+                    analyzer.onPacket(receiver.data(i) + offset, nowNs);
+                }
+            }
+        }
+        receiveCpuSeconds = threadCpuSeconds();
+    });
+
+    const auto cpuStart = processCpuSeconds();
+    std::unique_ptr<Inserter> inserter;
+    if (config.passthrough)
+    {
+        inserter = std::make_unique<Passthrough>(config);
+    }
+    else
+    {
+        inserter = std::make_unique<Pipeline>(config);
+    }
+    inserter->run();
+
+    double sendCpuSeconds = 0.0;
+    std::thread sendThread([&]() { sendStream(options, generator, sender, sendTimes, sendCpuSeconds); });
+
+    // The main loop serves the bus of the remuxing pipeline and the splice request queues.
+    auto mainLoop = g_main_loop_new(nullptr, FALSE);
+    const auto buffering = config.passthrough ? std::chrono::milliseconds(0) : config.latencyOptions.bufferTime;
+    g_timeout_add(static_cast<guint>(std::chrono::milliseconds(options.duration + drainTime + buffering).count()),
+        quitCallback,
+        mainLoop);
+    g_main_loop_run(mainLoop);
+    g_main_loop_unref(mainLoop);
+
+    sendThread.join();
+    inserter->stop();
+    inserter.reset();
+    receiving = false;
+    receiveThread.join();
+
+    // The bench's own sending and receiving threads are not part of the engine's CPU time.
+    result.cpuSeconds = processCpuSeconds() - cpuStart - sendCpuSeconds - receiveCpuSeconds;
+    result.seconds = static_cast<double>(options.duration.count());
+    result.packetsIn = generator.packets();
+    analyzer.finish(result);
+    return true;
+}
+
+bool runOffline(const Options& options, Result& result)
+{
+    char inputName[] = "/tmp/inserter-bench-XXXXXX";
+    const auto inputFile = mkstemp(inputName);
+    if (inputFile < 0)
+    {
+        fprintf(stderr, "Unable to create the input file: %s\n", strerror(errno));
+        return false;
+    }
+
+    bench::TsGenerator generator(options.stream);
+    std::vector<uint8_t> buffer(1024 * utils::ts::packetSize);
+    bool written = true;
+    while (written && generator.time() < static_cast<double>(options.duration.count()))
+    {
+        for (size_t offset = 0; offset < buffer.size(); offset += utils::ts::packetSize)
+        {
+            generator.next(buffer.data() + offset);
+        }
+        written = write(inputFile, buffer.data(), buffer.size()) == static_cast<ssize_t>(buffer.size());
+    }
+    close(inputFile);
+
+    auto config = makeChannelConfig(options, "offline");
+    config.inputFile = inputName;
+    config.outputFile = std::string(inputName) + ".ts";
+
+    OfflineStats stats;
+    const auto cpuStart = processCpuSeconds();
+    const auto succeeded = written && OfflineInserter(config).run(stats);
+    result.cpuSeconds = processCpuSeconds() - cpuStart;
+    result.seconds = stats.seconds;
+    result.packetsIn = stats.bytesIn / utils::ts::packetSize;
+
+    OutputAnalyzer analyzer(options.stream.videoPid, nullptr);
+    auto outputFile = fopen(config.outputFile.c_str(), "rb");
+    while (outputFile)
+    {
+        const auto size = fread(buffer.data(), 1, buffer.size(), outputFile);
+        for (size_t offset = 0; offset + utils::ts::packetSize <= size; offset += utils::ts::packetSize)
+        {
+            analyzer.onPacket(buffer.data() + offset, 0);
+        }
+        if (size < buffer.size())
+        {
+            fclose(outputFile);
+            outputFile = nullptr;
+        }
+    }
+    analyzer.finish(result);
+
+    unlink(inputName);
+    unlink(config.outputFile.c_str());
+    return succeeded;
+}
+
+double percentile(const std::vector<double>& sorted, const double q)
+{
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(q * static_cast<double>(sorted.size())))];
+}
+
+void writeResult(FILE* output, const Options& options, const std::string& mode, Result& result)
+{
+    const auto mbps = static_cast<double>(result.packetsOut * utils::ts::packetSize * 8) / result.seconds / 1e6;
+    const auto cpuPercent = 100.0 * result.cpuSeconds / result.seconds;
+
+    fprintf(output,
+        "{\"bench\":\"inserter\",\"mode\":\"%s\",\"duration_s\":%.3f,\"bitrate_mbps\":%.3f,\"audio_pids\":%zu,"
+        "\"gop_frames\":%u,\"frame_rate\":%u,\"pcr_interval_ms\":%lld,\"packets_in\":%llu,\"packets_out\":%llu,"
+        "\"packets_per_s\":%.1f,\"output_mbps\":%.3f,\"cpu_percent\":%.2f,\"cpu_percent_per_mbps\":%.4f,",
+        mode.c_str(),
+        result.seconds,
+        static_cast<double>(options.stream.bitrate) / 1e6,
+        options.stream.audioPids.size(),
+        options.stream.gopLength,
+        options.stream.frameRate,
+        static_cast<long long>(options.stream.pcrInterval.count()),
+        static_cast<unsigned long long>(result.packetsIn),
+        static_cast<unsigned long long>(result.packetsOut),
+        static_cast<double>(result.packetsIn) / result.seconds,
+        mbps,
+        cpuPercent,
+        mbps > 0.0 ? cpuPercent / mbps : 0.0);
+
+    if (result.latencies.empty())
+    {
+        fprintf(output, "\"latency_ms\":null,");
+    }
+    else
+    {
+        std::sort(result.latencies.begin(), result.latencies.end());
+        fprintf(output,
+            "\"latency_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},",
+            percentile(result.latencies, 0.5),
+            percentile(result.latencies, 0.9),
+            percentile(result.latencies, 0.99),
+            result.latencies.back());
+    }
+
+    fprintf(output,
+        "\"cues\":%u,\"verified_cues\":%u,\"gop_aligned_cues\":%u,\"splice_error_ms\":{\"mean\":%.3f,\"max\":%.3f}}\n",
+        result.cues,
+        result.verifiedCues,
+        result.alignedCues,
+        result.verifiedCues != 0 ? result.sumSpliceErrorMs / result.verifiedCues : 0.0,
+        result.maxSpliceErrorMs);
+    fflush(output);
+}
+
+bool parsePids(const char* text, bench::TsGeneratorConfig& stream)
+{
+    std::vector<uint16_t> pids;
+    for (auto position = text; *position != '\0';)
+    {
+        char* end = nullptr;
+        const auto pid = std::strtoul(position, &end, 0);
+        if (end == position || pid < 0x20 || pid >= utils::ts::nullPid || (*end != ',' && *end != '\0'))
+        {
+            return false;
+        }
+        pids.push_back(static_cast<uint16_t>(pid));
+        position = *end == ',' ? end + 1 : end;
+    }
+    if (pids.empty())
+    {
+        return false;
+    }
+
+    stream.videoPid = pids.front();
+    stream.audioPids.assign(pids.begin() + 1, pids.end());
+    return true;
+}
+
+bool parseOptions(int32_t argc, char** argv, Options& options)
+{
+    int32_t lowLatency = 0;
+    std::array<option, 12> longOptions;
+    longOptions[0] = {"mode", required_argument, 0, 'm'};
+    longOptions[1] = {"duration", required_argument, 0, 'd'};
+    longOptions[2] = {"bitrate", required_argument, 0, 'b'};
+    longOptions[3] = {"pids", required_argument, 0, 'p'};
+    longOptions[4] = {"gop", required_argument, 0, 'g'};
+    longOptions[5] = {"frame-rate", required_argument, 0, 'r'};
+    longOptions[6] = {"pcr-interval", required_argument, 0, 'c'};
+    longOptions[7] = {"cue-interval", required_argument, 0, 'n'};
+    longOptions[8] = {"port", required_argument, 0, 'P'};
+    longOptions[9] = {"low-latency", no_argument, &lowLatency, 1};
+    longOptions[10] = {"output", required_argument, 0, 'o'};
+    longOptions[11] = {0, 0, 0, 0};
+
+    int32_t getOptResult;
+    int32_t optionIndex = 0;
+    while ((getOptResult = getopt_long(argc, argv, "m:d:b:o:", longOptions.data(), &optionIndex)) != -1)
+    {
+        switch (getOptResult)
+        {
+        case 0:
+            break;
+        case 'm':
+            options.modes.emplace_back(optarg);
+            break;
+        case 'd':
+            options.duration = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 'b':
+            options.stream.bitrate = static_cast<uint64_t>(std::strtod(optarg, nullptr) * 1e6);
+            break;
+        case 'p':
+            if (!parsePids(optarg, options.stream))
+            {
+                return false;
+            }
+            break;
+        case 'g':
+            options.stream.gopLength = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'r':
+            options.stream.frameRate = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'c':
+            options.stream.pcrInterval = std::chrono::milliseconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 'n':
+            options.cueInterval = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
+            break;
+        case 'P':
+            options.port = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'o':
+            options.output = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    options.lowLatency = lowLatency != 0;
+    if (options.modes.empty())
+    {
+        options.modes = {"passthrough", "batched", "remux", "offline"};
+    }
+    for (const auto& mode : options.modes)
+    {
+        if (mode != "passthrough" && mode != "batched" && mode != "remux" && mode != "offline")
+        {
+            return false;
+        }
+    }
+
+    // One second of null packets at least has to fit the PSI, PCR and audio next to the video.
+    const auto audioBitrate = 200000 * options.stream.audioPids.size();
+    return options.duration.count() > 0 && options.cueInterval.count() > 0 && options.stream.gopLength > 0 &&
+        bench::TsGenerator::frameRateCode(options.stream.frameRate) != 0 && options.stream.pcrInterval.count() > 0 &&
+        options.stream.pcrInterval.count() <= 100 &&
+        static_cast<double>(options.stream.bitrate) * (1.0 - options.stream.videoShare) > audioBitrate + 200000.0;
+}
+
+} // namespace
+
+int32_t main(int32_t argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        printf("%s\n", usageString);
+        return 1;
+    }
+
+    FILE* output = stdout;
+    if (!options.output.empty())
+    {
+        // Results of successive runs accumulate, one line per mode and run.
+        output = fopen(options.output.c_str(), "a");
+        if (!output)
+        {
+            fprintf(stderr, "Unable to open %s: %s\n", options.output.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    // Engine logs go to stderr, stdout only carries results.
+    Logger::setLevel(Logger::Level::WARNING);
+    Logger::start(stderr);
+    gst_init(&argc, &argv);
+
+    bool succeeded = true;
+    auto port = options.port;
+    for (const auto& mode : options.modes)
+    {
+        Result result;
+        const auto ran = mode == "offline" ? runOffline(options, result) : runLive(options, mode, port, result);
+        port += 2;
+        if (!ran || result.seconds <= 0.0)
+        {
+            fprintf(stderr, "Mode %s failed\n", mode.c_str());
+            succeeded = false;
+            continue;
+        }
+        writeResult(output, options, mode, result);
+    }
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    gst_deinit();
+    Logger::stop();
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+/**
+ * Measures the cost of a Logger call on the calling thread, with the asynchronous writer and with synchronous
+ * writes. Calls come in bursts, like the log lines of a splice or a channel start, with pauses for the writer.
+ */
+
+namespace
+{
+
+const uint32_t bursts = 2000;
+const uint32_t burstSize = 32;
+const auto burstPause = std::chrono::milliseconds(1);
+
+struct Result
+{
+    double medianNs;
+    double p99Ns;
+    double maxNs;
+};
+
+Result measure()
+{
+    std::vector<int64_t> durations;
+    durations.reserve(bursts * burstSize);
+
+    for (uint32_t burst = 0; burst < bursts; ++burst)
+    {
+        for (uint32_t i = 0; i < burstSize; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            Logger::log("[bench] SCTE-35 splice_insert: pts %llu (%llu s), immediate %c, request %u",
+                static_cast<unsigned long long>(burst) * 90000ULL,
+                static_cast<unsigned long long>(burst),
+                (i & 1) ? 'y' : 'n',
+                burst * burstSize + i);
+            durations.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        std::this_thread::sleep_for(burstPause);
+    }
+
+    std::sort(durations.begin(), durations.end());
+    return {static_cast<double>(durations[durations.size() / 2]),
+        static_cast<double>(durations[durations.size() * 99 / 100]),
+        static_cast<double>(durations.back())};
+}
+
+} // namespace
+
+int32_t main()
+{
+    auto output = fopen("/dev/null", "w");
+    if (output == nullptr)
+    {
+        printf("Unable to open /dev/null\n");
+        return 1;
+    }
+
+    Logger::start(output);
+    const auto asynchronous = measure();
+    Logger::stop();
+    const auto dropped = Logger::droppedMessages();
+
+    // The output stays at /dev/null after stop.
+    const auto synchronous = measure();
+    fclose(output);
+
+    printf("%u calls in bursts of %u\n", bursts * burstSize, burstSize);
+    printf("asynchronous: median %.0f ns, p99 %.0f ns, max %.0f ns, %llu dropped\n",
+        asynchronous.medianNs,
+        asynchronous.p99Ns,
+        asynchronous.maxNs,
+        static_cast<unsigned long long>(dropped));
+    printf("synchronous:  median %.0f ns, p99 %.0f ns, max %.0f ns\n",
+        synchronous.medianNs,
+        synchronous.p99Ns,
+        synchronous.maxNs);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#define GST_USE_UNSTABLE_API 1
+
+#include "SpliceFactory.h"
+#include "SpliceInfoSection.h"
+#include "utils/Crc32.h"
+#include "utils/ScopedGstObject.h"
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <gst/gst.h>
+#include <gst/mpegts/mpegts.h>
+#include <random>
+
+/**
+ * Compares building splice_insert sections through libgstmpegts with the SpliceInfoSection encoder, and fuzzes the
+ * encoder: random sections of every command must parse back through libgstmpegts with the same field values.
+ */
+
+namespace
+{
+
+const uint16_t scte35Pid = 35;
+const uint32_t iterations = 200000;
+const uint32_t fuzzIterations = 20000;
+
+template <typename Function>
+double nanosecondsPerCall(Function&& function)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        function(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / iterations;
+}
+
+uint32_t crc32MpegBytewise(const uint8_t* data, const size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = (crc << 8) ^ utils::detail::crc32MpegTables[0][((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+SpliceInfo randomSpliceInfo(std::mt19937_64& random)
+{
+    const auto time33 = [&random]() { return random() & ((uint64_t(1) << 33) - 1); };
+
+    SpliceInfo info;
+    const SpliceCommandType commands[] = {SpliceCommandType::SPLICE_NULL,
+        SpliceCommandType::SPLICE_INSERT,
+        SpliceCommandType::TIME_SIGNAL,
+        SpliceCommandType::BANDWIDTH_RESERVATION};
+    info.command = commands[random() % 4];
+    info.ptsAdjustment = random() % 2 ? time33() : 0;
+    info.tier = static_cast<uint16_t>(random() & 0xFFF);
+
+    auto& spliceInsert = info.spliceInsert;
+    spliceInsert.type = random() % 2 ? SpliceType::OUT : SpliceType::IN;
+    spliceInsert.eventId = static_cast<uint32_t>(random());
+    spliceInsert.uniqueProgramId = static_cast<uint16_t>(random());
+    spliceInsert.immediate = random() % 4 == 0;
+    spliceInsert.spliceTime = time33();
+    spliceInsert.hasDuration = random() % 2;
+    spliceInsert.breakDuration = time33();
+    spliceInsert.autoReturn = random() % 2;
+
+    info.timeSpecified = random() % 4 != 0;
+    info.spliceTime = time33();
+
+    info.hasAvailDescriptor = random() % 4 == 0;
+    info.providerAvailId = static_cast<uint32_t>(random());
+    info.segmentationCount = random() % (SpliceInfo::maxSegmentationDescriptors + 1);
+    for (size_t i = 0; i < info.segmentationCount; ++i)
+    {
+        auto& descriptor = info.segmentation[i];
+        descriptor.eventId = static_cast<uint32_t>(random());
+        descriptor.cancel = random() % 8 == 0;
+        descriptor.typeId = static_cast<uint8_t>(random());
+        descriptor.hasDuration = random() % 2;
+        descriptor.duration = random() & ((uint64_t(1) << 40) - 1);
+        descriptor.deliveryNotRestricted = random() % 2;
+        descriptor.upidType = static_cast<uint8_t>(random());
+        descriptor.upidSize = static_cast<uint8_t>(random() % (SegmentationDescriptor::maxUpidSize + 1));
+        for (auto& byte : descriptor.upid)
+        {
+            byte = static_cast<uint8_t>(random());
+        }
+        descriptor.subSegmentsExpected = random() % 4 == 0 ? static_cast<uint8_t>(random() | 1) : 0;
+    }
+    return info;
+}
+
+uint32_t read32(const uint8_t* data)
+{
+    return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+/**
+ * @return True if libgstmpegts parses section back into the field values of info.
+ */
+bool parsesBack(const SpliceInfo& info, const uint8_t* section, const size_t size)
+{
+    auto data = static_cast<guint8*>(g_malloc(size));
+    memcpy(data, section, size);
+    utils::ScopedGstObject mpegTsSection(gst_mpegts_section_new(scte35Pid, data, size));
+    const auto sit = gst_mpegts_section_get_scte_sit(mpegTsSection.get());
+    if (!sit || sit->splice_command_type != static_cast<GstMpegtsSCTESpliceCommandType>(info.command) ||
+        sit->pts_adjustment != info.ptsAdjustment || sit->tier != info.tier)
+    {
+        return false;
+    }
+
+    if (info.command == SpliceCommandType::TIME_SIGNAL &&
+        (static_cast<bool>(sit->splice_time_specified) != info.timeSpecified ||
+            (info.timeSpecified && sit->splice_time != info.spliceTime)))
+    {
+        return false;
+    }
+
+    if (info.command == SpliceCommandType::SPLICE_INSERT)
+    {
+        const auto& expected = info.spliceInsert;
+        if (!sit->splices || sit->splices->len != 1)
+        {
+            return false;
+        }
+        const auto event = static_cast<const GstMpegtsSCTESpliceEvent*>(sit->splices->pdata[0]);
+        if (event->splice_event_id != expected.eventId ||
+            static_cast<bool>(event->out_of_network_indicator) != (expected.type == SpliceType::OUT) ||
+            static_cast<bool>(event->splice_immediate_flag) != expected.immediate ||
+            (!expected.immediate && event->program_splice_time != expected.spliceTime) ||
+            static_cast<bool>(event->duration_flag) != expected.hasDuration ||
+            (expected.hasDuration &&
+                (event->break_duration != expected.breakDuration ||
+                    static_cast<bool>(event->break_duration_auto_return) != expected.autoReturn)) ||
+            event->unique_program_id != expected.uniqueProgramId)
+        {
+            return false;
+        }
+    }
+
+    // The descriptor loop is kept as raw descriptors: check tags, identifiers, event ids and UPIDs.
+    const auto expectedDescriptors = info.segmentationCount + (info.hasAvailDescriptor ? 1 : 0);
+    if (!sit->descriptors || sit->descriptors->len != expectedDescriptors)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < expectedDescriptors; ++i)
+    {
+        const auto descriptor = static_cast<const GstMpegtsDescriptor*>(sit->descriptors->pdata[i]);
+        const auto payload = descriptor->data + 2;
+        if (info.hasAvailDescriptor && i == 0)
+        {
+            if (descriptor->tag != 0x00 || read32(payload) != 0x43554549 || read32(payload + 4) != info.providerAvailId)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const auto& segmentation = info.segmentation[info.hasAvailDescriptor ? i - 1 : i];
+        if (descriptor->tag != 0x02 || read32(payload) != 0x43554549 || read32(payload + 4) != segmentation.eventId)
+        {
+            return false;
+        }
+        if (!segmentation.cancel &&
+            (payload[10 + (segmentation.hasDuration ? 5 : 0)] != segmentation.upidType ||
+                memcmp(payload + 12 + (segmentation.hasDuration ? 5 : 0), segmentation.upid.data(),
+                    segmentation.upidSize) != 0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int32_t main(int32_t argc, char** argv)
+{
+    gst_init(&argc, &argv);
+
+    SpliceFactory libraryFactory(std::chrono::seconds(30), false, true);
+    SpliceFactory encoderFactory(std::chrono::seconds(30), false, true);
+    std::array<uint8_t, maxSpliceInfoSectionSize> section{};
+    size_t checksum = 0;
+
+    const auto libraryNs = nanosecondsPerCall([&](const uint32_t i) {
+        const auto spliceType = (i & 1) ? SpliceType::IN : SpliceType::OUT;
+        auto scteSit = libraryFactory.makeScteSit(spliceType, i * 3000ULL, SpliceTimeBase::PTS);
+        utils::ScopedGstObject mpegTsSection(gst_mpegts_section_from_scte_sit(scteSit, scte35Pid));
+        gsize size = 0;
+        const auto data = gst_mpegts_section_packetize(mpegTsSection.get(), &size);
+        memcpy(section.data(), data, size);
+        checksum += size;
+    });
+
+    const auto encoderNs = nanosecondsPerCall([&](const uint32_t i) {
+        SpliceRequest request;
+        request.type = (i & 1) ? SpliceType::IN : SpliceType::OUT;
+        const auto spliceInfo = encoderFactory.makeSpliceInfo(request, i * 3000ULL);
+        checksum += writeSpliceInfoSection(spliceInfo, section.data(), section.size());
+    });
+
+    std::mt19937_64 random(35);
+    uint32_t failures = 0;
+    for (uint32_t i = 0; i < fuzzIterations; ++i)
+    {
+        const auto spliceInfo = randomSpliceInfo(random);
+        const auto size = writeSpliceInfoSection(spliceInfo, section.data(), section.size());
+        if (size == 0 || !parsesBack(spliceInfo, section.data(), size))
+        {
+            ++failures;
+        }
+    }
+
+    std::array<uint8_t, 1024> crcInput{};
+    for (size_t i = 0; i < crcInput.size(); ++i)
+    {
+        crcInput[i] = static_cast<uint8_t>(i * 31);
+    }
+    const auto bytewiseNs = nanosecondsPerCall(
+        [&](const uint32_t i) { checksum += crc32MpegBytewise(crcInput.data(), crcInput.size() - (i & 1)); });
+    const auto sliceBy8Ns = nanosecondsPerCall(
+        [&](const uint32_t i) { checksum += utils::crc32Mpeg(crcInput.data(), crcInput.size() - (i & 1)); });
+
+    printf("splice_insert libgstmpegts: %8.1f ns/section\n", libraryNs);
+    printf("splice_insert encoder:      %8.1f ns/section (%.1fx)\n", encoderNs, libraryNs / encoderNs);
+    printf("fuzzed round trips:         %u, %u failed\n", fuzzIterations, failures);
+    printf("crc32 1 KB bytewise:        %8.1f ns\n", bytewiseNs);
+    printf("crc32 1 KB slice-by-8:      %8.1f ns (%.1fx)\n", sliceBy8Ns, bytewiseNs / sliceBy8Ns);
+    printf("(checksum %zu)\n", checksum);
+
+    gst_deinit();
+    return failures == 0 ? 0 : 1;
+}
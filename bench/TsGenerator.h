@@ -0,0 +1,448 @@
+#pragma once
+
+#include "utils/Crc32.h"
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace bench
+{
+
+/**
+ * Shape of a synthetic stream: one program with an MPEG-1 video PID and AAC audio PIDs, multiplexed at a constant
+ * rate with null packets.
+ */
+struct TsGeneratorConfig
+{
+    // Mux rate in bits per second.
+    uint64_t bitrate = 10000000;
+    // Share of the mux rate taken by video, the rest is audio, PSI and null packets.
+    double videoShare = 0.7;
+    uint16_t pmtPid = 0x1000;
+    uint16_t videoPid = 0x100;
+    std::vector<uint16_t> audioPids = {0x101};
+    // 24, 25, 30, 50 or 60.
+    uint32_t frameRate = 25;
+    // Pictures per GOP, each GOP starts with a sequence header and an I picture flagged as random access point.
+    uint32_t gopLength = 50;
+    std::chrono::milliseconds pcrInterval = std::chrono::milliseconds(40);
+    std::chrono::milliseconds psiInterval = std::chrono::milliseconds(100);
+    // Distance between the PCR and the PTS of a picture that starts at that PCR.
+    std::chrono::milliseconds ptsDelay = std::chrono::milliseconds(500);
+};
+
+/**
+ * Writes a synthetic constant bitrate MPEG-TS stream one packet at a time. The elementary streams carry valid
+ * headers (sequence, GOP and picture headers, ADTS frames) around filler, enough for the parsers of the remuxing
+ * pipeline and for VideoClock, but nothing decodes to a picture. Timestamps follow the packet position at the mux
+ * rate, so the stream can be paced in real time or written as fast as possible.
+ */
+class TsGenerator
+{
+public:
+    static uint8_t frameRateCode(const uint32_t frameRate)
+    {
+        switch (frameRate)
+        {
+        case 24:
+            return 2;
+        case 25:
+            return 3;
+        case 30:
+            return 5;
+        case 50:
+            return 6;
+        case 60:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    explicit TsGenerator(const TsGeneratorConfig& config)
+        : config_(config),
+          packets_(0),
+          nextPsiTime_(0.0),
+          nextPcrTime_(0.0),
+          pFrameSize_(0),
+          patContinuityCounter_(0x0F),
+          pmtContinuityCounter_(0x0F),
+          sendPmt_(false)
+    {
+        streams_.push_back({config_.videoPid, 0xE0, 0x0F, {}, 0, 0, 1.0 / config_.frameRate});
+        for (const auto pid : config_.audioPids)
+        {
+            streams_.push_back({pid, static_cast<uint8_t>(0xC0 + streams_.size() - 1), 0x0F, {}, 0, 0,
+                static_cast<double>(audioFrameSamples) / audioSampleRate});
+        }
+
+        const auto averageFrameSize = static_cast<double>(config_.bitrate) * config_.videoShare / 8.0 /
+            config_.frameRate;
+        pFrameSize_ = static_cast<size_t>(averageFrameSize * config_.gopLength / (config_.gopLength + 3));
+        pFrameSize_ = std::max(pFrameSize_, minimumFrameSize);
+        writePat();
+        writePmt();
+    }
+
+    /**
+     * Writes the next packet of the stream.
+     */
+    void next(uint8_t* packet)
+    {
+        const auto now = time();
+        ++packets_;
+
+        if (sendPmt_)
+        {
+            sendPmt_ = false;
+            writeSection(packet, config_.pmtPid, pmt_, pmtContinuityCounter_);
+            return;
+        }
+        if (now >= nextPsiTime_)
+        {
+            nextPsiTime_ += std::chrono::duration<double>(config_.psiInterval).count();
+            sendPmt_ = true;
+            writeSection(packet, utils::ts::patPid, pat_, patContinuityCounter_);
+            return;
+        }
+
+        for (auto& stream : streams_)
+        {
+            if (stream.written == stream.pes.size() && stream.nextUnit * stream.unitDuration <= now)
+            {
+                makePes(stream);
+            }
+        }
+
+        const auto pcrDue = now >= nextPcrTime_;
+        if (pcrDue)
+        {
+            nextPcrTime_ += std::chrono::duration<double>(config_.pcrInterval).count();
+        }
+
+        // The stream whose pending access unit is due first goes out first.
+        Stream* selected = nullptr;
+        for (auto& stream : streams_)
+        {
+            if (stream.written < stream.pes.size() && (!selected || unitTime(stream) < unitTime(*selected)))
+            {
+                selected = &stream;
+            }
+        }
+
+        if (pcrDue && selected != &streams_.front())
+        {
+            writePcrOnly(packet, now);
+            return;
+        }
+        if (!selected)
+        {
+            writeNull(packet);
+            return;
+        }
+        writePesPacket(packet, *selected, pcrDue, now);
+    }
+
+    /**
+     * @return Position of the next packet at the mux rate in seconds from the start of the stream.
+     */
+    double time() const { return static_cast<double>(packets_) * utils::ts::packetSize * 8 / config_.bitrate; }
+
+    uint64_t packets() const { return packets_; }
+
+    /**
+     * @return 33-bit PTS of the first picture.
+     */
+    uint64_t firstPts() const { return ptsAt(0.0); }
+
+    uint64_t frameDuration() const { return utils::ts::ptsClockRate / config_.frameRate; }
+
+    uint64_t gopDuration() const { return frameDuration() * config_.gopLength; }
+
+private:
+    static const uint32_t audioSampleRate = 48000;
+    static const uint32_t audioFrameSamples = 1024;
+    static const uint32_t audioBitrate = 128000;
+    static const size_t minimumFrameSize = 64;
+    static const uint8_t videoStreamType = 0x01;
+    static const uint8_t aacStreamType = 0x0F;
+
+    struct Stream
+    {
+        uint16_t pid;
+        uint8_t streamId;
+        uint8_t continuityCounter;
+        std::vector<uint8_t> pes;
+        size_t written;
+        // Index of the next access unit and the duration of one in seconds.
+        uint64_t nextUnit;
+        double unitDuration;
+    };
+
+    /**
+     * MSB first bit writer for the video headers.
+     */
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& output) : output_(output), bits_(0) {}
+
+        void write(const uint32_t value, const uint32_t count)
+        {
+            for (uint32_t bit = count; bit > 0; --bit)
+            {
+                if (bits_ % 8 == 0)
+                {
+                    output_.push_back(0);
+                }
+                output_.back() |= static_cast<uint8_t>(((value >> (bit - 1)) & 1) << (7 - bits_ % 8));
+                ++bits_;
+            }
+        }
+
+        void startCode(const uint8_t code)
+        {
+            bits_ = 0;
+            output_.insert(output_.end(), {0x00, 0x00, 0x01, code});
+        }
+
+    private:
+        std::vector<uint8_t>& output_;
+        uint32_t bits_;
+    };
+
+    TsGeneratorConfig config_;
+    uint64_t packets_;
+    double nextPsiTime_;
+    double nextPcrTime_;
+    size_t pFrameSize_;
+    std::vector<Stream> streams_;
+    std::vector<uint8_t> pat_;
+    std::vector<uint8_t> pmt_;
+    uint8_t patContinuityCounter_;
+    uint8_t pmtContinuityCounter_;
+    bool sendPmt_;
+
+    /**
+     * @return Time in seconds of the access unit the PES of stream holds.
+     */
+    static double unitTime(const Stream& stream)
+    {
+        return static_cast<double>(stream.nextUnit - 1) * stream.unitDuration;
+    }
+
+    uint64_t pcrAt(const double time) const { return static_cast<uint64_t>(time * 27000000.0); }
+
+    uint64_t ptsAt(const double time) const
+    {
+        return (pcrAt(time) / 300 + static_cast<uint64_t>(config_.ptsDelay.count()) * 90) % utils::ts::ptsModulo;
+    }
+
+    static void appendCrc(std::vector<uint8_t>& section)
+    {
+        const auto crc = utils::crc32Mpeg(section.data(), section.size());
+        section.insert(section.end(),
+            {static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16), static_cast<uint8_t>(crc >> 8),
+                static_cast<uint8_t>(crc)});
+    }
+
+    static void setSectionLength(std::vector<uint8_t>& section)
+    {
+        const auto length = section.size() + 4 - 3;
+        section[1] = static_cast<uint8_t>(0xB0 | (length >> 8));
+        section[2] = static_cast<uint8_t>(length & 0xFF);
+    }
+
+    void writePat()
+    {
+        pat_ = {0x00, 0, 0, 0x00, 0x01, 0xC1, 0x00, 0x00, 0x00, 0x01,
+            static_cast<uint8_t>(0xE0 | (config_.pmtPid >> 8)), static_cast<uint8_t>(config_.pmtPid & 0xFF)};
+        setSectionLength(pat_);
+        appendCrc(pat_);
+    }
+
+    void writePmt()
+    {
+        pmt_ = {0x02, 0, 0, 0x00, 0x01, 0xC1, 0x00, 0x00, static_cast<uint8_t>(0xE0 | (config_.videoPid >> 8)),
+            static_cast<uint8_t>(config_.videoPid & 0xFF), 0xF0, 0x00};
+        for (const auto& stream : streams_)
+        {
+            pmt_.insert(pmt_.end(),
+                {stream.pid == config_.videoPid ? videoStreamType : aacStreamType,
+                    static_cast<uint8_t>(0xE0 | (stream.pid >> 8)), static_cast<uint8_t>(stream.pid & 0xFF), 0xF0,
+                    0x00});
+        }
+        setSectionLength(pmt_);
+        appendCrc(pmt_);
+    }
+
+    void makePes(Stream& stream)
+    {
+        const auto unit = stream.nextUnit++;
+        const auto pts = ptsAt(static_cast<double>(unit) * stream.unitDuration);
+        const auto isVideo = &stream == &streams_.front();
+
+        auto& pes = stream.pes;
+        pes.clear();
+        stream.written = 0;
+        pes.insert(pes.end(), {0x00, 0x00, 0x01, stream.streamId, 0x00, 0x00, 0x80, 0x80, 0x05});
+        pes.insert(pes.end(),
+            {static_cast<uint8_t>(0x21 | ((pts >> 29) & 0x0E)), static_cast<uint8_t>(pts >> 22),
+                static_cast<uint8_t>(0x01 | ((pts >> 14) & 0xFE)), static_cast<uint8_t>(pts >> 7),
+                static_cast<uint8_t>(0x01 | ((pts << 1) & 0xFE))});
+
+        if (isVideo)
+        {
+            writePicture(pes, unit);
+            return;
+        }
+
+        const size_t frameSize = audioBitrate / 8 * audioFrameSamples / audioSampleRate;
+        const auto esStart = pes.size();
+        // ADTS header: AAC LC, 48 kHz, stereo, no CRC.
+        pes.insert(pes.end(),
+            {0xFF, 0xF1, 0x4C, static_cast<uint8_t>(0x80 | (frameSize >> 11)),
+                static_cast<uint8_t>((frameSize >> 3) & 0xFF), static_cast<uint8_t>(((frameSize & 0x07) << 5) | 0x1F),
+                0xFC});
+        pes.resize(esStart + frameSize, 0x00);
+        const auto pesLength = pes.size() - 6;
+        pes[4] = static_cast<uint8_t>(pesLength >> 8);
+        pes[5] = static_cast<uint8_t>(pesLength & 0xFF);
+    }
+
+    void writePicture(std::vector<uint8_t>& pes, const uint64_t frame)
+    {
+        const auto gopPosition = static_cast<uint32_t>(frame % config_.gopLength);
+        const auto intra = gopPosition == 0;
+        const auto esStart = pes.size();
+        BitWriter bits(pes);
+
+        if (intra)
+        {
+            bits.startCode(0xB3);
+            bits.write(720, 12);
+            bits.write(576, 12);
+            bits.write(8, 4);
+            bits.write(frameRateCode(config_.frameRate), 4);
+            bits.write(static_cast<uint32_t>(std::min<uint64_t>(config_.bitrate / 400, 0x3FFFE)), 18);
+            bits.write(1, 1);
+            bits.write(112, 10);
+            bits.write(0, 3);
+
+            const auto seconds = frame / config_.frameRate;
+            bits.startCode(0xB8);
+            bits.write(0, 1);
+            bits.write(static_cast<uint32_t>(seconds / 3600 % 24), 5);
+            bits.write(static_cast<uint32_t>(seconds / 60 % 60), 6);
+            bits.write(1, 1);
+            bits.write(static_cast<uint32_t>(seconds % 60), 6);
+            bits.write(static_cast<uint32_t>(frame % config_.frameRate), 6);
+            bits.write(1, 1);
+            bits.write(0, 6);
+        }
+
+        bits.startCode(0x00);
+        bits.write(gopPosition & 0x3FF, 10);
+        bits.write(intra ? 1 : 2, 3);
+        bits.write(0xFFFF, 16);
+        if (!intra)
+        {
+            bits.write(0, 1);
+            bits.write(1, 3);
+        }
+        bits.write(0, 1);
+
+        // One slice of filler that never emulates a start code.
+        bits.startCode(0x01);
+        bits.write(0x08, 8);
+        pes.resize(esStart + (intra ? pFrameSize_ * 4 : pFrameSize_), 0xFF);
+    }
+
+    static void writeAdaptationField(uint8_t* packet, const size_t size, const uint8_t flags, const uint64_t* pcr)
+    {
+        packet[3] |= 0x20;
+        packet[4] = static_cast<uint8_t>(size - 1);
+        if (size == 1)
+        {
+            return;
+        }
+
+        packet[5] = flags;
+        auto position = packet + 6;
+        if (pcr)
+        {
+            const auto base = (*pcr / 300) % utils::ts::ptsModulo;
+            const auto extension = *pcr % 300;
+            position[0] = static_cast<uint8_t>(base >> 25);
+            position[1] = static_cast<uint8_t>(base >> 17);
+            position[2] = static_cast<uint8_t>(base >> 9);
+            position[3] = static_cast<uint8_t>(base >> 1);
+            position[4] = static_cast<uint8_t>(((base & 0x01) << 7) | 0x7E | (extension >> 8));
+            position[5] = static_cast<uint8_t>(extension & 0xFF);
+            position += 6;
+        }
+        memset(position, 0xFF, static_cast<size_t>(packet + 4 + size - position));
+    }
+
+    void writePesPacket(uint8_t* packet, Stream& stream, const bool withPcr, const double now)
+    {
+        const auto start = stream.written == 0;
+        stream.continuityCounter = (stream.continuityCounter + 1) & 0x0F;
+        utils::ts::writeHeader(packet, stream.pid, start, stream.continuityCounter);
+
+        const auto isVideo = &stream == &streams_.front();
+        const auto randomAccess = isVideo && start && (stream.nextUnit - 1) % config_.gopLength == 0;
+        const auto pcr = pcrAt(now);
+        size_t adaptationSize = withPcr ? 8 : (randomAccess ? 2 : 0);
+        const auto remaining = stream.pes.size() - stream.written;
+        if (remaining < utils::ts::packetSize - 4 - adaptationSize)
+        {
+            adaptationSize = utils::ts::packetSize - 4 - remaining;
+        }
+        if (adaptationSize != 0)
+        {
+            writeAdaptationField(packet,
+                adaptationSize,
+                static_cast<uint8_t>((withPcr ? 0x10 : 0x00) | (randomAccess ? 0x40 : 0x00)),
+                withPcr ? &pcr : nullptr);
+        }
+
+        const auto payloadSize = utils::ts::packetSize - 4 - adaptationSize;
+        memcpy(packet + 4 + adaptationSize, stream.pes.data() + stream.written, payloadSize);
+        stream.written += payloadSize;
+    }
+
+    void writePcrOnly(uint8_t* packet, const double now)
+    {
+        // Adaptation field only, the continuity counter does not advance.
+        const auto& video = streams_.front();
+        utils::ts::writeHeader(packet, video.pid, false, video.continuityCounter);
+        packet[3] &= 0xCF;
+        const auto pcr = pcrAt(now);
+        writeAdaptationField(packet, utils::ts::packetSize - 4, 0x10, &pcr);
+    }
+
+    static void writeNull(uint8_t* packet)
+    {
+        utils::ts::writeHeader(packet, utils::ts::nullPid, false, 0);
+        memset(packet + 4, 0xFF, utils::ts::packetSize - 4);
+    }
+
+    static void writeSection(uint8_t* packet,
+        const uint16_t pid,
+        const std::vector<uint8_t>& section,
+        uint8_t& continuityCounter)
+    {
+        continuityCounter = (continuityCounter + 1) & 0x0F;
+        utils::ts::writeHeader(packet, pid, true, continuityCounter);
+        packet[4] = 0;
+        memcpy(packet + 5, section.data(), section.size());
+        memset(packet + 5 + section.size(), 0xFF, utils::ts::packetSize - 5 - section.size());
+    }
+};
+
+} // namespace bench
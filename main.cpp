@@ -1,23 +1,82 @@
+#include "BatchRunner.h"
+#include "ChannelConfig.h"
+#include "ControlServer.h"
+#include "CueMonitor.h"
+#include "Logger.h"
+#include "Passthrough.h"
 #include "Pipeline.h"
+#include "utils/ProcessStats.h"
+#include "utils/ThreadAffinity.h"
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
+#include <fstream>
 #include <getopt.h>
 #include <glib-2.0/glib.h>
+#include <gst/gst.h>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 namespace
 {
 
 const char* usageString =
     "Usage: scte35-inserter -i <MPEG-TS input address:port> -o [MPEG-TS output address:port] -n "
-    "<SCTE-35 splice interval s> -d <SCTE-35 splice duration s> [--immediate] [--autoreturn] --file [output "
-    "file name (instead of UDP output)]";
+    "<SCTE-35 splice interval s> -d <SCTE-35 splice duration s> [--immediate] [--autoreturn] [--passthrough] --file "
+    "[output file name] [--name <channel name>] [--cores <core list, e.g. 2,3 or 4-7>] "
+    "[--batched-udp] [--socket-buffer <bytes>] [--batch <datagrams>] [--busy-poll <us>] [--control <address:port>] "
+    "[--control-socket <path>] [--log-level <debug|info|warning|error>] [--log-json] [--low-latency] "
+    "[--buffer-time <ms>] [--queue-max-time <ms, 0 unbounded>] [--leaky] [--demux-latency <ms>] [--mux-latency <ms>] "
+    "[--no-sync] [--cue <cue>]... [--cue-schedule <CSV or JSON file>] [--secondary-input <address:port>] "
+    "[--redundancy-delay <ms>] [--state-file <path>] [--merge-scte35] [--packet-ring <interface>] "
+    "[--output-queue <kB per output>] [--pace] [--cbr <kbps>] [--pace-delay <ms>] [--hls <directory>] "
+    "[--hls-segment <s>] [--hls-list-size <segments>] [--input-pool <buffers>] [--hugepages] [--trace <JSON file>] "
+    "[--trace-sample <1 in n buffers>]\n"
+    "       scte35-inserter --channels <channel list file, one line of the options above per channel> "
+    "[--control <address:port>] [--control-socket <path>] [--log-level <level>] [--log-json]\n"
+    "       scte35-inserter --input-file <MPEG-TS file> (--file <output file> | --hls <directory>)... "
+    "-d <SCTE-35 splice duration s> "
+    "[-n <interval s>] [--cue <offset s>[:out|in|signal][:<duration s>]]... [--cue-schedule <CSV or JSON file>] "
+    "[--merge-scte35] [--hls-segment <s>] [--hls-list-size <segments>]\n"
+    "       scte35-inserter --batch-input <directory of .ts files or manifest> --batch-output <directory> "
+    "-d <SCTE-35 splice duration s> [cue options as above] [--threads <n>] [--batch-memory <MB>] "
+    "[--batch-report <CSV file>]\n"
+    "       scte35-inserter --monitor (-i <MPEG-TS input address:port> | --input-file <MPEG-TS file>) "
+    "[--monitor-report <CSV file>]\n"
+    "       -n 0 disables the interval splices of a channel, cues then only come from the schedule or the control "
+    "API\n"
+    "       -o and --file may be repeated and combined, each output then gets the same stream from its own queue";
+
+const std::chrono::seconds statsInterval(60);
+// 2022-7 style merging needs the skew between the paths, the merge ring is sized to the delay at 200 Mbit/s.
+const std::chrono::milliseconds maxRedundancyDelay(1000);
+
+/**
+ * Options that apply to the whole process, only valid on the command line.
+ */
+struct ProcessConfig
+{
+    std::string channelsFile;
+    std::pair<std::string, uint32_t> controlAddress;
+    std::string controlSocketPath;
+    bool hasLogLevel = false;
+    Logger::Level logLevel = Logger::Level::INFO;
+    bool logJson = false;
+    BatchOptions batch;
+
+    bool hasControl() const { return !controlAddress.first.empty() || !controlSocketPath.empty(); }
+    bool hasProcessOptions() const
+    {
+        return !channelsFile.empty() || hasControl() || hasLogLevel || logJson || !batch.input.empty();
+    }
+};
 
 GMainLoop* mainLoop = nullptr;
-std::unique_ptr<Pipeline> pipeline;
+std::vector<std::unique_ptr<Inserter>> inserters;
+utils::ContextSwitches lastContextSwitches;
 
 void intSignalHandler(int32_t)
 {
@@ -40,29 +99,30 @@ std::pair<std::string, uint32_t> splitAddressPort(const char* address)
     return {result, std::strtoul(next, nullptr, 10)};
 }
 
-} // namespace
-
-int32_t main(int32_t argc, char** argv)
+/**
+ * Parses the per-channel options shared by the command line and the lines of a channel list file.
+ * @param processConfig Set from the process wide options, only valid on the command line.
+ */
+bool parseOptions(int32_t argc, char** argv, ChannelConfig& config, ProcessConfig& processConfig)
 {
-    {
-        struct sigaction sigactionData = {};
-        sigactionData.sa_handler = intSignalHandler;
-        sigactionData.sa_flags = 0;
-        sigemptyset(&sigactionData.sa_mask);
-        sigaction(SIGINT, &sigactionData, nullptr);
-    }
-
-    std::pair<std::string, uint32_t> inAddress;
-    std::pair<std::string, uint32_t> outAddress;
     int32_t getOptResult;
-    std::chrono::seconds spliceInterval(0);
-    std::chrono::seconds spliceDuration(0);
-    std::string outputFileName;
-
     int32_t immediate = 0;
     int32_t autoReturn = 0;
+    int32_t passthrough = 0;
+    int32_t batchedUdp = 0;
+    int32_t logJson = 0;
+    int32_t lowLatency = 0;
+    int32_t leaky = 0;
+    int32_t noSync = 0;
+    int32_t monitor = 0;
+    int32_t mergeScte35 = 0;
+    int32_t pace = 0;
+    int32_t hugePages = 0;
+    // Explicit latency options override the --low-latency profile regardless of their order.
+    LatencyOptions latencyOverrides;
+    std::array<bool, 4> hasLatencyOverride = {};
 
-    std::array<option, 8> longOptions;
+    std::array<option, 53> longOptions;
     longOptions[0] = {"file", required_argument, 0, 'f'};
     longOptions[1] = {"immediate", no_argument, &immediate, 1};
     longOptions[2] = {"input", required_argument, 0, 'i'};
@@ -70,9 +130,55 @@ int32_t main(int32_t argc, char** argv)
     longOptions[4] = {"interval", required_argument, 0, 'n'};
     longOptions[5] = {"duration", required_argument, 0, 'd'};
     longOptions[6] = {"autoreturn", no_argument, &autoReturn, 1};
-    longOptions[7] = {0, 0, 0, 0};
+    longOptions[7] = {"passthrough", no_argument, &passthrough, 1};
+    longOptions[8] = {"name", required_argument, 0, 'N'};
+    longOptions[9] = {"cores", required_argument, 0, 'C'};
+    longOptions[10] = {"channels", required_argument, 0, 'c'};
+    longOptions[11] = {"batched-udp", no_argument, &batchedUdp, 1};
+    longOptions[12] = {"socket-buffer", required_argument, 0, 'S'};
+    longOptions[13] = {"batch", required_argument, 0, 'B'};
+    longOptions[14] = {"busy-poll", required_argument, 0, 'P'};
+    longOptions[15] = {"control", required_argument, 0, 'A'};
+    longOptions[16] = {"control-socket", required_argument, 0, 'U'};
+    longOptions[17] = {"log-level", required_argument, 0, 'L'};
+    longOptions[18] = {"log-json", no_argument, &logJson, 1};
+    longOptions[19] = {"low-latency", no_argument, &lowLatency, 1};
+    longOptions[20] = {"buffer-time", required_argument, 0, 'T'};
+    longOptions[21] = {"queue-max-time", required_argument, 0, 'Q'};
+    longOptions[22] = {"leaky", no_argument, &leaky, 1};
+    longOptions[23] = {"demux-latency", required_argument, 0, 'D'};
+    longOptions[24] = {"mux-latency", required_argument, 0, 'M'};
+    longOptions[25] = {"no-sync", no_argument, &noSync, 1};
+    longOptions[26] = {"input-file", required_argument, 0, 'I'};
+    longOptions[27] = {"cue", required_argument, 0, 'K'};
+    longOptions[28] = {"cue-schedule", required_argument, 0, 'H'};
+    longOptions[29] = {"batch-input", required_argument, 0, 'b'};
+    longOptions[30] = {"batch-output", required_argument, 0, 'O'};
+    longOptions[31] = {"batch-report", required_argument, 0, 'R'};
+    longOptions[32] = {"threads", required_argument, 0, 'W'};
+    longOptions[33] = {"batch-memory", required_argument, 0, 'm'};
+    longOptions[34] = {"monitor", no_argument, &monitor, 1};
+    longOptions[35] = {"monitor-report", required_argument, 0, 'Y'};
+    longOptions[36] = {"secondary-input", required_argument, 0, 'X'};
+    longOptions[37] = {"redundancy-delay", required_argument, 0, 'Z'};
+    longOptions[38] = {"state-file", required_argument, 0, 'G'};
+    longOptions[39] = {"merge-scte35", no_argument, &mergeScte35, 1};
+    longOptions[40] = {"packet-ring", required_argument, 0, 'E'};
+    longOptions[41] = {"output-queue", required_argument, 0, 'V'};
+    longOptions[42] = {"pace", no_argument, &pace, 1};
+    longOptions[43] = {"cbr", required_argument, 0, 'J'};
+    longOptions[44] = {"pace-delay", required_argument, 0, 'F'};
+    longOptions[45] = {"hls", required_argument, 0, 'g'};
+    longOptions[46] = {"hls-segment", required_argument, 0, 'h'};
+    longOptions[47] = {"hls-list-size", required_argument, 0, 'j'};
+    longOptions[48] = {"input-pool", required_argument, 0, 'k'};
+    longOptions[49] = {"hugepages", no_argument, &hugePages, 1};
+    longOptions[50] = {"trace", required_argument, 0, 't'};
+    longOptions[51] = {"trace-sample", required_argument, 0, 'u'};
+    longOptions[52] = {0, 0, 0, 0};
 
     int32_t optionIndex = 0;
+    optind = 0;
 
     while ((getOptResult = getopt_long(argc, argv, "f:i:o:n:d:", longOptions.data(), &optionIndex)) != -1)
     {
@@ -81,49 +187,527 @@ int32_t main(int32_t argc, char** argv)
         case 0:
             break;
         case 'i':
-            inAddress = splitAddressPort(optarg);
+            config.inputAddress = splitAddressPort(optarg);
             break;
         case 'o':
-            outAddress = splitAddressPort(optarg);
+            if (config.outputAddress.first.empty())
+            {
+                config.outputAddress = splitAddressPort(optarg);
+            }
+            else
+            {
+                config.extraOutputAddresses.push_back(splitAddressPort(optarg));
+            }
+            break;
+        case 'X':
+            config.secondaryInputAddress = splitAddressPort(optarg);
+            break;
+        case 'Z':
+            config.redundancyDelay = std::chrono::milliseconds(std::strtoll(optarg, nullptr, 10));
+            break;
+        case 'G':
+            config.stateFile = optarg;
             break;
         case 'n':
-            spliceInterval = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
+            config.spliceInterval = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
             break;
         case 'd':
-            spliceDuration = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
+            config.spliceDuration = std::chrono::seconds(std::strtoull(optarg, nullptr, 10));
             break;
         case 'f':
-            outputFileName = optarg;
+            if (config.outputFile.empty())
+            {
+                config.outputFile = optarg;
+            }
+            else
+            {
+                config.extraOutputFiles.emplace_back(optarg);
+            }
+            break;
+        case 'g':
+            config.hls.directory = optarg;
+            break;
+        case 'h':
+            config.hls.segmentDuration =
+                std::chrono::milliseconds(static_cast<int64_t>(std::strtod(optarg, nullptr) * 1000.0));
+            break;
+        case 'j':
+            config.hls.listSize = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'J':
+            config.udpOptions.pacing.cbrBitrate = std::strtoull(optarg, nullptr, 10) * 1000;
+            break;
+        case 'F':
+            config.udpOptions.pacing.delay = std::chrono::milliseconds(std::strtoll(optarg, nullptr, 10));
+            break;
+        case 'k':
+            config.udpOptions.inputPoolBuffers = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 't':
+            config.trace.file = optarg;
+            break;
+        case 'u':
+            config.trace.sampleInterval = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'V':
+            config.outputQueueSize = std::strtoull(optarg, nullptr, 10) * 1024;
+            break;
+        case 'N':
+            config.name = optarg;
+            break;
+        case 'C':
+            if (!utils::parseCoreList(optarg, config.cores))
+            {
+                return false;
+            }
+            break;
+        case 'c':
+            processConfig.channelsFile = optarg;
+            break;
+        case 'A':
+            processConfig.controlAddress = splitAddressPort(optarg);
+            break;
+        case 'U':
+            processConfig.controlSocketPath = optarg;
+            break;
+        case 'L':
+            if (!Logger::parseLevel(optarg, processConfig.logLevel))
+            {
+                return false;
+            }
+            processConfig.hasLogLevel = true;
+            break;
+        case 'I':
+            config.inputFile = optarg;
+            break;
+        case 'K':
+            config.cues.emplace_back(optarg);
+            break;
+        case 'H':
+            config.cueScheduleFile = optarg;
+            break;
+        case 'Y':
+            config.monitorReport = optarg;
+            break;
+        case 'b':
+            processConfig.batch.input = optarg;
+            break;
+        case 'O':
+            processConfig.batch.outputDirectory = optarg;
+            break;
+        case 'R':
+            processConfig.batch.reportFile = optarg;
+            break;
+        case 'W':
+            processConfig.batch.threads = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'm':
+            processConfig.batch.memoryBudget = std::strtoull(optarg, nullptr, 10) * 1024 * 1024;
+            break;
+        case 'T':
+            latencyOverrides.bufferTime = std::chrono::milliseconds(std::strtoll(optarg, nullptr, 10));
+            hasLatencyOverride[0] = true;
+            break;
+        case 'Q':
+            latencyOverrides.queueMaxTime = std::chrono::milliseconds(std::strtoll(optarg, nullptr, 10));
+            hasLatencyOverride[1] = true;
+            break;
+        case 'D':
+            latencyOverrides.demuxLatency = std::chrono::milliseconds(std::strtoll(optarg, nullptr, 10));
+            hasLatencyOverride[2] = true;
+            break;
+        case 'M':
+            latencyOverrides.muxLatency = std::chrono::milliseconds(std::strtoll(optarg, nullptr, 10));
+            hasLatencyOverride[3] = true;
+            break;
+        case 'S':
+            config.udpOptions.socketBufferSize = static_cast<int32_t>(std::strtol(optarg, nullptr, 10));
+            break;
+        case 'B':
+            config.udpOptions.batchSize = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'P':
+            config.udpOptions.busyPollUs = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10));
+            break;
+        case 'E':
+            config.udpOptions.packetRingInterface = optarg;
             break;
         default:
+            return false;
+        }
+    }
+
+    config.immediate = immediate == 1;
+    config.autoReturn = autoReturn == 1;
+    config.passthrough = passthrough == 1;
+    config.batchedUdp = batchedUdp == 1;
+    config.monitor = monitor == 1;
+    config.mergeUpstreamCues = mergeScte35 == 1;
+    config.udpOptions.pacing.enabled = pace == 1 || config.udpOptions.pacing.cbrBitrate != 0;
+    config.udpOptions.inputPoolHugePages = hugePages == 1;
+    processConfig.logJson = logJson == 1;
+
+    if (lowLatency == 1)
+    {
+        config.latencyOptions = LatencyOptions::lowLatency();
+    }
+    if (hasLatencyOverride[0])
+    {
+        config.latencyOptions.bufferTime = latencyOverrides.bufferTime;
+    }
+    if (hasLatencyOverride[1])
+    {
+        config.latencyOptions.queueMaxTime = latencyOverrides.queueMaxTime;
+    }
+    if (hasLatencyOverride[2])
+    {
+        config.latencyOptions.demuxLatency = latencyOverrides.demuxLatency;
+    }
+    if (hasLatencyOverride[3])
+    {
+        config.latencyOptions.muxLatency = latencyOverrides.muxLatency;
+    }
+    config.latencyOptions.leakyQueues = config.latencyOptions.leakyQueues || leaky == 1;
+    config.latencyOptions.syncOutput = config.latencyOptions.syncOutput && noSync == 0;
+
+    if (config.name.empty() && !config.inputAddress.first.empty())
+    {
+        config.name = config.inputAddress.first + ":" + std::to_string(config.inputAddress.second);
+    }
+    else if (config.name.empty())
+    {
+        config.name = config.inputFile;
+    }
+
+    return true;
+}
+
+/**
+ * @param hasControl A channel without a splice interval or a cue schedule is only valid when cues can come from the
+ * control API.
+ */
+bool isValid(const ChannelConfig& config, const bool hasControl)
+{
+    const auto hasCues = config.spliceInterval.count() != 0 || !config.cues.empty() || !config.cueScheduleFile.empty();
+    const auto hasSecondaryInput = !config.secondaryInputAddress.first.empty();
+    if (hasSecondaryInput &&
+        (config.secondaryInputAddress.second == 0 || config.secondaryInputAddress == config.inputAddress ||
+            (!config.passthrough && !config.batchedUdp && config.udpOptions.packetRingInterface.empty()) ||
+            config.monitor || !config.inputFile.empty() ||
+            config.redundancyDelay.count() <= 0 || config.redundancyDelay > maxRedundancyDelay))
+    {
+        return false;
+    }
+    if ((!config.stateFile.empty() && (config.monitor || !config.inputFile.empty())) ||
+        (config.mergeUpstreamCues && config.monitor))
+    {
+        return false;
+    }
+
+    // Offline runs write one output file, an HLS output may come on top of it.
+    const auto hasHls = !config.hls.directory.empty();
+    if ((config.monitor || !config.inputFile.empty()) && config.outputCount() - (hasHls ? 1 : 0) > 1)
+    {
+        return false;
+    }
+    if (hasHls && (config.monitor || config.hls.segmentDuration.count() <= 0 || config.hls.listSize == 0))
+    {
+        return false;
+    }
+    // The input pool replaces the buffers of the remuxing mode's receive thread.
+    if ((config.udpOptions.inputPoolBuffers != 0 &&
+            (config.passthrough || config.monitor || !config.inputFile.empty())) ||
+        (config.udpOptions.inputPoolHugePages && config.udpOptions.inputPoolBuffers == 0))
+    {
+        return false;
+    }
+    // Only the remuxing mode has gstreamer elements to trace.
+    if ((!config.trace.file.empty() && (config.passthrough || config.monitor || !config.inputFile.empty())) ||
+        config.trace.sampleInterval == 0)
+    {
+        return false;
+    }
+    const auto hasUdpOutput = !config.outputAddress.first.empty();
+    if (config.udpOptions.pacing.enabled && (!hasUdpOutput || config.udpOptions.pacing.delay.count() <= 0))
+    {
+        return false;
+    }
+    const auto hasExtraOutputPort = std::all_of(config.extraOutputAddresses.begin(),
+        config.extraOutputAddresses.end(),
+        [](const std::pair<std::string, uint32_t>& address) { return !address.first.empty() && address.second != 0; });
+
+    if (config.monitor)
+    {
+        const auto hasInputAddress = !config.inputAddress.first.empty() && config.inputAddress.second != 0;
+        return hasInputAddress != !config.inputFile.empty() && config.outputAddress.first.empty() &&
+            config.outputFile.empty() && !hasCues;
+    }
+    if (!config.inputFile.empty())
+    {
+        return config.inputAddress.first.empty() && config.outputAddress.first.empty() &&
+            (!config.outputFile.empty() || hasHls) && config.spliceDuration.count() != 0 && hasCues;
+    }
+
+    return !(config.inputAddress.first.empty() || config.inputAddress.second == 0 ||
+        ((config.outputAddress.first.empty() || config.outputAddress.second == 0) && config.outputFile.empty() &&
+            !hasHls) ||
+        (!config.outputAddress.first.empty() && config.outputAddress.second == 0) || !hasExtraOutputPort ||
+        config.outputQueueSize == 0 ||
+        (!hasCues && !hasControl) || config.spliceDuration.count() == 0 ||
+        config.udpOptions.socketBufferSize <= 0 || config.udpOptions.batchSize == 0 ||
+        config.udpOptions.batchSize > 1024 || config.latencyOptions.bufferTime.count() < 0 ||
+        config.latencyOptions.queueMaxTime.count() < 0 ||
+        (config.latencyOptions.queueMaxTime.count() != 0 &&
+            config.latencyOptions.queueMaxTime < config.latencyOptions.bufferTime));
+}
+
+bool loadChannelsFile(const std::string& fileName, const bool hasControl, std::vector<ChannelConfig>& configs)
+{
+    std::ifstream file(fileName);
+    if (!file)
+    {
+        printf("Unable to open channel list %s\n", fileName.c_str());
+        return false;
+    }
+
+    std::string line;
+    uint32_t lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+        const auto firstCharacter = line.find_first_not_of(" \t");
+        if (firstCharacter == std::string::npos || line[firstCharacter] == '#')
+        {
+            continue;
+        }
+
+        const auto commandLine = "scte35-inserter " + line;
+        gint lineArgc = 0;
+        gchar** lineArgv = nullptr;
+        if (!g_shell_parse_argv(commandLine.c_str(), &lineArgc, &lineArgv, nullptr))
+        {
+            printf("%s:%u: unable to parse line\n", fileName.c_str(), lineNumber);
+            return false;
+        }
+
+        ChannelConfig config;
+        ProcessConfig lineProcessConfig;
+        const auto parsed = parseOptions(lineArgc, lineArgv, config, lineProcessConfig);
+        g_strfreev(lineArgv);
+
+        const auto sharesStateFile = !config.stateFile.empty() &&
+            std::any_of(configs.begin(), configs.end(), [&config](const ChannelConfig& other) {
+                return other.stateFile == config.stateFile;
+            });
+        const auto sharesTraceFile = !config.trace.file.empty() &&
+            std::any_of(configs.begin(), configs.end(), [&config](const ChannelConfig& other) {
+                return other.trace.file == config.trace.file;
+            });
+        if (!parsed || lineProcessConfig.hasProcessOptions() || !isValid(config, hasControl) || sharesStateFile ||
+            sharesTraceFile)
+        {
+            printf("%s:%u: invalid channel options\n", fileName.c_str(), lineNumber);
+            return false;
+        }
+        configs.push_back(std::move(config));
+    }
+
+    return !configs.empty();
+}
+
+gboolean logProcessStatsCallback(gpointer /*userData*/)
+{
+    const auto contextSwitches = utils::processContextSwitches();
+    const auto seconds = static_cast<double>(statsInterval.count());
+    Logger::log("Process stats: %zu channels, RSS %llu kB, context switches %.1f/s voluntary, %.1f/s involuntary",
+        inserters.size(),
+        static_cast<unsigned long long>(utils::residentSetSizeKb()),
+        (contextSwitches.voluntary - lastContextSwitches.voluntary) / seconds,
+        (contextSwitches.involuntary - lastContextSwitches.involuntary) / seconds);
+    lastContextSwitches = contextSwitches;
+    return TRUE;
+}
+
+} // namespace
+
+int32_t main(int32_t argc, char** argv)
+{
+    {
+        struct sigaction sigactionData = {};
+        sigactionData.sa_handler = intSignalHandler;
+        sigactionData.sa_flags = 0;
+        sigemptyset(&sigactionData.sa_mask);
+        sigaction(SIGINT, &sigactionData, nullptr);
+    }
+
+    std::vector<ChannelConfig> configs;
+    ProcessConfig processConfig;
+    {
+        ChannelConfig config;
+        if (!parseOptions(argc, argv, config, processConfig))
+        {
+            printf("%s\n", usageString);
+            return 1;
+        }
+
+        if (!processConfig.batch.input.empty())
+        {
+            // The command line channel options are the template of every file in the batch.
+            config.inputFile = processConfig.batch.input;
+            config.outputFile = processConfig.batch.outputDirectory;
+            if (!processConfig.channelsFile.empty() || processConfig.hasControl() || !config.hls.directory.empty() ||
+                !isValid(config, false))
+            {
+                printf("%s\n", usageString);
+                return 1;
+            }
+            configs.push_back(std::move(config));
+        }
+        else if (!processConfig.channelsFile.empty())
+        {
+            if (!loadChannelsFile(processConfig.channelsFile, processConfig.hasControl(), configs))
+            {
+                printf("%s\n", usageString);
+                return 1;
+            }
+        }
+        else if (isValid(config, processConfig.hasControl()))
+        {
+            configs.push_back(std::move(config));
+        }
+        else
+        {
             printf("%s\n", usageString);
             return 1;
         }
     }
 
-    if (inAddress.first.empty() || inAddress.second == 0 ||
-        ((outAddress.first.empty() || outAddress.second == 0) && outputFileName.empty()) ||
-        ((!outAddress.first.empty() && outAddress.second != 0) && !outputFileName.empty()) ||
-        spliceInterval.count() == 0 || spliceDuration.count() == 0)
+    const auto monitorFiles = std::count_if(configs.begin(), configs.end(), [](const ChannelConfig& config) {
+        return config.monitor && !config.inputFile.empty();
+    });
+    const auto offlineConfigs = std::count_if(configs.begin(), configs.end(), [](const ChannelConfig& config) {
+        return !config.inputFile.empty();
+    });
+    // File runs end when their files are done, they cannot be mixed with live channels or take control requests.
+    if ((monitorFiles != 0 && static_cast<size_t>(monitorFiles) != configs.size()) ||
+        (offlineConfigs != 0 && (static_cast<size_t>(offlineConfigs) != configs.size() || processConfig.hasControl())))
     {
         printf("%s\n", usageString);
         return 1;
     }
 
+    Logger::setLevel(processConfig.logLevel);
+    Logger::start(stdout, processConfig.logJson);
+
+    gst_init(nullptr, nullptr);
+
+    if (monitorFiles != 0)
+    {
+        bool succeeded = true;
+        for (const auto& config : configs)
+        {
+            CueMonitor cueMonitor(config);
+            succeeded = cueMonitor.runFile() && succeeded;
+        }
+
+        gst_deinit();
+        Logger::stop();
+        return succeeded ? 0 : 1;
+    }
+
+    if (offlineConfigs != 0)
+    {
+        BatchRunner batchRunner(processConfig.batch);
+        bool succeeded = true;
+        if (!processConfig.batch.input.empty())
+        {
+            succeeded = batchRunner.addJobs(configs.front());
+        }
+        else
+        {
+            for (const auto& config : configs)
+            {
+                succeeded = batchRunner.addJob(config) && succeeded;
+            }
+        }
+        succeeded = succeeded && batchRunner.run();
+
+        gst_deinit();
+        Logger::stop();
+        return succeeded ? 0 : 1;
+    }
+
     mainLoop = g_main_loop_new(nullptr, FALSE);
 
-    std::chrono::milliseconds mpegTsBufferSize(1000);
-    pipeline = std::make_unique<Pipeline>(inAddress,
-        outAddress,
-        mpegTsBufferSize,
-        spliceInterval,
-        spliceDuration,
-        immediate == 1,
-        autoReturn == 1,
-        outputFileName);
-    pipeline->run();
+    const auto startupBegin = std::chrono::steady_clock::now();
+    const auto startupRssKb = utils::residentSetSizeKb();
+
+    for (const auto& config : configs)
+    {
+        const auto channelBegin = std::chrono::steady_clock::now();
+        const auto channelRssKb = utils::residentSetSizeKb();
+
+        if (config.monitor)
+        {
+            inserters.push_back(std::make_unique<CueMonitor>(config));
+        }
+        else if (config.passthrough)
+        {
+            inserters.push_back(std::make_unique<Passthrough>(config));
+        }
+        else
+        {
+            inserters.push_back(std::make_unique<Pipeline>(config));
+        }
+        inserters.back()->run();
+
+        Logger::log("[%s] Channel started in %lld us, RSS +%lld kB",
+            config.name.c_str(),
+            static_cast<long long>(
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - channelBegin)
+                    .count()),
+            static_cast<long long>(utils::residentSetSizeKb()) - static_cast<long long>(channelRssKb));
+    }
+
+    const auto totalRssKb = utils::residentSetSizeKb();
+    const auto startupMs =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startupBegin).count();
+    const auto rssPerChannelKb = totalRssKb > startupRssKb ? (totalRssKb - startupRssKb) / inserters.size() : 0;
+    Logger::log("Started %zu channels in %lld ms, RSS %llu kB (%llu kB per channel)",
+        inserters.size(),
+        static_cast<long long>(startupMs),
+        static_cast<unsigned long long>(totalRssKb),
+        static_cast<unsigned long long>(rssPerChannelKb));
+
+    ControlServer controlServer;
+    if (processConfig.hasControl())
+    {
+        for (size_t i = 0; i < configs.size(); ++i)
+        {
+            if (!configs[i].monitor)
+            {
+                controlServer.addChannel(configs[i].name, inserters[i].get());
+            }
+        }
+
+        if ((!processConfig.controlAddress.first.empty() && !controlServer.listenTcp(processConfig.controlAddress)) ||
+            (!processConfig.controlSocketPath.empty() && !controlServer.listenUnix(processConfig.controlSocketPath)))
+        {
+            Logger::error("Unable to start the control API");
+        }
+        controlServer.run();
+    }
+
+    lastContextSwitches = utils::processContextSwitches();
+    g_timeout_add_seconds(statsInterval.count(), logProcessStatsCallback, nullptr);
 
     g_main_loop_run(mainLoop);
 
+    controlServer.stop();
+    inserters.clear();
+    g_main_loop_unref(mainLoop);
+    gst_deinit();
+    Logger::stop();
+
     return 0;
 }
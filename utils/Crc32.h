@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+
+namespace detail
+{
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+/**
+ * Slice-by-8 tables for the MSB-first CRC-32/MPEG-2 polynomial. Table k holds the CRC of byte i followed by k zero
+ * bytes, so eight input bytes are folded in with eight independent lookups.
+ */
+constexpr Crc32Tables makeCrc32MpegTables()
+{
+    Crc32Tables tables{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i << 24;
+        for (uint32_t bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+        }
+        tables[0][i] = crc;
+    }
+
+    for (size_t table = 1; table < tables.size(); ++table)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            const auto previous = tables[table - 1][i];
+            tables[table][i] = (previous << 8) ^ tables[0][previous >> 24];
+        }
+    }
+    return tables;
+}
+
+inline constexpr auto crc32MpegTables = makeCrc32MpegTables();
+
+} // namespace detail
+
+/**
+ * CRC-32/MPEG-2 as used by PSI and SCTE-35 sections. Computing it over a section including its trailing CRC
+ * yields 0 for an intact section.
+ */
+inline uint32_t crc32Mpeg(const uint8_t* data, const size_t size)
+{
+    const auto& tables = detail::crc32MpegTables;
+    uint32_t crc = 0xFFFFFFFF;
+    size_t i = 0;
+
+    for (; i + 8 <= size; i += 8)
+    {
+        const auto word = crc ^
+            ((static_cast<uint32_t>(data[i]) << 24) | (static_cast<uint32_t>(data[i + 1]) << 16) |
+                (static_cast<uint32_t>(data[i + 2]) << 8) | data[i + 3]);
+        crc = tables[7][word >> 24] ^ tables[6][(word >> 16) & 0xFF] ^ tables[5][(word >> 8) & 0xFF] ^
+            tables[4][word & 0xFF] ^ tables[3][data[i + 4]] ^ tables[2][data[i + 5]] ^ tables[1][data[i + 6]] ^
+            tables[0][data[i + 7]];
+    }
+
+    for (; i < size; ++i)
+    {
+        crc = (crc << 8) ^ tables[0][((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+} // namespace utils
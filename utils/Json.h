@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+namespace utils
+{
+
+/**
+ * Returns the value of a top level key of a flat JSON object, with the quotes of string values removed. Enough for
+ * the few scalar fields of control requests and cue schedules.
+ */
+inline bool jsonValue(const std::string& body, const char* key, std::string& value)
+{
+    const auto quotedKey = std::string("\"") + key + "\"";
+    auto position = body.find(quotedKey);
+    if (position == std::string::npos)
+    {
+        return false;
+    }
+
+    position = body.find_first_not_of(" \t\r\n", position + quotedKey.size());
+    if (position == std::string::npos || body[position] != ':')
+    {
+        return false;
+    }
+
+    position = body.find_first_not_of(" \t\r\n", position + 1);
+    if (position == std::string::npos)
+    {
+        return false;
+    }
+
+    if (body[position] == '"')
+    {
+        const auto end = body.find('"', position + 1);
+        if (end == std::string::npos)
+        {
+            return false;
+        }
+        value = body.substr(position + 1, end - position - 1);
+        return true;
+    }
+
+    const auto end = body.find_first_of(",} \t\r\n", position);
+    value = body.substr(position, end == std::string::npos ? std::string::npos : end - position);
+    return !value.empty();
+}
+
+} // namespace utils
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace utils
+{
+
+/**
+ * Bounded lock-free queue for any number of producers and consumers. Every slot carries a sequence number that
+ * tells producers and consumers whose turn it is, so push and pop are a compare-and-swap on the shared position and
+ * never block or allocate.
+ * @tparam Capacity Number of slots, must be a power of two.
+ */
+template <typename T, size_t Capacity>
+class LockFreeQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    LockFreeQueue() : pushPosition_(0), popPosition_(0)
+    {
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    /**
+     * @return False if the queue is full.
+     */
+    bool push(T value)
+    {
+        auto position = pushPosition_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& slot = slots_[position & (Capacity - 1)];
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+            if (difference == 0)
+            {
+                if (pushPosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = pushPosition_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @return False if the queue is empty.
+     */
+    bool pop(T& value)
+    {
+        auto position = popPosition_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& slot = slots_[position & (Capacity - 1)];
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+            if (difference == 0)
+            {
+                if (popPosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(slot.value);
+                    slot.sequence.store(position + Capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = popPosition_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    static const size_t cacheLineSize = 64;
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::array<Slot, Capacity> slots_;
+    alignas(cacheLineSize) std::atomic<size_t> pushPosition_;
+    alignas(cacheLineSize) std::atomic<size_t> popPosition_;
+};
+
+} // namespace utils
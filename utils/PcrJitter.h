@@ -0,0 +1,66 @@
+#pragma once
+
+#include "utils/TsPacket.h"
+#include <chrono>
+#include <cstdint>
+
+namespace utils::ts
+{
+
+/**
+ * Measures how far the time between consecutive PCRs at some point of the packet path differs from the PCR
+ * difference itself. Locks on to the first PID that carries a PCR, a PCR step of more than a second (discontinuity
+ * or wrap) restarts the measurement.
+ */
+class PcrJitter
+{
+public:
+    /**
+     * @param now Time the packet passes the measuring point.
+     * @param jitter Set to the arrival time difference minus the PCR difference.
+     * @return True if jitter was set.
+     */
+    bool onPacket(const uint8_t* packet,
+        const std::chrono::steady_clock::time_point now,
+        std::chrono::nanoseconds& jitter)
+    {
+        const auto packetPid = pid(packet);
+        if (pid_ != nullPid && packetPid != pid_)
+        {
+            return false;
+        }
+
+        uint64_t pcr = 0;
+        if (!readPcr(packet, pcr))
+        {
+            return false;
+        }
+        pid_ = packetPid;
+
+        const auto hadPrevious = hasPrevious_;
+        const auto previousPcr = previousPcr_;
+        const auto previousTime = previousTime_;
+        hasPrevious_ = true;
+        previousPcr_ = pcr;
+        previousTime_ = now;
+
+        if (!hadPrevious || pcr <= previousPcr || pcr - previousPcr > pcrClockRate)
+        {
+            return false;
+        }
+
+        const auto pcrDifference = std::chrono::nanoseconds((pcr - previousPcr) * 1000 / 27);
+        jitter = std::chrono::duration_cast<std::chrono::nanoseconds>(now - previousTime) - pcrDifference;
+        return true;
+    }
+
+private:
+    static const uint64_t pcrClockRate = 27000000;
+
+    uint16_t pid_ = nullPid;
+    bool hasPrevious_ = false;
+    uint64_t previousPcr_ = 0;
+    std::chrono::steady_clock::time_point previousTime_;
+};
+
+} // namespace utils::ts
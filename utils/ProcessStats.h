@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+
+namespace utils
+{
+
+struct ContextSwitches
+{
+    uint64_t voluntary = 0;
+    uint64_t involuntary = 0;
+};
+
+/**
+ * @return Resident set size of the process in kB, 0 if unavailable.
+ */
+inline uint64_t residentSetSizeKb()
+{
+    auto file = fopen("/proc/self/status", "r");
+    if (!file)
+    {
+        return 0;
+    }
+
+    uint64_t result = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+        {
+            result = strtoull(line + 6, nullptr, 10);
+            break;
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+inline ContextSwitches processContextSwitches()
+{
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+
+    ContextSwitches result;
+    result.voluntary = static_cast<uint64_t>(usage.ru_nvcsw);
+    result.involuntary = static_cast<uint64_t>(usage.ru_nivcsw);
+    return result;
+}
+
+} // namespace utils
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "utils/TsPacket.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace utils::ts
+{
+
+inline size_t sectionSize(const uint8_t* section)
+{
+    return 3 + (((section[1] & 0x0F) << 8) | section[2]);
+}
+
+/**
+ * Reassembles PSI/SI sections carried on a single PID, including sections spanning several packets and several
+ * sections packed into one packet. The buffer is reserved for the largest section up front, so reassembly never
+ * allocates.
+ */
+class SectionAssembler
+{
+public:
+    SectionAssembler() : lastContinuityCounter_(-1) { buffer_.reserve(maxBufferedSize); }
+
+    template <typename Callback>
+    void push(const uint8_t* packet, Callback&& onSection)
+    {
+        const auto offset = payloadOffset(packet);
+        if (offset >= packetSize)
+        {
+            return;
+        }
+
+        const auto counter = continuityCounter(packet);
+        if (lastContinuityCounter_ == counter)
+        {
+            return;
+        }
+        if (lastContinuityCounter_ >= 0 && ((lastContinuityCounter_ + 1) & 0x0F) != counter)
+        {
+            buffer_.clear();
+        }
+        lastContinuityCounter_ = counter;
+
+        auto payload = packet + offset;
+        auto size = packetSize - offset;
+
+        if (!payloadUnitStart(packet))
+        {
+            if (!buffer_.empty())
+            {
+                append(payload, size, onSection);
+            }
+            return;
+        }
+
+        const size_t pointer = payload[0];
+        ++payload;
+        --size;
+        if (pointer > size)
+        {
+            buffer_.clear();
+            return;
+        }
+
+        if (!buffer_.empty())
+        {
+            append(payload, pointer, onSection);
+            buffer_.clear();
+        }
+        payload += pointer;
+        size -= pointer;
+
+        while (size > 0 && payload[0] != 0xFF)
+        {
+            if (size < 3 || sectionSize(payload) > size)
+            {
+                buffer_.assign(payload, payload + size);
+                return;
+            }
+
+            const auto currentSectionSize = sectionSize(payload);
+            onSection(payload, currentSectionSize);
+            payload += currentSectionSize;
+            size -= currentSectionSize;
+        }
+    }
+
+    void reset()
+    {
+        buffer_.clear();
+        lastContinuityCounter_ = -1;
+    }
+
+private:
+    // A section of the largest section_length plus the rest of the packet that completes it.
+    static const size_t maxBufferedSize = 3 + 0xFFF + packetSize;
+
+    std::vector<uint8_t> buffer_;
+    int32_t lastContinuityCounter_;
+
+    template <typename Callback>
+    void append(const uint8_t* data, const size_t size, Callback&& onSection)
+    {
+        buffer_.insert(buffer_.end(), data, data + size);
+        if (buffer_.size() < 3)
+        {
+            return;
+        }
+
+        const auto currentSectionSize = sectionSize(buffer_.data());
+        if (buffer_.size() >= currentSectionSize)
+        {
+            onSection(buffer_.data(), currentSectionSize);
+            buffer_.clear();
+        }
+    }
+};
+
+/**
+ * Splits a complete section into TS packets on pid, padding the last packet with 0xFF.
+ * @param continuityCounter Continuity counter of the previous packet on pid, advanced for every packet written.
+ */
+inline void packetizeSection(const uint16_t pid,
+    const uint8_t* section,
+    const size_t size,
+    uint8_t& continuityCounter,
+    std::vector<uint8_t>& output)
+{
+    size_t written = 0;
+    bool first = true;
+    while (written < size || first)
+    {
+        const auto packetOffset = output.size();
+        output.resize(packetOffset + packetSize, 0xFF);
+        auto packet = output.data() + packetOffset;
+
+        continuityCounter = (continuityCounter + 1) & 0x0F;
+        writeHeader(packet, pid, first, continuityCounter);
+
+        size_t payloadPosition = 4;
+        if (first)
+        {
+            packet[payloadPosition++] = 0;
+            first = false;
+        }
+
+        const auto chunk = std::min(size - written, packetSize - payloadPosition);
+        memcpy(packet + payloadPosition, section + written, chunk);
+        written += chunk;
+    }
+}
+
+} // namespace utils::ts
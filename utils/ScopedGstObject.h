@@ -23,25 +23,25 @@ private:
 };
 
 template <>
-ScopedGstObject<GstCaps>::~ScopedGstObject()
+inline ScopedGstObject<GstCaps>::~ScopedGstObject()
 {
     gst_caps_unref(value_);
 }
 
 template <>
-ScopedGstObject<GstMessage>::~ScopedGstObject()
+inline ScopedGstObject<GstMessage>::~ScopedGstObject()
 {
     gst_message_unref(value_);
 }
 
 template <>
-ScopedGstObject<GstBus>::~ScopedGstObject()
+inline ScopedGstObject<GstBus>::~ScopedGstObject()
 {
     gst_object_unref(value_);
 }
 
 template <>
-ScopedGstObject<GstMpegtsSection>::~ScopedGstObject()
+inline ScopedGstObject<GstMpegtsSection>::~ScopedGstObject()
 {
     gst_mpegts_section_unref(value_);
 }
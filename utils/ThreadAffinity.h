@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace utils
+{
+
+/**
+ * Parses a core list such as "2,3,8-11".
+ */
+inline bool parseCoreList(const char* coreList, std::vector<uint32_t>& cores)
+{
+    cores.clear();
+    const char* position = coreList;
+    while (*position)
+    {
+        char* end = nullptr;
+        const auto first = std::strtoul(position, &end, 10);
+        if (end == position)
+        {
+            return false;
+        }
+
+        auto last = first;
+        if (*end == '-')
+        {
+            position = end + 1;
+            last = std::strtoul(position, &end, 10);
+            if (end == position || last < first)
+            {
+                return false;
+            }
+        }
+
+        for (auto core = first; core <= last; ++core)
+        {
+            cores.push_back(static_cast<uint32_t>(core));
+        }
+
+        if (*end == ',')
+        {
+            ++end;
+        }
+        else if (*end != '\0')
+        {
+            return false;
+        }
+        position = end;
+    }
+
+    return !cores.empty();
+}
+
+/**
+ * Restricts the calling thread to cores. An empty list leaves the affinity unchanged.
+ */
+inline bool setCurrentThreadAffinity(const std::vector<uint32_t>& cores)
+{
+    if (cores.empty())
+    {
+        return true;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (const auto core : cores)
+    {
+        if (core < CPU_SETSIZE)
+        {
+            CPU_SET(core, &cpuSet);
+        }
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+}
+
+} // namespace utils
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace utils
+{
+
+/**
+ * Hierarchical timing wheel over an abstract 64-bit tick. Level 0 has one slot per tick, every further level one
+ * slot per full turn of the level below. An entry goes to the level of the highest tick digit in which its expiry
+ * differs from the current tick, and moves down a level each time its slot comes round, so insert is O(1) and each
+ * entry is moved at most once per level before it fires. Expiries beyond the top level wait in an overflow list.
+ *
+ * Not thread safe.
+ */
+template <typename T>
+class TimerWheel
+{
+public:
+    explicit TimerWheel(const uint64_t now = 0) : now_(now), size_(0) {}
+
+    uint64_t now() const { return now_; }
+    size_t size() const { return size_; }
+
+    /**
+     * Adds value to fire at tick expiry, an expiry that has already passed fires on the next advance.
+     */
+    void insert(const uint64_t expiry, T value)
+    {
+        ++size_;
+        if (expiry <= now_)
+        {
+            due_.push_back({expiry, std::move(value)});
+            return;
+        }
+        place(expiry, std::move(value));
+    }
+
+    /**
+     * Moves the wheel to tick now and calls fire(expiry, value) for every entry with an expiry up to now, in
+     * expiry order. fire may insert new entries.
+     */
+    template <typename Function>
+    void advance(const uint64_t now, Function&& fire)
+    {
+        fireAll(due_, fire);
+
+        while (now_ < now)
+        {
+            if (size_ == 0)
+            {
+                now_ = now;
+                break;
+            }
+
+            ++now_;
+            for (size_t level = 1; level < levels && digit(now_, level - 1) == 0; ++level)
+            {
+                cascade(slots_[level][digit(now_, level)]);
+                if (level == levels - 1 && digit(now_, level) == 0)
+                {
+                    cascade(overflow_);
+                }
+            }
+            fireAll(slots_[0][digit(now_, 0)], fire);
+        }
+    }
+
+    /**
+     * Removes every entry, calling take(expiry, value) for each in no particular order, and moves the wheel to tick
+     * now, which may lie before the current tick. take must not insert.
+     */
+    template <typename Function>
+    void reset(const uint64_t now, Function&& take)
+    {
+        for (auto& level : slots_)
+        {
+            for (auto& slot : level)
+            {
+                fireAll(slot, take);
+            }
+        }
+        fireAll(overflow_, take);
+        fireAll(due_, take);
+        now_ = now;
+    }
+
+private:
+    static const size_t levelBits = 6;
+    static const size_t slotCount = size_t(1) << levelBits;
+    static const size_t levels = 4;
+
+    struct Entry
+    {
+        uint64_t expiry;
+        T value;
+    };
+
+    using Slot = std::vector<Entry>;
+
+    uint64_t now_;
+    size_t size_;
+    std::array<std::array<Slot, slotCount>, levels> slots_;
+    Slot overflow_;
+    Slot due_;
+
+    static size_t digit(const uint64_t tick, const size_t level)
+    {
+        return static_cast<size_t>((tick >> (level * levelBits)) & (slotCount - 1));
+    }
+
+    /**
+     * Only called with expiries from the current tick on, an expiry of the current tick lands in the level 0 slot
+     * that is about to fire.
+     */
+    void place(const uint64_t expiry, T value)
+    {
+        const auto difference = expiry ^ now_;
+        for (size_t level = 0; level < levels; ++level)
+        {
+            if ((difference >> ((level + 1) * levelBits)) == 0)
+            {
+                slots_[level][digit(expiry, level)].push_back({expiry, std::move(value)});
+                return;
+            }
+        }
+        overflow_.push_back({expiry, std::move(value)});
+    }
+
+    void cascade(Slot& slot)
+    {
+        Slot entries;
+        entries.swap(slot);
+        for (auto& entry : entries)
+        {
+            place(entry.expiry, std::move(entry.value));
+        }
+    }
+
+    template <typename Function>
+    void fireAll(Slot& slot, Function& fire)
+    {
+        while (!slot.empty())
+        {
+            Slot entries;
+            entries.swap(slot);
+            for (auto& entry : entries)
+            {
+                --size_;
+                fire(entry.expiry, std::move(entry.value));
+            }
+        }
+    }
+};
+
+} // namespace utils
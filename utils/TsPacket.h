@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils::ts
+{
+
+constexpr size_t packetSize = 188;
+constexpr uint8_t syncByte = 0x47;
+constexpr uint16_t patPid = 0x0000;
+constexpr uint16_t nullPid = 0x1FFF;
+constexpr uint64_t ptsModulo = 1ULL << 33;
+constexpr uint64_t ptsClockRate = 90000;
+
+inline uint16_t pid(const uint8_t* packet)
+{
+    return static_cast<uint16_t>(((packet[1] & 0x1F) << 8) | packet[2]);
+}
+
+inline bool payloadUnitStart(const uint8_t* packet)
+{
+    return (packet[1] & 0x40) != 0;
+}
+
+inline bool hasAdaptationField(const uint8_t* packet)
+{
+    return (packet[3] & 0x20) != 0;
+}
+
+inline bool hasPayload(const uint8_t* packet)
+{
+    return (packet[3] & 0x10) != 0;
+}
+
+inline uint8_t continuityCounter(const uint8_t* packet)
+{
+    return packet[3] & 0x0F;
+}
+
+inline void setContinuityCounter(uint8_t* packet, const uint8_t counter)
+{
+    packet[3] = static_cast<uint8_t>((packet[3] & 0xF0) | (counter & 0x0F));
+}
+
+/**
+ * @return Offset of the payload within the packet, or packetSize if the packet carries no payload.
+ */
+inline size_t payloadOffset(const uint8_t* packet)
+{
+    if (!hasPayload(packet))
+    {
+        return packetSize;
+    }
+
+    if (!hasAdaptationField(packet))
+    {
+        return 4;
+    }
+
+    const size_t offset = 5 + packet[4];
+    return offset < packetSize ? offset : packetSize;
+}
+
+inline bool randomAccessIndicator(const uint8_t* packet)
+{
+    return hasAdaptationField(packet) && packet[4] > 0 && (packet[5] & 0x40) != 0;
+}
+
+/**
+ * @param pcr Set to the 27 MHz PCR value if the packet carries one.
+ */
+inline bool readPcr(const uint8_t* packet, uint64_t& pcr)
+{
+    if (!hasAdaptationField(packet) || packet[4] < 7 || (packet[5] & 0x10) == 0)
+    {
+        return false;
+    }
+
+    const uint64_t base = (static_cast<uint64_t>(packet[6]) << 25) | (static_cast<uint64_t>(packet[7]) << 17) |
+        (static_cast<uint64_t>(packet[8]) << 9) | (static_cast<uint64_t>(packet[9]) << 1) |
+        (static_cast<uint64_t>(packet[10]) >> 7);
+    const uint64_t extension = (static_cast<uint64_t>(packet[10] & 0x01) << 8) | packet[11];
+    pcr = base * 300 + extension;
+    return true;
+}
+
+/**
+ * Overwrites the PCR of a packet that carries one with the 27 MHz value pcr, modulo the PCR range.
+ */
+inline void writePcr(uint8_t* packet, const uint64_t pcr)
+{
+    const auto base = (pcr / 300) & (ptsModulo - 1);
+    const auto extension = pcr % 300;
+    packet[6] = static_cast<uint8_t>(base >> 25);
+    packet[7] = static_cast<uint8_t>(base >> 17);
+    packet[8] = static_cast<uint8_t>(base >> 9);
+    packet[9] = static_cast<uint8_t>(base >> 1);
+    packet[10] = static_cast<uint8_t>(((base & 0x01) << 7) | 0x7E | (extension >> 8));
+    packet[11] = static_cast<uint8_t>(extension & 0xFF);
+}
+
+/**
+ * Reads the 33-bit PTS from the PES header starting a payload unit.
+ */
+inline bool readPesPts(const uint8_t* packet, uint64_t& pts)
+{
+    if (!payloadUnitStart(packet))
+    {
+        return false;
+    }
+
+    const auto offset = payloadOffset(packet);
+    if (offset + 14 > packetSize)
+    {
+        return false;
+    }
+
+    const auto pes = packet + offset;
+    if (pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01 || (pes[7] & 0x80) == 0)
+    {
+        return false;
+    }
+
+    pts = (static_cast<uint64_t>(pes[9] & 0x0E) << 29) | (static_cast<uint64_t>(pes[10]) << 22) |
+        (static_cast<uint64_t>(pes[11] & 0xFE) << 14) | (static_cast<uint64_t>(pes[12]) << 7) |
+        (static_cast<uint64_t>(pes[13]) >> 1);
+    return true;
+}
+
+/**
+ * @return Signed distance from 33-bit timestamp from to 33-bit timestamp to, across a wrap of the 33-bit range.
+ */
+inline int64_t ptsDifference(const uint64_t to, const uint64_t from)
+{
+    auto difference = static_cast<int64_t>((to - from) & (ptsModulo - 1));
+    if (difference >= static_cast<int64_t>(ptsModulo / 2))
+    {
+        difference -= static_cast<int64_t>(ptsModulo);
+    }
+    return difference;
+}
+
+/**
+ * Extends a 33-bit timestamp to 64 bits relative to the previous extended value. Extended values start at 2^33 so
+ * that small backward steps never underflow, and 0 stays free to mean unknown.
+ */
+inline uint64_t unwrapPts(const uint64_t previous, const uint64_t value)
+{
+    if (previous == 0)
+    {
+        return value + ptsModulo;
+    }
+
+    return previous + ptsDifference(value, previous);
+}
+
+/**
+ * @return Offset of the first of three consecutive sync bytes, size if there is none.
+ */
+inline size_t findSync(const uint8_t* data, const size_t size)
+{
+    for (size_t offset = 0; offset < std::min(size, packetSize); ++offset)
+    {
+        bool synced = true;
+        for (size_t packet = 0; packet < 3 && offset + packet * packetSize < size; ++packet)
+        {
+            synced = synced && data[offset + packet * packetSize] == syncByte;
+        }
+        if (synced)
+        {
+            return offset;
+        }
+    }
+    return size;
+}
+
+/**
+ * Writes a packet header for a payload-only packet; the caller fills the remaining 184 bytes.
+ */
+inline void writeHeader(uint8_t* packet, const uint16_t pid, const bool payloadUnitStart, const uint8_t counter)
+{
+    packet[0] = syncByte;
+    packet[1] = static_cast<uint8_t>((payloadUnitStart ? 0x40 : 0x00) | ((pid >> 8) & 0x1F));
+    packet[2] = static_cast<uint8_t>(pid & 0xFF);
+    packet[3] = static_cast<uint8_t>(0x10 | (counter & 0x0F));
+}
+
+} // namespace utils::ts
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils
+{
+
+/**
+ * Fixed size thread pool where every worker owns a deque of jobs. Workers take their own newest job first and,
+ * when their deque is empty, steal the oldest job of another worker, so long jobs submitted to one worker do not
+ * leave the others idle. Jobs submitted from a worker go to its own deque.
+ */
+class WorkStealingPool
+{
+public:
+    using Job = std::function<void()>;
+
+    /**
+     * @param threads Number of workers, 0 for one per hardware thread.
+     */
+    explicit WorkStealingPool(size_t threads = 0) : pending_(0), nextQueue_(0), stopping_(false)
+    {
+        if (threads == 0)
+        {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers_.emplace_back(&WorkStealingPool::workerFunction, this, i);
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        workAvailable_.notify_all();
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    void submit(Job job)
+    {
+        // Counted before it is queued, so it cannot finish before it is counted.
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+        }
+
+        const auto index = currentWorker() < queues_.size() ? currentWorker() : nextQueue_++ % queues_.size();
+        {
+            std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+            queues_[index]->jobs.push_back(std::move(job));
+        }
+        workAvailable_.notify_one();
+    }
+
+    /**
+     * Blocks until every submitted job, including jobs submitted by jobs, has finished.
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        allDone_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable workAvailable_;
+    std::condition_variable allDone_;
+    size_t pending_;
+    std::atomic<size_t> nextQueue_;
+    bool stopping_;
+
+    static size_t& currentWorker()
+    {
+        thread_local size_t index = static_cast<size_t>(-1);
+        return index;
+    }
+
+    bool takeJob(const size_t index, Job& job)
+    {
+        {
+            auto& own = *queues_[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty())
+            {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t offset = 1; offset < queues_.size(); ++offset)
+        {
+            auto& victim = *queues_[(index + offset) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty())
+            {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerFunction(const size_t index)
+    {
+        currentWorker() = index;
+        for (;;)
+        {
+            Job job;
+            if (takeJob(index, job))
+            {
+                job();
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0)
+                {
+                    allDone_.notify_all();
+                }
+                continue;
+            }
+
+            // The timeout covers a job submitted between takeJob and the wait.
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopping_)
+            {
+                return;
+            }
+            workAvailable_.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+};
+
+} // namespace utils